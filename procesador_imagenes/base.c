@@ -11,25 +11,93 @@
 //   wget https://raw.githubusercontent.com/nothings/stb/master/stb_image_write.h
 //
 // Compilar: gcc -o img img_base.c -pthread -lm
+// Biblioteca: -DPROCESADOR_BIBLIOTECA omite main() (API en procesador.h)
 // Ejecutar: ./img [ruta_imagen.png]
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+
+extern char** environ;   // Entorno heredado por los procesos lanzados con posix_spawn
+
+// QUÉ: Intrínsecos SIMD opcionales (solo si el compilador los habilita).
+// CÓMO: Se activan con -mavx2, -mavx512vbmi o -march=native; sin esas banderas el
+// programa usa únicamente las versiones escalares.
+// POR QUÉ: Permite acelerar operaciones sobre tramos contiguos de píxeles sin
+// romper la compilación en máquinas o compiladores sin esas extensiones.
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// QUÉ: Contadores de hardware del kernel Linux (perf_event_open).
+// CÓMO: Solo se incluyen en Linux; en otros sistemas los benchmarks muestran
+// únicamente tiempos.
+// POR QUÉ: Permiten medir fallos de caché sin herramientas externas.
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define PERF_COUNT_HW_CACHE_MISSES_SEGURO PERF_COUNT_HW_CACHE_MISSES
+#else
+#define PERF_COUNT_HW_CACHE_MISSES_SEGURO 0
+#endif
 
 // QUÉ: Incluir bibliotecas stb para cargar y guardar imágenes PNG.
 // CÓMO: stb_image.h lee PNG/JPG a memoria; stb_image_write.h escribe PNG.
 // POR QUÉ: Son bibliotecas de un solo archivo, simples y sin dependencias externas.
+// Se compilan con enlace interno (STATIC) para que la biblioteca no exporte
+// los símbolos stbi_* ni choque con otra copia de stb en quien enlaza; el
+// pragma evita los avisos por las funciones de stb que este programa no usa.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define STB_IMAGE_STATIC
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#define STB_IMAGE_WRITE_STATIC
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#pragma GCC diagnostic pop
+
+// QUÉ: Interfaz pública de la biblioteca (ImagenProcesador, PasoPipeline...).
+// CÓMO: Compilado con -DPROCESADOR_BIBLIOTECA, este archivo no define main()
+// y sirve como biblioteca; sin esa bandera es el programa con menú.
+// POR QUÉ: Incluirla aquí garantiza que las definiciones coincidan con lo
+// que ven los programas que enlazan.
+#include "procesador.h"
+
+// QUÉ: Matriz libre que una imagen guarda para su próxima operación.
+// CÓMO: Puntero a la matriz (NULL si no hay) con su propia geometría.
+// POR QUÉ: Ver tomarMatrizDestino() y reemplazarPixeles().
+typedef struct {
+    unsigned char*** pixeles;
+    int alto;
+    int ancho;
+    int canales;
+} MatrizRepuesto;
 
 // QUÉ: Estructura para almacenar la imagen (ancho, alto, canales, píxeles).
 // CÓMO: Usa matriz 3D para píxeles (alto x ancho x canales), donde canales es
-// 1 (grises) o 3 (RGB). Píxeles son unsigned char (0-255).
+// 1 (grises) o 3 (RGB). Píxeles son unsigned char (0-255). 'repuesto' es la
+// otra mitad del doble búfer: al copiar la estructura hay que vaciarlo en la
+// copia (le pertenece a una sola imagen).
 // POR QUÉ: Permite manejar tanto grises como color, con memoria dinámica para
 // flexibilidad y evitar desperdicio.
 typedef struct {
@@ -37,1011 +105,9817 @@ typedef struct {
     int alto;            // Alto de la imagen en píxeles
     int canales;         // 1 (escala de grises) o 3 (RGB)
     unsigned char*** pixeles; // Matriz 3D: [alto][ancho][canales]
+    MatrizRepuesto repuesto;  // Matriz libre para la próxima operación (doble búfer)
 } ImagenInfo;
 
+// QUÉ: Indica si las operaciones muestran mensajes informativos.
+// CÓMO: 1 en el menú interactivo, 0 en el modo de línea de comandos (salvo
+// -v) y en la biblioteca (salvo procesadorActivarMensajes). Se fija antes de
+// crear hilos y después solo se lee; junto con la configuración de las
+// estadísticas (más abajo) son las únicas variables globales modificables.
+// POR QUÉ: Los mensajes de progreso son útiles en el menú pero en trabajos
+// por lotes solo agregan E/S; pasarlo como parámetro cambiaría todas las firmas.
+#ifdef PROCESADOR_BIBLIOTECA
+static int mensajesActivos = 0;
+#else
+static int mensajesActivos = 1;
+#endif
+
+// QUÉ: Número de hilos de cada operación concurrente.
+// CÓMO: HILOS_POR_DEFECTO (2, como en el diseño original); --threads lo cambia
+// y la suite de benchmarks lo recorre de 1 a N. Como mensajesActivos, solo se
+// escribe cuando no hay operaciones en curso.
+// POR QUÉ: Con 2 hilos fijos no se puede medir la escalabilidad de cada kernel
+// ni aprovechar máquinas con más núcleos.
+#define HILOS_POR_DEFECTO 2
+#define MAX_HILOS_OPERACION 64
+static int hilosPorOperacion = HILOS_POR_DEFECTO;
+
+// QUÉ: printf condicionado a mensajesActivos.
+// CÓMO: vprintf con los mismos argumentos.
+// POR QUÉ: Las operaciones informan su resultado con esta función; los menús
+// y los errores (stderr) siguen usando printf/fprintf.
+static void informar(const char* formato, ...) __attribute__((format(printf, 1, 2)));
+static void informar(const char* formato, ...) {
+    if (!mensajesActivos) return;
+    va_list args;
+    va_start(args, formato);
+    vprintf(formato, args);
+    va_end(args);
+}
+
 // =====================================================================
-// FUNCIONES AUXILIARES DE MANEJO DE MEMORIA
+// TRAZA DE EJECUCIÓN (--trace, FORMATO CHROME / PERFETTO)
 // =====================================================================
 
-// QUÉ: Asigna memoria para una matriz 3D de píxeles (alto x ancho x canales).
-// CÓMO: Asigna en tres niveles: filas, columnas y canales por píxel. Si falla 
-// en cualquier nivel, libera toda la memoria ya asignada y retorna NULL.
-// POR QUÉ: Centraliza la asignación de matrices 3D con manejo robusto de errores,
-// evitando fugas de memoria y duplicación de código en todas las funciones.
-unsigned char*** asignarMatriz3D(int alto, int ancho, int canales) {
-    // Validar parámetros
-    if (alto <= 0 || ancho <= 0 || canales <= 0) {
-        fprintf(stderr, "Error: Parámetros inválidos para asignarMatriz3D (alto=%d, ancho=%d, canales=%d)\n",
-                alto, ancho, canales);
-        return NULL;
+#define EVENTOS_POR_BLOQUE_TRAZA 1024
+
+// QUÉ: Devuelve el tiempo actual en segundos con un reloj monotónico.
+// CÓMO: Usa clock_gettime(CLOCK_MONOTONIC), que no retrocede si cambia la hora
+// del sistema.
+// POR QUÉ: Base para medir cuánto tarda cada operación (benchmarks).
+static double tiempoActualSegundos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// QUÉ: Copia una cadena escapada para JSON.
+// CÓMO: Escapa comillas, barras y caracteres de control; trunca si no cabe.
+// POR QUÉ: Las rutas de archivo van en el campo "detalle".
+static void escaparJSON(char* destino, size_t tam, const char* texto) {
+    size_t n = 0;
+    for (; *texto && n + 7 < tam; texto++) {
+        unsigned char c = (unsigned char)*texto;
+        if (c == '"' || c == '\\') {
+            destino[n++] = '\\';
+            destino[n++] = (char)c;
+        } else if (c < 0x20) {
+            n += (size_t)snprintf(destino + n, tam - n, "\\u%04x", c);
+        } else {
+            destino[n++] = (char)c;
+        }
     }
+    destino[n] = '\0';
+}
 
-    // Nivel 1: Asignar arreglo de filas
-    unsigned char*** matriz = malloc(alto * sizeof(unsigned char**));
-    if (!matriz) {
-        fprintf(stderr, "Error de memoria: No se pudo asignar arreglo de filas\n");
-        return NULL;
+// QUÉ: Un intervalo de la traza (evento "X" de Chrome: inicio y duración).
+// CÓMO: Nombre y detalle copiados; la categoría es siempre un literal
+// ("operacion", "e/s", "region", "bloque" o "cola").
+// POR QUÉ: Un solo evento por intervalo en lugar de un par inicio/fin, y
+// copiar las cadenas permite registrar rutas que después se liberan.
+typedef struct {
+    char nombre[24];
+    const char* categoria;
+    char detalle[48];
+    double inicio;          // Segundos del reloj monotónico
+    double duracion;
+    int hilo;               // Id del hilo en el sistema (tid)
+} EventoTraza;
+
+// QUÉ: Bloque de eventos de un hilo.
+// CÓMO: Cada hilo llena su bloque actual y, cuando se llena, reserva otro;
+// todos los bloques quedan en una lista que solo crece.
+// POR QUÉ: Registrar un evento no toma ningún lock: el hilo escribe en su
+// bloque y publica la cantidad con una escritura atómica.
+typedef struct BloqueTraza {
+    EventoTraza eventos[EVENTOS_POR_BLOQUE_TRAZA];
+    int numEventos;                 // Escrito solo por el hilo dueño (__atomic release)
+    struct BloqueTraza* siguiente;  // Siguiente bloque de la lista global
+} BloqueTraza;
+
+// QUÉ: Configuración y estado de la traza.
+// CÓMO: trazaActiva se fija con mensajesActivos, antes de crear hilos.
+// bloquesTraza es la cabeza de la lista de bloques: se inserta con
+// compare-and-swap y se recorre al escribir el archivo; cada hilo apunta a su
+// bloque actual con una variable __thread. generacionTraza cambia cada vez
+// que liberarTraza() suelta la lista: un hilo cuyo bloque es de otra
+// generación no lo usa (ya fue liberado) y reserva uno nuevo.
+// POR QUÉ: Es la única estructura global que crece mientras hay hilos; al
+// ser de solo inserción atómica no necesita mutex.
+static int trazaActiva = 0;
+static BloqueTraza* bloquesTraza = NULL;
+static int generacionTraza = 0;
+static __thread BloqueTraza* bloqueTrazaHilo;
+static __thread int generacionTrazaHilo;
+
+// QUÉ: Id del hilo que llama, tal como lo muestra el sistema.
+// CÓMO: gettid en Linux (cacheado por hilo); en otros sistemas, pthread_self.
+// POR QUÉ: Chrome agrupa los eventos en una fila por (pid, tid).
+static int idHiloTraza(void) {
+    static __thread int id;
+    if (!id) {
+#if defined(__linux__)
+        id = (int)syscall(SYS_gettid);
+#else
+        id = (int)((uintptr_t)pthread_self() & 0x7fffffff);
+#endif
     }
+    return id;
+}
 
-    // Nivel 2: Asignar arreglo de columnas para cada fila
-    for (int y = 0; y < alto; y++) {
-        matriz[y] = malloc(ancho * sizeof(unsigned char*));
-        if (!matriz[y]) {
-            fprintf(stderr, "Error de memoria: No se pudo asignar columnas en fila %d\n", y);
-            // Liberar filas ya asignadas
-            for (int yy = 0; yy < y; yy++) {
-                for (int x = 0; x < ancho; x++) {
-                    free(matriz[yy][x]);
-                }
-                free(matriz[yy]);
-            }
-            free(matriz);
-            return NULL;
+// QUÉ: Registra un intervalo [inicio, fin] en el bloque del hilo que llama.
+// CÓMO: Si el bloque está lleno (o no hay), reserva uno nuevo y lo inserta en
+// la lista con __atomic_compare_exchange; copia el evento y publica la nueva
+// cantidad. 'hilo' permite registrar intervalos de otro hilo (los bloques de
+// una región se registran desde quien hizo el join). Sin memoria, el evento
+// se pierde en silencio.
+// POR QUÉ: La traza nunca debe hacer fallar ni serializar una operación.
+static void registrarEventoTraza(const char* nombre, const char* categoria, const char* detalle, double inicio,
+                                 double fin, int hilo) {
+    BloqueTraza* bloque = bloqueTrazaHilo;
+    int generacion = __atomic_load_n(&generacionTraza, __ATOMIC_RELAXED);
+    if (!bloque || generacionTrazaHilo != generacion || bloque->numEventos == EVENTOS_POR_BLOQUE_TRAZA) {
+        bloque = calloc(1, sizeof(BloqueTraza));
+        if (!bloque) return;
+        bloque->siguiente = __atomic_load_n(&bloquesTraza, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&bloquesTraza, &bloque->siguiente, bloque, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
         }
+        bloqueTrazaHilo = bloque;
+        generacionTrazaHilo = generacion;
+    }
+    EventoTraza* e = &bloque->eventos[bloque->numEventos];
+    snprintf(e->nombre, sizeof(e->nombre), "%s", nombre);
+    snprintf(e->detalle, sizeof(e->detalle), "%s", detalle ? detalle : "");
+    e->categoria = categoria;
+    e->inicio = inicio;
+    e->duracion = fin - inicio;
+    e->hilo = hilo;
+    __atomic_store_n(&bloque->numEventos, bloque->numEventos + 1, __ATOMIC_RELEASE);
+}
 
-        // Nivel 3: Asignar canales para cada píxel de la fila
-        for (int x = 0; x < ancho; x++) {
-            matriz[y][x] = malloc(canales * sizeof(unsigned char));
-            if (!matriz[y][x]) {
-                fprintf(stderr, "Error de memoria: No se pudo asignar canales en [%d][%d]\n", y, x);
-                // Liberar píxeles de esta fila ya asignados
-                for (int xx = 0; xx < x; xx++) {
-                    free(matriz[y][xx]);
-                }
-                free(matriz[y]);
-                // Liberar filas anteriores completamente
-                for (int yy = 0; yy < y; yy++) {
-                    for (int xx = 0; xx < ancho; xx++) {
-                        free(matriz[yy][xx]);
-                    }
-                    free(matriz[yy]);
-                }
-                free(matriz);
-                return NULL;
-            }
+// QUÉ: Escribe la traza en formato JSON de Chrome (chrome://tracing, Perfetto).
+// CÓMO: Recorre la lista de bloques (lectura atómica de cada cantidad) y
+// escribe un evento "X" por intervalo con tiempos en microsegundos desde el
+// primer evento; el hilo principal se nombra con un evento de metadatos.
+// Devuelve 0 si no se pudo escribir.
+// POR QUÉ: Muestra en una línea de tiempo qué etapa o qué hilo es el cuello
+// de botella de un pipeline.
+static int escribirTraza(const char* ruta) {
+    FILE* archivo = fopen(ruta, "w");
+    if (!archivo) {
+        fprintf(stderr, "Error: No se pudo crear la traza %s\n", ruta);
+        return 0;
+    }
+    BloqueTraza* cabeza = __atomic_load_n(&bloquesTraza, __ATOMIC_ACQUIRE);
+    double origen = -1;
+    for (BloqueTraza* b = cabeza; b; b = b->siguiente) {
+        int n = __atomic_load_n(&b->numEventos, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < n; i++) {
+            if (origen < 0 || b->eventos[i].inicio < origen) origen = b->eventos[i].inicio;
         }
     }
-
-    return matriz;
+    int pid = (int)getpid();
+    fprintf(archivo, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(archivo, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"principal\"}}",
+            pid, idHiloTraza());
+    for (BloqueTraza* b = cabeza; b; b = b->siguiente) {
+        int n = __atomic_load_n(&b->numEventos, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < n; i++) {
+            const EventoTraza* e = &b->eventos[i];
+            char nombre[64], detalle[128];
+            escaparJSON(nombre, sizeof(nombre), e->nombre);
+            escaparJSON(detalle, sizeof(detalle), e->detalle);
+            fprintf(archivo, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"detalle\":\"%s\"}}",
+                    nombre, e->categoria, (e->inicio - origen) * 1e6, e->duracion * 1e6, pid, e->hilo, detalle);
+        }
+    }
+    fprintf(archivo, "\n]}\n");
+    if (fclose(archivo) != 0) {
+        fprintf(stderr, "Error al escribir la traza %s\n", ruta);
+        return 0;
+    }
+    return 1;
 }
 
-// QUÉ: Libera la memoria de una matriz 3D de píxeles.
-// CÓMO: Libera en orden inverso a la asignación: primero canales (píxeles), 
-// luego columnas (filas), finalmente el arreglo principal.
-// POR QUÉ: Evita fugas de memoria liberando todos los niveles de la matriz 3D
-// correctamente, con verificación de puntero nulo para robustez.
-void liberarMatriz3D(unsigned char*** matriz, int alto, int ancho) {
-    if (!matriz) {
-        return; // Seguro ante punteros nulos
+// QUÉ: Libera todos los bloques de eventos de la traza.
+// CÓMO: Separa la lista con un intercambio atómico, avanza generacionTraza
+// (los bloques actuales de cada hilo quedan invalidados) y libera cada
+// bloque. Se llama sin operaciones en curso, como activar o desactivar la traza.
+// POR QUÉ: Los bloques solo crecen; tras escribirlos (o al salir) ya no
+// sirven, y en un programa que enlaza la biblioteca la memoria se acumularía.
+static void liberarTraza(void) {
+    BloqueTraza* b = __atomic_exchange_n(&bloquesTraza, NULL, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&generacionTraza, 1, __ATOMIC_RELAXED);
+    bloqueTrazaHilo = NULL;
+    while (b) {
+        BloqueTraza* siguiente = b->siguiente;
+        free(b);
+        b = siguiente;
     }
+}
 
-    for (int y = 0; y < alto; y++) {
-        if (matriz[y]) {
-            for (int x = 0; x < ancho; x++) {
-                free(matriz[y][x]); // Liberar canales de cada píxel
-            }
-            free(matriz[y]); // Liberar fila (columnas)
-        }
+// =====================================================================
+// CONTADORES DE HARDWARE (perf_event_open)
+// =====================================================================
+
+#define NUM_CONTADORES_HILO 5
+
+// QUÉ: Abre un contador de hardware (p. ej. fallos de caché) sobre el hilo actual.
+// CÓMO: Usa la llamada perf_event_open de Linux. Con heredar = 1 también
+// cuenta los hilos que se creen después (sus cuentas se suman al terminar,
+// antes de leer tras pthread_join); con 0 cuenta solo este hilo. Pide los
+// tiempos activo/contando para corregir la multiplexación.
+// POR QUÉ: Permite comprobar con datos reales que las teselas reducen fallos
+// de caché. Devuelve -1 si el sistema no lo permite (otro SO, contenedor,
+// perf_event_paranoid alto), y quien mide sigue mostrando solo tiempos.
+static int abrirContadorHardware(unsigned long long configuracion, int heredar) {
+#if defined(__linux__)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = configuracion;
+    attr.disabled = 1;
+    attr.inherit = heredar ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)configuracion;
+    (void)heredar;
+    return -1;
+#endif
+}
+
+// QUÉ: Pone a cero y activa un contador abierto con abrirContadorHardware().
+// CÓMO: ioctl RESET + ENABLE; no hace nada si el contador no está disponible.
+// POR QUÉ: Delimita exactamente la región medida.
+static void iniciarContadorHardware(int fd) {
+#if defined(__linux__)
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#else
+    (void)fd;
+#endif
+}
+
+// QUÉ: Lee el valor actual de un contador (-1 si no está disponible).
+// CÓMO: read del valor con sus tiempos activo/contando; si el núcleo
+// multiplexó el contador, escala el valor por activo/contando.
+// POR QUÉ: Un contador que sigue activo se puede leer al empezar y al
+// terminar una operación y restar.
+static long long leerContadorHardware(int fd) {
+#if defined(__linux__)
+    if (fd < 0) return -1;
+    unsigned long long lectura[3];     // valor, tiempo activo, tiempo contando
+    if (read(fd, lectura, sizeof(lectura)) != (ssize_t)sizeof(lectura) || lectura[2] == 0) return -1;
+    if (lectura[2] < lectura[1]) return (long long)((double)lectura[0] * lectura[1] / lectura[2]);
+    return (long long)lectura[0];
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+// QUÉ: Detiene un contador y devuelve su valor (-1 si no está disponible).
+// CÓMO: ioctl DISABLE y leerContadorHardware().
+// POR QUÉ: Complemento de iniciarContadorHardware().
+static long long detenerContadorHardware(int fd) {
+#if defined(__linux__)
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    return leerContadorHardware(fd);
+}
+
+// QUÉ: Eventos que se cuentan en cada hilo con --counters.
+// CÓMO: Índices de los arreglos de valores, en el orden de configuracionContadores.
+// POR QUÉ: Ciclos e instrucciones dan el IPC; referencias y fallos de la
+// caché de último nivel, la tasa de fallos LLC; los fallos de salto muestran
+// el costo de las ramas en los bucles internos.
+typedef enum {
+    CONTADOR_CICLOS,
+    CONTADOR_INSTRUCCIONES,
+    CONTADOR_REFERENCIAS_LLC,
+    CONTADOR_FALLOS_LLC,
+    CONTADOR_FALLOS_SALTO
+} TipoContadorHilo;
+
+#if defined(__linux__)
+static const unsigned long long configuracionContadores[NUM_CONTADORES_HILO] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+#else
+static const unsigned long long configuracionContadores[NUM_CONTADORES_HILO] = {0, 0, 0, 0, 0};
+#endif
+
+// QUÉ: Indica si se leen contadores de hardware en cada hilo de trabajo.
+// CÓMO: Se fija con mensajesActivos (antes de crear hilos), solo si
+// contadoresHardwareDisponibles() respondió que sí.
+// POR QUÉ: Abrir cinco contadores por hilo cuesta llamadas al sistema; solo
+// se paga cuando se pide --counters.
+static int contadoresActivos = 0;
+
+// QUÉ: Suma de contadores de varias mediciones.
+// CÓMO: Por contador, la suma y cuántas mediciones lo tenían disponible
+// (un contador puede faltar aunque otros funcionen, p. ej. LLC en una VM).
+// POR QUÉ: Distinguir "0 fallos" de "no se pudo medir".
+typedef struct {
+    long long valor[NUM_CONTADORES_HILO];
+    long validos[NUM_CONTADORES_HILO];
+} SumaContadores;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Comprueba si este sistema permite contar ciclos en un hilo.
+// CÓMO: Abre y cierra un contador de ciclos sin herencia.
+// POR QUÉ: Se llama una vez al activar --counters para avisar y seguir solo
+// con tiempos, en lugar de fallar cada apertura en cada hilo.
+static int contadoresHardwareDisponibles(void) {
+    int fd = abrirContadorHardware(configuracionContadores[CONTADOR_CICLOS], 0);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Abre y activa los contadores de hardware del hilo que llama.
+// CÓMO: Un contador sin herencia por evento; los que no se pueden abrir quedan en -1.
+// POR QUÉ: Cada hilo de trabajo se mide por separado alrededor de su función.
+static void abrirContadoresHilo(int fds[NUM_CONTADORES_HILO]) {
+    for (int i = 0; i < NUM_CONTADORES_HILO; i++) {
+        fds[i] = abrirContadorHardware(configuracionContadores[i], 0);
+        iniciarContadorHardware(fds[i]);
     }
-    free(matriz); // Liberar arreglo principal (filas)
 }
 
-// QUÉ: Crea una copia completa (clon) de una matriz 3D de píxeles.
-// CÓMO: Asigna nueva matriz con asignarMatriz3D(), luego copia píxel por píxel
-// todos los canales desde la matriz origen.
-// POR QUÉ: Necesario para operaciones que requieren preservar la imagen original
-// mientras crean una versión modificada (filtros, transformaciones).
-unsigned char*** clonarMatriz3D(unsigned char*** origen, int alto, int ancho, int canales) {
-    // Validar parámetros
-    if (!origen) {
-        fprintf(stderr, "Error: Matriz origen es NULL en clonarMatriz3D\n");
-        return NULL;
+// QUÉ: Detiene, lee y cierra los contadores abiertos con abrirContadoresHilo().
+// CÓMO: Deja en 'valores' cada cuenta (-1 si no estaba disponible).
+// POR QUÉ: Complemento de abrirContadoresHilo().
+static void cerrarContadoresHilo(int fds[NUM_CONTADORES_HILO], long long valores[NUM_CONTADORES_HILO]) {
+    for (int i = 0; i < NUM_CONTADORES_HILO; i++) {
+        valores[i] = detenerContadorHardware(fds[i]);
+        if (fds[i] >= 0) close(fds[i]);
     }
-    if (alto <= 0 || ancho <= 0 || canales <= 0) {
-        fprintf(stderr, "Error: Parámetros inválidos para clonarMatriz3D (alto=%d, ancho=%d, canales=%d)\n",
-                alto, ancho, canales);
-        return NULL;
+}
+
+// QUÉ: Suma una medición de contadores a 'suma'.
+// CÓMO: Solo suma los valores disponibles (>= 0) y cuenta cuántos fueron.
+// POR QUÉ: Lo usan las regiones (por hilo) y las operaciones.
+static void sumarContadores(SumaContadores* suma, const long long valores[NUM_CONTADORES_HILO]) {
+    for (int i = 0; i < NUM_CONTADORES_HILO; i++) {
+        if (valores[i] < 0) continue;
+        suma->valor[i] += valores[i];
+        suma->validos[i]++;
     }
+}
 
-    // Asignar nueva matriz
-    unsigned char*** clon = asignarMatriz3D(alto, ancho, canales);
-    if (!clon) {
-        fprintf(stderr, "Error: No se pudo asignar memoria para clonar matriz\n");
-        return NULL;
+// QUÉ: Contadores que quedan abiertos en el hilo que mide operaciones.
+// CÓMO: Se abren la primera vez que el hilo los lee y siguen activos hasta
+// que termina el proceso (a lo sumo cinco descriptores por hilo que mide).
+// POR QUÉ: Las operaciones se pueden anidar (un pipeline contiene una
+// rotación) y pueden fallar a mitad de camino; leer un contador siempre
+// activo al principio y al final no deja nada que cerrar.
+static __thread int fdsContadoresPropios[NUM_CONTADORES_HILO];
+static __thread int contadoresPropiosAbiertos;
+
+// QUÉ: Lee los contadores del hilo que llama (abriéndolos si hace falta).
+// CÓMO: abrirContadoresHilo() la primera vez; luego leerContadorHardware().
+// POR QUÉ: Mide lo que la operación hace fuera de sus regiones paralelas
+// (p. ej. decodificar PNG con stb, que no usa hilos).
+static void leerContadoresPropios(long long valores[NUM_CONTADORES_HILO]) {
+    if (!contadoresPropiosAbiertos) {
+        abrirContadoresHilo(fdsContadoresPropios);
+        contadoresPropiosAbiertos = 1;
     }
+    for (int i = 0; i < NUM_CONTADORES_HILO; i++) valores[i] = leerContadorHardware(fdsContadoresPropios[i]);
+}
 
-    // Copiar píxel por píxel
-    for (int y = 0; y < alto; y++) {
-        for (int x = 0; x < ancho; x++) {
-            for (int c = 0; c < canales; c++) {
-                clon[y][x][c] = origen[y][x][c];
-            }
+// =====================================================================
+// CONTABILIDAD Y PRESUPUESTO DE MEMORIA (--mem-limit)
+// =====================================================================
+
+// QUÉ: Bytes vivos y pico del proceso, y presupuesto opcional.
+// CÓMO: limiteMemoriaBytes se fija antes de crear hilos (0 = sin límite);
+// los bytes vivos y el pico se actualizan con operaciones atómicas. Se
+// cuentan las matrices (datos y tablas de punteros), el búfer que decodifica
+// stb, el búfer filtrado del guardado PNG y la salida de DEFLATE.
+// POR QUÉ: Esos búferes del tamaño de la imagen conviven durante la carga y
+// el guardado; en un contenedor el pico, no el tamaño de la imagen, decide si
+// el proceso muere por falta de memoria.
+static size_t limiteMemoriaBytes = 0;
+static size_t bytesVivosProceso = 0;
+static size_t picoBytesProceso = 0;
+
+// QUÉ: Contadores de memoria del hilo para las estadísticas por operación.
+// CÓMO: bytesReservadosHilo y reservasHilo solo crecen; vivosHilo es la suma
+// de reservas menos liberaciones hechas por este hilo (puede bajar de cero
+// si libera lo que reservó otro) y picoHilo su máximo.
+// POR QUÉ: iniciarMedicion() y terminarMedicion() restan valores del mismo
+// hilo, sin compartir nada escrito.
+static __thread size_t bytesReservadosHilo;
+static __thread long reservasHilo;
+static __thread long long vivosHilo;
+static __thread long long picoHilo;
+
+static int soltarBloqueOcioso(void);
+static size_t bytesOciososPool(void);
+
+// QUÉ: Registra una reserva de 'bytes' respetando el presupuesto.
+// CÓMO: Suma atómicamente a los bytes vivos; si pasan del límite deshace la
+// suma y devuelve al sistema bloques ociosos del pool hasta que quepa; si no
+// quedan, informa (si 'que' no es NULL) y devuelve 0. Si cabe, actualiza el
+// pico del proceso con compare-and-swap y los contadores del hilo.
+// POR QUÉ: Se llama antes del malloc: una reserva que no cabe falla enseguida
+// con un mensaje claro, en lugar de que el sistema mate al proceso.
+static int contarReserva(size_t bytes, const char* que) {
+    size_t vivos = __atomic_add_fetch(&bytesVivosProceso, bytes, __ATOMIC_RELAXED);
+    while (limiteMemoriaBytes && vivos > limiteMemoriaBytes) {
+        __atomic_sub_fetch(&bytesVivosProceso, bytes, __ATOMIC_RELAXED);
+        if (soltarBloqueOcioso()) {
+            vivos = __atomic_add_fetch(&bytesVivosProceso, bytes, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (que) {
+            size_t enUso = vivos - bytes;
+            fprintf(stderr, "Error: %s necesita %.1f MB y el presupuesto de memoria tiene %.1f MB libres "
+                            "(límite %.0f MB)\n", que, bytes / (1024.0 * 1024.0),
+                    enUso < limiteMemoriaBytes ? (limiteMemoriaBytes - enUso) / (1024.0 * 1024.0) : 0.0,
+                    limiteMemoriaBytes / (1024.0 * 1024.0));
         }
+        return 0;
+    }
+    size_t pico = __atomic_load_n(&picoBytesProceso, __ATOMIC_RELAXED);
+    while (vivos > pico && !__atomic_compare_exchange_n(&picoBytesProceso, &pico, vivos, 1, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+    }
+    bytesReservadosHilo += bytes;
+    reservasHilo++;
+    vivosHilo += (long long)bytes;
+    if (vivosHilo > picoHilo) picoHilo = vivosHilo;
+    return 1;
+}
+
+// QUÉ: Registra la liberación de 'bytes' contados con contarReserva().
+// CÓMO: Resta atómicamente de los bytes vivos y de los del hilo.
+// POR QUÉ: Contraparte de contarReserva().
+static void contarLiberacion(size_t bytes) {
+    __atomic_sub_fetch(&bytesVivosProceso, bytes, __ATOMIC_RELAXED);
+    vivosHilo -= (long long)bytes;
+}
+
+// QUÉ: Anota en los contadores del hilo un bloque que empieza (bytes > 0) o
+// deja (bytes < 0) de usarse sin cambiar los bytes vivos del proceso.
+// CÓMO: Igual que la parte del hilo de contarReserva()/contarLiberacion().
+// POR QUÉ: Un bloque del pool sigue contado en el proceso mientras está
+// ocioso, pero la operación que lo reutiliza sí lo reserva: sus bytes y su
+// pico deben verse en las estadísticas aunque no haya malloc ni mmap.
+static void contarUsoHilo(long long bytes) {
+    if (bytes > 0) {
+        bytesReservadosHilo += (size_t)bytes;
+        reservasHilo++;
     }
+    vivosHilo += bytes;
+    if (vivosHilo > picoHilo) picoHilo = vivosHilo;
+}
 
-    return clon;
+// QUÉ: Bytes que aún admite el presupuesto.
+// CÓMO: Límite menos bytes vivos, sin contar los bloques ociosos del pool
+// (contarReserva() los devuelve al sistema antes de rechazar); SIZE_MAX si no
+// hay límite.
+// POR QUÉ: La carga y el guardado eligen con esto entre el camino de imagen
+// completa y el de streaming o por bandas.
+static size_t memoriaDisponible(void) {
+    if (!limiteMemoriaBytes) return SIZE_MAX;
+    size_t vivos = __atomic_load_n(&bytesVivosProceso, __ATOMIC_RELAXED);
+    size_t ociosos = bytesOciososPool();
+    vivos = vivos > ociosos ? vivos - ociosos : 0;
+    return vivos < limiteMemoriaBytes ? limiteMemoriaBytes - vivos : 0;
+}
+
+// QUÉ: malloc contado contra el presupuesto.
+// CÓMO: contarReserva() y luego malloc; si malloc falla deshace la cuenta.
+// POR QUÉ: Para los búferes grandes que no son matrices (búfer filtrado PNG).
+static void* reservarContado(size_t bytes, const char* que) {
+    if (!contarReserva(bytes, que)) return NULL;
+    void* p = malloc(bytes);
+    if (!p) contarLiberacion(bytes);
+    return p;
+}
+
+// QUÉ: free de un búfer reservado con reservarContado().
+// CÓMO: Libera y descuenta sus bytes (nada si es NULL).
+// POR QUÉ: Contraparte de reservarContado().
+static void liberarContado(void* p, size_t bytes) {
+    if (!p) return;
+    free(p);
+    contarLiberacion(bytes);
+}
+
+// QUÉ: realloc contado de un búfer que crece.
+// CÓMO: Cuenta solo la diferencia; si no cabe o realloc falla devuelve NULL
+// y el búfer original sigue válido y contado con su tamaño anterior.
+// POR QUÉ: La salida de DEFLATE crece mientras se comprime.
+static void* recontarBufer(void* p, size_t capacidad, size_t nueva) {
+    if (!contarReserva(nueva - capacidad, NULL)) return NULL;
+    void* tmp = realloc(p, nueva);
+    if (!tmp) contarLiberacion(nueva - capacidad);
+    return tmp;
 }
 
 // =====================================================================
-// FUNCIONES AUXILIARES DE INTERPOLACIÓN
+// AFINIDAD DE HILOS Y PRIMER TOQUE (--numa)
 // =====================================================================
 
-// QUÉ: Calcula el valor interpolado de un píxel en coordenadas fraccionarias
-// usando interpolación bilineal.
-// CÓMO: Obtiene los 4 píxeles vecinos (esquinas del rectángulo que contiene el
-// punto), calcula pesos basados en distancias fraccionarias, y promedia los
-// valores con la fórmula bilineal: I = (1-a)(1-b)I00 + a(1-b)I10 + (1-a)bI01 + abI11.
-// Aplica clamping en los bordes para evitar accesos fuera de límites.
-// POR QUÉ: Necesario para operaciones de transformación geométrica (rotación,
-// escalado) que mapean píxeles a coordenadas no enteras, produciendo resultados
-// suaves sin aliasing.
-unsigned char interpolacionBilineal(unsigned char*** img, float x, float y, int c, 
-                                   int ancho, int alto) {
-    // Obtener coordenadas enteras de las 4 esquinas del rectángulo
-    int x0 = (int)floor(x);  // Esquina superior izquierda X
-    int y0 = (int)floor(y);  // Esquina superior izquierda Y
-    int x1 = x0 + 1;         // Esquina superior derecha X
-    int y1 = y0 + 1;         // Esquina inferior izquierda Y
-    
-    // Clamp coordenadas a límites válidos de la imagen
-    // Esto maneja píxeles en los bordes replicando el píxel más cercano
-    if (x0 < 0) x0 = 0;
-    if (y0 < 0) y0 = 0;
-    if (x1 >= ancho) x1 = ancho - 1;
-    if (y1 >= alto) y1 = alto - 1;
-    
-    // Calcular partes fraccionarias (pesos de interpolación)
-    // a = distancia horizontal desde x0 (0.0 = en x0, 1.0 = en x1)
-    // b = distancia vertical desde y0 (0.0 = en y0, 1.0 = en y1)
-    float a = x - x0;
-    float b = y - y0;
-    
-    // Obtener valores de los 4 píxeles vecinos
-    // v00 = esquina superior izquierda
-    // v10 = esquina superior derecha
-    // v01 = esquina inferior izquierda
-    // v11 = esquina inferior derecha
-    float v00 = img[y0][x0][c];
-    float v10 = img[y0][x1][c];
-    float v01 = img[y1][x0][c];
-    float v11 = img[y1][x1][c];
-    
-    // Aplicar fórmula de interpolación bilineal
-    // Interpola primero en X (horizontalmente) para las dos filas,
-    // luego interpola en Y (verticalmente) entre los resultados
-    float resultado = (1.0f - a) * (1.0f - b) * v00  // Peso esquina superior izquierda
-                    + a * (1.0f - b) * v10            // Peso esquina superior derecha
-                    + (1.0f - a) * b * v01            // Peso esquina inferior izquierda
-                    + a * b * v11;                    // Peso esquina inferior derecha
-    
-    // Redondear y convertir a unsigned char
-    // Suma 0.5 para redondeo correcto antes del truncado
-    return (unsigned char)(resultado + 0.5f);
+#define MAX_CPUS_AFINIDAD 1024              // CPUs que entran en la máscara de afinidad
+#define TAM_PAGINA_GRANDE (2 * 1024 * 1024) // Página de THP en x86-64 y arm64
+
+// QUÉ: Configuración de --numa: activa y CPUs donde se fijan los hilos.
+// CÓMO: cpusAfinidad guarda en orden las CPUs permitidas al proceso; se
+// llena en activarAfinidad() antes de crear hilos y luego solo se lee.
+// POR QUÉ: Linux numera las CPUs de cada nodo de forma contigua, así que
+// repartir los hilos parejo sobre esta lista reparte las bandas entre nodos.
+static int numaActivo = 0;
+static int cpusAfinidad[MAX_CPUS_AFINIDAD];
+static int numCpusAfinidad = 0;
+
+// QUÉ: Grupos de afinidad: uno por hilo de lote o de servidor que lanza
+// operaciones a la vez.
+// CÓMO: numGruposAfinidad se fija antes de crear esos hilos; cada uno guarda
+// su número en grupoAfinidadHilo, y los hilos de sus operaciones lo heredan
+// por argumento (ver ejecutarHiloMedido()).
+// POR QUÉ: Sin grupos, el hilo i de cada operación concurrente iría a la
+// misma CPU: N trabajadores x T hilos se amontonarían en T CPUs.
+static int numGruposAfinidad = 1;
+static __thread int grupoAfinidadHilo;
+
+// QUÉ: Activa el modo --numa leyendo las CPUs permitidas al proceso.
+// CÓMO: sched_getaffinity por syscall (sin _GNU_SOURCE) y recorre la
+// máscara. Devuelve 0 (y deja el modo apagado) si no se puede leer o fuera
+// de Linux.
+// POR QUÉ: Respeta taskset/cgroups: solo se fija a CPUs que el proceso ya
+// tenía.
+static int activarAfinidad(int activa) {
+    numaActivo = 0;
+    numCpusAfinidad = 0;
+    if (!activa) return 1;
+#if defined(__linux__) && defined(SYS_sched_getaffinity)
+    unsigned long mascara[MAX_CPUS_AFINIDAD / (8 * sizeof(unsigned long))];
+    memset(mascara, 0, sizeof(mascara));
+    long bytes = syscall(SYS_sched_getaffinity, 0, sizeof(mascara), mascara);
+    for (long cpu = 0; bytes > 0 && cpu < bytes * 8; cpu++) {
+        if (mascara[cpu / (8 * sizeof(unsigned long))] & (1UL << (cpu % (8 * sizeof(unsigned long))))) {
+            cpusAfinidad[numCpusAfinidad++] = (int)cpu;
+        }
+    }
+#endif
+    numaActivo = numCpusAfinidad > 0;
+    return numaActivo;
+}
+
+// QUÉ: Fija el hilo que llama a la CPU que le toca al hilo 'indice' del grupo.
+// CÓMO: Cada grupo recibe un tramo contiguo de cpusAfinidad y los índices
+// 0..hilosPorOperacion-1 se reparten en partes iguales dentro de él (si hay
+// más hilos que CPUs, varios comparten CPU de forma pareja); llama a
+// sched_setaffinity con una sola CPU. Sin --numa no hace nada.
+// POR QUÉ: El hilo i de cada operación de un grupo corre siempre en la misma
+// CPU, así la banda i que tocó primero (ver tocarPaginas()) queda en su nodo,
+// y los grupos concurrentes no compiten por las mismas CPUs.
+static void fijarHiloActual(int grupo, int indice) {
+#if defined(__linux__) && defined(SYS_sched_setaffinity)
+    if (!numaActivo) return;
+    long ranura = (long)(grupo % numGruposAfinidad) * hilosPorOperacion + indice % hilosPorOperacion;
+    int cpu = cpusAfinidad[ranura * numCpusAfinidad / ((long)numGruposAfinidad * hilosPorOperacion)];
+    unsigned long mascara[MAX_CPUS_AFINIDAD / (8 * sizeof(unsigned long))];
+    memset(mascara, 0, sizeof(mascara));
+    mascara[cpu / (8 * sizeof(unsigned long))] = 1UL << (cpu % (8 * sizeof(unsigned long)));
+    syscall(SYS_sched_setaffinity, 0, sizeof(mascara), mascara);
+#else
+    (void)grupo;
+    (void)indice;
+#endif
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Reparte las CPUs de --numa entre 'grupos' hilos concurrentes.
+// CÓMO: Fija numGruposAfinidad; llamar antes de crear esos hilos.
+// POR QUÉ: El lote y el servidor ejecutan varias operaciones a la vez.
+static void repartirAfinidadEnGrupos(int grupos) {
+    numGruposAfinidad = grupos > 0 ? grupos : 1;
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Una banda de páginas que un hilo toca por primera vez.
+// CÓMO: Inicio, bytes, índice del hilo y grupo de quien llama (para fijarlo).
+// POR QUÉ: Argumento de tocarBandaHilo().
+typedef struct {
+    unsigned char* inicio;
+    size_t bytes;
+    int indice;
+    int grupo;
+} BandaPrimerToque;
+
+// QUÉ: Escribe un byte por página de su banda desde la CPU del hilo 'indice'.
+// CÓMO: fijarHiloActual() y luego un recorrido de 4 KB en 4 KB.
+// POR QUÉ: Linux ubica cada página en el nodo del hilo que la toca primero.
+static void* tocarBandaHilo(void* args) {
+    BandaPrimerToque* b = (BandaPrimerToque*)args;
+    fijarHiloActual(b->grupo, b->indice);
+    for (size_t i = 0; i < b->bytes; i += 4096) b->inicio[i] = 0;
+    return NULL;
+}
+
+// QUÉ: Prefalla un bloque nuevo de 'tam' bytes.
+// CÓMO: Sin --numa (o si el bloque no alcanza una página grande por hilo) lo
+// toca el hilo que llama. Con --numa lo parte en hilosPorOperacion bandas
+// proporcionales (cortadas en múltiplos de 2 MB) y cada banda la toca el hilo
+// de ese índice, fijado a su CPU; si un hilo no se puede crear, su banda la
+// toca quien llama.
+// POR QUÉ: Los datos y la tabla de punteros van en orden de filas, así que la
+// banda i de bytes es la banda i de filas que procesará el hilo i (reparto
+// por filas o teselas contiguas); con el bloque entero tocado por un solo
+// hilo, la mitad de los hilos de una máquina de dos zócalos leerían de la
+// memoria del otro nodo.
+static void tocarPaginas(unsigned char* base, size_t tam) {
+    int numHilos = numaActivo ? hilosPorOperacion : 1;
+    if (numHilos < 2 || tam < (size_t)numHilos * TAM_PAGINA_GRANDE) {
+        for (size_t i = 0; i < tam; i += 4096) base[i] = 0;
+        return;
+    }
+    pthread_t hilos[numHilos];
+    BandaPrimerToque bandas[numHilos];
+    int creado[numHilos];
+    for (int i = 0; i < numHilos; i++) {
+        size_t desde = tam / numHilos * i / TAM_PAGINA_GRANDE * TAM_PAGINA_GRANDE;
+        size_t hasta = i == numHilos - 1 ? tam : tam / numHilos * (i + 1) / TAM_PAGINA_GRANDE * TAM_PAGINA_GRANDE;
+        bandas[i].inicio = base + desde;
+        bandas[i].bytes = hasta - desde;
+        bandas[i].indice = i;
+        bandas[i].grupo = grupoAfinidadHilo;
+        creado[i] = pthread_create(&hilos[i], NULL, tocarBandaHilo, &bandas[i]) == 0;
+    }
+    for (int i = 0; i < numHilos; i++) {
+        if (creado[i]) {
+            pthread_join(hilos[i], NULL);
+        } else {
+            for (size_t j = 0; j < bandas[i].bytes; j += 4096) bandas[i].inicio[j] = 0;
+        }
+    }
 }
 
 // =====================================================================
-// FUNCIONES AUXILIARES DE CONVOLUCIÓN
+// POOL DE BLOQUES GRANDES (--no-pool)
 // =====================================================================
 
-// QUÉ: Genera un kernel Gaussiano 2D para operaciones de desenfoque (blur).
-// CÓMO: Asigna matriz 2D de floats, aplica fórmula Gaussiana G(x,y) = 
-// (1/(2πσ²)) * e^(-(x²+y²)/(2σ²)) para cada elemento, luego normaliza
-// dividiendo por la suma total para que todos los pesos sumen 1.0.
-// POR QUÉ: El kernel Gaussiano produce desenfoque natural preservando bordes
-// mejor que un simple promedio. La normalización garantiza que el brillo de
-// la imagen se mantenga constante después de la convolución.
-float** generarKernelGaussiano(int tamKernel, float sigma) {
-    // Validar que el tamaño del kernel sea impar
-    if (tamKernel <= 0 || tamKernel % 2 == 0) {
-        fprintf(stderr, "Error: El tamaño del kernel debe ser impar y positivo (recibido: %d)\n", 
-                tamKernel);
-        return NULL;
+#define MAX_BLOQUES_POOL 8                  // Bloques ociosos que conserva el pool
+#define UMBRAL_BLOQUE_POOL (256 * 1024)     // Por debajo se usa malloc
+
+// QUÉ: Bloques grandes ociosos listos para reutilizar.
+// CÓMO: Arreglo fijo protegido por un mutex (lo comparten los hilos del lote
+// y del servidor); poolActivo se fija antes de crear hilos.
+// POR QUÉ: Cada paso de un pipeline reserva un destino del tamaño de la imagen
+// y libera el origen; con malloc esos bloques van directo a mmap/munmap y
+// cada reserva vuelve a pagar un fallo de página por cada 4 KB.
+typedef struct {
+    void* base;
+    size_t capacidad;
+} BloquePool;
+
+static int poolActivo = 1;
+static struct {
+    pthread_mutex_t mutex;
+    BloquePool libres[MAX_BLOQUES_POOL];
+    int numLibres;
+    size_t bytesOciosos;
+    long reutilizados;
+    long nuevos;
+} poolBloques = {PTHREAD_MUTEX_INITIALIZER, {{NULL, 0}}, 0, 0, 0, 0};
+
+// QUÉ: Devuelve al sistema el bloque ocioso más grande del pool.
+// CÓMO: Lo saca del arreglo con el mutex tomado, hace munmap fuera y lo
+// descuenta. Devuelve 0 si no había ninguno.
+// POR QUÉ: Con --mem-limit los bloques ociosos cuentan como memoria en uso;
+// contarReserva() los suelta antes de rechazar una reserva.
+static int soltarBloqueOcioso(void) {
+    pthread_mutex_lock(&poolBloques.mutex);
+    int mayor = -1;
+    for (int i = 0; i < poolBloques.numLibres; i++) {
+        if (mayor < 0 || poolBloques.libres[i].capacidad > poolBloques.libres[mayor].capacidad) mayor = i;
     }
-    
-    // Validar que sigma sea positivo
-    if (sigma <= 0.0f) {
-        fprintf(stderr, "Error: Sigma debe ser positivo (recibido: %.2f)\n", sigma);
-        return NULL;
+    BloquePool bloque = {NULL, 0};
+    if (mayor >= 0) {
+        bloque = poolBloques.libres[mayor];
+        poolBloques.libres[mayor] = poolBloques.libres[--poolBloques.numLibres];
+        poolBloques.bytesOciosos -= bloque.capacidad;
     }
-    
-    // Asignar memoria para el kernel (matriz 2D de floats)
-    float** kernel = malloc(tamKernel * sizeof(float*));
-    if (!kernel) {
-        fprintf(stderr, "Error de memoria: No se pudo asignar kernel\n");
-        return NULL;
+    pthread_mutex_unlock(&poolBloques.mutex);
+    if (!bloque.base) return 0;
+    munmap(bloque.base, bloque.capacidad);
+    __atomic_sub_fetch(&bytesVivosProceso, bloque.capacidad, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// QUÉ: Bytes ociosos del pool.
+// CÓMO: Lectura de bytesOciosos con el mutex tomado.
+// POR QUÉ: memoriaDisponible() los trata como libres.
+static size_t bytesOciososPool(void) {
+    pthread_mutex_lock(&poolBloques.mutex);
+    size_t ociosos = poolBloques.bytesOciosos;
+    pthread_mutex_unlock(&poolBloques.mutex);
+    return ociosos;
+}
+
+// QUÉ: Bytes que cuenta tomarBloque() para un pedido de 'bytes' nuevo.
+// CÓMO: Sin pool o por debajo del umbral, los mismos bytes; si no, redondeados
+// a 4 KB, o a 2 MB desde 2 MB cuando no hay --mem-limit, como los proyecta
+// tomarBloque().
+// POR QUÉ: Las estimaciones previas del presupuesto (bytesMatriz3D) deben
+// usar el mismo redondeo que la reserva real, o eligen el camino de imagen
+// completa y luego la reserva no cabe. Con presupuesto no se redondea a 2 MB:
+// la tabla de punteros de una imagen chica podría costar casi el doble.
+static size_t capacidadBloque(size_t bytes) {
+    if (!poolActivo || bytes < UMBRAL_BLOQUE_POOL) return bytes;
+    size_t alineacion = bytes >= TAM_PAGINA_GRANDE && !limiteMemoriaBytes ? TAM_PAGINA_GRANDE : 4096;
+    return (bytes + alineacion - 1) / alineacion * alineacion;
+}
+
+// QUÉ: Reserva un bloque de al menos 'bytes', del pool si hay uno adecuado.
+// CÓMO: Por debajo de UMBRAL_BLOQUE_POOL (o con --no-pool) usa
+// reservarContado() y deja *capacidad en 0. Si no, toma el bloque ocioso más
+// chico con capacidad entre bytes y 2 x bytes; si no hay, proyecta uno nuevo
+// (desde 2 MB y sin --mem-limit, con tamaño y dirección múltiplos de 2 MB:
+// proyecta 2 MB de más y recorta las puntas), pide páginas grandes con madvise(MADV_HUGEPAGE)
+// y lo prefalla con tocarPaginas(). Los bloques del pool se cuentan por su
+// capacidad (capacidadBloque()) al crearlos; al reutilizarlos solo se anotan
+// en los contadores del hilo.
+// POR QUÉ: Reutilizar un bloque ya tocado evita los fallos de página y las
+// llamadas al sistema; el límite de 2x evita que una imagen chica retenga el
+// bloque de una grande. Solo un bloque alineado a 2 MB puede quedar cubierto
+// entero por páginas grandes (menos fallos de TLB al recorrer columnas).
+static void* tomarBloque(size_t bytes, size_t* capacidad, const char* que) {
+    *capacidad = 0;
+    if (!poolActivo || bytes < UMBRAL_BLOQUE_POOL) return reservarContado(bytes, que);
+
+    pthread_mutex_lock(&poolBloques.mutex);
+    int elegido = -1;
+    for (int i = 0; i < poolBloques.numLibres; i++) {
+        size_t c = poolBloques.libres[i].capacidad;
+        if (c >= bytes && c / 2 <= bytes && (elegido < 0 || c < poolBloques.libres[elegido].capacidad)) elegido = i;
     }
-    
-    for (int i = 0; i < tamKernel; i++) {
-        kernel[i] = malloc(tamKernel * sizeof(float));
-        if (!kernel[i]) {
-            fprintf(stderr, "Error de memoria: No se pudo asignar fila %d del kernel\n", i);
-            // Liberar filas ya asignadas
-            for (int j = 0; j < i; j++) {
-                free(kernel[j]);
-            }
-            free(kernel);
-            return NULL;
-        }
+    if (elegido >= 0) {
+        BloquePool bloque = poolBloques.libres[elegido];
+        poolBloques.libres[elegido] = poolBloques.libres[--poolBloques.numLibres];
+        poolBloques.bytesOciosos -= bloque.capacidad;
+        poolBloques.reutilizados++;
+        pthread_mutex_unlock(&poolBloques.mutex);
+        contarUsoHilo((long long)bloque.capacidad);
+        *capacidad = bloque.capacidad;
+        return bloque.base;
     }
+    pthread_mutex_unlock(&poolBloques.mutex);
+
+    size_t tam = capacidadBloque(bytes);
+    if (!contarReserva(tam, que)) return NULL;
+    size_t extra = tam >= TAM_PAGINA_GRANDE && tam % TAM_PAGINA_GRANDE == 0 ? TAM_PAGINA_GRANDE : 0;
+    unsigned char* mapa = mmap(NULL, tam + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapa == MAP_FAILED) {
+        contarLiberacion(tam);
+        return NULL;
+    }
+    pthread_mutex_lock(&poolBloques.mutex);
+    poolBloques.nuevos++;
+    pthread_mutex_unlock(&poolBloques.mutex);
+    unsigned char* base = mapa;
+    if (extra) {
+        base = (unsigned char*)(((uintptr_t)mapa + TAM_PAGINA_GRANDE - 1) & ~(uintptr_t)(TAM_PAGINA_GRANDE - 1));
+        if (base > mapa) munmap(mapa, base - mapa);
+        if (base + tam < mapa + tam + extra) munmap(base + tam, mapa + tam + extra - (base + tam));
+#ifdef MADV_HUGEPAGE
+        madvise(base, tam, MADV_HUGEPAGE);
+#endif
+    }
+    tocarPaginas(base, tam);   // Prefallar fuera del código medido
+    *capacidad = tam;
+    return base;
+}
+
+// QUÉ: Devuelve un bloque obtenido con tomarBloque().
+// CÓMO: Si vino de malloc (capacidad 0) lo libera con liberarContado(); si
+// es del pool lo deja ocioso, salvo que el pool esté lleno o desactivado, en
+// cuyo caso hace munmap y lo descuenta.
+// POR QUÉ: Contraparte de tomarBloque().
+static void devolverBloque(void* bloque, size_t bytes, size_t capacidad) {
+    if (!bloque) return;
+    if (capacidad == 0) {
+        liberarContado(bloque, bytes);
+        return;
+    }
+    pthread_mutex_lock(&poolBloques.mutex);
+    if (poolActivo && poolBloques.numLibres < MAX_BLOQUES_POOL) {
+        poolBloques.libres[poolBloques.numLibres].base = bloque;
+        poolBloques.libres[poolBloques.numLibres].capacidad = capacidad;
+        poolBloques.numLibres++;
+        poolBloques.bytesOciosos += capacidad;
+        pthread_mutex_unlock(&poolBloques.mutex);
+        contarUsoHilo(-(long long)capacidad);   // Sigue contado en el proceso, no en la operación
+        return;
+    }
+    pthread_mutex_unlock(&poolBloques.mutex);
+    munmap(bloque, capacidad);
+    contarLiberacion(capacidad);
+}
+
+// =====================================================================
+// ESTADÍSTICAS POR OPERACIÓN (--stats, --stats-json)
+// =====================================================================
+
+#define MAX_OPERACIONES_ESTADISTICAS 16     // Nombres distintos en el resumen
+#define MAX_REGIONES_ESTADISTICAS 16        // Regiones paralelas distintas en el resumen
+
+// QUÉ: Tiempo de CPU consumido por el proceso (todos sus hilos).
+// CÓMO: clock_gettime(CLOCK_PROCESS_CPUTIME_ID).
+// POR QUÉ: Las operaciones reparten su trabajo en hilos propios; el tiempo de
+// CPU del proceso los incluye (en lotes y en el servidor incluye también lo
+// que hagan otras operaciones al mismo tiempo).
+static double tiempoCPUSegundos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// QUÉ: Tiempo de CPU consumido por el hilo que llama.
+// CÓMO: clock_gettime(CLOCK_THREAD_CPUTIME_ID).
+// POR QUÉ: Distingue el tiempo que un hilo trabajó del que estuvo esperando
+// a ser planificado dentro de su región paralela.
+static double tiempoCPUHiloSegundos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// QUÉ: Totales de una operación (por nombre) para el resumen.
+// CÓMO: Veces, tiempos, megapíxeles, bytes y número de reservas, el pico de
+// memoria sobre la del inicio y, con --counters,
+// bytes de imagen procesados y contadores de hardware sumados.
+// POR QUÉ: El resumen de --stats muestra una fila por operación.
+typedef struct {
+    char nombre[24];
+    long veces;
+    double segundosPared;
+    double segundosCPU;
+    double megapixeles;
+    size_t bytesReservados;
+    long reservas;
+    size_t picoBytes;               // Máximo entre ejecuciones (no se suma)
+    double bytesImagen;             // El mayor entre entrada y salida (ancho x alto x canales)
+    SumaContadores contadores;      // Hilo que llama + hilos de sus regiones
+} AcumuladoOperacion;
+
+// QUÉ: Totales de una región paralela (por nombre) para el resumen.
+// CÓMO: Por cada ejecución suma el tiempo de pared de la región, el trabajo
+// (fin - inicio) del hilo más lento y el promedio por hilo, la CPU de los
+// hilos, hilos x pared (capacidad) y lo que cada hilo esperó en el join.
+// POR QUÉ: Con el reparto estático por filas o teselas, máximo/promedio es
+// el desbalance, y la espera es el tiempo que los hilos quedan ociosos.
+typedef struct {
+    char nombre[24];
+    long veces;
+    int hilos;                  // Hilos de la última ejecución
+    double segundosPared;       // Antes del primer pthread_create hasta el último join
+    double trabajoMaximo;
+    double trabajoPromedio;
+    double ocupado;             // CPU de los hilos de la región
+    double capacidad;           // Suma de hilos x segundosPared
+    double esperaJoin;          // Suma por hilo de (fin de la región - fin del hilo)
+} AcumuladoRegion;
+
+// QUÉ: Totales de todas las operaciones y regiones medidas por un hilo.
+// CÓMO: Arreglos fijos; los nombres nuevos se agregan al final.
+// POR QUÉ: Cada hilo acumula en el suyo (sin compartir nada escrito) y quien
+// lanza los hilos suma los registros después de pthread_join.
+typedef struct {
+    AcumuladoOperacion ops[MAX_OPERACIONES_ESTADISTICAS];
+    int numOps;
+    AcumuladoRegion regiones[MAX_REGIONES_ESTADISTICAS];
+    int numRegiones;
+} RegistroEstadisticas;
+
+// QUÉ: Configuración de las estadísticas y registros por hilo.
+// CÓMO: estadisticasActivas y salidaEstadisticasJSON se fijan junto con
+// mensajesActivos, antes de crear hilos, y después solo se leen. El registro
+// y los contadores de memoria son locales a cada hilo (__thread).
+// POR QUÉ: Medir sin mutex ni contadores compartidos; las líneas JSON se
+// escriben con una sola llamada (stdio bloquea el FILE por llamada).
+static int estadisticasActivas = 0;
+static FILE* salidaEstadisticasJSON = NULL;
+static __thread RegistroEstadisticas estadisticasHilo;
+static __thread SumaContadores contadoresRegionesHilo;  // Hilos de las regiones lanzadas por este hilo
+
+// QUÉ: Estado de una medición en curso.
+// CÓMO: Tiempos, bytes y contadores al empezar, y el tamaño de la imagen de entrada.
+// POR QUÉ: Se guarda en la pila de la operación; no hace nada si las
+// estadísticas y la traza están desactivadas.
+typedef struct {
+    double inicioPared;
+    double inicioCPU;
+    size_t bytesInicio;
+    long reservasInicio;
+    long long vivosInicio;
+    long long picoPrevio;           // picoHilo de una medición exterior (se restaura)
+    double pixelesEntrada;
+    double bytesEntrada;
+    long long contadoresPropios[NUM_CONTADORES_HILO];
+    SumaContadores contadoresRegiones;
+} MedicionOperacion;
+
+// QUÉ: Empieza a medir una operación.
+// CÓMO: Anota reloj monotónico, CPU del proceso y los contadores de memoria
+// del hilo, y reinicia su pico (guardando el de una medición exterior); con --counters también los contadores propios y los de sus regiones.
+// POR QUÉ: Se llama al comienzo de cada operación, después de validar.
+static void iniciarMedicion(MedicionOperacion* m, const ImagenInfo* info) {
+    if (!estadisticasActivas && !trazaActiva) return;
+    m->inicioPared = tiempoActualSegundos();
+    m->inicioCPU = tiempoCPUSegundos();
+    m->bytesInicio = bytesReservadosHilo;
+    m->reservasInicio = reservasHilo;
+    m->vivosInicio = vivosHilo;
+    m->picoPrevio = picoHilo;
+    picoHilo = vivosHilo;
+    m->pixelesEntrada = (info && info->pixeles) ? (double)info->ancho * info->alto : 0.0;
+    m->bytesEntrada = m->pixelesEntrada * (info ? info->canales : 0);
+    if (contadoresActivos) {
+        leerContadoresPropios(m->contadoresPropios);
+        m->contadoresRegiones = contadoresRegionesHilo;
+    }
+}
+
+// QUÉ: Suma una medición al registro dado.
+// CÓMO: Busca la fila con ese nombre o agrega una nueva (si hay lugar).
+// POR QUÉ: Lo comparten terminarMedicion() y combinarEstadisticas().
+static void acumularOperacion(RegistroEstadisticas* r, const AcumuladoOperacion* op) {
+    int i = 0;
+    while (i < r->numOps && strcmp(r->ops[i].nombre, op->nombre) != 0) i++;
+    if (i == r->numOps) {
+        if (r->numOps == MAX_OPERACIONES_ESTADISTICAS) return;
+        memset(&r->ops[i], 0, sizeof(r->ops[i]));
+        snprintf(r->ops[i].nombre, sizeof(r->ops[i].nombre), "%s", op->nombre);
+        r->numOps++;
+    }
+    r->ops[i].veces += op->veces;
+    r->ops[i].segundosPared += op->segundosPared;
+    r->ops[i].segundosCPU += op->segundosCPU;
+    r->ops[i].megapixeles += op->megapixeles;
+    r->ops[i].bytesReservados += op->bytesReservados;
+    r->ops[i].reservas += op->reservas;
+    if (op->picoBytes > r->ops[i].picoBytes) r->ops[i].picoBytes = op->picoBytes;
+    r->ops[i].bytesImagen += op->bytesImagen;
+    for (int c = 0; c < NUM_CONTADORES_HILO; c++) {
+        r->ops[i].contadores.valor[c] += op->contadores.valor[c];
+        r->ops[i].contadores.validos[c] += op->contadores.validos[c];
+    }
+}
+
+// QUÉ: Formatea una métrica derivada de contadores (cociente) o "n/d".
+// CÓMO: numerador / denominador si ambos contadores estuvieron disponibles;
+// 'escala' multiplica el resultado (100 para porcentajes). 'numerador' < 0
+// usa 'bytes' en su lugar (bytes por ciclo).
+// POR QUÉ: En una VM suele faltar algún contador (p. ej. LLC) aunque haya
+// ciclos; la tabla y el JSON deben mostrar qué no se pudo medir.
+static void formatearCocienteContadores(char* destino, size_t tam, const char* formato, const SumaContadores* s,
+                                        int numerador, int denominador, double bytes, double escala,
+                                        const char* sinDato) {
+    int hayNumerador = numerador < 0 ? bytes > 0 : s->validos[numerador] > 0;
+    if (!hayNumerador || s->validos[denominador] == 0 || s->valor[denominador] <= 0) {
+        snprintf(destino, tam, "%s", sinDato);
+        return;
+    }
+    double valor = numerador < 0 ? bytes : (double)s->valor[numerador];
+    snprintf(destino, tam, formato, escala * valor / (double)s->valor[denominador]);
+}
+
+// QUÉ: Termina de medir una operación correcta y la registra.
+// CÓMO: Calcula tiempo de pared y de CPU, megapíxeles (el mayor entre
+// entrada y salida), bytes y número de reservas, el pico de memoria del hilo
+// por encima de la del inicio y, con --counters, los contadores del
+// hilo y de sus regiones (-1 en el JSON si un contador no está disponible);
+// lo suma al registro del hilo y, si hay salida JSON, escribe una línea con
+// todos los campos. Con --trace
+// registra además el intervalo (cargar y guardar como E/S).
+// POR QUÉ: Una línea por operación se puede seguir en los registros de
+// producción para detectar regresiones.
+static void terminarMedicion(MedicionOperacion* m, const char* nombre, const char* detalle, const ImagenInfo* info) {
+    if (trazaActiva) {
+        int esES = strcmp(nombre, "cargar") == 0 || strcmp(nombre, "guardar") == 0;
+        registrarEventoTraza(nombre, esES ? "e/s" : "operacion", detalle, m->inicioPared, tiempoActualSegundos(),
+                             idHiloTraza());
+    }
+    if (!estadisticasActivas) return;
+    long long pico = picoHilo;
+    if (m->picoPrevio > picoHilo) picoHilo = m->picoPrevio;
+    AcumuladoOperacion op;
+    memset(&op, 0, sizeof(op));
+    snprintf(op.nombre, sizeof(op.nombre), "%s", nombre);
+    op.veces = 1;
+    op.segundosPared = tiempoActualSegundos() - m->inicioPared;
+    op.segundosCPU = tiempoCPUSegundos() - m->inicioCPU;
+    double pixelesSalida = (info && info->pixeles) ? (double)info->ancho * info->alto : 0.0;
+    op.megapixeles = (pixelesSalida > m->pixelesEntrada ? pixelesSalida : m->pixelesEntrada) / 1e6;
+    op.bytesReservados = bytesReservadosHilo - m->bytesInicio;
+    op.reservas = reservasHilo - m->reservasInicio;
+    op.picoBytes = pico > m->vivosInicio ? (size_t)(pico - m->vivosInicio) : 0;
+    double bytesSalida = pixelesSalida * (info ? info->canales : 0);
+    op.bytesImagen = bytesSalida > m->bytesEntrada ? bytesSalida : m->bytesEntrada;
+    if (contadoresActivos) {
+        long long propios[NUM_CONTADORES_HILO];
+        leerContadoresPropios(propios);
+        for (int c = 0; c < NUM_CONTADORES_HILO; c++) {
+            if (propios[c] >= 0 && m->contadoresPropios[c] >= 0) {
+                op.contadores.valor[c] += propios[c] - m->contadoresPropios[c];
+                op.contadores.validos[c] = 1;
+            }
+            if (contadoresRegionesHilo.validos[c] > m->contadoresRegiones.validos[c]) {
+                op.contadores.valor[c] += contadoresRegionesHilo.valor[c] - m->contadoresRegiones.valor[c];
+                op.contadores.validos[c] = 1;
+            }
+        }
+    }
+    acumularOperacion(&estadisticasHilo, &op);
+
+    if (salidaEstadisticasJSON) {
+        char detalleEscapado[512], contadores[384] = "";
+        escaparJSON(detalleEscapado, sizeof(detalleEscapado), detalle ? detalle : "");
+        if (contadoresActivos) {
+            const SumaContadores* k = &op.contadores;
+            char ipc[32], tasaLLC[32], bytesCiclo[32];
+            formatearCocienteContadores(ipc, sizeof(ipc), "%.3f", k, CONTADOR_INSTRUCCIONES, CONTADOR_CICLOS, 0, 1,
+                                        "null");
+            formatearCocienteContadores(tasaLLC, sizeof(tasaLLC), "%.4f", k, CONTADOR_FALLOS_LLC,
+                                        CONTADOR_REFERENCIAS_LLC, 0, 1, "null");
+            formatearCocienteContadores(bytesCiclo, sizeof(bytesCiclo), "%.4f", k, -1, CONTADOR_CICLOS,
+                                        op.bytesImagen, 1, "null");
+            snprintf(contadores, sizeof(contadores),
+                     ",\"ciclos\":%lld,\"instrucciones\":%lld,\"referencias_llc\":%lld,\"fallos_llc\":%lld,"
+                     "\"fallos_salto\":%lld,\"ipc\":%s,\"tasa_fallos_llc\":%s,\"bytes_ciclo\":%s",
+                     k->validos[CONTADOR_CICLOS] ? k->valor[CONTADOR_CICLOS] : -1,
+                     k->validos[CONTADOR_INSTRUCCIONES] ? k->valor[CONTADOR_INSTRUCCIONES] : -1,
+                     k->validos[CONTADOR_REFERENCIAS_LLC] ? k->valor[CONTADOR_REFERENCIAS_LLC] : -1,
+                     k->validos[CONTADOR_FALLOS_LLC] ? k->valor[CONTADOR_FALLOS_LLC] : -1,
+                     k->validos[CONTADOR_FALLOS_SALTO] ? k->valor[CONTADOR_FALLOS_SALTO] : -1, ipc, tasaLLC,
+                     bytesCiclo);
+        }
+        // Un solo fprintf (toma el cerrojo del FILE una vez): la línea sale
+        // entera aunque varios hilos escriban, sin un búfer intermedio que
+        // pueda quedarse corto con el detalle y los contadores
+        fprintf(salidaEstadisticasJSON,
+                "{\"op\":\"%s\",\"detalle\":\"%s\",\"pared_ms\":%.3f,\"cpu_ms\":%.3f,\"megapixeles\":%.4f,"
+                "\"mp_s\":%.2f,\"bytes\":%zu,\"reservas\":%ld,\"pico_bytes\":%zu,\"ancho\":%d,\"alto\":%d,"
+                "\"canales\":%d%s}\n",
+                op.nombre, detalleEscapado, op.segundosPared * 1e3, op.segundosCPU * 1e3, op.megapixeles,
+                op.segundosPared > 0 ? op.megapixeles / op.segundosPared : 0.0, op.bytesReservados, op.reservas,
+                op.picoBytes,
+                info ? info->ancho : 0, info ? info->alto : 0, info ? info->canales : 0, contadores);
+        fflush(salidaEstadisticasJSON);
+    }
+}
+
+// QUÉ: Tiempos de un hilo de una región paralela.
+// CÓMO: La función y los argumentos originales del hilo, y lo que anota
+// ejecutarHiloMedido(): reloj monotónico al empezar y terminar, la CPU y el
+// id del hilo (para la traza).
+// POR QUÉ: Vive en la pila de quien lanza los hilos, junto a sus Args; cada
+// hilo escribe solo su elemento.
+typedef struct {
+    void* (*funcion)(void*);
+    void* args;
+    double inicio;
+    double fin;
+    double ocupado;
+    int hilo;
+    int indice;                                 // Posición en la región (para --numa)
+    int grupo;                                  // Grupo de afinidad de quien lanzó la región
+    long long contadores[NUM_CONTADORES_HILO];  // Con --counters (-1 si no disponible)
+} TiempoHilo;
+
+// QUÉ: Ejecuta la función de un hilo anotando sus tiempos.
+// CÓMO: Con --numa primero fija el hilo a su CPU; luego envuelve la llamada
+// con el reloj monotónico y el de CPU del hilo y, con --counters, abre los
+// contadores de hardware del hilo alrededor de ella.
+// POR QUÉ: Mide (y ubica) todas las regiones sin tocar las funciones *Hilo.
+static void* ejecutarHiloMedido(void* args) {
+    TiempoHilo* t = (TiempoHilo*)args;
+    fijarHiloActual(t->grupo, t->indice);
+    int fds[NUM_CONTADORES_HILO];
+    t->hilo = idHiloTraza();
+    if (contadoresActivos) abrirContadoresHilo(fds);
+    t->inicio = tiempoActualSegundos();
+    double cpu = tiempoCPUHiloSegundos();
+    void* resultado = t->funcion(t->args);
+    t->ocupado = tiempoCPUHiloSegundos() - cpu;
+    t->fin = tiempoActualSegundos();
+    if (contadoresActivos) cerrarContadoresHilo(fds, t->contadores);
+    return resultado;
+}
+
+// QUÉ: pthread_create() del hilo 'indice' de una región, con sus tiempos en
+// 'tiempo'.
+// CÓMO: Sin estadísticas, traza ni --numa llama directo a pthread_create; si
+// no, lanza ejecutarHiloMedido() con 'tiempo'. Devuelve lo mismo que
+// pthread_create.
+// POR QUÉ: Sin --stats, --trace ni --numa el costo es una comparación por hilo.
+static int crearHiloMedido(pthread_t* hilo, TiempoHilo* tiempo, int indice, void* (*funcion)(void*), void* args) {
+    if (!estadisticasActivas && !trazaActiva && !numaActivo) return pthread_create(hilo, NULL, funcion, args);
+    tiempo->funcion = funcion;
+    tiempo->args = args;
+    tiempo->indice = indice;
+    tiempo->grupo = grupoAfinidadHilo;
+    tiempo->inicio = tiempo->fin = tiempo->ocupado = 0;
+    return pthread_create(hilo, NULL, ejecutarHiloMedido, tiempo);
+}
+
+// QUÉ: Marca el comienzo de una región paralela.
+// CÓMO: Devuelve el reloj monotónico (0 si las estadísticas y la traza están
+// desactivadas).
+// POR QUÉ: Se llama antes del primer crearHiloMedido() y su valor se pasa a
+// terminarRegion().
+static double iniciarRegion(void) {
+    return estadisticasActivas || trazaActiva ? tiempoActualSegundos() : 0.0;
+}
+
+// QUÉ: Suma una ejecución de región al registro dado.
+// CÓMO: Busca la fila con ese nombre o agrega una nueva (si hay lugar).
+// POR QUÉ: Lo comparten terminarRegion() y combinarEstadisticas().
+static void acumularRegion(RegistroEstadisticas* r, const AcumuladoRegion* region) {
+    int i = 0;
+    while (i < r->numRegiones && strcmp(r->regiones[i].nombre, region->nombre) != 0) i++;
+    if (i == r->numRegiones) {
+        if (r->numRegiones == MAX_REGIONES_ESTADISTICAS) return;
+        memset(&r->regiones[i], 0, sizeof(r->regiones[i]));
+        snprintf(r->regiones[i].nombre, sizeof(r->regiones[i].nombre), "%s", region->nombre);
+        r->numRegiones++;
+    }
+    AcumuladoRegion* a = &r->regiones[i];
+    a->veces += region->veces;
+    a->hilos = region->hilos;
+    a->segundosPared += region->segundosPared;
+    a->trabajoMaximo += region->trabajoMaximo;
+    a->trabajoPromedio += region->trabajoPromedio;
+    a->ocupado += region->ocupado;
+    a->capacidad += region->capacidad;
+    a->esperaJoin += region->esperaJoin;
+}
+
+// QUÉ: Termina de medir una región paralela (después de todos los join).
+// CÓMO: Con los tiempos de cada hilo calcula el trabajo máximo y promedio,
+// la CPU total y la espera de cada hilo hasta el último join; lo suma al
+// registro del hilo que llama y, si hay salida JSON, escribe una línea con
+// inicio, fin y CPU de cada hilo (ms desde el comienzo de la región). Con
+// --trace registra la región en el hilo que llama y el bloque de cada hilo
+// en la fila de ese hilo.
+// POR QUÉ: Muestra cuánto espera cada hilo en pthread_join por el reparto
+// estático, para elegir el número de hilos de cada operación.
+static void terminarRegion(const char* nombre, const TiempoHilo* tiempos, int numHilos, double inicioRegion) {
+    if ((!estadisticasActivas && !trazaActiva) || numHilos <= 0) return;
+    double finRegion = tiempoActualSegundos();
+    if (trazaActiva) {
+        registrarEventoTraza(nombre, "region", NULL, inicioRegion, finRegion, idHiloTraza());
+        for (int i = 0; i < numHilos; i++) {
+            char detalle[32];
+            snprintf(detalle, sizeof(detalle), "hilo %d de %d", i, numHilos);
+            registrarEventoTraza(nombre, "bloque", detalle, tiempos[i].inicio, tiempos[i].fin, tiempos[i].hilo);
+        }
+    }
+    if (!estadisticasActivas) return;
+    AcumuladoRegion region;
+    memset(&region, 0, sizeof(region));
+    snprintf(region.nombre, sizeof(region.nombre), "%s", nombre);
+    region.veces = 1;
+    region.hilos = numHilos;
+    region.segundosPared = finRegion - inicioRegion;
+    region.capacidad = numHilos * region.segundosPared;
+    for (int i = 0; i < numHilos; i++) {
+        double trabajo = tiempos[i].fin - tiempos[i].inicio;
+        if (trabajo > region.trabajoMaximo) region.trabajoMaximo = trabajo;
+        region.trabajoPromedio += trabajo / numHilos;
+        region.ocupado += tiempos[i].ocupado;
+        region.esperaJoin += finRegion - tiempos[i].fin;
+        if (contadoresActivos) sumarContadores(&contadoresRegionesHilo, tiempos[i].contadores);
+    }
+    acumularRegion(&estadisticasHilo, &region);
+
+    if (salidaEstadisticasJSON) {
+        // Se escribe por partes con el FILE bloqueado: la línea sale entera
+        // aunque otros hilos escriban, y su largo crece con numHilos
+        flockfile(salidaEstadisticasJSON);
+        fprintf(salidaEstadisticasJSON,
+                "{\"region\":\"%s\",\"hilos\":%d,\"pared_ms\":%.3f,\"desbalance\":%.3f,"
+                "\"espera_ms\":%.3f,\"utilizacion\":%.3f,\"por_hilo\":[",
+                region.nombre, numHilos, region.segundosPared * 1e3,
+                region.trabajoPromedio > 0 ? region.trabajoMaximo / region.trabajoPromedio : 1.0,
+                region.esperaJoin * 1e3, region.capacidad > 0 ? region.ocupado / region.capacidad : 0.0);
+        for (int i = 0; i < numHilos; i++) {
+            fprintf(salidaEstadisticasJSON, "%s{\"inicio_ms\":%.3f,\"fin_ms\":%.3f,\"cpu_ms\":%.3f}",
+                    i ? "," : "", (tiempos[i].inicio - inicioRegion) * 1e3,
+                    (tiempos[i].fin - inicioRegion) * 1e3, tiempos[i].ocupado * 1e3);
+        }
+        fputs("]}\n", salidaEstadisticasJSON);
+        funlockfile(salidaEstadisticasJSON);
+        fflush(salidaEstadisticasJSON);
+    }
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Suma el registro de otro hilo al registro dado.
+// CÓMO: acumularOperacion() y acumularRegion() fila por fila.
+// POR QUÉ: Los hilos de un lote entregan su registro al terminar.
+static void combinarEstadisticas(RegistroEstadisticas* destino, const RegistroEstadisticas* origen) {
+    for (int i = 0; i < origen->numOps; i++) acumularOperacion(destino, &origen->ops[i]);
+    for (int i = 0; i < origen->numRegiones; i++) acumularRegion(destino, &origen->regiones[i]);
+}
+
+// QUÉ: Muestra el resumen de --stats.
+// CÓMO: Una fila por operación con veces, tiempos totales, MP/s, MB y número
+// de reservas y el mayor pico de memoria; el pico del proceso y el uso del
+// pool de bloques; y una fila
+// por región paralela con su desbalance, la espera total en pthread_join y
+// la utilización (CPU de los hilos / hilos x pared).
+// POR QUÉ: Vista rápida de dónde se va el tiempo de un trabajo.
+static void mostrarResumenEstadisticas(FILE* salida, const RegistroEstadisticas* r) {
+    fprintf(salida, "Estadísticas por operación:\n");
+    fprintf(salida, "  %-14s %6s %11s %11s %10s %10s %8s %9s\n", "operación", "veces", "pared(ms)", "CPU(ms)",
+            "MP/s", "MB reserv.", "reservas", "pico MB");
+    for (int i = 0; i < r->numOps; i++) {
+        const AcumuladoOperacion* op = &r->ops[i];
+        fprintf(salida, "  %-14s %6ld %11.3f %11.3f %10.2f %10.2f %8ld %9.2f\n", op->nombre, op->veces,
+                op->segundosPared * 1e3, op->segundosCPU * 1e3,
+                op->segundosPared > 0 ? op->megapixeles / op->segundosPared : 0.0,
+                op->bytesReservados / (1024.0 * 1024.0), op->reservas, op->picoBytes / (1024.0 * 1024.0));
+    }
+    fprintf(salida, "Memoria: pico del proceso %.2f MB", picoBytesProceso / (1024.0 * 1024.0));
+    if (limiteMemoriaBytes) fprintf(salida, " (límite %.0f MB)", limiteMemoriaBytes / (1024.0 * 1024.0));
+    if (poolActivo) {
+        fprintf(salida, "; pool: %ld bloques reutilizados, %ld nuevos, %.2f MB ociosos", poolBloques.reutilizados,
+                poolBloques.nuevos, poolBloques.bytesOciosos / (1024.0 * 1024.0));
+    }
+    fprintf(salida, "\n");
+    int hayContadores = 0;
+    for (int i = 0; i < r->numOps; i++) hayContadores |= r->ops[i].contadores.validos[CONTADOR_CICLOS] > 0;
+    if (hayContadores) {
+        fprintf(salida, "Contadores de hardware por operación (hilo que la llama + hilos de sus regiones):\n");
+        fprintf(salida, "  %-14s %10s %10s %6s %12s %9s %14s %11s\n", "operación", "Mciclos", "Minstr", "IPC",
+                "fallos LLC", "tasa LLC", "fallos salto", "bytes/ciclo");
+        for (int i = 0; i < r->numOps; i++) {
+            const SumaContadores* k = &r->ops[i].contadores;
+            char columnas[5][32], ipc[16], tasa[16], bytesCiclo[16];
+            const int indices[5] = {CONTADOR_CICLOS, CONTADOR_INSTRUCCIONES, CONTADOR_FALLOS_LLC,
+                                    CONTADOR_FALLOS_SALTO, -1};
+            for (int c = 0; c < 4; c++) {
+                int indice = indices[c];
+                double escala = c < 2 ? 1e6 : 1.0;
+                if (k->validos[indice]) snprintf(columnas[c], sizeof(columnas[c]), c < 2 ? "%.1f" : "%.0f",
+                                                  k->valor[indice] / escala);
+                else snprintf(columnas[c], sizeof(columnas[c]), "n/d");
+            }
+            formatearCocienteContadores(ipc, sizeof(ipc), "%.2f", k, CONTADOR_INSTRUCCIONES, CONTADOR_CICLOS, 0, 1,
+                                        "n/d");
+            formatearCocienteContadores(tasa, sizeof(tasa), "%.1f%%", k, CONTADOR_FALLOS_LLC,
+                                        CONTADOR_REFERENCIAS_LLC, 0, 100, "n/d");
+            formatearCocienteContadores(bytesCiclo, sizeof(bytesCiclo), "%.3f", k, -1, CONTADOR_CICLOS,
+                                        r->ops[i].bytesImagen, 1, "n/d");
+            fprintf(salida, "  %-14s %10s %10s %6s %12s %9s %14s %11s\n", r->ops[i].nombre, columnas[0],
+                    columnas[1], ipc, columnas[2], tasa, columnas[3], bytesCiclo);
+        }
+    }
+    if (r->numRegiones == 0) return;
+    fprintf(salida, "Regiones paralelas (desbalance = trabajo del hilo más lento / promedio):\n");
+    fprintf(salida, "  %-14s %6s %5s %11s %10s %13s %11s\n", "región", "veces", "hilos", "pared(ms)",
+            "desbalance", "espera join", "utilización");
+    for (int i = 0; i < r->numRegiones; i++) {
+        const AcumuladoRegion* g = &r->regiones[i];
+        fprintf(salida, "  %-14s %6ld %5d %11.3f %10.2f %10.3f ms %10.1f%%\n", g->nombre, g->veces, g->hilos,
+                g->segundosPared * 1e3, g->trabajoPromedio > 0 ? g->trabajoMaximo / g->trabajoPromedio : 1.0,
+                g->esperaJoin * 1e3, g->capacidad > 0 ? 100.0 * g->ocupado / g->capacidad : 0.0);
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// FUNCIONES AUXILIARES DE MANEJO DE MEMORIA
+// =====================================================================
+
+#define TAM_CABECERA_BLOQUE 64          // Bytes reservados antes de los datos
+#define MAGIA_BLOQUE 0x4D543344u        // "D3TM": bloque de datos de matriz 3D
+
+// QUÉ: Origen del bloque de datos de una matriz 3D.
+// CÓMO: Se guarda en la cabecera escondida antes de los datos.
+// POR QUÉ: liberarMatriz3D() debe devolver cada bloque con la función que
+// corresponde (free, munmap o el pool) sin cambiar las llamadas existentes.
+typedef enum {
+    ORIGEN_MALLOC = 1,      // Reservado con malloc en asignarMatriz3D()
+    ORIGEN_MMAP = 2,        // Archivo proyectado (formato crudo nativo)
+    ORIGEN_COMPARTIDO = 3,  // Segmento de memoria compartida proyectado para escribir en el lugar
+    ORIGEN_POOL = 4         // Bloque del pool (tomarBloque), vuelve al pool al liberar
+} OrigenBloque;
+
+// QUÉ: Cabecera escondida que precede al bloque de datos de cada matriz.
+// CÓMO: Ocupa los TAM_CABECERA_BLOQUE bytes anteriores a matriz[0][0] y
+// guarda la dirección y el tamaño a liberar, y los bytes que se contaron.
+// POR QUÉ: Permite matrices cuyos datos no vienen de malloc (mmap de un
+// archivo) manteniendo pixeles[y][x][c] y liberarImagen() para todas.
+typedef struct {
+    uint32_t magia;         // MAGIA_BLOQUE
+    uint32_t origen;        // OrigenBloque
+    void* base;             // Dirección devuelta por malloc/mmap
+    size_t tamMapa;         // Bytes proyectados (ORIGEN_MMAP y ORIGEN_COMPARTIDO) o capacidad (ORIGEN_POOL)
+    uint64_t dispositivo;   // Identidad del segmento (solo ORIGEN_COMPARTIDO)
+    uint64_t inodo;
+    size_t bytesContados;   // Descontados al liberar (lo reservado con malloc)
+    size_t capacidadTabla;  // Tabla de punteros del pool (0 = malloc)
+} CabeceraBloque;
+
+_Static_assert(sizeof(CabeceraBloque) <= TAM_CABECERA_BLOQUE, "CabeceraBloque no cabe antes de los datos");
+
+// QUÉ: Devuelve la cabecera escondida de un bloque de datos.
+// CÓMO: Retrocede TAM_CABECERA_BLOQUE bytes desde el inicio de los datos.
+// POR QUÉ: Punto único para leer o escribir el origen del bloque.
+static CabeceraBloque* cabeceraDeBloque(unsigned char* datos) {
+    return (CabeceraBloque*)(datos - TAM_CABECERA_BLOQUE);
+}
+
+// QUÉ: Bytes que cuenta una matriz 3D reservada con asignarMatriz3D().
+// CÓMO: Cabecera + datos + arreglo de filas + tabla de punteros por píxel, con
+// el mismo redondeo que tomarBloque() (capacidadBloque()).
+// POR QUÉ: La tabla de punteros (8 bytes por píxel) pesa más que los datos de
+// una imagen RGB; las decisiones de presupuesto deben incluirla.
+static size_t bytesMatriz3D(int alto, int ancho, int canales) {
+    size_t numPixeles = (size_t)alto * (size_t)ancho;
+    return capacidadBloque(TAM_CABECERA_BLOQUE + numPixeles * (size_t)canales) +
+           ((size_t)alto + 1) * sizeof(unsigned char**) + capacidadBloque(numPixeles * sizeof(unsigned char*));
+}
+
+// QUÉ: Comprueba, antes de reservar, que una matriz más 'otros' bytes quepan
+// en el presupuesto de memoria.
+// CÓMO: Compara bytesMatriz3D() + otros con memoriaDisponible(); si no cabe,
+// informa una sola vez cuánto falta y cuánto de eso es la tabla de punteros
+// por píxel, y devuelve 0. Sin --mem-limit siempre devuelve 1.
+// POR QUÉ: Si la reserva fallara a mitad de camino, contarReserva(),
+// asignarMatriz3D() y quien la llamó informarían cada uno el mismo fallo;
+// así el trabajo falla enseguida con un único diagnóstico.
+static int matrizCabeEnPresupuesto(int alto, int ancho, int canales, size_t otros, const char* que) {
+    size_t total = bytesMatriz3D(alto, ancho, canales) + otros;
+    size_t libres = memoriaDisponible();
+    if (total <= libres) return 1;
+    size_t tabla = capacidadBloque((size_t)alto * (size_t)ancho * sizeof(unsigned char*));
+    fprintf(stderr, "Error: %s (%dx%d, %d canales) necesita %.1f MB, de ellos %.1f MB de la tabla de punteros "
+                    "por píxel, y el presupuesto de memoria tiene %.1f MB libres (límite %.0f MB)\n",
+            que, ancho, alto, canales, total / (1024.0 * 1024.0), tabla / (1024.0 * 1024.0),
+            libres / (1024.0 * 1024.0), limiteMemoriaBytes / (1024.0 * 1024.0));
+    return 0;
+}
+
+// QUÉ: Encabezado de una vista (recorte sin copia) de otra matriz 3D.
+// CÓMO: Va al principio del bloque de la vista, antes de la ranura escondida
+// y de su arreglo de filas; la ranura matriz[-1] apunta a él. Cada fila de la
+// vista apunta dentro de la tabla de punteros de la matriz raíz (con el
+// desplazamiento de la columna inicial), así que el paso entre filas es el de
+// la raíz. La vista es dueña de la raíz: liberar la vista la libera.
+// POR QUÉ: Un recorte solo necesita alto punteros nuevos; pixeles[y][x][c]
+// sigue valiendo para todas las operaciones que recorren por filas.
+typedef struct {
+    unsigned char*** raiz;  // Matriz completa que contiene los píxeles
+    int altoRaiz;           // Geometría de la raíz (para liberarla)
+    int anchoRaiz;
+    size_t bytes;           // Bytes reservados para esta vista (encabezado + filas)
+} VistaMatriz;
+
+// QUÉ: Indica si una matriz es una vista de otra.
+// CÓMO: Las matrices propias tienen NULL en la ranura escondida matriz[-1].
+// POR QUÉ: Lo consultan liberarMatriz3D(), reemplazarPixeles() y quien
+// necesite el bloque de datos contiguo (matriz[0][0] de una vista no lo es).
+static int esVista(unsigned char*** matriz) {
+    return matriz && matriz[-1] != NULL;
+}
+
+// QUÉ: Crea las tablas de filas y de píxeles sobre un bloque de datos existente.
+// CÓMO: Reserva el arreglo de filas (con una ranura escondida en matriz[-1]
+// que distingue las vistas) y la tabla de punteros de píxeles y hace
+// que matriz[y][x] apunte a datos + (y*ancho + x)*canales. El bloque debe
+// tener su CabeceraBloque ya escrita. La tabla de punteros (8 bytes por
+// píxel) sale del pool con tomarBloque(); lo reservado con malloc se anota en
+// bytesContados (más el bloque de datos, si también es de malloc).
+// POR QUÉ: Lo comparten asignarMatriz3D() (datos con malloc) y la carga del
+// formato crudo (datos proyectados con mmap, sin copiar).
+static unsigned char*** enlazarMatriz3D(unsigned char* datos, int alto, int ancho, int canales) {
+    size_t numPixeles = (size_t)alto * (size_t)ancho;
+    size_t bytesFilas = ((size_t)alto + 1) * sizeof(unsigned char**);
+    size_t bytesPunteros = numPixeles * sizeof(unsigned char*);
+
+    // Nivel 1: Asignar arreglo de filas, precedido por la ranura de vista (NULL = matriz propia)
+    unsigned char*** filas = reservarContado(bytesFilas, "El arreglo de filas de la imagen");
+    if (!filas) {
+        fprintf(stderr, "Error de memoria: No se pudo asignar arreglo de filas\n");
+        return NULL;
+    }
+    filas[0] = NULL;
+    unsigned char*** matriz = filas + 1;
+
+    // Nivel 2: Asignar punteros de todos los píxeles (columnas de cada fila)
+    size_t capacidadTabla;
+    unsigned char** punteros = tomarBloque(bytesPunteros, &capacidadTabla, "La tabla de punteros de la imagen");
+    if (!punteros) {
+        fprintf(stderr, "Error de memoria: No se pudo asignar columnas (%dx%d)\n", ancho, alto);
+        liberarContado(filas, bytesFilas);
+        return NULL;
+    }
+    CabeceraBloque* cabecera = cabeceraDeBloque(datos);
+    cabecera->bytesContados = bytesFilas + (capacidadTabla ? 0 : bytesPunteros);
+    cabecera->capacidadTabla = capacidadTabla;
+    if (cabecera->origen == ORIGEN_MALLOC) cabecera->bytesContados += TAM_CABECERA_BLOQUE + numPixeles * canales;
+
+    // Enlazar los tres niveles: fila y → columnas, píxel [y][x] → sus canales
+    for (int y = 0; y < alto; y++) {
+        matriz[y] = punteros + (size_t)y * ancho;
+        for (int x = 0; x < ancho; x++) {
+            matriz[y][x] = datos + ((size_t)y * ancho + x) * canales;
+        }
+    }
+    return matriz;
+}
+
+// QUÉ: Asigna memoria para una matriz 3D de píxeles (alto x ancho x canales).
+// CÓMO: Reserva un único bloque contiguo con los datos (precedido por su
+// CabeceraBloque; los grandes salen del pool con tomarBloque()) y luego el arreglo de filas y la tabla con los punteros de
+// todos los píxeles (enlazarMatriz3D). Cada puntero matriz[y][x] apunta dentro
+// del bloque, en orden [y][x][c]. Si alguna reserva falla, libera lo ya
+// asignado y retorna NULL. Todo se cuenta contra el presupuesto de memoria:
+// si no cabe, falla antes de reservar. El bloque no se inicializa (como malloc).
+// POR QUÉ: Se conserva la notación pixeles[y][x][c] para todo el programa,
+// pero los datos quedan seguidos en memoria (igual que el buffer de stb), lo
+// que permite recorrer la imagen en una sola pasada lineal (LUT, SIMD) y evita
+// miles de malloc pequeños por imagen.
+static unsigned char*** asignarMatriz3D(int alto, int ancho, int canales) {
+    // Validar parámetros
+    if (alto <= 0 || ancho <= 0 || canales <= 0) {
+        fprintf(stderr, "Error: Parámetros inválidos para asignarMatriz3D (alto=%d, ancho=%d, canales=%d)\n",
+                alto, ancho, canales);
+        return NULL;
+    }
+
+    // Nivel 3: Asignar un bloque contiguo con los canales de todos los píxeles
+    size_t numPixeles = (size_t)alto * (size_t)ancho;
+    size_t bytesBloque = TAM_CABECERA_BLOQUE + numPixeles * (size_t)canales;
+    size_t capacidad;
+    unsigned char* bloque = tomarBloque(bytesBloque, &capacidad, "La imagen");
+    if (!bloque) {
+        fprintf(stderr, "Error de memoria: No se pudo asignar canales (%dx%dx%d)\n",
+                ancho, alto, canales);
+        return NULL;
+    }
+    unsigned char* datos = bloque + TAM_CABECERA_BLOQUE;
+    CabeceraBloque* cabecera = cabeceraDeBloque(datos);
+    cabecera->magia = MAGIA_BLOQUE;
+    cabecera->origen = capacidad ? ORIGEN_POOL : ORIGEN_MALLOC;
+    cabecera->base = bloque;
+    cabecera->tamMapa = capacidad;
+
+    unsigned char*** matriz = enlazarMatriz3D(datos, alto, ancho, canales);
+    if (!matriz) {
+        devolverBloque(bloque, bytesBloque, capacidad);
+        return NULL;
+    }
+    return matriz;
+}
+
+// QUÉ: Libera la memoria de una matriz 3D de píxeles.
+// CÓMO: Libera en orden inverso a la asignación: primero el bloque de canales
+// (al que apunta matriz[0][0]) según el origen indicado en su cabecera (free,
+// munmap o de vuelta al pool), luego la tabla de columnas (matriz[0]) y
+// finalmente el arreglo principal. Una vista libera su arreglo de filas y
+// después la matriz raíz de la que es dueña.
+// POR QUÉ: Evita fugas de memoria liberando todos los niveles de la matriz 3D
+// correctamente, con verificación de puntero nulo para robustez. Se mantienen
+// alto y ancho en la firma para no cambiar las llamadas existentes.
+static void liberarMatriz3D(unsigned char*** matriz, int alto, int ancho) {
+    if (!matriz) {
+        return; // Seguro ante punteros nulos
+    }
+    if (esVista(matriz)) {
+        // Una vista solo tiene su arreglo de filas; los datos son de la raíz
+        VistaMatriz* vista = (VistaMatriz*)matriz[-1];
+        VistaMatriz copia = *vista;
+        liberarContado(vista, copia.bytes);
+        liberarMatriz3D(copia.raiz, copia.altoRaiz, copia.anchoRaiz);
+        return;
+    }
+
+    if (alto > 0 && ancho > 0 && matriz[0]) {
+        CabeceraBloque* cabecera = cabeceraDeBloque(matriz[0][0]);
+        int valida = cabecera->magia == MAGIA_BLOQUE;
+        size_t contados = valida ? cabecera->bytesContados : 0;
+        size_t capacidadTabla = valida ? cabecera->capacidadTabla : 0;
+        if (!valida) {
+            fprintf(stderr, "Error: Bloque de píxeles sin cabecera válida, no se libera\n");
+        } else if (cabecera->origen == ORIGEN_MMAP || cabecera->origen == ORIGEN_COMPARTIDO) {
+            munmap(cabecera->base, cabecera->tamMapa); // Archivo o segmento proyectado
+        } else if (cabecera->origen == ORIGEN_POOL) {
+            devolverBloque(cabecera->base, 0, cabecera->tamMapa); // Queda ocioso en el pool
+        } else {
+            free(cabecera->base); // Liberar bloque de canales de todos los píxeles
+        }
+        // Leídos antes: la cabecera vive dentro del bloque
+        if (capacidadTabla) devolverBloque(matriz[0], 0, capacidadTabla);
+        else free(matriz[0]);    // Liberar tabla de columnas
+        contarLiberacion(contados);
+    }
+    free(matriz - 1); // Liberar arreglo principal (filas y ranura de vista)
+}
+
+// QUÉ: Crea una copia completa (clon) de una matriz 3D de píxeles.
+// CÓMO: Asigna nueva matriz con asignarMatriz3D(), luego copia con un solo
+// memcpy el bloque contiguo de canales de la matriz origen (si el origen es
+// una vista, una copia por fila).
+// POR QUÉ: Necesario para operaciones que requieren preservar la imagen original
+// mientras crean una versión modificada (filtros, transformaciones).
+static unsigned char*** clonarMatriz3D(unsigned char*** origen, int alto, int ancho, int canales) {
+    // Validar parámetros
+    if (!origen) {
+        fprintf(stderr, "Error: Matriz origen es NULL en clonarMatriz3D\n");
+        return NULL;
+    }
+    if (alto <= 0 || ancho <= 0 || canales <= 0) {
+        fprintf(stderr, "Error: Parámetros inválidos para clonarMatriz3D (alto=%d, ancho=%d, canales=%d)\n",
+                alto, ancho, canales);
+        return NULL;
+    }
+
+    // Asignar nueva matriz
+    unsigned char*** clon = asignarMatriz3D(alto, ancho, canales);
+    if (!clon) {
+        fprintf(stderr, "Error: No se pudo asignar memoria para clonar matriz\n");
+        return NULL;
+    }
+
+    // Copiar el bloque contiguo de canales de una sola vez (una vista, fila por fila)
+    if (esVista(origen)) {
+        for (int y = 0; y < alto; y++) memcpy(clon[y][0], origen[y][0], (size_t)ancho * canales);
+    } else {
+        memcpy(clon[0][0], origen[0][0], (size_t)alto * ancho * canales);
+    }
+
+    return clon;
+}
+
+// QUÉ: Libera la matriz de repuesto de la imagen, si tiene.
+// CÓMO: liberarMatriz3D() con la geometría guardada y deja el repuesto vacío.
+// POR QUÉ: La usan liberarImagen() y las operaciones que cambian la geometría.
+static void descartarRepuesto(ImagenInfo* info) {
+    if (info->repuesto.pixeles) {
+        liberarMatriz3D(info->repuesto.pixeles, info->repuesto.alto, info->repuesto.ancho);
+    }
+    memset(&info->repuesto, 0, sizeof(info->repuesto));
+}
+
+// QUÉ: Matriz donde una operación escribe su resultado de alto x ancho x canales.
+// CÓMO: Si la imagen guarda un repuesto con esa geometría lo entrega (ya
+// enlazado, con su tabla de punteros armada); si no, descarta el repuesto
+// antes de reservar con asignarMatriz3D(), así no suma al pico. El llamador
+// la devuelve con reemplazarPixeles() o la libera si falla.
+// POR QUÉ: Desenfoque, Sobel sobre grises y los pipelines sin cambio de tamaño
+// producen la misma geometría que reciben: con el repuesto alternan entre dos
+// matrices sin reservar ni rearmar 8 bytes de punteros por píxel en cada paso.
+static unsigned char*** tomarMatrizDestino(ImagenInfo* info, int alto, int ancho, int canales) {
+    MatrizRepuesto* r = &info->repuesto;
+    if (r->pixeles && r->alto == alto && r->ancho == ancho && r->canales == canales) {
+        unsigned char*** matriz = r->pixeles;
+        r->pixeles = NULL;
+        return matriz;
+    }
+    descartarRepuesto(info);
+    return asignarMatriz3D(alto, ancho, canales);
+}
+
+// QUÉ: Pone 'nueva' (de alto x ancho x canales) como píxeles de la imagen.
+// CÓMO: Si la geometría no cambia, la matriz anterior es de malloc o del pool
+// y no hay --mem-limit, la conserva como repuesto; si no, la libera junto con
+// el repuesto (que ya no sirve).
+// POR QUÉ: Completa el doble búfer de tomarMatrizDestino(). Las matrices
+// proyectadas (.icr, memoria compartida) no se usan como borrador: escribir
+// en ellas copiaría páginas o modificaría el segmento de otro proceso. Con
+// presupuesto de memoria el repuesto no se guarda: en el pool sí puede
+// soltarse cuando otra reserva lo necesita.
+static void reemplazarPixeles(ImagenInfo* info, unsigned char*** nueva, int alto, int ancho, int canales) {
+    unsigned char*** anterior = info->pixeles;
+    int origen = anterior && !esVista(anterior) ? cabeceraDeBloque(anterior[0][0])->origen : 0;
+    int conservar = anterior && alto == info->alto && ancho == info->ancho && canales == info->canales &&
+                    (origen == ORIGEN_MALLOC || origen == ORIGEN_POOL) && limiteMemoriaBytes == 0;
+    descartarRepuesto(info);
+    if (conservar) {
+        info->repuesto.pixeles = anterior;
+        info->repuesto.alto = info->alto;
+        info->repuesto.ancho = info->ancho;
+        info->repuesto.canales = info->canales;
+    } else if (anterior) {
+        liberarMatriz3D(anterior, info->alto, info->ancho);
+    }
+    info->pixeles = nueva;
+    info->alto = alto;
+    info->ancho = ancho;
+    info->canales = canales;
+}
+
+// QUÉ: Recorta la imagen al rectángulo (x, y, ancho, alto) sin copiar píxeles.
+// CÓMO: Reserva un bloque con VistaMatriz, la ranura escondida y alto filas;
+// la fila f de la vista apunta a pixeles[y + f] + x, es decir, a la tabla de
+// punteros de la imagen con su mismo paso entre filas. Si la imagen ya era
+// una vista, la nueva hereda su raíz y solo se libera el arreglo de filas de
+// la anterior. El repuesto se descarta: su geometría ya no sirve. El
+// rectángulo debe estar dentro de la imagen (lo valida el llamador).
+// POR QUÉ: El recorte cuesta alto punteros y no alto x ancho x canales bytes;
+// y recortar antes de escalar o rotar hace que esas operaciones solo lean la
+// región.
+static int recortarSinCopia(ImagenInfo* info, int x, int y, int ancho, int alto) {
+    unsigned char*** origen = info->pixeles;
+    size_t bytes = sizeof(VistaMatriz) + ((size_t)alto + 1) * sizeof(unsigned char**);
+    VistaMatriz* vista = reservarContado(bytes, "La vista del recorte");
+    if (!vista) {
+        fprintf(stderr, "Error: Memoria insuficiente para el recorte\n");
+        return 0;
+    }
+    unsigned char*** filas = (unsigned char***)(vista + 1);
+    filas[0] = (unsigned char**)vista;
+    for (int f = 0; f < alto; f++) filas[f + 1] = origen[y + f] + x;
+
+    descartarRepuesto(info);
+    if (esVista(origen)) {
+        VistaMatriz* anterior = (VistaMatriz*)origen[-1];
+        *vista = *anterior;
+        liberarContado(anterior, anterior->bytes);
+    } else {
+        vista->raiz = origen;
+        vista->altoRaiz = info->alto;
+        vista->anchoRaiz = info->ancho;
+    }
+    vista->bytes = bytes;
+    info->pixeles = filas + 1;
+    info->alto = alto;
+    info->ancho = ancho;
+    return 1;
+}
+
+// QUÉ: Deshace la vista de la imagen volviendo a la matriz completa (raíz).
+// CÓMO: Libera el arreglo de filas de la vista y pone la raíz con su
+// geometría; los píxeles de la raíz no se tocan.
+// POR QUÉ: Es la salida de error cuando ni siquiera hay memoria para
+// compactar: la imagen queda contigua, aunque sin recortar.
+static void restaurarRaizVista(ImagenInfo* info) {
+    if (!esVista(info->pixeles)) return;
+    VistaMatriz* vista = (VistaMatriz*)info->pixeles[-1];
+    VistaMatriz copia = *vista;
+    liberarContado(vista, copia.bytes);
+    info->pixeles = copia.raiz;
+    info->alto = copia.altoRaiz;
+    info->ancho = copia.anchoRaiz;
+}
+
+// QUÉ: Comprueba que los datos de la imagen no sean una vista.
+// CÓMO: esVista(); si lo es, informa por stderr y devuelve 0.
+// POR QUÉ: Guardar, el formato crudo, la memoria compartida, las LUT y el
+// brillo recorren pixeles[0][0] (o pixeles[y][0]) como un tramo lineal; sobre
+// una vista leerían o escribirían las filas de la matriz completa.
+static int datosContiguos(const ImagenInfo* info, const char* que) {
+    if (!esVista(info->pixeles)) return 1;
+    fprintf(stderr, "Error: %s necesita una imagen contigua y la imagen es un recorte sin compactar\n", que);
+    return 0;
+}
+
+// QUÉ: Convierte una imagen que es una vista en una matriz propia.
+// CÓMO: Copia fila por fila a una matriz nueva y la pone con
+// reemplazarPixeles(), que libera la vista y con ella la raíz.
+// POR QUÉ: Guardar (un solo bloque para stb), el formato crudo, el brillo
+// lineal y procesadorPixeles() cuentan con datos contiguos; las vistas no
+// salen del pipeline.
+static int compactarVista(ImagenInfo* info) {
+    if (!esVista(info->pixeles)) return 1;
+    unsigned char*** nueva = clonarMatriz3D(info->pixeles, info->alto, info->ancho, info->canales);
+    if (!nueva) return 0;
+    reemplazarPixeles(info, nueva, info->alto, info->ancho, info->canales);
+    return 1;
+}
+
+// =====================================================================
+// FUNCIONES AUXILIARES DE INTERPOLACIÓN
+// =====================================================================
+
+// QUÉ: Calcula el valor interpolado de un píxel en coordenadas fraccionarias
+// usando interpolación bilineal.
+// CÓMO: Obtiene los 4 píxeles vecinos (esquinas del rectángulo que contiene el
+// punto), calcula pesos basados en distancias fraccionarias, y promedia los
+// valores con la fórmula bilineal: I = (1-a)(1-b)I00 + a(1-b)I10 + (1-a)bI01 + abI11.
+// Aplica clamping en los bordes para evitar accesos fuera de límites.
+// POR QUÉ: Necesario para operaciones de transformación geométrica (rotación,
+// escalado) que mapean píxeles a coordenadas no enteras, produciendo resultados
+// suaves sin aliasing.
+static unsigned char interpolacionBilineal(unsigned char*** img, float x, float y, int c, 
+                                   int ancho, int alto) {
+    // Obtener coordenadas enteras de las 4 esquinas del rectángulo
+    int x0 = (int)floor(x);  // Esquina superior izquierda X
+    int y0 = (int)floor(y);  // Esquina superior izquierda Y
+    int x1 = x0 + 1;         // Esquina superior derecha X
+    int y1 = y0 + 1;         // Esquina inferior izquierda Y
     
-    // Calcular el offset desde el centro del kernel
-    int offset = tamKernel / 2;
-    
-    // Calcular constante de la fórmula Gaussiana: 1 / (2πσ²)
-    float constante = 1.0f / (2.0f * M_PI * sigma * sigma);
+    // Clamp coordenadas a límites válidos de la imagen
+    // Esto maneja píxeles en los bordes replicando el píxel más cercano
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= ancho) x1 = ancho - 1;
+    if (y1 >= alto) y1 = alto - 1;
     
-    // Calcular denominador del exponente: 2σ²
-    float denominador = 2.0f * sigma * sigma;
+    // Calcular partes fraccionarias (pesos de interpolación)
+    // a = distancia horizontal desde x0 (0.0 = en x0, 1.0 = en x1)
+    // b = distancia vertical desde y0 (0.0 = en y0, 1.0 = en y1)
+    float a = x - x0;
+    float b = y - y0;
     
-    float suma = 0.0f; // Acumulador para normalización
+    // Obtener valores de los 4 píxeles vecinos
+    // v00 = esquina superior izquierda
+    // v10 = esquina superior derecha
+    // v01 = esquina inferior izquierda
+    // v11 = esquina inferior derecha
+    float v00 = img[y0][x0][c];
+    float v10 = img[y0][x1][c];
+    float v01 = img[y1][x0][c];
+    float v11 = img[y1][x1][c];
     
-    // Generar valores del kernel usando la fórmula Gaussiana
-    for (int ky = -offset; ky <= offset; ky++) {
-        for (int kx = -offset; kx <= offset; kx++) {
-            // Calcular G(x,y) = (1/(2πσ²)) * e^(-(x²+y²)/(2σ²))
-            float exponente = -(kx * kx + ky * ky) / denominador;
-            float valor = constante * exp(exponente);
-            
-            // Almacenar en la matriz (convertir coordenadas relativas a índices)
-            kernel[ky + offset][kx + offset] = valor;
-            suma += valor;
+    // Aplicar fórmula de interpolación bilineal
+    // Interpola primero en X (horizontalmente) para las dos filas,
+    // luego interpola en Y (verticalmente) entre los resultados
+    float resultado = (1.0f - a) * (1.0f - b) * v00  // Peso esquina superior izquierda
+                    + a * (1.0f - b) * v10            // Peso esquina superior derecha
+                    + (1.0f - a) * b * v01            // Peso esquina inferior izquierda
+                    + a * b * v11;                    // Peso esquina inferior derecha
+    
+    // Redondear y convertir a unsigned char
+    // Suma 0.5 para redondeo correcto antes del truncado
+    return (unsigned char)(resultado + 0.5f);
+}
+
+// =====================================================================
+// MOTOR DE TESELAS (BLOQUES 2D DEL TAMAÑO DE LA CACHÉ L2)
+// =====================================================================
+
+#define TAM_L2_POR_DEFECTO (256 * 1024)  // Si el sistema no informa la caché L2
+
+// QUÉ: Devuelve el tamaño de la caché L2 en bytes.
+// CÓMO: Consulta sysconf(_SC_LEVEL2_CACHE_SIZE) cuando existe (glibc); si no
+// hay dato usa TAM_L2_POR_DEFECTO.
+// POR QUÉ: El tamaño de tesela se ajusta a la caché de cada máquina.
+static long tamanoCacheL2(void) {
+    long tam = -1;
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    tam = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return tam > 0 ? tam : TAM_L2_POR_DEFECTO;
+}
+
+// QUÉ: Calcula el lado (en píxeles) de una tesela cuadrada que cabe en L2.
+// CÓMO: Cada píxel cuesta su puntero (pixeles[y][x]) más sus canales, tanto en
+// la entrada (tesela + halo a cada lado) como en la salida. Se busca el mayor
+// lado múltiplo de 16 (entre 16 y 512) cuyo total quepa en media caché L2.
+// POR QUÉ: La otra mitad queda para el kernel, la pila y lo que comparta el
+// otro hilo; así la ventana k x k se lee siempre desde caché.
+static int calcularLadoTesela(int canales, int halo) {
+    long presupuesto = tamanoCacheL2() / 2;
+    long bytesPorPixel = (long)sizeof(unsigned char*) + canales;
+    int lado = 512;
+    while (lado > 16) {
+        long entrada = (long)(lado + 2 * halo) * (lado + 2 * halo);
+        long salida = (long)lado * lado;
+        if ((entrada + salida) * bytesPorPixel <= presupuesto) break;
+        lado -= 16;
+    }
+    return lado;
+}
+
+// QUÉ: Función que procesa una tesela [x0, x1) x [y0, y1).
+// CÓMO: Recibe los datos de la operación y el índice del hilo que la ejecuta.
+// POR QUÉ: El índice permite que cada hilo use sus propios búferes sin mutex.
+typedef void (*FuncionTesela)(void* datos, int hilo, int x0, int y0, int x1, int y1);
+
+// QUÉ: Estructura para pasar datos al hilo del motor de teselas.
+// CÓMO: Contiene la función a aplicar, sus datos, la geometría de la rejilla
+// y el índice del hilo.
+// POR QUÉ: Cada hilo recorre su propia lista de teselas, sin compartir nada escrito.
+typedef struct {
+    FuncionTesela procesarTesela;   // Operación a aplicar por tesela
+    void* datos;                    // Datos de la operación (solo lectura salvo destino)
+    int ancho;                      // Ancho de la región a recorrer
+    int alto;                       // Alto de la región a recorrer
+    int lado;                       // Lado de cada tesela
+    int hilo;                       // Índice de este hilo (0 .. numHilos-1)
+    int numHilos;                   // Total de hilos
+} TeselasArgs;
+
+// QUÉ: Procesa las teselas que le tocan a un hilo.
+// CÓMO: Numera las teselas por filas de teselas y toma una de cada numHilos
+// (reparto estático intercalado, sin contadores compartidos). Con --numa toma
+// en cambio un tramo contiguo de la numeración: una banda de filas.
+// POR QUÉ: Cada tesela escribe una zona distinta del destino, por lo que los
+// hilos no necesitan sincronizarse. La banda contigua coincide con la que el
+// mismo hilo tocó primero en el bloque (ver tocarPaginas()).
+static void* procesarTeselasHilo(void* args) {
+    TeselasArgs* t = (TeselasArgs*)args;
+    int teselasX = (t->ancho + t->lado - 1) / t->lado;
+    int teselasY = (t->alto + t->lado - 1) / t->lado;
+    int total = teselasX * teselasY;
+    int desde = numaActivo ? (int)((long)total * t->hilo / t->numHilos) : t->hilo;
+    int hasta = numaActivo ? (int)((long)total * (t->hilo + 1) / t->numHilos) : total;
+    int paso = numaActivo ? 1 : t->numHilos;
+    for (int i = desde; i < hasta; i += paso) {
+        int x0 = (i % teselasX) * t->lado;
+        int y0 = (i / teselasX) * t->lado;
+        int x1 = (x0 + t->lado < t->ancho) ? x0 + t->lado : t->ancho;
+        int y1 = (y0 + t->lado < t->alto) ? y0 + t->lado : t->alto;
+        t->procesarTesela(t->datos, t->hilo, x0, y0, x1, y1);
+    }
+    return NULL;
+}
+
+// QUÉ: Recorre una región de ancho x alto en teselas de lado x lado con hilos.
+// CÓMO: Lanza hilosPorOperacion hilos con procesarTeselasHilo() y espera con
+// join; con --stats mide la región con el nombre 'region'.
+// POR QUÉ: Lo usan la convolución, Sobel y el pipeline fusionado para trabajar
+// sobre bloques que caben en L2 en lugar de filas completas.
+static int ejecutarPorTeselasConcurrente(const char* region, int ancho, int alto, int lado,
+                                  FuncionTesela procesarTesela, void* datos) {
+    const int numHilos = hilosPorOperacion;
+    pthread_t hilos[numHilos];
+    TeselasArgs args[numHilos];
+    TiempoHilo tiempos[numHilos];
+    double inicioRegion = iniciarRegion();
+
+    for (int i = 0; i < numHilos; i++) {
+        args[i].procesarTesela = procesarTesela;
+        args[i].datos = datos;
+        args[i].ancho = ancho;
+        args[i].alto = alto;
+        args[i].lado = lado;
+        args[i].hilo = i;
+        args[i].numHilos = numHilos;
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, procesarTeselasHilo, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d para teselas\n", i);
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            return 0;
+        }
+    }
+    for (int i = 0; i < numHilos; i++) {
+        pthread_join(hilos[i], NULL);
+    }
+    terminarRegion(region, tiempos, numHilos, inicioRegion);
+    return 1;
+}
+
+// =====================================================================
+// FUNCIONES AUXILIARES DE CONVOLUCIÓN
+// =====================================================================
+
+// QUÉ: Genera un kernel Gaussiano 2D para operaciones de desenfoque (blur).
+// CÓMO: Asigna matriz 2D de floats, aplica fórmula Gaussiana G(x,y) = 
+// (1/(2πσ²)) * e^(-(x²+y²)/(2σ²)) para cada elemento, luego normaliza
+// dividiendo por la suma total para que todos los pesos sumen 1.0.
+// POR QUÉ: El kernel Gaussiano produce desenfoque natural preservando bordes
+// mejor que un simple promedio. La normalización garantiza que el brillo de
+// la imagen se mantenga constante después de la convolución.
+static float** generarKernelGaussiano(int tamKernel, float sigma) {
+    // Validar que el tamaño del kernel sea impar
+    if (tamKernel <= 0 || tamKernel % 2 == 0) {
+        fprintf(stderr, "Error: El tamaño del kernel debe ser impar y positivo (recibido: %d)\n", 
+                tamKernel);
+        return NULL;
+    }
+    
+    // Validar que sigma sea positivo
+    if (sigma <= 0.0f) {
+        fprintf(stderr, "Error: Sigma debe ser positivo (recibido: %.2f)\n", sigma);
+        return NULL;
+    }
+    
+    // Asignar memoria para el kernel (matriz 2D de floats)
+    float** kernel = malloc(tamKernel * sizeof(float*));
+    if (!kernel) {
+        fprintf(stderr, "Error de memoria: No se pudo asignar kernel\n");
+        return NULL;
+    }
+    
+    for (int i = 0; i < tamKernel; i++) {
+        kernel[i] = malloc(tamKernel * sizeof(float));
+        if (!kernel[i]) {
+            fprintf(stderr, "Error de memoria: No se pudo asignar fila %d del kernel\n", i);
+            // Liberar filas ya asignadas
+            for (int j = 0; j < i; j++) {
+                free(kernel[j]);
+            }
+            free(kernel);
+            return NULL;
+        }
+    }
+    
+    // Calcular el offset desde el centro del kernel
+    int offset = tamKernel / 2;
+    
+    // Calcular constante de la fórmula Gaussiana: 1 / (2πσ²)
+    float constante = 1.0f / (2.0f * M_PI * sigma * sigma);
+    
+    // Calcular denominador del exponente: 2σ²
+    float denominador = 2.0f * sigma * sigma;
+    
+    float suma = 0.0f; // Acumulador para normalización
+    
+    // Generar valores del kernel usando la fórmula Gaussiana
+    for (int ky = -offset; ky <= offset; ky++) {
+        for (int kx = -offset; kx <= offset; kx++) {
+            // Calcular G(x,y) = (1/(2πσ²)) * e^(-(x²+y²)/(2σ²))
+            float exponente = -(kx * kx + ky * ky) / denominador;
+            float valor = constante * exp(exponente);
+            
+            // Almacenar en la matriz (convertir coordenadas relativas a índices)
+            kernel[ky + offset][kx + offset] = valor;
+            suma += valor;
+        }
+    }
+    
+    // Normalizar el kernel para que la suma sea 1.0
+    // Esto garantiza que el brillo promedio de la imagen no cambie
+    if (suma > 0.0f) {
+        for (int i = 0; i < tamKernel; i++) {
+            for (int j = 0; j < tamKernel; j++) {
+                kernel[i][j] /= suma;
+            }
+        }
+    }
+    
+    return kernel;
+}
+
+// QUÉ: Estructura para pasar datos al hilo de convolución.
+// CÓMO: Contiene matrices origen y destino, kernel, rango de filas y dimensiones.
+// POR QUÉ: Los hilos necesitan datos específicos para procesar convolución en paralelo,
+// incluyendo acceso al kernel y matrices separadas para lectura y escritura.
+typedef struct {
+    unsigned char*** pixelesOrigen;   // Matriz de lectura (imagen original)
+    unsigned char*** pixelesDestino;  // Matriz de escritura (resultado)
+    float** kernel;                   // Kernel de convolución
+    int tamKernel;                    // Tamaño del kernel (debe ser impar)
+    int inicio;                       // Fila inicial (inclusiva)
+    int fin;                          // Fila final (exclusiva)
+    int ancho;                        // Ancho de la imagen
+    int alto;                         // Alto de la imagen
+    int canales;                      // Número de canales (1 o 3)
+} ConvolucionArgs;
+
+// QUÉ: Estructura para pasar datos al hilo de escalado.
+// CÓMO: Contiene matrices origen y destino, dimensiones originales y destino,
+// y el rango de filas a procesar en la imagen destino.
+// POR QUÉ: Los hilos necesitan los factores de escala implícitos en las dimensiones
+// para mapear cada píxel destino a su posición en la imagen origen.
+typedef struct {
+    unsigned char*** pixelesOrigen;   // Matriz de lectura (imagen original)
+    unsigned char*** pixelesDestino;  // Matriz de escritura (imagen escalada)
+    int anchoOrigen;                  // Ancho de la imagen original
+    int altoOrigen;                   // Alto de la imagen original
+    int anchoDestino;                 // Ancho de la imagen escalada
+    int altoDestino;                  // Alto de la imagen escalada
+    int canales;                      // Número de canales (1 o 3)
+    int inicio;                       // Fila inicial en imagen destino (inclusiva)
+    int fin;                          // Fila final en imagen destino (exclusiva)
+} EscaladoArgs;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Aplica convolución a una región rectangular [x0, x1) x [y0, y1).
+// CÓMO: Para cada píxel de la región, aplica el kernel mediante suma ponderada
+// de los píxeles vecinos. Usa clamping de coordenadas para replicar bordes.
+// Clamp el resultado final a [0, 255]. Procesa cada canal independientemente.
+// POR QUÉ: La comparten la versión por filas y la versión por teselas.
+static void convolucionRegion(const ConvolucionArgs* cArgs, int x0, int y0, int x1, int y1) {
+    // Calcular el offset desde el centro del kernel
+    int offset = cArgs->tamKernel / 2;
+    
+    // Procesar cada píxel de la región
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            // Procesar cada canal del píxel independientemente
+            for (int c = 0; c < cArgs->canales; c++) {
+                float suma = 0.0f;
+                
+                // Aplicar convolución: sumar píxeles vecinos ponderados por kernel
+                for (int ky = -offset; ky <= offset; ky++) {
+                    for (int kx = -offset; kx <= offset; kx++) {
+                        // Calcular coordenadas del píxel vecino
+                        int ny = y + ky;
+                        int nx = x + kx;
+                        
+                        // Manejo de bordes: replicar píxeles de borde (clamping)
+                        // Esto evita artefactos negros en los bordes
+                        if (ny < 0) ny = 0;
+                        if (ny >= cArgs->alto) ny = cArgs->alto - 1;
+                        if (nx < 0) nx = 0;
+                        if (nx >= cArgs->ancho) nx = cArgs->ancho - 1;
+                        
+                        // Acumular: valor_pixel * peso_kernel
+                        suma += cArgs->pixelesOrigen[ny][nx][c] * 
+                                cArgs->kernel[ky + offset][kx + offset];
+                    }
+                }
+                
+                // Redondear y clamp resultado a rango válido [0, 255]
+                int resultado = (int)(suma + 0.5f);  // Redondeo
+                if (resultado < 0) resultado = 0;
+                if (resultado > 255) resultado = 255;
+                
+                // Asignar resultado a matriz destino
+                cArgs->pixelesDestino[y][x][c] = (unsigned char)resultado;
+            }
+        }
+    }
+    
+}
+
+// QUÉ: Aplica convolución en un rango de filas (para hilos).
+// CÓMO: Procesa las filas [inicio, fin) completas con convolucionRegion().
+// POR QUÉ: Permite procesar la imagen en paralelo dividiendo filas entre hilos,
+// mejorando el rendimiento en sistemas multi-core. Se conserva como
+// referencia para comparar con la versión por teselas.
+static void* aplicarConvolucionHilo(void* args) {
+    ConvolucionArgs* cArgs = (ConvolucionArgs*)args;
+    convolucionRegion(cArgs, 0, cArgs->inicio, cArgs->ancho, cArgs->fin);
+    return NULL;
+}
+
+// QUÉ: Aplica convolución a una tesela (función para el motor de teselas).
+// CÓMO: Los datos son un ConvolucionArgs compartido de solo lectura (salvo el
+// destino, donde cada tesela escribe una zona distinta).
+// POR QUÉ: Con teselas que caben en L2, las k filas de la ventana se reutilizan
+// desde caché en lugar de traerse de memoria en cada fila.
+static void convolucionTesela(void* datos, int hilo, int x0, int y0, int x1, int y1) {
+    (void)hilo;
+    convolucionRegion((const ConvolucionArgs*)datos, x0, y0, x1, y1);
+}
+
+// QUÉ: Aplica desenfoque Gaussiano mediante convolución concurrente.
+// CÓMO: Genera kernel Gaussiano, crea matriz temporal para resultados, recorre
+// la imagen en teselas del tamaño de L2 repartidas entre los hilos, espera
+// sincronización, reemplaza matriz original.
+// POR QUÉ: Suaviza la imagen para reducir ruido. Usa concurrencia para acelerar
+// el procesamiento en imágenes grandes.
+static void aplicarConvolucionConcurrente(ImagenInfo* info, int tamKernel, float sigma) {
+    // Validar que hay imagen cargada
+    if (!info || !info->pixeles) {
+        fprintf(stderr, "Error: No hay imagen cargada para aplicar convolución\n");
+        return;
+    }
+    
+    // Validar tamaño del kernel (debe ser impar y positivo)
+    if (tamKernel <= 0 || tamKernel % 2 == 0) {
+        fprintf(stderr, "Error: El tamaño del kernel debe ser impar y positivo (recibido: %d)\n", 
+                tamKernel);
+        return;
+    }
+    
+    // Validar sigma (debe ser positivo)
+    if (sigma <= 0.0f) {
+        fprintf(stderr, "Error: Sigma debe ser positivo (recibido: %.2f)\n", sigma);
+        return;
+    }
+    
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+    informar("Generando kernel Gaussiano %dx%d con sigma=%.2f...\n", 
+           tamKernel, tamKernel, sigma);
+    
+    // Generar kernel Gaussiano
+    float** kernel = generarKernelGaussiano(tamKernel, sigma);
+    if (!kernel) {
+        fprintf(stderr, "Error: No se pudo generar el kernel Gaussiano\n");
+        return;
+    }
+    
+    informar("Aplicando convolución a imagen %dx%d, %d canales...\n", 
+           info->ancho, info->alto, info->canales);
+    
+    // Matriz para los resultados: el repuesto de la imagen si lo tiene
+    unsigned char*** matrizTemporal = tomarMatrizDestino(info, info->alto, info->ancho, info->canales);
+    if (!matrizTemporal) {
+        fprintf(stderr, "Error: No se pudo asignar memoria para matriz temporal\n");
+        // Liberar kernel antes de retornar
+        for (int i = 0; i < tamKernel; i++) {
+            free(kernel[i]);
+        }
+        free(kernel);
+        return;
+    }
+    
+    // Datos compartidos por todas las teselas (solo lectura salvo el destino)
+    ConvolucionArgs datos;
+    datos.pixelesOrigen = info->pixeles;
+    datos.pixelesDestino = matrizTemporal;
+    datos.kernel = kernel;
+    datos.tamKernel = tamKernel;
+    datos.inicio = 0;
+    datos.fin = info->alto;
+    datos.ancho = info->ancho;
+    datos.alto = info->alto;
+    datos.canales = info->canales;
+
+    // Recorrer la imagen en teselas que caben en la caché L2, repartidas entre hilos
+    int lado = calcularLadoTesela(info->canales, tamKernel / 2);
+    if (!ejecutarPorTeselasConcurrente("desenfoque", info->ancho, info->alto, lado, convolucionTesela,
+                                       &datos)) {
+        liberarMatriz3D(matrizTemporal, info->alto, info->ancho);
+        for (int j = 0; j < tamKernel; j++) {
+            free(kernel[j]);
+        }
+        free(kernel);
+        return;
+    }
+    
+    // Liberar el kernel (ya no se necesita)
+    for (int i = 0; i < tamKernel; i++) {
+        free(kernel[i]);
+    }
+    free(kernel);
+    
+    // Reemplazar con la nueva; la original queda como repuesto
+    reemplazarPixeles(info, matrizTemporal, info->alto, info->ancho, info->canales);
+    
+    terminarMedicion(&medicion, "desenfoque", NULL, info);
+    informar("Convolución aplicada con kernel %dx%d, sigma=%.2f, teselas de %dx%d (%s)\n", 
+           tamKernel, tamKernel, sigma, lado, lado,
+           info->canales == 1 ? "grises" : "RGB");
+}
+
+// QUÉ: Escala (redimensiona) una imagen en un rango de filas (para hilos).
+// CÓMO: Para cada píxel en la imagen destino, calcula su posición correspondiente
+// en la imagen origen usando factores de escala (scaleX, scaleY). Como las
+// coordenadas resultantes son fraccionarias, usa interpolación bilineal para
+// obtener valores suaves. Procesa cada canal independientemente.
+// POR QUÉ: La interpolación bilineal evita aliasing (efecto pixelado o escalera)
+// que ocurre con nearest-neighbor, produciendo imágenes escaladas de mayor calidad.
+// El procesamiento por hilos acelera operaciones en imágenes grandes.
+static void* escalarImagenHilo(void* args) {
+    EscaladoArgs* eArgs = (EscaladoArgs*)args;
+    
+    // Calcular factores de escala (mapeo destino → origen)
+    // Si anchoDestino < anchoOrigen: upscale (ampliar)
+    // Si anchoDestino > anchoOrigen: downscale (reducir)
+    float scaleX = (float)eArgs->anchoOrigen / eArgs->anchoDestino;
+    float scaleY = (float)eArgs->altoOrigen / eArgs->altoDestino;
+    
+    // Procesar cada fila asignada a este hilo en la imagen DESTINO
+    for (int y = eArgs->inicio; y < eArgs->fin; y++) {
+        for (int x = 0; x < eArgs->anchoDestino; x++) {
+            // Calcular coordenadas correspondientes en imagen ORIGEN
+            // Estas coordenadas son fraccionarias (float), no enteras
+            float xOrig = x * scaleX;
+            float yOrig = y * scaleY;
+            
+            // Procesar cada canal del píxel
+            for (int c = 0; c < eArgs->canales; c++) {
+                // Usar interpolación bilineal para obtener valor suave
+                // Esto considera los 4 píxeles vecinos más cercanos en la imagen origen
+                unsigned char valorInterpolado = interpolacionBilineal(
+                    eArgs->pixelesOrigen,
+                    xOrig,
+                    yOrig,
+                    c,
+                    eArgs->anchoOrigen,
+                    eArgs->altoOrigen
+                );
+                
+                // Asignar valor interpolado al píxel destino
+                eArgs->pixelesDestino[y][x][c] = valorInterpolado;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+// QUÉ: Escala (redimensiona) una imagen a nuevas dimensiones usando concurrencia.
+// CÓMO: Crea matriz con nuevas dimensiones, divide filas entre hilosPorOperacion hilos, cada hilo
+// mapea píxeles destino a origen con interpolación bilineal, sincroniza, y reemplaza
+// la imagen original actualizando dimensiones en la estructura.
+// POR QUÉ: Permite cambiar el tamaño de imágenes (ampliar o reducir) manteniendo
+// calidad visual mediante interpolación. La concurrencia acelera el procesamiento.
+static void escalarImagenConcurrente(ImagenInfo* info, int nuevoAncho, int nuevoAlto) {
+    // Validar que hay imagen cargada
+    if (!info || !info->pixeles) {
+        fprintf(stderr, "Error: No hay imagen cargada para escalar\n");
+        return;
+    }
+    
+    // Validar nuevas dimensiones (deben ser positivas)
+    if (nuevoAncho <= 0 || nuevoAlto <= 0) {
+        fprintf(stderr, "Error: Las nuevas dimensiones deben ser positivas (recibido: %dx%d)\n",
+                nuevoAncho, nuevoAlto);
+        return;
+    }
+    
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+
+    // Mensaje informativo sobre la operación
+    informar("Escalando imagen de %dx%d a %dx%d...\n", 
+           info->ancho, info->alto, nuevoAncho, nuevoAlto);
+    
+    // Crear nueva matriz con las dimensiones destino
+    unsigned char*** nueva = tomarMatrizDestino(info, nuevoAlto, nuevoAncho, info->canales);
+    if (!nueva) {
+        fprintf(stderr, "Error: No se pudo asignar memoria para imagen escalada\n");
+        return;
+    }
+    
+    // Configurar hilos para procesamiento paralelo
+    const int numHilos = hilosPorOperacion;
+    pthread_t hilos[numHilos];
+    EscaladoArgs args[numHilos];
+    TiempoHilo tiempos[numHilos];
+    int filasPorHilo = (int)ceil((double)nuevoAlto / numHilos);
+    double inicioRegion = iniciarRegion();
+    
+    // Configurar y lanzar hilos
+    for (int i = 0; i < numHilos; i++) {
+        args[i].pixelesOrigen = info->pixeles;
+        args[i].pixelesDestino = nueva;
+        args[i].anchoOrigen = info->ancho;
+        args[i].altoOrigen = info->alto;
+        args[i].anchoDestino = nuevoAncho;
+        args[i].altoDestino = nuevoAlto;
+        args[i].canales = info->canales;
+        args[i].inicio = i * filasPorHilo;
+        args[i].fin = ((i + 1) * filasPorHilo < nuevoAlto) 
+                      ? (i + 1) * filasPorHilo 
+                      : nuevoAlto;
+        
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, escalarImagenHilo, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d para escalado\n", i);
+            // Esperar a los hilos ya lanzados (escriben en 'nueva') antes de liberar
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            liberarMatriz3D(nueva, nuevoAlto, nuevoAncho);
+            return;
+        }
+    }
+    
+    // Esperar a que todos los hilos terminen
+    for (int i = 0; i < numHilos; i++) {
+        pthread_join(hilos[i], NULL);
+    }
+    terminarRegion("redimensionar", tiempos, numHilos, inicioRegion);
+    
+    // Reemplazar la matriz original y actualizar dimensiones (canales sin cambios)
+    reemplazarPixeles(info, nueva, nuevoAlto, nuevoAncho, info->canales);
+    
+    terminarMedicion(&medicion, "redimensionar", NULL, info);
+    informar("Escalado completado. Nuevas dimensiones: %dx%d (%s)\n",
+           nuevoAncho, nuevoAlto,
+           info->canales == 1 ? "grises" : "RGB");
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Liberar memoria asignada para la imagen.
+// CÓMO: Libera la matriz 3D con liberarMatriz3D() y reinicia la estructura.
+// POR QUÉ: Evita fugas de memoria, esencial en C para manejar recursos manualmente.
+static void liberarImagen(ImagenInfo* info) {
+    if (info->pixeles) {
+        liberarMatriz3D(info->pixeles, info->alto, info->ancho); // Canales, columnas y filas
+        info->pixeles = NULL;
+    }
+    descartarRepuesto(info);
+    info->ancho = 0;
+    info->alto = 0;
+    info->canales = 0;
+}
+
+static int cargarPNGConPocaMemoria(const char* ruta, ImagenInfo* info);
+
+// QUÉ: Canales de la matriz para un archivo con 'canalesArchivo' canales.
+// CÓMO: Grises y grises+alfa → 1; RGB, RGBA y paleta → 3 (el alfa se descarta).
+// POR QUÉ: La carga con stb y la carga en streaming deben dar la misma
+// imagen, y el presupuesto debe estimar la matriz que de verdad se reserva.
+static int canalesMatrizArchivo(int canalesArchivo) {
+    return canalesArchivo <= 2 ? 1 : 3;
+}
+
+// QUÉ: Estima lo que stb tiene reservado a la vez al decodificar 'ruta'.
+// CÓMO: Con stbi_info (solo lee la cabecera) y el tamaño del archivo: el
+// archivo comprimido, los datos inflados (una fila más de bytes de filtro),
+// la imagen con los canales del archivo y, si difieren, su conversión a los
+// canales de la matriz. Deja las dimensiones en *ancho y *alto y en *canales
+// los canales de la matriz (canalesMatrizArchivo()); devuelve 0 si stb no
+// reconoce el archivo.
+// POR QUÉ: Decide, antes de decodificar, si la carga completa cabe en el
+// presupuesto de memoria.
+static size_t bytesDecodificacionStb(const char* ruta, int* ancho, int* alto, int* canales) {
+    struct stat st;
+    int canalesArchivo;
+    if (!stbi_info(ruta, ancho, alto, &canalesArchivo) || stat(ruta, &st) != 0) return 0;
+    *canales = canalesMatrizArchivo(canalesArchivo);
+    size_t bytesImagen = (size_t)*ancho * *alto * canalesArchivo;
+    size_t bytesConvertida = canalesArchivo != *canales ? (size_t)*ancho * *alto * *canales : 0;
+    return (size_t)st.st_size + (size_t)*alto + bytesImagen + bytesImagen + bytesConvertida;
+}
+
+// QUÉ: Cargar una imagen PNG desde un archivo.
+// CÓMO: Usa stbi_load pidiendo 1 o 3 canales (canalesMatrizArchivo(), como
+// la carga en streaming) y convierte los datos a una matriz 3D (alto x ancho
+// x canales). Antes cuenta contra el presupuesto lo que stb tendrá reservado
+// (bytesDecodificacionStb); si junto con la matriz no cabe, carga en
+// streaming (solo la matriz ocupa memoria completa).
+// POR QUÉ: La matriz 3D es intuitiva para principiantes y permite procesar
+// píxeles y canales individualmente.
+static int cargarImagen(const char* ruta, ImagenInfo* info) {
+    int canales;
+    int anchoArchivo, altoArchivo, canalesMatriz = 0;
+    size_t bytesDecodificacion = bytesDecodificacionStb(ruta, &anchoArchivo, &altoArchivo, &canalesMatriz);
+    if (bytesDecodificacion > 0) {
+        if (bytesDecodificacion + bytesMatriz3D(altoArchivo, anchoArchivo, canalesMatriz) > memoriaDisponible()) {
+            informar("El presupuesto de memoria no alcanza para decodificar %s completo: carga en streaming\n", ruta);
+            return cargarPNGConPocaMemoria(ruta, info);
+        }
+        if (!contarReserva(bytesDecodificacion, "La decodificación")) return 0;
+    }
+    // QUÉ: Cargar imagen con 1 canal (grises, con o sin alfa) o 3 (color).
+    // CÓMO: stbi_load convierte a los canales pedidos (descarta el alfa).
+    // POR QUÉ: Respetar el formato original asegura que grises o RGB se
+    // mantengan, igual que en la carga en streaming.
+    if (bytesDecodificacion == 0) {
+        fprintf(stderr, "Error al cargar imagen: %s\n", ruta);   // stb no reconoce el archivo
+        return 0;
+    }
+    unsigned char* datos = stbi_load(ruta, &info->ancho, &info->alto, &canales, canalesMatriz);
+    if (!datos) {
+        fprintf(stderr, "Error al cargar imagen: %s\n", ruta);
+        contarLiberacion(bytesDecodificacion);
+        return 0;
+    }
+    info->canales = canalesMatriz;   // stb devuelve los canales pedidos; 'canales' son los del archivo
+
+    // QUÉ: Asignar memoria para matriz 3D.
+    // CÓMO: Usa asignarMatriz3D() (filas, columnas y un bloque de canales).
+    // POR QUÉ: Estructura clara y flexible para grises (1 canal) o RGB (3 canales).
+    info->pixeles = asignarMatriz3D(info->alto, info->ancho, info->canales);
+    if (!info->pixeles) {
+        fprintf(stderr, "Error de memoria al asignar la matriz de la imagen\n");
+        stbi_image_free(datos);
+        contarLiberacion(bytesDecodificacion);
+        info->ancho = 0;
+        info->alto = 0;
+        info->canales = 0;
+        return 0;
+    }
+    for (int y = 0; y < info->alto; y++) {
+        for (int x = 0; x < info->ancho; x++) {
+            // Copiar píxeles a matriz 3D
+            for (int c = 0; c < info->canales; c++) {
+                info->pixeles[y][x][c] = datos[(y * info->ancho + x) * info->canales + c];
+            }
+        }
+    }
+
+    stbi_image_free(datos); // Liberar buffer de stb
+    contarLiberacion(bytesDecodificacion);
+    informar("Imagen cargada: %dx%d, %d canales (%s)\n", info->ancho, info->alto,
+           info->canales, info->canales == 1 ? "grises" : "RGB");
+    return 1;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Mostrar la matriz de píxeles (primeras 10 filas).
+// CÓMO: Imprime los valores de los píxeles, agrupando canales por píxel (grises o RGB).
+// POR QUÉ: Ayuda a visualizar la matriz para entender la estructura de datos.
+static void mostrarMatriz(const ImagenInfo* info) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    printf("Matriz de la imagen (primeras 10 filas):\n");
+    for (int y = 0; y < info->alto && y < 10; y++) {
+        for (int x = 0; x < info->ancho; x++) {
+            if (info->canales == 1) {
+                printf("%3u ", info->pixeles[y][x][0]); // Escala de grises
+            } else {
+                printf("(%3u,%3u,%3u) ", info->pixeles[y][x][0], info->pixeles[y][x][1],
+                       info->pixeles[y][x][2]); // RGB
+            }
+        }
+        printf("\n");
+    }
+    if (info->alto > 10) {
+        printf("... (más filas)\n");
+    }
+}
+
+// QUÉ: Guardar la matriz como PNG (grises o RGB).
+// CÓMO: Aplana la matriz 3D a 1D y usa stbi_write_png con el número de canales correcto.
+// POR QUÉ: Respeta el formato original (grises o RGB) para consistencia.
+static int guardarPNG(const ImagenInfo* info, const char* rutaSalida) {
+    if (!info->pixeles) {
+        fprintf(stderr, "No hay imagen para guardar.\n");
+        return 0;
+    }
+
+    // QUÉ: Aplanar matriz 3D a 1D para stb.
+    // CÓMO: Copia píxeles en orden [y][x][c] a un arreglo plano.
+    // POR QUÉ: stb_write_png requiere datos contiguos.
+    unsigned char* datos1D = (unsigned char*)malloc(info->ancho * info->alto * info->canales);
+    if (!datos1D) {
+        fprintf(stderr, "Error de memoria al aplanar imagen\n");
+        return 0;
+    }
+    for (int y = 0; y < info->alto; y++) {
+        for (int x = 0; x < info->ancho; x++) {
+            for (int c = 0; c < info->canales; c++) {
+                datos1D[(y * info->ancho + x) * info->canales + c] = info->pixeles[y][x][c];
+            }
+        }
+    }
+
+    // QUÉ: Guardar como PNG.
+    // CÓMO: Usa stbi_write_png con los canales de la imagen original.
+    // POR QUÉ: Mantiene el formato (grises o RGB) de la entrada.
+    int resultado = stbi_write_png(rutaSalida, info->ancho, info->alto, info->canales,
+                                   datos1D, info->ancho * info->canales);
+    free(datos1D);
+    if (resultado) {
+        informar("Imagen guardada en: %s (%s)\n", rutaSalida,
+               info->canales == 1 ? "grises" : "RGB");
+        return 1;
+    } else {
+        fprintf(stderr, "Error al guardar PNG: %s\n", rutaSalida);
+        return 0;
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Estructura para pasar datos al hilo de ajuste de brillo.
+// CÓMO: Contiene matriz, rango de filas, ancho, canales y delta de brillo.
+// POR QUÉ: Los hilos necesitan datos específicos para procesar en paralelo.
+typedef struct {
+    unsigned char*** pixeles;
+    int inicio;
+    int fin;
+    int ancho;
+    int canales;
+    int delta;
+} BrilloArgs;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Ajustar brillo en un rango de filas (para hilos).
+// CÓMO: Suma delta a cada canal de cada píxel, con clamp entre 0-255.
+// POR QUÉ: Procesa píxeles en paralelo para demostrar concurrencia.
+static void* ajustarBrilloHilo(void* args) {
+    BrilloArgs* bArgs = (BrilloArgs*)args;
+    for (int y = bArgs->inicio; y < bArgs->fin; y++) {
+        for (int x = 0; x < bArgs->ancho; x++) {
+            for (int c = 0; c < bArgs->canales; c++) {
+                int nuevoValor = bArgs->pixeles[y][x][c] + bArgs->delta;
+                bArgs->pixeles[y][x][c] = (unsigned char)(nuevoValor < 0 ? 0 :
+                                                          (nuevoValor > 255 ? 255 : nuevoValor));
+            }
+        }
+    }
+    return NULL;
+}
+
+// QUÉ: Ajustar brillo de la imagen usando múltiples hilos.
+// CÓMO: Divide las filas entre 2 hilos, los lanza con crearHiloMedido() y
+// espera con join (región "brillo_clasico" en --stats y --trace).
+// POR QUÉ: Usa concurrencia para acelerar el procesamiento y enseñar hilos.
+static void ajustarBrilloConcurrente(ImagenInfo* info, int delta) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+
+    const int numHilos = 2; // QUÉ: Número fijo de hilos para simplicidad.
+    pthread_t hilos[numHilos];
+    BrilloArgs args[numHilos];
+    TiempoHilo tiempos[numHilos];
+    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
+    double inicioRegion = iniciarRegion();
+
+    // QUÉ: Configurar y lanzar hilos.
+    // CÓMO: Asigna rangos de filas a cada hilo y pasa datos.
+    // POR QUÉ: Divide el trabajo para procesar en paralelo.
+    for (int i = 0; i < numHilos; i++) {
+        args[i].pixeles = info->pixeles;
+        args[i].inicio = i * filasPorHilo;
+        args[i].fin = (i + 1) * filasPorHilo < info->alto ? (i + 1) * filasPorHilo : info->alto;
+        args[i].ancho = info->ancho;
+        args[i].canales = info->canales;
+        args[i].delta = delta;
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, ajustarBrilloHilo, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d\n", i);
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            return;
+        }
+    }
+
+    // QUÉ: Esperar a que los hilos terminen.
+    // CÓMO: Usa pthread_join para sincronizar.
+    // POR QUÉ: Garantiza que todos los píxeles se procesen antes de continuar.
+    for (int i = 0; i < numHilos; i++) {
+        pthread_join(hilos[i], NULL);
+    }
+    terminarRegion("brillo_clasico", tiempos, numHilos, inicioRegion);
+    informar("Brillo ajustado concurrentemente con %d hilos (%s).\n", numHilos,
+           info->canales == 1 ? "grises" : "RGB");
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// BRILLO VECTORIZADO (SUMA SATURADA SOBRE EL BLOQUE CONTIGUO)
+// =====================================================================
+
+// QUÉ: Suma o resta un valor con saturación a un tramo contiguo de bytes.
+// CÓMO: Con AVX2 usa vpaddusb/vpsubusb sobre 32 bytes por instrucción; con SSE2
+// (siempre disponible en x86-64) usa paddusb/psubusb sobre 16 bytes. La suma
+// saturada ya recorta a [0, 255], así que no hay ramas ni comparaciones por
+// muestra. El resto del tramo (menos de un vector) se procesa byte a byte.
+// POR QUÉ: El brillo es la operación más usada; sobre datos contiguos queda
+// limitada solo por el ancho de banda de memoria.
+static void sumarSaturadoTramo(unsigned char* datos, size_t n, int delta) {
+    size_t i = 0;
+    unsigned char magnitud = (unsigned char)(delta > 255 ? 255 : (delta < -255 ? 255 : abs(delta)));
+#if defined(__AVX2__)
+    const __m256i valor256 = _mm256_set1_epi8((char)magnitud);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(datos + i));
+        v = delta >= 0 ? _mm256_adds_epu8(v, valor256) : _mm256_subs_epu8(v, valor256);
+        _mm256_storeu_si256((__m256i*)(datos + i), v);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i valor128 = _mm_set1_epi8((char)magnitud);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(datos + i));
+        v = delta >= 0 ? _mm_adds_epu8(v, valor128) : _mm_subs_epu8(v, valor128);
+        _mm_storeu_si128((__m128i*)(datos + i), v);
+    }
+#endif
+    for (; i < n; i++) {
+        int nuevoValor = datos[i] + delta;
+        datos[i] = (unsigned char)(nuevoValor < 0 ? 0 : (nuevoValor > 255 ? 255 : nuevoValor));
+    }
+}
+
+// QUÉ: Ajusta el brillo de un rango de filas tratándolo como tramo lineal (para hilos).
+// CÓMO: Las filas [inicio, fin) ocupan (fin - inicio) * ancho * canales bytes
+// seguidos a partir de pixeles[inicio][0]; se procesan con sumarSaturadoTramo().
+// POR QUÉ: Evita las dos indirecciones por byte de pixeles[y][x][c] y permite
+// usar instrucciones vectoriales. Reutiliza BrilloArgs de ajustarBrilloHilo.
+static void* ajustarBrilloVectorialHilo(void* args) {
+    BrilloArgs* bArgs = (BrilloArgs*)args;
+    if (bArgs->inicio >= bArgs->fin) return NULL;
+    size_t n = (size_t)(bArgs->fin - bArgs->inicio) * bArgs->ancho * bArgs->canales;
+    sumarSaturadoTramo(bArgs->pixeles[bArgs->inicio][0], n, bArgs->delta);
+    return NULL;
+}
+
+// QUÉ: Lanza hilosPorOperacion hilos con la función de brillo indicada, sin imprimir mensajes.
+// CÓMO: Mismo reparto por filas que ajustarBrilloConcurrente().
+// POR QUÉ: Lo comparten la versión vectorial, el pipeline y el benchmark, que
+// necesita ejecutar ambas versiones (clásica y vectorial) muchas veces sin ruido.
+static int lanzarBrilloConcurrente(ImagenInfo* info, int delta, void* (*funcionHilo)(void*)) {
+    if (!datosContiguos(info, "El brillo por tramos")) return 0;
+    const int numHilos = hilosPorOperacion;
+    pthread_t hilos[numHilos];
+    BrilloArgs args[numHilos];
+    TiempoHilo tiempos[numHilos];
+    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
+    double inicioRegion = iniciarRegion();
+
+    for (int i = 0; i < numHilos; i++) {
+        args[i].pixeles = info->pixeles;
+        args[i].inicio = i * filasPorHilo;
+        args[i].fin = (i + 1) * filasPorHilo < info->alto ? (i + 1) * filasPorHilo : info->alto;
+        args[i].ancho = info->ancho;
+        args[i].canales = info->canales;
+        args[i].delta = delta;
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, funcionHilo, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d\n", i);
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            return 0;
+        }
+    }
+    for (int i = 0; i < numHilos; i++) {
+        pthread_join(hilos[i], NULL);
+    }
+    terminarRegion("brillo", tiempos, numHilos, inicioRegion);
+    return 1;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Ajusta el brillo con suma saturada vectorial usando hilosPorOperacion hilos.
+// CÓMO: Cada hilo procesa su bloque de filas como un tramo contiguo de bytes.
+// POR QUÉ: Mismo resultado que ajustarBrilloConcurrente(), pero a velocidad de
+// memoria; es la versión que usa el menú (el pipeline usa el mismo kernel
+// desde ejecutarBrillosEnLugar()).
+static void ajustarBrilloVectorialConcurrente(ImagenInfo* info, int delta) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+    if (lanzarBrilloConcurrente(info, delta, ajustarBrilloVectorialHilo)) {
+        terminarMedicion(&medicion, "brillo", NULL, info);
+        informar("Brillo ajustado concurrentemente con %d hilos y suma saturada vectorial (%s).\n",
+               hilosPorOperacion, info->canales == 1 ? "grises" : "RGB");
+    }
+}
+
+// QUÉ: Mide el rendimiento (GB/s) del brillo clásico frente al vectorial.
+// CÓMO: Clona la imagen, ejecuta cada versión 'repeticiones' veces alternando
+// +delta y -delta, toma el tiempo con reloj monotónico y reporta el mejor
+// tiempo por pasada. Cada pasada lee y escribe todos los bytes (2 x tamaño).
+// POR QUÉ: Permite comprobar en cada máquina que el kernel vectorial se acerca
+// al ancho de banda de memoria, sin modificar la imagen del usuario.
+static void medirRendimientoBrillo(const ImagenInfo* info, int repeticiones) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    ImagenInfo copia = *info;
+    memset(&copia.repuesto, 0, sizeof(copia.repuesto));
+    copia.pixeles = clonarMatriz3D(info->pixeles, info->alto, info->ancho, info->canales);
+    if (!copia.pixeles) {
+        fprintf(stderr, "Error: Memoria insuficiente para el benchmark\n");
+        return;
+    }
+
+    double bytes = (double)info->alto * info->ancho * info->canales;
+    const char* nombres[2] = {"clásico (pixeles[y][x][c])", "vectorial (suma saturada)"};
+    void* (*funciones[2])(void*) = {ajustarBrilloHilo, ajustarBrilloVectorialHilo};
+
+    printf("Benchmark de brillo: %dx%d, %d canales, %.1f MB, %d repeticiones\n",
+           info->ancho, info->alto, info->canales, bytes / 1e6, repeticiones);
+    for (int v = 0; v < 2; v++) {
+        double mejor = 1e30;
+        for (int r = 0; r < repeticiones; r++) {
+            double t0 = tiempoActualSegundos();
+            if (!lanzarBrilloConcurrente(&copia, (r % 2 == 0) ? 30 : -30, funciones[v])) break;
+            double t = tiempoActualSegundos() - t0;
+            if (t < mejor) mejor = t;
+        }
+        printf("  %-28s %8.3f ms  %7.2f GB/s (lectura + escritura)\n",
+               nombres[v], mejor * 1e3, 2.0 * bytes / mejor / 1e9);
+    }
+
+    liberarMatriz3D(copia.pixeles, copia.alto, copia.ancho);
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// MOTOR DE OPERACIONES PUNTUALES (TABLAS DE CONSULTA / LUT)
+// =====================================================================
+
+// QUÉ: Tabla de consulta (LUT) con 256 entradas por canal.
+// CÓMO: tabla[c][v] es el valor de salida del canal c cuando la entrada vale v.
+// Se reservan 3 canales aunque la imagen sea en grises (solo se usa el 0).
+// POR QUÉ: Toda operación puntual (brillo, contraste, gamma, invertir, umbral,
+// niveles, curvas) depende solo del valor del píxel, así que basta calcularla
+// 256 veces por canal en lugar de una vez por muestra de la imagen.
+typedef struct {
+    unsigned char tabla[3][256];
+} TablaLUT;
+
+// QUÉ: Recorta un valor entero al rango válido de un píxel [0, 255].
+// CÓMO: Compara con los extremos y devuelve el valor acotado.
+// POR QUÉ: Todas las LUT se construyen con aritmética entera o flotante que
+// puede salirse del rango; centralizar el clamp evita repetirlo.
+static unsigned char recortarByte(int valor) {
+    return (unsigned char)(valor < 0 ? 0 : (valor > 255 ? 255 : valor));
+}
+
+// QUÉ: Inicializa una LUT como identidad (la salida es igual a la entrada).
+// CÓMO: Llena tabla[c][v] = v para los 3 canales.
+// POR QUÉ: Es el punto de partida para componer operaciones y el valor de los
+// canales que una operación no modifica.
+static void lutIdentidad(TablaLUT* lut) {
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            lut->tabla[c][v] = (unsigned char)v;
+        }
+    }
+}
+
+// QUÉ: Indica si el canal c debe ser modificado por una operación.
+// CÓMO: canal = -1 selecciona todos; otro valor selecciona solo ese canal.
+// POR QUÉ: Permite aplicar niveles o curvas a un solo canal (p. ej. solo rojo).
+static int lutAfectaCanal(int canal, int c) {
+    return canal < 0 || canal == c;
+}
+
+// QUÉ: Construye la LUT de brillo: salida = entrada + delta, con clamp.
+// CÓMO: Parte de la identidad y suma delta en los canales seleccionados.
+// POR QUÉ: Es la misma operación que ajustarBrilloHilo, pero calculada una
+// sola vez por valor posible.
+static void lutBrillo(TablaLUT* lut, int canal, int delta) {
+    lutIdentidad(lut);
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        for (int v = 0; v < 256; v++) {
+            lut->tabla[c][v] = recortarByte(v + delta);
+        }
+    }
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Construye la LUT de contraste alrededor del gris medio (128).
+// CÓMO: salida = (entrada - 128) * factor + 128, redondeada y con clamp.
+// POR QUÉ: factor > 1 aumenta el contraste y 0 < factor < 1 lo reduce.
+static void lutContraste(TablaLUT* lut, int canal, float factor) {
+    lutIdentidad(lut);
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        for (int v = 0; v < 256; v++) {
+            lut->tabla[c][v] = recortarByte((int)lroundf((v - 128) * factor + 128.0f));
+        }
+    }
+}
+
+// QUÉ: Construye la LUT de corrección gamma.
+// CÓMO: salida = 255 * (entrada / 255)^(1 / gamma), redondeada.
+// POR QUÉ: gamma > 1 aclara los tonos medios y gamma < 1 los oscurece, sin
+// saturar los extremos (0 y 255 se conservan).
+static void lutGamma(TablaLUT* lut, int canal, float gamma) {
+    lutIdentidad(lut);
+    float exponente = 1.0f / gamma;
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        for (int v = 0; v < 256; v++) {
+            lut->tabla[c][v] = recortarByte((int)lroundf(255.0f * powf(v / 255.0f, exponente)));
+        }
+    }
+}
+
+// QUÉ: Construye la LUT de inversión (negativo): salida = 255 - entrada.
+// CÓMO: Parte de la identidad e invierte los canales seleccionados.
+// POR QUÉ: Operación clásica de negativo fotográfico.
+static void lutInvertir(TablaLUT* lut, int canal) {
+    lutIdentidad(lut);
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        for (int v = 0; v < 256; v++) {
+            lut->tabla[c][v] = (unsigned char)(255 - v);
+        }
+    }
+}
+
+// QUÉ: Construye la LUT de umbral (binarización).
+// CÓMO: salida = 255 si entrada >= umbral, si no 0.
+// POR QUÉ: Separa objetos del fondo; útil antes de análisis de formas.
+static void lutUmbral(TablaLUT* lut, int canal, int umbral) {
+    lutIdentidad(lut);
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        for (int v = 0; v < 256; v++) {
+            lut->tabla[c][v] = (unsigned char)(v >= umbral ? 255 : 0);
+        }
+    }
+}
+
+// QUÉ: Construye la LUT de niveles (estiramiento lineal de rango).
+// CÓMO: Mapea [negroEntrada, blancoEntrada] a [negroSalida, blancoSalida]
+// linealmente; lo que queda fuera del rango de entrada se satura.
+// POR QUÉ: Corrige imágenes lavadas u oscuras usando todo el rango 0-255.
+static void lutNiveles(TablaLUT* lut, int canal, int negroEntrada, int blancoEntrada,
+                int negroSalida, int blancoSalida) {
+    lutIdentidad(lut);
+    int rangoEntrada = blancoEntrada - negroEntrada;
+    if (rangoEntrada <= 0) rangoEntrada = 1; // Evitar división por cero
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        for (int v = 0; v < 256; v++) {
+            int entrada = v < negroEntrada ? negroEntrada : (v > blancoEntrada ? blancoEntrada : v);
+            float t = (float)(entrada - negroEntrada) / rangoEntrada;
+            lut->tabla[c][v] = recortarByte((int)lroundf(negroSalida + t * (blancoSalida - negroSalida)));
+        }
+    }
+}
+
+// QUÉ: Construye una LUT de curva a partir de puntos de control.
+// CÓMO: Los puntos (x, y) deben venir ordenados por x creciente; entre dos
+// puntos se interpola linealmente, antes del primero y después del último se
+// usa el valor del extremo.
+// POR QUÉ: Las curvas generalizan brillo, contraste y gamma en una sola
+// herramienta que el usuario define a mano.
+static void lutCurva(TablaLUT* lut, int canal, const int* puntosX, const int* puntosY, int numPuntos) {
+    lutIdentidad(lut);
+    if (numPuntos <= 0) return;
+    for (int c = 0; c < 3; c++) {
+        if (!lutAfectaCanal(canal, c)) continue;
+        int tramo = 0;
+        for (int v = 0; v < 256; v++) {
+            int valor;
+            if (v <= puntosX[0]) {
+                valor = puntosY[0];
+            } else if (v >= puntosX[numPuntos - 1]) {
+                valor = puntosY[numPuntos - 1];
+            } else {
+                // Avanzar al tramo [puntosX[tramo], puntosX[tramo + 1]] que contiene v
+                while (tramo < numPuntos - 2 && v > puntosX[tramo + 1]) tramo++;
+                int dx = puntosX[tramo + 1] - puntosX[tramo];
+                float t = dx > 0 ? (float)(v - puntosX[tramo]) / dx : 1.0f;
+                valor = (int)lroundf(puntosY[tramo] + t * (puntosY[tramo + 1] - puntosY[tramo]));
+            }
+            lut->tabla[c][v] = recortarByte(valor);
+        }
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Compone dos LUT: acumulada pasa a ser "primero acumulada, luego siguiente".
+// CÓMO: Para cada canal y valor v: acumulada[c][v] = siguiente[c][acumulada[c][v]].
+// POR QUÉ: Varias operaciones puntuales consecutivas se reducen a una sola
+// tabla, de modo que la imagen se recorre una única vez sin importar cuántas
+// operaciones se encadenen.
+static void componerLUT(TablaLUT* acumulada, const TablaLUT* siguiente) {
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            acumulada->tabla[c][v] = siguiente->tabla[c][acumulada->tabla[c][v]];
+        }
+    }
+}
+
+// QUÉ: Estructura para pasar datos al hilo que aplica una LUT.
+// CÓMO: Contiene la matriz, el rango de filas, dimensiones y la tabla.
+// POR QUÉ: Cada hilo procesa su bloque de filas de forma independiente.
+typedef struct {
+    unsigned char*** pixeles;   // Matriz a modificar (en el lugar)
+    const TablaLUT* lut;        // Tabla compuesta a aplicar
+    int inicio;                 // Fila inicial (inclusiva)
+    int fin;                    // Fila final (exclusiva)
+    int ancho;                  // Ancho de la imagen
+    int canales;                // Número de canales (1 o 3)
+} LUTArgs;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Aplica una misma tabla de 256 entradas a un tramo contiguo de bytes, byte a byte.
+// CÓMO: datos[i] = tabla[datos[i]].
+// POR QUÉ: Es la referencia con la que se compara la versión vectorial y la
+// que se usa cuando la CPU no tiene una búsqueda de 256 entradas en un vector.
+static void aplicarTablaTramoEscalar(unsigned char* datos, size_t n, const unsigned char* tabla) {
+    for (size_t i = 0; i < n; i++) {
+        datos[i] = tabla[datos[i]];
+    }
+}
+
+// QUÉ: Aplica una misma tabla de 256 entradas a un tramo contiguo de bytes.
+// CÓMO: Con AVX-512 VBMI (-mavx512vbmi o -march=native en CPU que lo tengan)
+// la tabla ocupa 4 registros de 64 entradas; vpermi2b busca a la vez en dos
+// de ellos con los 7 bits bajos de cada byte (mitad baja y mitad alta de la
+// tabla) y el bit alto elige entre los dos resultados: 3 instrucciones por
+// cada 64 bytes. El resto del tramo se resuelve byte a byte. Sin VBMI se usa
+// el recorrido escalar: con SSSE3/AVX2 (pshufb busca solo en 16 entradas) la
+// búsqueda necesita 16 rondas por vector y resulta más lenta que la tabla.
+// POR QUÉ: Como la matriz 3D guarda sus datos en un bloque contiguo, un rango
+// de filas es un tramo lineal de bytes y puede procesarse sin indirecciones.
+static void aplicarTablaTramo(unsigned char* datos, size_t n, const unsigned char* tabla) {
+    size_t i = 0;
+#if defined(__AVX512VBMI__)
+    const __m512i tabla0 = _mm512_loadu_si512((const void*)(tabla + 0));
+    const __m512i tabla1 = _mm512_loadu_si512((const void*)(tabla + 64));
+    const __m512i tabla2 = _mm512_loadu_si512((const void*)(tabla + 128));
+    const __m512i tabla3 = _mm512_loadu_si512((const void*)(tabla + 192));
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(datos + i));
+        __m512i bajo = _mm512_permutex2var_epi8(tabla0, v, tabla1);
+        __m512i alto = _mm512_permutex2var_epi8(tabla2, v, tabla3);
+        __m512i resultado = _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), bajo, alto);
+        _mm512_storeu_si512((void*)(datos + i), resultado);
+    }
+#endif
+    aplicarTablaTramoEscalar(datos + i, n - i, tabla);
+}
+
+// QUÉ: Aplica la LUT a un rango de filas (para hilos).
+// CÓMO: Toma el tramo contiguo de bytes de sus filas (desde pixeles[inicio][0]).
+// Si todos los canales usan la misma tabla (grises, o una operación aplicada a
+// todos los canales) lo trata como un solo canal; si no, busca cada canal en
+// su propia tabla píxel a píxel.
+// POR QUÉ: Una sola pasada por la imagen, sin ramas ni clamp por muestra.
+static void* aplicarLUTHilo(void* args) {
+    LUTArgs* lArgs = (LUTArgs*)args;
+    if (lArgs->inicio >= lArgs->fin) return NULL;
+
+    unsigned char* datos = lArgs->pixeles[lArgs->inicio][0];
+    size_t numPixeles = (size_t)(lArgs->fin - lArgs->inicio) * lArgs->ancho;
+
+    int tablasIguales = 1;
+    for (int c = 1; c < lArgs->canales; c++) {
+        if (memcmp(lArgs->lut->tabla[0], lArgs->lut->tabla[c], 256) != 0) tablasIguales = 0;
+    }
+
+    if (tablasIguales) {
+        aplicarTablaTramo(datos, numPixeles * lArgs->canales, lArgs->lut->tabla[0]);
+    } else {
+        for (size_t p = 0; p < numPixeles; p++) {
+            for (int c = 0; c < lArgs->canales; c++) {
+                datos[p * lArgs->canales + c] = lArgs->lut->tabla[c][datos[p * lArgs->canales + c]];
+            }
+        }
+    }
+    return NULL;
+}
+
+// QUÉ: Aplica una LUT (posiblemente compuesta de varias operaciones) a la imagen.
+// CÓMO: Divide las filas entre hilosPorOperacion hilos; cada hilo recorre su tramo una sola vez.
+// POR QUÉ: Encadenar brillo + contraste + gamma cuesta lo mismo que uno solo,
+// porque las tablas ya se compusieron con componerLUT().
+static void aplicarLUTConcurrente(ImagenInfo* info, const TablaLUT* lut) {
+    if (!info || !info->pixeles) {
+        fprintf(stderr, "Error: No hay imagen cargada para aplicar la operación puntual\n");
+        return;
+    }
+    if (!datosContiguos(info, "La operación puntual")) return;
+
+    const int numHilos = hilosPorOperacion;
+    pthread_t hilos[numHilos];
+    LUTArgs args[numHilos];
+    TiempoHilo tiempos[numHilos];
+    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
+    double inicioRegion = iniciarRegion();
+
+    for (int i = 0; i < numHilos; i++) {
+        args[i].pixeles = info->pixeles;
+        args[i].lut = lut;
+        args[i].inicio = i * filasPorHilo;
+        args[i].fin = ((i + 1) * filasPorHilo < info->alto)
+                      ? (i + 1) * filasPorHilo
+                      : info->alto;
+        args[i].ancho = info->ancho;
+        args[i].canales = info->canales;
+
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, aplicarLUTHilo, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d para operación puntual\n", i);
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            return;
+        }
+    }
+
+    for (int i = 0; i < numHilos; i++) {
+        pthread_join(hilos[i], NULL);
+    }
+    terminarRegion("lut", tiempos, numHilos, inicioRegion);
+    informar("Operaciones puntuales aplicadas en una sola pasada con %d hilos (%s).\n",
+           numHilos, info->canales == 1 ? "grises" : "RGB");
+}
+
+// QUÉ: Comprueba que aplicarTablaTramo() da lo mismo que la versión escalar.
+// CÓMO: Recorre con varias tablas (identidad, inversión y bytes pseudoaleatorios)
+// un tramo con los 256 valores repetidos y un resto que no llena un vector, y
+// compara byte a byte con aplicarTablaTramoEscalar(). Devuelve 1 si coinciden.
+// POR QUÉ: La versión vectorial solo vale si es exacta para cada valor de entrada.
+static int verificarTablaTramo(void) {
+    unsigned char entrada[256 * 4 + 37], vectorial[sizeof(entrada)], escalar[sizeof(entrada)];
+    unsigned char tabla[256];
+    uint32_t estado = 2463534242u;
+    for (size_t i = 0; i < sizeof(entrada); i++) entrada[i] = (unsigned char)(i * 167 + i / 256);
+    for (int caso = 0; caso < 3; caso++) {
+        for (int v = 0; v < 256; v++) {
+            estado ^= estado << 13;
+            estado ^= estado >> 17;
+            estado ^= estado << 5;
+            tabla[v] = (unsigned char)(caso == 0 ? v : caso == 1 ? 255 - v : (int)(estado & 255));
+        }
+        memcpy(vectorial, entrada, sizeof(entrada));
+        memcpy(escalar, entrada, sizeof(entrada));
+        aplicarTablaTramo(vectorial, sizeof(entrada), tabla);
+        aplicarTablaTramoEscalar(escalar, sizeof(entrada), tabla);
+        if (memcmp(vectorial, escalar, sizeof(entrada)) != 0) return 0;
+    }
+    return 1;
+}
+
+// QUÉ: Mide el rendimiento (GB/s) de aplicar una LUT con la tabla escalar frente a la vectorial.
+// CÓMO: Primero verifica con verificarTablaTramo() que ambas dan lo mismo; luego
+// clona la imagen y aplica a todo su bloque contiguo, en un solo hilo, una
+// tabla de inversión 'repeticiones' veces con cada versión, y reporta el mejor
+// tiempo por pasada y la aceleración.
+// POR QUÉ: La versión vectorial solo se justifica si es más rápida en la
+// máquina que la compila; sin AVX-512 VBMI solo se mide la escalar.
+static void medirRendimientoLUT(const ImagenInfo* info, int repeticiones) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    if (!verificarTablaTramo()) {
+        fprintf(stderr, "Error: La LUT vectorial no coincide con la escalar; no se reportan tiempos\n");
+        return;
+    }
+    ImagenInfo copia = *info;
+    memset(&copia.repuesto, 0, sizeof(copia.repuesto));
+    copia.pixeles = clonarMatriz3D(info->pixeles, info->alto, info->ancho, info->canales);
+    if (!copia.pixeles) {
+        fprintf(stderr, "Error: Memoria insuficiente para el benchmark\n");
+        return;
+    }
+
+    unsigned char tabla[256];
+    for (int v = 0; v < 256; v++) tabla[v] = (unsigned char)(255 - v);
+    size_t bytes = (size_t)info->alto * info->ancho * info->canales;
+    unsigned char* datos = copia.pixeles[0][0];
+    const char* nombres[2] = {"escalar (tabla[v])", "vectorial (vpermi2b)"};
+    void (*funciones[2])(unsigned char*, size_t, const unsigned char*) = {aplicarTablaTramoEscalar,
+                                                                          aplicarTablaTramo};
+    double mejores[2] = {0, 0};
+#if defined(__AVX512VBMI__)
+    const int versiones = 2;
+#else
+    const int versiones = 1;    // Sin VBMI aplicarTablaTramo() es el mismo recorrido escalar
+#endif
+
+    printf("Benchmark de LUT: %dx%d, %d canales, %.1f MB, %d repeticiones, 1 hilo\n", info->ancho,
+           info->alto, info->canales, bytes / 1e6, repeticiones);
+    for (int v = 0; v < versiones; v++) {
+        mejores[v] = 1e30;
+        for (int r = 0; r < repeticiones; r++) {
+            double t0 = tiempoActualSegundos();
+            funciones[v](datos, bytes, tabla);
+            double t = tiempoActualSegundos() - t0;
+            if (t < mejores[v]) mejores[v] = t;
+        }
+        printf("  %-28s %8.3f ms  %7.2f GB/s (lectura + escritura)\n",
+               nombres[v], mejores[v] * 1e3, 2.0 * bytes / mejores[v] / 1e9);
+    }
+    if (versiones == 2) {
+        printf("  Aceleración vectorial: %.2fx\n", mejores[0] / mejores[1]);
+    } else {
+        printf("  Compilado sin AVX-512 VBMI: la LUT usa solo la versión escalar\n");
+    }
+
+    liberarMatriz3D(copia.pixeles, copia.alto, copia.ancho);
+}
+
+// QUÉ: Submenú para encadenar operaciones puntuales y aplicarlas de una vez.
+// CÓMO: Cada operación elegida construye su LUT y se compone con la acumulada;
+// al elegir "Aplicar" se recorre la imagen una sola vez.
+// POR QUÉ: Separa la interacción (scanf) del motor de LUT y muestra al usuario
+// que varias operaciones no cuestan varias pasadas.
+static void menuOperacionesPuntuales(ImagenInfo* imagen) {
+    if (!imagen->pixeles) {
+        printf("Primero carga una imagen (opción 1).\n");
+        return;
+    }
+
+    TablaLUT acumulada, operacion;
+    lutIdentidad(&acumulada);
+    int numOperaciones = 0;
+
+    while (1) {
+        printf("\n--- Operaciones puntuales (%d en cola) ---\n", numOperaciones);
+        printf("1. Brillo\n");
+        printf("2. Contraste\n");
+        printf("3. Gamma\n");
+        printf("4. Invertir (negativo)\n");
+        printf("5. Umbral\n");
+        printf("6. Niveles\n");
+        printf("7. Curva (puntos de control)\n");
+        printf("8. Aplicar operaciones en cola\n");
+        printf("9. Cancelar\n");
+        printf("Opción: ");
+
+        int opcion;
+        if (scanf("%d", &opcion) != 1) {
+            while (getchar() != '\n');
+            printf("Entrada inválida.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+
+        if (opcion == 8) {
+            if (numOperaciones == 0) {
+                printf("No hay operaciones en cola.\n");
+                return;
+            }
+            aplicarLUTConcurrente(imagen, &acumulada);
+            return;
+        }
+        if (opcion == 9) {
+            printf("Operaciones puntuales canceladas.\n");
+            return;
+        }
+        if (opcion < 1 || opcion > 7) {
+            printf("Opción inválida.\n");
+            continue;
+        }
+
+        // Canal afectado (solo tiene sentido en RGB)
+        int canal = -1;
+        if (imagen->canales == 3) {
+            printf("Canal (-1 = todos, 0 = R, 1 = G, 2 = B): ");
+            if (scanf("%d", &canal) != 1 || canal < -1 || canal > 2) {
+                while (getchar() != '\n');
+                printf("Canal inválido.\n");
+                continue;
+            }
+            while (getchar() != '\n');
+        }
+
+        int valido = 1;
+        int leyoParametros = 1; // Invertir no pide parámetros: no hay línea que limpiar
+        switch (opcion) {
+            case 1: {
+                int delta;
+                printf("Valor de brillo (+/-): ");
+                valido = scanf("%d", &delta) == 1;
+                if (valido) lutBrillo(&operacion, canal, delta);
+                break;
+            }
+            case 2: {
+                float factor;
+                printf("Factor de contraste (>1 aumenta, <1 reduce): ");
+                valido = scanf("%f", &factor) == 1 && factor >= 0.0f;
+                if (valido) lutContraste(&operacion, canal, factor);
+                break;
+            }
+            case 3: {
+                float gamma;
+                printf("Gamma (>1 aclara, <1 oscurece): ");
+                valido = scanf("%f", &gamma) == 1 && gamma > 0.0f;
+                if (valido) lutGamma(&operacion, canal, gamma);
+                break;
+            }
+            case 4:
+                lutInvertir(&operacion, canal);
+                leyoParametros = 0;
+                break;
+            case 5: {
+                int umbral;
+                printf("Umbral (0-255): ");
+                valido = scanf("%d", &umbral) == 1 && umbral >= 0 && umbral <= 255;
+                if (valido) lutUmbral(&operacion, canal, umbral);
+                break;
+            }
+            case 6: {
+                int ne, be, ns, bs;
+                printf("Negro y blanco de entrada, negro y blanco de salida (4 valores 0-255): ");
+                valido = scanf("%d %d %d %d", &ne, &be, &ns, &bs) == 4 &&
+                         ne >= 0 && be <= 255 && ne < be &&
+                         ns >= 0 && ns <= 255 && bs >= 0 && bs <= 255;
+                if (valido) lutNiveles(&operacion, canal, ne, be, ns, bs);
+                break;
+            }
+            case 7: {
+                int numPuntos;
+                int puntosX[16], puntosY[16];
+                printf("Número de puntos de control (2-16): ");
+                valido = scanf("%d", &numPuntos) == 1 && numPuntos >= 2 && numPuntos <= 16;
+                for (int i = 0; valido && i < numPuntos; i++) {
+                    printf("Punto %d (entrada salida, x creciente): ", i + 1);
+                    valido = scanf("%d %d", &puntosX[i], &puntosY[i]) == 2 &&
+                             puntosX[i] >= 0 && puntosX[i] <= 255 &&
+                             puntosY[i] >= 0 && puntosY[i] <= 255 &&
+                             (i == 0 || puntosX[i] > puntosX[i - 1]);
+                }
+                if (valido) lutCurva(&operacion, canal, puntosX, puntosY, numPuntos);
+                break;
+            }
+        }
+        if (leyoParametros) while (getchar() != '\n');
+
+        if (!valido) {
+            printf("Parámetros inválidos.\n");
+            continue;
+        }
+        componerLUT(&acumulada, &operacion);
+        numOperaciones++;
+        printf("Operación agregada a la cola.\n");
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// HISTORIAL DE DESHACER/REHACER (menú)
+// =====================================================================
+
+#define LADO_TESELA_HISTORIAL 64              // Píxeles por lado de cada tesela guardada
+#define MAX_PASOS_HISTORIAL 64                // Estados que recuerda el historial
+#define BYTES_HISTORIAL (256u * 1024 * 1024)  // Presupuesto de las teselas guardadas
+
+// QUÉ: Tesela de una instantánea, compartida entre instantáneas.
+// CÓMO: Contador de referencias, bytes de píxeles y las filas de la tesela
+// una tras otra (ancho de tesela x canales bytes cada una).
+// POR QUÉ: Una tesela que no cambió entre dos pasos se guarda una sola vez.
+typedef struct {
+    int referencias;
+    size_t bytes;
+    unsigned char datos[];
+} TeselaHistorial;
+
+// QUÉ: Estado de la imagen en un paso del historial.
+// CÓMO: Geometría, nombre de la operación que lo produjo y una rejilla de
+// teselas de LADO_TESELA_HISTORIAL (las del borde pueden ser más chicas).
+// POR QUÉ: Reconstruir la imagen es copiar cada tesela a su lugar.
+typedef struct {
+    char nombre[32];
+    int ancho;
+    int alto;
+    int canales;
+    int teselasX;
+    int teselasY;
+    TeselaHistorial** teselas;
+} InstantaneaImagen;
+
+// QUÉ: Historial lineal de instantáneas con un cursor.
+// CÓMO: 'actual' es el estado que muestra la imagen; los posteriores son los
+// que se pueden rehacer. 'bytes' suma las teselas distintas (cada una una
+// vez, aunque la compartan varias instantáneas).
+// POR QUÉ: Lo usa solo el menú (un hilo), así que no necesita mutex.
+typedef struct {
+    InstantaneaImagen* pasos[MAX_PASOS_HISTORIAL];
+    int numPasos;
+    int actual;
+    size_t bytes;
+} HistorialImagen;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Suelta una referencia a una tesela y la libera con la última.
+// CÓMO: Descuenta sus bytes del historial y de la contabilidad de memoria.
+// POR QUÉ: Las instantáneas comparten teselas.
+static void soltarTeselaHistorial(HistorialImagen* h, TeselaHistorial* t) {
+    if (!t || --t->referencias > 0) return;
+    h->bytes -= t->bytes;
+    liberarContado(t, sizeof(TeselaHistorial) + t->bytes);
+}
+
+// QUÉ: Libera una instantánea (y las teselas que solo ella usaba).
+// CÓMO: soltarTeselaHistorial() sobre cada tesela; acepta teselas NULL de
+// una instantánea a medio crear.
+// POR QUÉ: Se llama al descartar pasos viejos, la rama de rehacer o todo.
+static void liberarInstantanea(HistorialImagen* h, InstantaneaImagen* s) {
+    if (!s) return;
+    if (s->teselas) {
+        for (int i = 0; i < s->teselasX * s->teselasY; i++) soltarTeselaHistorial(h, s->teselas[i]);
+        free(s->teselas);
+    }
+    free(s);
+}
+
+// QUÉ: Toma una instantánea de 'imagen' compartiendo lo que no cambió.
+// CÓMO: Si 'previa' tiene la misma geometría compara cada tesela de la
+// imagen con la de 'previa' fila por fila (memcmp) y, si es igual, suma una
+// referencia en lugar de copiarla; si no, copia la tesela. En *nuevas deja
+// cuántas teselas copió. Devuelve NULL si no hay memoria.
+// POR QUÉ: Es copia en escritura a nivel de tesela: las operaciones escriben
+// directo en pixeles[y][x][c], sin aviso de qué tocaron, así que las teselas
+// sucias se detectan al cerrar el paso; comparar cuesta una lectura de la
+// imagen y evita guardar de nuevo lo que no cambió (p. ej. fuera de la región
+// de un ajuste de brillo).
+static InstantaneaImagen* crearInstantanea(HistorialImagen* h, const ImagenInfo* imagen,
+                                           const InstantaneaImagen* previa, const char* nombre, int* nuevas) {
+    const int lado = LADO_TESELA_HISTORIAL;
+    InstantaneaImagen* s = calloc(1, sizeof(InstantaneaImagen));
+    if (!s) return NULL;
+    snprintf(s->nombre, sizeof(s->nombre), "%s", nombre);
+    s->ancho = imagen->ancho;
+    s->alto = imagen->alto;
+    s->canales = imagen->canales;
+    s->teselasX = (imagen->ancho + lado - 1) / lado;
+    s->teselasY = (imagen->alto + lado - 1) / lado;
+    s->teselas = calloc((size_t)s->teselasX * s->teselasY, sizeof(TeselaHistorial*));
+    if (!s->teselas) {
+        free(s);
+        return NULL;
+    }
+    int misma = previa && previa->ancho == s->ancho && previa->alto == s->alto && previa->canales == s->canales;
+    *nuevas = 0;
+    for (int ty = 0; ty < s->teselasY; ty++) {
+        for (int tx = 0; tx < s->teselasX; tx++) {
+            int i = ty * s->teselasX + tx;
+            int x0 = tx * lado, y0 = ty * lado;
+            int alto = y0 + lado < s->alto ? lado : s->alto - y0;
+            size_t bytesFila = (size_t)(x0 + lado < s->ancho ? lado : s->ancho - x0) * s->canales;
+
+            TeselaHistorial* anterior = misma ? previa->teselas[i] : NULL;
+            int igual = anterior != NULL;
+            for (int y = 0; igual && y < alto; y++) {
+                igual = memcmp(anterior->datos + y * bytesFila, imagen->pixeles[y0 + y][x0], bytesFila) == 0;
+            }
+            if (igual) {
+                anterior->referencias++;
+                s->teselas[i] = anterior;
+                continue;
+            }
+            size_t bytes = bytesFila * alto;
+            TeselaHistorial* t = reservarContado(sizeof(TeselaHistorial) + bytes, NULL);
+            if (!t) {
+                liberarInstantanea(h, s);
+                return NULL;
+            }
+            t->referencias = 1;
+            t->bytes = bytes;
+            for (int y = 0; y < alto; y++) memcpy(t->datos + y * bytesFila, imagen->pixeles[y0 + y][x0], bytesFila);
+            h->bytes += bytes;
+            s->teselas[i] = t;
+            (*nuevas)++;
+        }
+    }
+    return s;
+}
+
+// QUÉ: Reconstruye la imagen a partir de una instantánea.
+// CÓMO: Toma la matriz destino con tomarMatrizDestino() (el repuesto si la
+// geometría coincide), copia cada tesela a su lugar y la instala con
+// reemplazarPixeles(). Devuelve 0 si no hay memoria.
+// POR QUÉ: Deshacer y rehacer no vuelven a leer el archivo.
+static int restaurarInstantanea(const InstantaneaImagen* s, ImagenInfo* imagen) {
+    const int lado = LADO_TESELA_HISTORIAL;
+    unsigned char*** destino = tomarMatrizDestino(imagen, s->alto, s->ancho, s->canales);
+    if (!destino) return 0;
+    for (int ty = 0; ty < s->teselasY; ty++) {
+        for (int tx = 0; tx < s->teselasX; tx++) {
+            const TeselaHistorial* t = s->teselas[ty * s->teselasX + tx];
+            int x0 = tx * lado, y0 = ty * lado;
+            int alto = y0 + lado < s->alto ? lado : s->alto - y0;
+            size_t bytesFila = (size_t)(x0 + lado < s->ancho ? lado : s->ancho - x0) * s->canales;
+            for (int y = 0; y < alto; y++) memcpy(destino[y0 + y][x0], t->datos + y * bytesFila, bytesFila);
+        }
+    }
+    reemplazarPixeles(imagen, destino, s->alto, s->ancho, s->canales);
+    return 1;
+}
+
+// QUÉ: Quita del historial el paso 'i' y corre los siguientes.
+// CÓMO: liberarInstantanea() y memmove del arreglo; ajusta el cursor.
+// POR QUÉ: Lo usan el presupuesto (pasos viejos) y la rama de rehacer.
+static void quitarPasoHistorial(HistorialImagen* h, int i) {
+    liberarInstantanea(h, h->pasos[i]);
+    memmove(&h->pasos[i], &h->pasos[i + 1], (size_t)(h->numPasos - i - 1) * sizeof(h->pasos[0]));
+    h->numPasos--;
+    if (h->actual >= i) h->actual--;
+}
+
+// QUÉ: Agrega al historial el estado actual de la imagen tras 'nombre'.
+// CÓMO: Compara con el paso actual; si nada cambió no agrega nada. Si no,
+// descarta la rama de rehacer, agrega la instantánea y, mientras se pase de
+// MAX_PASOS_HISTORIAL o de BYTES_HISTORIAL, descarta los pasos más viejos
+// (nunca el actual) y avisa cuántos ya no se pueden deshacer.
+// POR QUÉ: El menú lo llama después de cada opción que puede modificar la
+// imagen; el presupuesto acota lo que cuesta poder deshacer, y con imágenes
+// de más de BYTES_HISTORIAL cada paso descarta el anterior, algo que el
+// usuario debe saber antes de confiar en deshacer.
+static void registrarEnHistorial(HistorialImagen* h, const ImagenInfo* imagen, const char* nombre) {
+    if (!imagen->pixeles) return;
+    const InstantaneaImagen* previa = h->actual >= 0 ? h->pasos[h->actual] : NULL;
+    int nuevas = 0;
+    InstantaneaImagen* s = crearInstantanea(h, imagen, previa, nombre, &nuevas);
+    if (!s) {
+        printf("Aviso: sin memoria para el historial; este paso no se podrá deshacer.\n");
+        return;
+    }
+    if (previa && nuevas == 0 && previa->ancho == s->ancho && previa->alto == s->alto &&
+        previa->canales == s->canales) {
+        liberarInstantanea(h, s);   // La opción no modificó la imagen
+        return;
+    }
+    while (h->numPasos > h->actual + 1) quitarPasoHistorial(h, h->numPasos - 1);
+    int descartados = 0;
+    if (h->numPasos == MAX_PASOS_HISTORIAL) {
+        quitarPasoHistorial(h, 0);
+        descartados++;
+    }
+    h->pasos[h->numPasos++] = s;
+    h->actual = h->numPasos - 1;
+    while (h->bytes > BYTES_HISTORIAL && h->actual > 0) {
+        quitarPasoHistorial(h, 0);
+        descartados++;
+    }
+    informar("Historial: %s (%d de %d teselas nuevas), %d pasos, %.1f MB\n", nombre, nuevas,
+             s->teselasX * s->teselasY, h->numPasos, h->bytes / (1024.0 * 1024.0));
+    if (h->bytes > BYTES_HISTORIAL) {
+        printf("Aviso: la imagen (%.1f MB) no cabe en el historial (%u MB); solo se guarda el último "
+               "estado, así que no se podrá deshacer.\n", h->bytes / (1024.0 * 1024.0),
+               BYTES_HISTORIAL / (1024u * 1024u));
+    } else if (descartados > 0) {
+        printf("Aviso: el historial se llenó (%d pasos o %u MB); se descartaron %d paso(s) antiguo(s) "
+               "que ya no se pueden deshacer.\n", MAX_PASOS_HISTORIAL, BYTES_HISTORIAL / (1024u * 1024u),
+               descartados);
+    }
+}
+
+// QUÉ: Deshace (direccion -1) o rehace (+1) un paso.
+// CÓMO: Mueve el cursor y restaura esa instantánea en la imagen.
+// POR QUÉ: Permite probar alternativas sin recargar el archivo.
+static void moverEnHistorial(HistorialImagen* h, ImagenInfo* imagen, int direccion) {
+    int destino = h->actual + direccion;
+    if (destino < 0 || destino >= h->numPasos) {
+        printf("No hay nada que %s.\n", direccion < 0 ? "deshacer" : "rehacer");
+        return;
+    }
+    if (!restaurarInstantanea(h->pasos[destino], imagen)) {
+        printf("Error: Memoria insuficiente para restaurar la imagen\n");
+        return;
+    }
+    printf("%s: %s (paso %d de %d)\n", direccion < 0 ? "Deshecho" : "Rehecho",
+           h->pasos[direccion < 0 ? h->actual : destino]->nombre, destino + 1, h->numPasos);
+    h->actual = destino;
+}
+
+// QUÉ: Libera todo el historial.
+// CÓMO: quitarPasoHistorial() hasta vaciarlo.
+// POR QUÉ: Al salir del menú.
+static void liberarHistorial(HistorialImagen* h) {
+    while (h->numPasos > 0) quitarPasoHistorial(h, h->numPasos - 1);
+    h->actual = -1;
+}
+
+// QUÉ: Mostrar el menú interactivo.
+// CÓMO: Imprime opciones y espera entrada del usuario.
+// POR QUÉ: Proporciona una interfaz simple para interactuar con el programa.
+static void mostrarMenu() {
+    printf("\n--- Plataforma de Edición de Imágenes ---\n");
+    printf("1. Cargar imagen PNG\n");
+    printf("2. Mostrar matriz de píxeles\n");
+    printf("3. Guardar como PNG\n");
+    printf("4. Ajustar brillo (+/- valor) concurrentemente\n");
+    printf("5. Aplicar desenfoque Gaussiano (convolución)\n");
+    printf("6. Redimensionar imagen (escalar)\n");
+    printf("7. Rotar imagen\n");
+    printf("8. Detectar bordes (Sobel)\n");
+    printf("9. Operaciones puntuales (contraste, gamma, invertir, umbral, niveles, curvas)\n");
+    printf("10. Pipeline fusionado (varias operaciones en una sola pasada)\n");
+    printf("11. Imágenes grandes en disco (teselas proyectadas con mmap)\n");
+    printf("12. Cargar PNG en streaming (gris/escalar/brillo al decodificar)\n");
+    printf("13. Guardar PNG con nivel de compresión y filtro\n");
+    printf("14. Formatos sin compresión (crudo nativo .icr, PPM/PGM)\n");
+    printf("15. Herramientas de rendimiento (benchmarks)\n");
+    printf("16. Deshacer\n");
+    printf("17. Rehacer\n");
+    printf("18. Salir\n");
+    printf("Opción: ");
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Función principal que controla el flujo del programa.
+// CÓMO: Maneja entrada CLI, ejecuta el menú en bucle y llama funciones según opción.
+// POR QUÉ: Centraliza la lógica y asegura limpieza al salir.
+
+
+// ============================================================================
+// FUNCIONES NUEVAS: Rotación concurrente y Detección de Bordes (Sobel)
+// QUÉ: Se agregan según reglas del parcial sin modificar código base existente.
+// CÓMO: Se usan pthreads (2 hilos), matrices 3D, interpolación bilineal y Sobel.
+// POR QUÉ: Extienden la plataforma con transformaciones y análisis de bordes.
+// ============================================================================
+
+typedef struct {
+    unsigned char*** origen;
+    unsigned char*** destino;
+    int anchoOrig, altoOrig;
+    int anchoDest, altoDest;
+    int canales;
+    float anguloRad;
+    int inicio, fin;
+} RotacionArgs;
+
+static void* rotarHilo(void* arg) {
+    RotacionArgs* r = (RotacionArgs*)arg;
+    float cxO = r->anchoOrig / 2.0f, cyO = r->altoOrig / 2.0f;
+    float cxN = r->anchoDest / 2.0f, cyN = r->altoDest / 2.0f;
+    float cosA = cosf(r->anguloRad), sinA = sinf(r->anguloRad);
+
+    for (int y = r->inicio; y < r->fin; y++) {
+        for (int x = 0; x < r->anchoDest; x++) {
+            float xO = (x - cxN) * cosA + (y - cyN) * sinA + cxO;
+            float yO = -(x - cxN) * sinA + (y - cyN) * cosA + cyO;
+            for (int c = 0; c < r->canales; c++) {
+                if (xO >= 0 && xO < r->anchoOrig && yO >= 0 && yO < r->altoOrig) {
+                    r->destino[y][x][c] = interpolacionBilineal(
+                        r->origen, xO, yO, c, r->anchoOrig, r->altoOrig
+                    );
+                } else {
+                    r->destino[y][x][c] = 0;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// QUÉ: Dimensiones de una imagen de ancho x alto rotada 'angulo' grados.
+// CÓMO: Caja que contiene la imagen girada (proyecciones con |cos| y |sin|).
+// POR QUÉ: La comparten la rotación y la validación del pipeline, que sigue
+// la geometría paso a paso para comprobar las regiones de interés.
+static void dimensionesRotacion(int ancho, int alto, float angulo, int* nuevoAncho, int* nuevoAlto) {
+    float rad = angulo * (float)M_PI / 180.0f;
+    float cosA = fabsf(cosf(rad)), sinA = fabsf(sinf(rad));
+    *nuevoAncho = (int)ceilf(alto * sinA + ancho * cosA);
+    *nuevoAlto  = (int)ceilf(alto * cosA + ancho * sinA);
+}
+
+// QUÉ: Rotar imagen por un ángulo en grados, creando nueva matriz.
+// CÓMO: Calcula dimensiones destino, divide por filas entre hilosPorOperacion hilos y usa
+//       interpolación bilineal para mapear destino→origen.
+//       Devuelve 1 si rotó y 0 si falló (la imagen queda sin cambios).
+// POR QUÉ: Mantiene calidad visual y cumple concurrencia mínima del parcial.
+static int rotarImagenConcurrente(ImagenInfo* info, float angulo) {
+    if (!info || !info->pixeles) {
+        fprintf(stderr, "Error: No hay imagen cargada\n");
+        return 0;
+    }
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+    float rad = angulo * (float)M_PI / 180.0f;
+    int nuevoAncho, nuevoAlto;
+    dimensionesRotacion(info->ancho, info->alto, angulo, &nuevoAncho, &nuevoAlto);
+    if (!matrizCabeEnPresupuesto(nuevoAlto, nuevoAncho, info->canales, 0, "La imagen rotada")) return 0;
+
+    unsigned char*** nueva = tomarMatrizDestino(info, nuevoAlto, nuevoAncho, info->canales);
+    if (!nueva) {
+        fprintf(stderr, "Error: Memoria insuficiente para rotación\n");
+        return 0;
+    }
+
+    const int numHilos = hilosPorOperacion;
+    pthread_t hilos[numHilos];
+    RotacionArgs args[numHilos];
+    TiempoHilo tiempos[numHilos];
+    int filasPorHilo = (int)ceil((double)nuevoAlto / numHilos);
+    double inicioRegion = iniciarRegion();
+
+    for (int i = 0; i < numHilos; i++) {
+        args[i].origen = info->pixeles;
+        args[i].destino = nueva;
+        args[i].anchoOrig = info->ancho;
+        args[i].altoOrig = info->alto;
+        args[i].anchoDest = nuevoAncho;
+        args[i].altoDest = nuevoAlto;
+        args[i].canales = info->canales;
+        args[i].anguloRad = rad;
+        args[i].inicio = i * filasPorHilo;
+        args[i].fin = ((i + 1) * filasPorHilo < nuevoAlto) ? (i + 1) * filasPorHilo : nuevoAlto;
+
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, rotarHilo, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d en rotación\n", i);
+            // Esperar a los hilos ya lanzados (escriben en 'nueva') antes de liberar
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            liberarMatriz3D(nueva, nuevoAlto, nuevoAncho);
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < numHilos; i++) pthread_join(hilos[i], NULL);
+    terminarRegion("rotar", tiempos, numHilos, inicioRegion);
+
+    reemplazarPixeles(info, nueva, nuevoAlto, nuevoAncho, info->canales);
+    terminarMedicion(&medicion, "rotar", NULL, info);
+    informar("Rotación completada. Nuevas dimensiones: %dx%d\n", nuevoAncho, nuevoAlto);
+    return 1;
+}
+
+// ========================== SOBEL ==========================
+typedef struct {
+    unsigned char*** origen;
+    unsigned char*** destino;
+    int inicio, fin;
+    int ancho, alto;
+} SobelArgs;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Aplica Sobel a una región rectangular [x0, x1) x [y0, y1).
+// CÓMO: Calcula Gx y Gy con bordes replicados y guarda la magnitud (con clamp).
+// POR QUÉ: La comparten la versión por filas y la versión por teselas.
+static void sobelRegion(const SobelArgs* s, int x0, int y0, int x1, int y1) {
+    // Kernels Sobel
+    int Gx[3][3] = { {-1,0,1}, {-2,0,2}, {-1,0,1} };
+    int Gy[3][3] = { {-1,-2,-1}, {0,0,0}, {1,2,1} };
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            int sx = 0, sy = 0;
+            for (int ky = -1; ky <= 1; ky++) {
+                for (int kx = -1; kx <= 1; kx++) {
+                    int ny = y + ky, nx = x + kx;
+                    if (ny < 0) ny = 0;
+                    if (nx < 0) nx = 0;
+                    if (ny >= s->alto) ny = s->alto - 1;
+                    if (nx >= s->ancho) nx = s->ancho - 1;
+                    int v = s->origen[ny][nx][0]; // siempre gris en esta fase
+                    sx += v * Gx[ky+1][kx+1];
+                    sy += v * Gy[ky+1][kx+1];
+                }
+            }
+            int mag = (int)(sqrtf((float)(sx*sx + sy*sy)) + 0.5f);
+            if (mag > 255) mag = 255;
+            if (mag < 0) mag = 0;
+            s->destino[y][x][0] = (unsigned char)mag;
+        }
+    }
+}
+
+static void* sobelHilo(void* arg) {
+    SobelArgs* s = (SobelArgs*)arg;
+    sobelRegion(s, 0, s->inicio, s->ancho, s->fin);
+    return NULL;
+}
+
+// QUÉ: Aplica Sobel a una tesela (función para el motor de teselas).
+// CÓMO: Los datos son un SobelArgs compartido; cada tesela escribe su zona.
+// POR QUÉ: Mantiene las 3 filas de la ventana en caché en imágenes anchas.
+static void sobelTesela(void* datos, int hilo, int x0, int y0, int x1, int y1) {
+    (void)hilo;
+    sobelRegion((const SobelArgs*)datos, x0, y0, x1, y1);
+}
+
+// QUÉ: Detectar bordes con Sobel. Resultado en escala de grises (1 canal).
+// CÓMO: Si la imagen es RGB, se convierte a gris; luego se aplica Gx/Gy por
+// teselas del tamaño de L2 repartidas entre los hilos.
+// POR QUÉ: Extrae bordes fuertes para análisis posterior.
+static void detectarBordesConcurrente(ImagenInfo* info) {
+    if (!info || !info->pixeles) {
+        fprintf(stderr, "Error: No hay imagen cargada\n");
+        return;
+    }
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+
+    // Asegurar imagen en escala de grises
+    if (info->canales == 3) {
+        unsigned char*** gris = tomarMatrizDestino(info, info->alto, info->ancho, 1);
+        if (!gris) { fprintf(stderr, "Error: Memoria insuficiente\n"); return; }
+        for (int y = 0; y < info->alto; y++) {
+            for (int x = 0; x < info->ancho; x++) {
+                gris[y][x][0] = (unsigned char)(
+                    0.299f * info->pixeles[y][x][0] +
+                    0.587f * info->pixeles[y][x][1] +
+                    0.114f * info->pixeles[y][x][2]
+                );
+            }
+        }
+        reemplazarPixeles(info, gris, info->alto, info->ancho, 1);
+    }
+
+    unsigned char*** salida = tomarMatrizDestino(info, info->alto, info->ancho, 1);
+    if (!salida) { fprintf(stderr, "Error: Memoria insuficiente\n"); return; }
+
+    SobelArgs datos;
+    datos.origen = info->pixeles;
+    datos.destino = salida;
+    datos.inicio = 0;
+    datos.fin = info->alto;
+    datos.ancho = info->ancho;
+    datos.alto = info->alto;
+
+    int lado = calcularLadoTesela(1, 1);
+    if (!ejecutarPorTeselasConcurrente("sobel", info->ancho, info->alto, lado, sobelTesela, &datos)) {
+        liberarMatriz3D(salida, info->alto, info->ancho);
+        return;
+    }
+
+    reemplazarPixeles(info, salida, info->alto, info->ancho, 1);
+    terminarMedicion(&medicion, "sobel", NULL, info);
+    informar("Detección de bordes aplicada (Sobel). Imagen ahora en grises.\n");
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+
+
+// =====================================================================
+// PIPELINE FUSIONADO (VARIAS OPERACIONES EN UNA SOLA PASADA POR FILAS)
+// =====================================================================
+
+// Los tipos TipoPaso y PasoPipeline están en procesador.h (son parte de la API).
+
+// QUÉ: Una etapa ya preparada para ejecutarse fusionada.
+// CÓMO: Guarda dimensiones de entrada y salida y los datos precalculados
+// (LUT compuesta para brillo, kernel Gaussiano para desenfoque).
+// POR QUÉ: Los hilos solo leen estas etapas; todo lo costoso se calcula una vez.
+typedef struct {
+    TipoPaso tipo;
+    int anchoEntrada, altoEntrada, canalesEntrada;
+    int anchoSalida, altoSalida, canalesSalida;
+    TablaLUT lut;       // PASO_BRILLO (varios brillos seguidos se componen)
+    float** kernel;     // PASO_DESENFOQUE
+    int tamKernel;      // PASO_DESENFOQUE
+} EtapaFusionada;
+
+// QUÉ: Buffer circular de filas (búfer de líneas) de la salida de una etapa.
+// CÓMO: Guarda numFilas filas en una pequeña matriz 3D; la fila y se guarda en
+// la ranura y % numFilas y filaEnRanura indica qué fila hay en cada ranura.
+// POR QUÉ: Una etapa solo necesita unas pocas filas de la anterior (su altura
+// de ventana), así que no hace falta materializar la imagen intermedia entera.
+typedef struct {
+    unsigned char*** filas;   // Matriz [numFilas][anchoSalida][canalesSalida]
+    int* filaEnRanura;        // Fila guardada en cada ranura (-1 = vacía)
+    int numFilas;             // Altura de la ventana de la etapa siguiente
+} BufferLineas;
+
+// QUÉ: Estado de un hilo del pipeline fusionado.
+// CÓMO: Contiene la imagen de entrada, las etapas, los búferes de línea
+// propios del hilo, la matriz destino y, por etapa, el rango de columnas
+// [xInicio, xFin) que hace falta calcular para la tesela actual.
+// POR QUÉ: Cada hilo tiene sus propios búferes y rangos, así que no comparte
+// nada escrito con el otro hilo (sin mutex).
+typedef struct {
+    unsigned char*** origen;        // Imagen de entrada (solo lectura)
+    const EtapaFusionada* etapas;   // Etapas del segmento
+    int numEtapas;                  // Número de etapas
+    BufferLineas* buffers;          // numEtapas - 1 búferes (uno por etapa intermedia)
+    int* xInicio;                   // Primera columna a calcular por etapa
+    int* xFin;                      // Columna final (exclusiva) por etapa
+    unsigned char*** destino;       // Salida de la última etapa
+    int regionX, regionY;           // Esquina de la región de interés (0, 0 sin región)
+    unsigned char*** filaRegion;    // Fila completa de la última etapa (solo con región)
+    unsigned char*** ventanas;      // Filas de entrada del desenfoque: alturaMaxVentana por etapa
+    int alturaMaxVentana;           // Mayor alturaVentanaEtapa() del segmento
+} PipelineFusionadoArgs;
+
+// QUÉ: Cuántas filas de la etapa anterior necesita una etapa para una fila suya.
+// CÓMO: Brillo 1 fila, escalado 2 (interpolación bilineal), desenfoque
+// tamKernel filas y Sobel 3.
+// POR QUÉ: Define el tamaño mínimo del búfer de líneas de la etapa anterior.
+static int alturaVentanaEtapa(const EtapaFusionada* etapa) {
+    switch (etapa->tipo) {
+        case PASO_ESCALAR:    return 2;
+        case PASO_DESENFOQUE: return etapa->tamKernel;
+        case PASO_SOBEL:      return 3;
+        default:              return 1;
+    }
+}
+
+static void calcularFilaEtapa(PipelineFusionadoArgs* p, int s, int y, unsigned char** salida);
+
+// QUÉ: Devuelve la fila y de la salida de la etapa s (s = -1 es la imagen origen).
+// CÓMO: Si la fila ya está en el búfer de líneas de la etapa la reutiliza; si
+// no, la calcula en su ranura pidiendo recursivamente las filas que necesite
+// de la etapa anterior.
+// POR QUÉ: Las filas se producen bajo demanda y en orden, de modo que cada
+// fila intermedia se calcula (casi siempre) una sola vez por hilo.
+static unsigned char** obtenerFilaEtapa(PipelineFusionadoArgs* p, int s, int y) {
+    if (s < 0) {
+        return p->origen[y];
+    }
+    BufferLineas* b = &p->buffers[s];
+    int ranura = y % b->numFilas;
+    if (b->filaEnRanura[ranura] != y) {
+        calcularFilaEtapa(p, s, y, b->filas[ranura]);
+        b->filaEnRanura[ranura] = y;
+    }
+    return b->filas[ranura];
+}
+
+// QUÉ: Calcula la fila y de la salida de la etapa s en 'salida'.
+// CÓMO: Aplica la misma fórmula que la operación original (LUT de brillo,
+// interpolación bilineal, convolución con bordes replicados, Sobel), leyendo
+// las filas de entrada con obtenerFilaEtapa(). Solo calcula las columnas
+// [xInicio[s], xFin[s]) que necesita la tesela actual.
+// POR QUÉ: Los resultados coinciden con ejecutar las operaciones una a una,
+// pero sin matrices intermedias del tamaño de la imagen.
+static void calcularFilaEtapa(PipelineFusionadoArgs* p, int s, int y, unsigned char** salida) {
+    const EtapaFusionada* e = &p->etapas[s];
+
+    switch (e->tipo) {
+        case PASO_BRILLO: {
+            unsigned char** fila = obtenerFilaEtapa(p, s - 1, y);
+            for (int x = p->xInicio[s]; x < p->xFin[s]; x++) {
+                for (int c = 0; c < e->canalesSalida; c++) {
+                    salida[x][c] = e->lut.tabla[c][fila[x][c]];
+                }
+            }
+            break;
+        }
+        case PASO_ESCALAR: {
+            float scaleX = (float)e->anchoEntrada / e->anchoSalida;
+            float scaleY = (float)e->altoEntrada / e->altoSalida;
+            float yOrig = y * scaleY;
+            int y0 = (int)floor(yOrig);
+            int y1 = (y0 + 1 < e->altoEntrada) ? y0 + 1 : e->altoEntrada - 1;
+            // Ventana de 2 filas: interpolacionBilineal() ve una imagen de alto 2
+            unsigned char** ventana[2];
+            ventana[0] = obtenerFilaEtapa(p, s - 1, y0);
+            ventana[1] = obtenerFilaEtapa(p, s - 1, y1);
+            float yLocal = yOrig - y0;
+            for (int x = p->xInicio[s]; x < p->xFin[s]; x++) {
+                float xOrig = x * scaleX;
+                for (int c = 0; c < e->canalesSalida; c++) {
+                    salida[x][c] = interpolacionBilineal(ventana, xOrig, yLocal, c,
+                                                         e->anchoEntrada, 2);
+                }
+            }
+            break;
+        }
+        case PASO_DESENFOQUE: {
+            int offset = e->tamKernel / 2;
+            // La ventana es de la etapa (obtenerFilaEtapa() puede recalcular
+            // otro desenfoque anterior) y está en el heap: su alto lo elige el usuario
+            unsigned char*** ventana = p->ventanas + (size_t)s * p->alturaMaxVentana;
+            for (int ky = -offset; ky <= offset; ky++) {
+                int ny = y + ky;
+                if (ny < 0) ny = 0;
+                if (ny >= e->altoEntrada) ny = e->altoEntrada - 1;
+                ventana[ky + offset] = obtenerFilaEtapa(p, s - 1, ny);
+            }
+            for (int x = p->xInicio[s]; x < p->xFin[s]; x++) {
+                for (int c = 0; c < e->canalesSalida; c++) {
+                    float suma = 0.0f;
+                    for (int ky = -offset; ky <= offset; ky++) {
+                        for (int kx = -offset; kx <= offset; kx++) {
+                            int nx = x + kx;
+                            if (nx < 0) nx = 0;
+                            if (nx >= e->anchoEntrada) nx = e->anchoEntrada - 1;
+                            suma += ventana[ky + offset][nx][c] *
+                                    e->kernel[ky + offset][kx + offset];
+                        }
+                    }
+                    int resultado = (int)(suma + 0.5f);
+                    if (resultado < 0) resultado = 0;
+                    if (resultado > 255) resultado = 255;
+                    salida[x][c] = (unsigned char)resultado;
+                }
+            }
+            break;
+        }
+        case PASO_SOBEL: {
+            int Gx[3][3] = { {-1,0,1}, {-2,0,2}, {-1,0,1} };
+            int Gy[3][3] = { {-1,-2,-1}, {0,0,0}, {1,2,1} };
+            unsigned char** ventana[3];
+            for (int ky = -1; ky <= 1; ky++) {
+                int ny = y + ky;
+                if (ny < 0) ny = 0;
+                if (ny >= e->altoEntrada) ny = e->altoEntrada - 1;
+                ventana[ky + 1] = obtenerFilaEtapa(p, s - 1, ny);
+            }
+            for (int x = p->xInicio[s]; x < p->xFin[s]; x++) {
+                int sx = 0, sy = 0;
+                for (int ky = -1; ky <= 1; ky++) {
+                    for (int kx = -1; kx <= 1; kx++) {
+                        int nx = x + kx;
+                        if (nx < 0) nx = 0;
+                        if (nx >= e->anchoEntrada) nx = e->anchoEntrada - 1;
+                        unsigned char* px = ventana[ky + 1][nx];
+                        // Misma conversión a gris que detectarBordesConcurrente()
+                        int v = (e->canalesEntrada == 3)
+                                ? (unsigned char)(0.299f * px[0] + 0.587f * px[1] + 0.114f * px[2])
+                                : px[0];
+                        sx += v * Gx[ky + 1][kx + 1];
+                        sy += v * Gy[ky + 1][kx + 1];
+                    }
+                }
+                int mag = (int)(sqrtf((float)(sx * sx + sy * sy)) + 0.5f);
+                if (mag > 255) mag = 255;
+                salida[x][0] = (unsigned char)mag;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// QUÉ: Calcula qué columnas de cada etapa hacen falta para la tesela [x0, x1).
+// CÓMO: Parte de la última etapa y retrocede: brillo necesita las mismas
+// columnas, desenfoque y Sobel añaden su halo horizontal, y el escalado mapea
+// el rango a coordenadas de su entrada (más una columna para interpolar).
+// POR QUÉ: Cada etapa calcula solo la franja necesaria, así que toda la
+// cadena trabaja sobre bloques que caben en la caché.
+static void calcularRangosColumnas(PipelineFusionadoArgs* p, int x0, int x1) {
+    int a = x0, b = x1;
+    for (int s = p->numEtapas - 1; s >= 0; s--) {
+        const EtapaFusionada* e = &p->etapas[s];
+        p->xInicio[s] = a;
+        p->xFin[s] = b;
+        switch (e->tipo) {
+            case PASO_DESENFOQUE:
+                a -= e->tamKernel / 2;
+                b += e->tamKernel / 2;
+                break;
+            case PASO_SOBEL:
+                a -= 1;
+                b += 1;
+                break;
+            case PASO_ESCALAR: {
+                float scaleX = (float)e->anchoEntrada / e->anchoSalida;
+                int primera = (int)floor(a * scaleX);
+                int ultima = (int)floor((b - 1) * scaleX) + 1;
+                a = primera;
+                b = ultima + 1;
+                break;
+            }
+            default:
+                break;
+        }
+        if (a < 0) a = 0;
+        if (b > e->anchoEntrada) b = e->anchoEntrada;
+    }
+}
+
+// QUÉ: Ejecuta el pipeline fusionado sobre una tesela de salida (motor de teselas).
+// CÓMO: Toma el estado del hilo, calcula los rangos de columnas por etapa,
+// vacía sus búferes de línea y produce las filas de la tesela en orden; las
+// filas intermedias salen de los búferes de línea. Con región de interés la
+// tesela está en coordenadas de la región: se desplaza a las de la imagen,
+// cada fila se calcula en filaRegion y se copia al destino del tamaño de la
+// región.
+// POR QUÉ: Toda la cadena se resuelve en un solo recorrido de la imagen, con
+// un conjunto de trabajo del tamaño de la tesela. Con región, las etapas
+// leen de la imagen completa, así que el halo de los vecindarios sale de
+// fuera de la región sin casos especiales.
+static void pipelineFusionadoTesela(void* datos, int hilo, int x0, int y0, int x1, int y1) {
+    PipelineFusionadoArgs* p = &((PipelineFusionadoArgs*)datos)[hilo];
+    int dx = p->regionX, dy = p->regionY;
+    calcularRangosColumnas(p, x0 + dx, x1 + dx);
+    for (int s = 0; s < p->numEtapas - 1; s++) {
+        for (int i = 0; i < p->buffers[s].numFilas; i++) p->buffers[s].filaEnRanura[i] = -1;
+    }
+    int ultima = p->numEtapas - 1;
+    size_t bytesTramo = (size_t)(x1 - x0) * p->etapas[ultima].canalesSalida;
+    for (int y = y0; y < y1; y++) {
+        if (p->filaRegion) {
+            calcularFilaEtapa(p, ultima, y + dy, p->filaRegion[0]);
+            memcpy(p->destino[y][x0], p->filaRegion[0][x0 + dx], bytesTramo);
+        } else {
+            calcularFilaEtapa(p, ultima, y, p->destino[y]);
+        }
+    }
+}
+
+// QUÉ: Libera los recursos de un arreglo de etapas preparadas.
+// CÓMO: Libera los kernels Gaussianos de las etapas de desenfoque.
+// POR QUÉ: Centraliza la limpieza para las salidas con error y la normal.
+static void liberarEtapasFusionadas(EtapaFusionada* etapas, int numEtapas) {
+    for (int s = 0; s < numEtapas; s++) {
+        if (etapas[s].tipo == PASO_DESENFOQUE && etapas[s].kernel) {
+            for (int i = 0; i < etapas[s].tamKernel; i++) free(etapas[s].kernel[i]);
+            free(etapas[s].kernel);
+            etapas[s].kernel = NULL;
+        }
+    }
+}
+
+// QUÉ: Libera los búferes de línea de un hilo.
+// CÓMO: Libera cada matriz de filas y su arreglo de índices.
+// POR QUÉ: Limpieza simétrica a crearBuffersLineas().
+static void liberarBuffersLineas(BufferLineas* buffers, int numBuffers,
+                                 const EtapaFusionada* etapas) {
+    if (!buffers) return;
+    for (int s = 0; s < numBuffers; s++) {
+        liberarMatriz3D(buffers[s].filas, buffers[s].numFilas, etapas[s].anchoSalida);
+        free(buffers[s].filaEnRanura);
+    }
+    free(buffers);
+}
+
+// QUÉ: Crea los búferes de línea de un hilo (uno por etapa intermedia).
+// CÓMO: El búfer de la etapa s tiene la altura de ventana de la etapa s + 1.
+// POR QUÉ: Es la única memoria extra del pipeline: unas pocas filas por etapa.
+static BufferLineas* crearBuffersLineas(const EtapaFusionada* etapas, int numEtapas) {
+    int numBuffers = numEtapas - 1;
+    BufferLineas* buffers = calloc(numBuffers > 0 ? numBuffers : 1, sizeof(BufferLineas));
+    if (!buffers) return NULL;
+    for (int s = 0; s < numBuffers; s++) {
+        buffers[s].numFilas = alturaVentanaEtapa(&etapas[s + 1]);
+        buffers[s].filas = asignarMatriz3D(buffers[s].numFilas, etapas[s].anchoSalida,
+                                           etapas[s].canalesSalida);
+        buffers[s].filaEnRanura = malloc(buffers[s].numFilas * sizeof(int));
+        if (!buffers[s].filas || !buffers[s].filaEnRanura) {
+            liberarBuffersLineas(buffers, s + 1, etapas);
+            return NULL;
+        }
+        for (int i = 0; i < buffers[s].numFilas; i++) buffers[s].filaEnRanura[i] = -1;
+    }
+    return buffers;
+}
+
+// QUÉ: Indica si un paso tiene región de interés.
+// CÓMO: Ancho o alto de la región distinto de 0 (ambos 0 = imagen completa).
+// POR QUÉ: Los pasos armados antes de existir la región (o con memset / {})
+// siguen actuando sobre toda la imagen.
+static int pasoConRegion(const PasoPipeline* paso) {
+    return paso->regionAncho != 0 || paso->regionAlto != 0;
+}
+
+// QUÉ: Copia el resultado de un segmento con región de vuelta a la imagen.
+// CÓMO: Fila por fila dentro del rectángulo; si el segmento terminó en grises
+// (Sobel sobre RGB) repite el valor en todos los canales de la imagen.
+// POR QUÉ: Fuera de la región la imagen no cambia, y tampoco su número de
+// canales: el recorrido cuesta lo que mide la región.
+static void escribirRegion(ImagenInfo* info, unsigned char*** region, int x, int y, int ancho, int alto,
+                           int canales) {
+    size_t bytesFila = (size_t)ancho * canales;
+    for (int f = 0; f < alto; f++) {
+        if (canales == info->canales) {
+            memcpy(info->pixeles[y + f][x], region[f][0], bytesFila);
+            continue;
+        }
+        for (int c = 0; c < ancho; c++) {
+            unsigned char valor = region[f][c][0];
+            for (int k = 0; k < info->canales; k++) info->pixeles[y + f][x + c][k] = valor;
+        }
+    }
+}
+
+// QUÉ: Ejecuta en el lugar un segmento formado solo por brillos, sin región.
+// CÓMO: Junta los deltas seguidos del mismo signo (saturar dos veces hacia el
+// mismo lado es saturar una vez con la suma) y aplica cada grupo con
+// lanzarBrilloConcurrente() y la suma saturada vectorial sobre el bloque
+// contiguo; una cadena con signos alternados hace una pasada por grupo.
+// POR QUÉ: Es el brillo de la línea de comandos, los lotes, el servidor y la
+// biblioteca: a velocidad de memoria y sin matriz destino, en lugar de la
+// etapa por filas con LUT a través de pixeles[y][x].
+static int ejecutarBrillosEnLugar(ImagenInfo* info, const PasoPipeline* pasos, int numPasos) {
+    int i = 0;
+    while (i < numPasos) {
+        int delta = pasos[i].delta;
+        int fin = i + 1;
+        while (fin < numPasos && (pasos[fin].delta >= 0) == (delta >= 0)) {
+            delta += pasos[fin].delta;
+            if (delta > 255) delta = 255;
+            if (delta < -255) delta = -255;
+            fin++;
+        }
+        if (delta != 0 && !lanzarBrilloConcurrente(info, delta, ajustarBrilloVectorialHilo)) return 0;
+        i = fin;
+    }
+    return 1;
+}
+
+// QUÉ: Ejecuta un segmento de pasos fusionables (sin rotación) sobre la imagen.
+// CÓMO: Prepara las etapas (compone brillos consecutivos en una LUT y genera
+// kernels), asigna la matriz destino y búferes de línea por hilo, recorre la
+// salida por teselas repartidas entre los hilos y reemplaza la imagen original.
+// Si los pasos tienen región de interés (todos la misma, sin escalar), el
+// destino y las teselas miden la región y el resultado se escribe encima de
+// la imagen con escribirRegion().
+// Un segmento solo de brillos sin región (sobre una imagen que no es vista)
+// se aplica en el lugar con ejecutarBrillosEnLugar().
+// POR QUÉ: Una sola matriz nueva y un solo recorrido en lugar de uno por paso;
+// con región, el trabajo es proporcional a la región más su halo.
+static int ejecutarSegmentoFusionado(ImagenInfo* info, const PasoPipeline* pasos, int numPasos) {
+    int soloBrillos = !pasoConRegion(&pasos[0]) && !esVista(info->pixeles);
+    for (int i = 0; soloBrillos && i < numPasos; i++) soloBrillos = pasos[i].tipo == PASO_BRILLO;
+    if (soloBrillos) return ejecutarBrillosEnLugar(info, pasos, numPasos);
+
+    EtapaFusionada* etapas = calloc(numPasos, sizeof(EtapaFusionada));
+    if (!etapas) {
+        fprintf(stderr, "Error: Memoria insuficiente para el pipeline\n");
+        return 0;
+    }
+
+    // Preparar etapas encadenando dimensiones
+    int numEtapas = 0;
+    int ancho = info->ancho, alto = info->alto, canales = info->canales;
+    for (int i = 0; i < numPasos; i++) {
+        const PasoPipeline* paso = &pasos[i];
+
+        // Brillos consecutivos: componer en la LUT de la etapa anterior
+        if (paso->tipo == PASO_BRILLO && numEtapas > 0 &&
+            etapas[numEtapas - 1].tipo == PASO_BRILLO) {
+            TablaLUT siguiente;
+            lutBrillo(&siguiente, -1, paso->delta);
+            componerLUT(&etapas[numEtapas - 1].lut, &siguiente);
+            continue;
+        }
+
+        EtapaFusionada* e = &etapas[numEtapas];
+        e->tipo = paso->tipo;
+        e->anchoEntrada = ancho;
+        e->altoEntrada = alto;
+        e->canalesEntrada = canales;
+        switch (paso->tipo) {
+            case PASO_BRILLO:
+                lutBrillo(&e->lut, -1, paso->delta);
+                break;
+            case PASO_DESENFOQUE:
+                e->tamKernel = paso->tamKernel;
+                e->kernel = generarKernelGaussiano(paso->tamKernel, paso->sigma);
+                if (!e->kernel) {
+                    liberarEtapasFusionadas(etapas, numEtapas);
+                    free(etapas);
+                    return 0;
+                }
+                break;
+            case PASO_ESCALAR:
+                ancho = paso->nuevoAncho;
+                alto = paso->nuevoAlto;
+                break;
+            case PASO_SOBEL:
+                canales = 1;
+                break;
+            default:
+                break;
+        }
+        e->anchoSalida = ancho;
+        e->altoSalida = alto;
+        e->canalesSalida = canales;
+        numEtapas++;
+    }
+
+    // Con región: destino del tamaño de la región y la imagen se conserva
+    int enRegion = pasoConRegion(&pasos[0]);
+    int altoDestino = enRegion ? pasos[0].regionAlto : alto;
+    int anchoDestino = enRegion ? pasos[0].regionAncho : ancho;
+    if (!matrizCabeEnPresupuesto(altoDestino, anchoDestino, canales, 0, "El resultado del pipeline")) {
+        liberarEtapasFusionadas(etapas, numEtapas);
+        free(etapas);
+        return 0;
+    }
+    unsigned char*** destino = enRegion ? asignarMatriz3D(altoDestino, anchoDestino, canales)
+                                        : tomarMatrizDestino(info, alto, ancho, canales);
+    if (!destino) {
+        fprintf(stderr, "Error: No se pudo asignar memoria para el resultado del pipeline\n");
+        liberarEtapasFusionadas(etapas, numEtapas);
+        free(etapas);
+        return 0;
+    }
+
+    // Estado por hilo: búferes de línea y rangos de columnas propios
+    PipelineFusionadoArgs args[MAX_HILOS_OPERACION];
+    int haloTotal = 0, alturaMaxVentana = 1;
+    for (int s = 0; s < numEtapas; s++) {
+        haloTotal += alturaVentanaEtapa(&etapas[s]) / 2;
+        if (alturaVentanaEtapa(&etapas[s]) > alturaMaxVentana) alturaMaxVentana = alturaVentanaEtapa(&etapas[s]);
+    }
+    int exito = 1;
+    int hilosPreparados = 0;
+
+    for (int i = 0; i < hilosPorOperacion; i++) {
+        args[i].origen = info->pixeles;
+        args[i].etapas = etapas;
+        args[i].numEtapas = numEtapas;
+        args[i].destino = destino;
+        args[i].regionX = enRegion ? pasos[0].regionX : 0;
+        args[i].regionY = enRegion ? pasos[0].regionY : 0;
+        args[i].filaRegion = enRegion ? asignarMatriz3D(1, ancho, canales) : NULL;
+        args[i].buffers = crearBuffersLineas(etapas, numEtapas);
+        args[i].alturaMaxVentana = alturaMaxVentana;
+        args[i].ventanas = malloc((size_t)numEtapas * alturaMaxVentana * sizeof(unsigned char**));
+        args[i].xInicio = malloc(numEtapas * sizeof(int));
+        args[i].xFin = malloc(numEtapas * sizeof(int));
+        hilosPreparados++;
+        if (!args[i].buffers || !args[i].ventanas || !args[i].xInicio || !args[i].xFin ||
+            (enRegion && !args[i].filaRegion)) {
+            fprintf(stderr, "Error: Memoria insuficiente para búferes de línea\n");
+            exito = 0;
+            break;
+        }
+    }
+
+    if (exito) {
+        int lado = calcularLadoTesela(canales > info->canales ? canales : info->canales, haloTotal);
+        exito = ejecutarPorTeselasConcurrente("pipeline", anchoDestino, altoDestino, lado,
+                                              pipelineFusionadoTesela, args);
+    }
+
+    for (int i = 0; i < hilosPreparados; i++) {
+        liberarMatriz3D(args[i].filaRegion, 1, ancho);
+        liberarBuffersLineas(args[i].buffers, numEtapas - 1, etapas);
+        free(args[i].ventanas);
+        free(args[i].xInicio);
+        free(args[i].xFin);
+    }
+    liberarEtapasFusionadas(etapas, numEtapas);
+    free(etapas);
+
+    if (!exito) {
+        liberarMatriz3D(destino, altoDestino, anchoDestino);
+        return 0;
+    }
+
+    if (enRegion) {
+        escribirRegion(info, destino, pasos[0].regionX, pasos[0].regionY, anchoDestino, altoDestino, canales);
+        liberarMatriz3D(destino, altoDestino, anchoDestino);
+    } else {
+        reemplazarPixeles(info, destino, alto, ancho, canales);
+    }
+    return 1;
+}
+
+// QUÉ: Nombre corto de un tipo de paso.
+// CÓMO: Tabla por tipo; coincide con los nombres de las estadísticas.
+// POR QUÉ: Identifica cada paso en el resumen de --stats y en el JSON.
+static const char* nombrePasoPipeline(TipoPaso tipo) {
+    switch (tipo) {
+        case PASO_BRILLO: return "brillo";
+        case PASO_DESENFOQUE: return "desenfoque";
+        case PASO_ESCALAR: return "redimensionar";
+        case PASO_ROTAR: return "rotar";
+        case PASO_SOBEL: return "sobel";
+        case PASO_RECORTAR: return "recortar";
+    }
+    return "desconocido";
+}
+
+// QUÉ: Valida la región de interés de un paso contra la geometría que tendrá
+// la imagen al llegar a ese paso.
+// CÓMO: Sin región solo exige que un recorte la tenga; con región, ancho y alto
+// positivos y el rectángulo completo dentro de la imagen.
+// POR QUÉ: Un rectángulo fuera de la imagen se rechaza antes de tocarla, en
+// vez de leer fuera de la matriz a mitad del pipeline.
+static int validarRegionPaso(const PasoPipeline* paso, int numero, int ancho, int alto) {
+    if (!pasoConRegion(paso)) {
+        if (paso->tipo != PASO_RECORTAR) return 1;
+        fprintf(stderr, "Error: Paso %d: el recorte necesita una región\n", numero);
+        return 0;
+    }
+    if (paso->regionX < 0 || paso->regionY < 0 || paso->regionAncho <= 0 || paso->regionAlto <= 0 ||
+        paso->regionAncho > ancho - paso->regionX || paso->regionAlto > alto - paso->regionY) {
+        fprintf(stderr, "Error: Paso %d: la región %d,%d,%dx%d no cabe en la imagen de %dx%d\n", numero,
+                paso->regionX, paso->regionY, paso->regionAncho, paso->regionAlto, ancho, alto);
+        return 0;
+    }
+    return 1;
+}
+
+// QUÉ: Valida los parámetros de todos los pasos de un pipeline.
+// CÓMO: Recorre los pasos siguiendo la geometría que tendrá la imagen en cada
+// uno (recortes, escalados y rotaciones la cambian) para comprobar kernels,
+// dimensiones y regiones de interés.
+// POR QUÉ: El pipeline falla antes de tocar la imagen, y la biblioteca
+// distingue un argumento inválido de una operación fallida.
+static int validarPasosPipeline(const ImagenInfo* info, const PasoPipeline* pasos, int numPasos) {
+    int ancho = info->ancho, alto = info->alto;
+    for (int i = 0; i < numPasos; i++) {
+        const PasoPipeline* paso = &pasos[i];
+        if (!validarRegionPaso(paso, i + 1, ancho, alto)) return 0;
+        if (pasoConRegion(paso) && paso->tipo != PASO_BRILLO && paso->tipo != PASO_DESENFOQUE &&
+            paso->tipo != PASO_SOBEL) {
+            ancho = paso->regionAncho;
+            alto = paso->regionAlto;
+        }
+        if (paso->tipo == PASO_ESCALAR) {
+            ancho = paso->nuevoAncho;
+            alto = paso->nuevoAlto;
+        } else if (paso->tipo == PASO_ROTAR) {
+            dimensionesRotacion(ancho, alto, paso->angulo, &ancho, &alto);
+        }
+        if (paso->tipo == PASO_DESENFOQUE &&
+            (paso->tamKernel <= 0 || paso->tamKernel % 2 == 0 || paso->sigma <= 0.0f)) {
+            fprintf(stderr, "Error: Paso %d: kernel impar y positivo, sigma positivo\n", i + 1);
+            return 0;
+        }
+        if (paso->tipo == PASO_ESCALAR && (paso->nuevoAncho <= 0 || paso->nuevoAlto <= 0)) {
+            fprintf(stderr, "Error: Paso %d: las dimensiones deben ser positivas\n", i + 1);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// QUÉ: Ejecuta una cadena de operaciones fusionándolas en pasadas por filas.
+// CÓMO: Valida los pasos (siguiendo la geometría para comprobar las regiones)
+// y parte la cadena en segmentos separados por rotaciones, recortes y
+// cambios de región; cada segmento se ejecuta en un único recorrido por
+// teselas con búferes de línea por hilo, y cada rotación con
+// rotarImagenConcurrente(). Un recorte (o un escalado o rotación con región)
+// convierte la imagen en una vista sin copia; si al final sigue siéndolo, se
+// compacta. Con región, brillo, desenfoque y Sobel solo cambian el
+// rectángulo: un segmento con región admite un vecindario solo como primer
+// paso, para que su halo se lea de la imagen como la dejó el paso anterior.
+// POR QUÉ: El "pipeline completo" del README (escalar → desenfoque → brillo)
+// hacía una pasada y una matriz nueva por operación; fusionado cuesta
+// aproximadamente un solo recorrido de memoria. La rotación necesita filas
+// arbitrarias del origen, por eso no se fusiona. Las regiones hacen que
+// ajustar una marca de agua o una cara cueste lo que mide el rectángulo.
+static int ejecutarPipelineFusionadoConcurrente(ImagenInfo* info, const PasoPipeline* pasos, int numPasos) {
+    if (!info || !info->pixeles) {
+        fprintf(stderr, "Error: No hay imagen cargada para el pipeline\n");
+        return 0;
+    }
+    if (!pasos || numPasos <= 0) {
+        fprintf(stderr, "Error: El pipeline no tiene pasos\n");
+        return 0;
+    }
+
+    // Validar parámetros de todos los pasos antes de tocar la imagen
+    if (!validarPasosPipeline(info, pasos, numPasos)) return 0;
+
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+    int i = 0;
+    while (i < numPasos) {
+        const PasoPipeline* paso = &pasos[i];
+        int conRegion = pasoConRegion(paso);
+
+        // Recorte, o escalado/rotación de una región: vista sin copia y el
+        // paso sigue sobre ella como si fuera la imagen completa
+        if (paso->tipo == PASO_RECORTAR || (conRegion && (paso->tipo == PASO_ESCALAR || paso->tipo == PASO_ROTAR))) {
+            if (!recortarSinCopia(info, paso->regionX, paso->regionY, paso->regionAncho, paso->regionAlto)) break;
+        }
+        if (paso->tipo == PASO_RECORTAR || paso->tipo == PASO_ROTAR) {
+            if (paso->tipo == PASO_ROTAR && !rotarImagenConcurrente(info, paso->angulo)) break;
+            i++;
+            continue;
+        }
+        if (conRegion && paso->tipo == PASO_ESCALAR) {
+            PasoPipeline completo = *paso;
+            completo.regionAncho = completo.regionAlto = 0;
+            if (!ejecutarSegmentoFusionado(info, &completo, 1)) break;
+            i++;
+            continue;
+        }
+
+        // Segmento: pasos seguidos sin rotar ni recortar; con región, la misma
+        // región y después del primero solo brillos
+        int fin = i + 1;
+        while (fin < numPasos && pasos[fin].tipo != PASO_ROTAR && pasos[fin].tipo != PASO_RECORTAR &&
+               pasoConRegion(&pasos[fin]) == conRegion &&
+               (!conRegion || (pasos[fin].tipo == PASO_BRILLO && pasos[fin].regionX == paso->regionX &&
+                               pasos[fin].regionY == paso->regionY && pasos[fin].regionAncho == paso->regionAncho &&
+                               pasos[fin].regionAlto == paso->regionAlto))) {
+            fin++;
+        }
+        if (!ejecutarSegmentoFusionado(info, paso, fin - i)) break;
+        i = fin;
+    }
+
+    // La vista no sale del pipeline (tampoco cuando un paso falló): se
+    // compacta, y si no hay memoria ni para eso la imagen vuelve a ser la
+    // matriz completa de la que se recortó, que no necesita reservar nada
+    if (!compactarVista(info)) {
+        fprintf(stderr, "Error: Memoria insuficiente para compactar el recorte; se conserva la imagen sin recortar\n");
+        restaurarRaizVista(info);
+        return 0;
+    }
+    if (i < numPasos) return 0;   // Un paso falló (ya informado)
+
+    // Un paso suelto se registra con su nombre (una rotación sola ya se
+    // registró dentro de rotarImagenConcurrente); varios, como "pipeline"
+    if (numPasos > 1) {
+        char detalle[128] = "";
+        for (int i = 0; i < numPasos && strlen(detalle) + 16 < sizeof(detalle); i++) {
+            if (i > 0) strcat(detalle, "+");
+            strcat(detalle, nombrePasoPipeline(pasos[i].tipo));
+        }
+        terminarMedicion(&medicion, "pipeline", detalle, info);
+    } else if (pasos[0].tipo != PASO_ROTAR) {
+        terminarMedicion(&medicion, nombrePasoPipeline(pasos[0].tipo), NULL, info);
+    }
+    informar("Pipeline de %d pasos ejecutado. Resultado: %dx%d (%s)\n", numPasos,
+           info->ancho, info->alto, info->canales == 1 ? "grises" : "RGB");
+    return 1;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Lee un entero desde la entrada estándar mostrando un mensaje.
+// CÓMO: Imprime el mensaje, usa scanf y limpia el buffer en ambos casos.
+// POR QUÉ: Los submenús piden muchos parámetros seguidos; evita repetir el
+// patrón scanf + limpieza en cada uno.
+static int leerEnteroMenu(const char* mensaje, int* valor) {
+    printf("%s", mensaje);
+    int ok = scanf("%d", valor) == 1;
+    while (getchar() != '\n');
+    if (!ok) printf("Entrada inválida.\n");
+    return ok;
+}
+
+// QUÉ: Lee un número real desde la entrada estándar mostrando un mensaje.
+// CÓMO: Igual que leerEnteroMenu() pero con %f; rechaza nan e inf.
+// POR QUÉ: Sigma y ángulos son valores reales, y uno no finito daría
+// dimensiones sin sentido al rotar.
+static int leerRealMenu(const char* mensaje, float* valor) {
+    printf("%s", mensaje);
+    int ok = scanf("%f", valor) == 1 && isfinite(*valor);
+    while (getchar() != '\n');
+    if (!ok) printf("Entrada inválida.\n");
+    return ok;
+}
+
+// QUÉ: Lee un rectángulo x, y, ancho, alto desde la entrada estándar.
+// CÓMO: Cuatro leerEnteroMenu() seguidos sobre los campos de región del paso.
+// POR QUÉ: Lo piden el recorte y la región de interés del submenú.
+static int leerRegionMenu(PasoPipeline* paso) {
+    return leerEnteroMenu("x: ", &paso->regionX) && leerEnteroMenu("y: ", &paso->regionY) &&
+           leerEnteroMenu("Ancho: ", &paso->regionAncho) && leerEnteroMenu("Alto: ", &paso->regionAlto);
+}
+
+// QUÉ: Submenú para armar un pipeline paso a paso y ejecutarlo fusionado.
+// CÓMO: Pide el número de pasos y, para cada uno, su tipo y parámetros. El
+// tipo 7 fija una región de interés para los pasos siguientes (no cuenta
+// como paso; ancho y alto 0 vuelven a la imagen completa).
+// POR QUÉ: Permite ejecutar una cadena completa con un solo recorrido.
+static void menuPipelineFusionado(ImagenInfo* imagen) {
+    if (!imagen->pixeles) {
+        printf("Primero carga una imagen (opción 1).\n");
+        return;
+    }
+
+    int numPasos;
+    if (!leerEnteroMenu("Número de pasos (1-16): ", &numPasos)) return;
+    if (numPasos < 1 || numPasos > 16) {
+        printf("El número de pasos debe estar entre 1 y 16.\n");
+        return;
+    }
+
+    PasoPipeline pasos[16];
+    PasoPipeline region;
+    memset(pasos, 0, sizeof(pasos));
+    memset(&region, 0, sizeof(region));
+    for (int i = 0; i < numPasos; i++) {
+        int tipo;
+        printf("Paso %d: 1=brillo, 2=desenfoque, 3=escalar, 4=rotar, 5=bordes Sobel, 6=recortar, "
+               "7=región para los pasos siguientes\n", i + 1);
+        if (!leerEnteroMenu("Tipo: ", &tipo)) return;
+        if (tipo >= 1 && tipo <= 5) {
+            pasos[i].regionX = region.regionX;
+            pasos[i].regionY = region.regionY;
+            pasos[i].regionAncho = region.regionAncho;
+            pasos[i].regionAlto = region.regionAlto;
+        }
+        switch (tipo) {
+            case 1:
+                pasos[i].tipo = PASO_BRILLO;
+                if (!leerEnteroMenu("Valor de brillo (+/-): ", &pasos[i].delta)) return;
+                break;
+            case 2:
+                pasos[i].tipo = PASO_DESENFOQUE;
+                if (!leerEnteroMenu("Tamaño del kernel (impar): ", &pasos[i].tamKernel)) return;
+                if (!leerRealMenu("Sigma: ", &pasos[i].sigma)) return;
+                break;
+            case 3:
+                pasos[i].tipo = PASO_ESCALAR;
+                if (!leerEnteroMenu("Nuevo ancho: ", &pasos[i].nuevoAncho)) return;
+                if (!leerEnteroMenu("Nuevo alto: ", &pasos[i].nuevoAlto)) return;
+                break;
+            case 4:
+                pasos[i].tipo = PASO_ROTAR;
+                if (!leerRealMenu("Ángulo (grados): ", &pasos[i].angulo)) return;
+                break;
+            case 5:
+                pasos[i].tipo = PASO_SOBEL;
+                break;
+            case 6:
+                pasos[i].tipo = PASO_RECORTAR;
+                if (!leerRegionMenu(&pasos[i])) return;
+                break;
+            case 7:
+                if (!leerRegionMenu(&region)) return;
+                i--;
+                break;
+            default:
+                printf("Tipo inválido.\n");
+                return;
+        }
+    }
+
+    ejecutarPipelineFusionadoConcurrente(imagen, pasos, numPasos);
+}
+
+// QUÉ: Compara el pipeline del README ejecutado paso a paso y fusionado.
+// CÓMO: Sobre dos copias de la imagen ejecuta escalar (mitad de tamaño) →
+// desenfoque 3x3 → brillo +30, primero con las funciones individuales y luego
+// con el pipeline fusionado; mide ambos tiempos y verifica que coincidan.
+// POR QUÉ: Muestra en cada máquina cuánto ahorra evitar las pasadas y las
+// matrices intermedias.
+static void medirPipelineFusionado(const ImagenInfo* info) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    ImagenInfo secuencial = *info;
+    ImagenInfo fusionado = *info;
+    memset(&secuencial.repuesto, 0, sizeof(secuencial.repuesto));
+    memset(&fusionado.repuesto, 0, sizeof(fusionado.repuesto));
+    secuencial.pixeles = clonarMatriz3D(info->pixeles, info->alto, info->ancho, info->canales);
+    fusionado.pixeles = clonarMatriz3D(info->pixeles, info->alto, info->ancho, info->canales);
+    if (!secuencial.pixeles || !fusionado.pixeles) {
+        fprintf(stderr, "Error: Memoria insuficiente para el benchmark\n");
+        liberarImagen(&secuencial);
+        liberarImagen(&fusionado);
+        return;
+    }
+
+    int nuevoAncho = info->ancho / 2 > 0 ? info->ancho / 2 : 1;
+    int nuevoAlto = info->alto / 2 > 0 ? info->alto / 2 : 1;
+    PasoPipeline pasos[3];
+    memset(pasos, 0, sizeof(pasos));
+    pasos[0].tipo = PASO_ESCALAR;
+    pasos[0].nuevoAncho = nuevoAncho;
+    pasos[0].nuevoAlto = nuevoAlto;
+    pasos[1].tipo = PASO_DESENFOQUE;
+    pasos[1].tamKernel = 3;
+    pasos[1].sigma = 1.0f;
+    pasos[2].tipo = PASO_BRILLO;
+    pasos[2].delta = 30;
+
+    double t0 = tiempoActualSegundos();
+    escalarImagenConcurrente(&secuencial, nuevoAncho, nuevoAlto);
+    aplicarConvolucionConcurrente(&secuencial, 3, 1.0f);
+    ajustarBrilloConcurrente(&secuencial, 30);
+    double tSecuencial = tiempoActualSegundos() - t0;
+
+    t0 = tiempoActualSegundos();
+    ejecutarPipelineFusionadoConcurrente(&fusionado, pasos, 3);
+    double tFusionado = tiempoActualSegundos() - t0;
+
+    int iguales = secuencial.alto == fusionado.alto && secuencial.ancho == fusionado.ancho &&
+                  memcmp(secuencial.pixeles[0][0], fusionado.pixeles[0][0],
+                         (size_t)secuencial.alto * secuencial.ancho * secuencial.canales) == 0;
+
+    printf("\nPipeline escalar %dx%d → desenfoque 3x3 → brillo +30:\n", nuevoAncho, nuevoAlto);
+    printf("  paso a paso: %8.3f ms\n", tSecuencial * 1e3);
+    printf("  fusionado:   %8.3f ms (%.2fx)\n", tFusionado * 1e3,
+           tFusionado > 0 ? tSecuencial / tFusionado : 0.0);
+    printf("  resultados %s\n", iguales ? "idénticos" : "DIFERENTES");
+
+    liberarImagen(&secuencial);
+    liberarImagen(&fusionado);
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// IMÁGENES FUERA DE MEMORIA (ARCHIVO DE TESELAS PROYECTADO CON MMAP)
+// =====================================================================
+
+#define MAGIA_TESELAS "IMGTSL1"     // Identificador del formato (8 bytes con '\0')
+#define LADO_TESELA_DISCO 256       // Lado por defecto (potencia de 2)
+#define FACTOR_VENTANA_MAPEADA 4    // Ventana máxima de escalado/rotación: 4 teselas de área
+
+// QUÉ: Cabecera del archivo de teselas (.tsl) tal como se guarda en disco.
+// CÓMO: Tamaños fijos (stdint) y desplazamiento de los datos alineado a página.
+// Los píxeles se guardan por teselas de lado x lado (en orden de filas de
+// teselas) y dentro de cada tesela en orden [y][x][c]; las teselas del borde
+// se guardan completas (con relleno).
+// POR QUÉ: Un bloque 2D de la imagen queda contiguo en el archivo, de modo que
+// procesar una tesela toca pocas páginas aunque la imagen mida decenas de GB.
+typedef struct {
+    char magia[8];                 // MAGIA_TESELAS
+    int32_t ancho;                 // Ancho en píxeles
+    int32_t alto;                  // Alto en píxeles
+    int32_t canales;               // 1 o 3
+    int32_t lado;                  // Lado de la tesela (potencia de 2)
+    int64_t desplazamientoDatos;   // Inicio de los píxeles (múltiplo de página)
+} CabeceraTeselas;
+
+// QUÉ: Imagen almacenada en un archivo de teselas proyectado en memoria.
+// CÓMO: Guarda la geometría, la proyección (mmap) y un puntero al primer píxel.
+// POR QUÉ: El sistema operativo trae a RAM solo las páginas que se tocan y
+// puede descartarlas después, así que el trabajo no depende del tamaño total.
+typedef struct {
+    int ancho, alto, canales;      // Geometría de la imagen
+    int lado;                      // Lado de la tesela
+    int desplazamientoLado;        // log2(lado): x >> desplazamientoLado = tesela
+    int teselasX, teselasY;        // Número de teselas por fila y por columna
+    size_t bytesTesela;            // lado * lado * canales
+    unsigned char* datos;          // Primer byte de la primera tesela
+    void* mapa;                    // Inicio de la proyección (cabecera incluida)
+    size_t tamMapa;                // Tamaño de la proyección
+    int fd;                        // Descriptor del archivo
+} ImagenMapeada;
+
+// QUÉ: Devuelve el puntero a los canales del píxel (x, y) de una imagen mapeada.
+// CÓMO: Con lado potencia de 2, la tesela y la posición dentro de ella salen
+// de desplazamientos y máscaras de bits.
+// POR QUÉ: Es el equivalente a pixeles[y][x] para imágenes en disco.
+static unsigned char* pixelMapeado(const ImagenMapeada* img, int x, int y) {
+    int tx = x >> img->desplazamientoLado;
+    int ty = y >> img->desplazamientoLado;
+    int lx = x & (img->lado - 1);
+    int ly = y & (img->lado - 1);
+    size_t tesela = (size_t)ty * img->teselasX + tx;
+    return img->datos + tesela * img->bytesTesela +
+           ((size_t)ly * img->lado + lx) * img->canales;
+}
+
+// QUÉ: Completa los campos derivados de una ImagenMapeada y valida la geometría.
+// CÓMO: Calcula log2(lado), número de teselas y tamaño de cada tesela.
+// POR QUÉ: Se comparte entre crear y abrir.
+static int prepararGeometriaMapeada(ImagenMapeada* img) {
+    if (img->ancho <= 0 || img->alto <= 0 || (img->canales != 1 && img->canales != 3) ||
+        img->lado < 16 || (img->lado & (img->lado - 1)) != 0) {
+        return 0;
+    }
+    img->desplazamientoLado = 0;
+    while ((1 << img->desplazamientoLado) < img->lado) img->desplazamientoLado++;
+    img->teselasX = (img->ancho + img->lado - 1) / img->lado;
+    img->teselasY = (img->alto + img->lado - 1) / img->lado;
+    img->bytesTesela = (size_t)img->lado * img->lado * img->canales;
+    return 1;
+}
+
+// QUÉ: Crea un archivo de teselas vacío y lo proyecta para lectura/escritura.
+// CÓMO: Escribe la cabecera, extiende el archivo con ftruncate (sin escribir
+// los píxeles: el sistema crea un archivo disperso) y lo proyecta con mmap
+// compartido, de modo que lo escrito en memoria termina en el archivo.
+// POR QUÉ: Permite crear resultados más grandes que la RAM disponible.
+static int crearImagenMapeada(const char* ruta, int ancho, int alto, int canales, int lado,
+                       ImagenMapeada* img) {
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+    img->ancho = ancho;
+    img->alto = alto;
+    img->canales = canales;
+    img->lado = lado;
+    if (!prepararGeometriaMapeada(img)) {
+        fprintf(stderr, "Error: Geometría inválida para archivo de teselas (%dx%d, %d canales, lado %d)\n",
+                ancho, alto, canales, lado);
+        return 0;
+    }
+
+    long pagina = sysconf(_SC_PAGESIZE);
+    CabeceraTeselas cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magia, MAGIA_TESELAS, sizeof(cab.magia));
+    cab.ancho = ancho;
+    cab.alto = alto;
+    cab.canales = canales;
+    cab.lado = lado;
+    cab.desplazamientoDatos = ((sizeof(cab) + pagina - 1) / pagina) * pagina;
+
+    size_t bytesDatos = (size_t)img->teselasX * img->teselasY * img->bytesTesela;
+    img->tamMapa = (size_t)cab.desplazamientoDatos + bytesDatos;
+
+    img->fd = open(ruta, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (img->fd < 0) {
+        fprintf(stderr, "Error al crear archivo de teselas: %s\n", ruta);
+        return 0;
+    }
+    if (write(img->fd, &cab, sizeof(cab)) != (ssize_t)sizeof(cab) ||
+        ftruncate(img->fd, (off_t)img->tamMapa) != 0) {
+        fprintf(stderr, "Error al reservar %zu bytes en: %s\n", img->tamMapa, ruta);
+        close(img->fd);
+        img->fd = -1;
+        return 0;
+    }
+    img->mapa = mmap(NULL, img->tamMapa, PROT_READ | PROT_WRITE, MAP_SHARED, img->fd, 0);
+    if (img->mapa == MAP_FAILED) {
+        fprintf(stderr, "Error al proyectar archivo de teselas: %s\n", ruta);
+        close(img->fd);
+        img->fd = -1;
+        img->mapa = NULL;
+        return 0;
+    }
+    img->datos = (unsigned char*)img->mapa + cab.desplazamientoDatos;
+    return 1;
+}
+
+// QUÉ: Abre un archivo de teselas existente y lo proyecta en memoria.
+// CÓMO: Lee y valida la cabecera, comprueba el tamaño del archivo y hace mmap
+// de solo lectura (o lectura/escritura si se pide).
+// POR QUÉ: Las operaciones leen el origen sin cargarlo completo en RAM.
+static int abrirImagenMapeada(const char* ruta, int escritura, ImagenMapeada* img) {
+    memset(img, 0, sizeof(*img));
+    img->fd = open(ruta, escritura ? O_RDWR : O_RDONLY);
+    if (img->fd < 0) {
+        fprintf(stderr, "Error al abrir archivo de teselas: %s\n", ruta);
+        return 0;
+    }
+
+    CabeceraTeselas cab;
+    struct stat st;
+    if (read(img->fd, &cab, sizeof(cab)) != (ssize_t)sizeof(cab) ||
+        memcmp(cab.magia, MAGIA_TESELAS, sizeof(cab.magia)) != 0 || fstat(img->fd, &st) != 0) {
+        fprintf(stderr, "Error: %s no es un archivo de teselas válido\n", ruta);
+        close(img->fd);
+        return 0;
+    }
+    img->ancho = cab.ancho;
+    img->alto = cab.alto;
+    img->canales = cab.canales;
+    img->lado = cab.lado;
+    if (!prepararGeometriaMapeada(img) || cab.desplazamientoDatos < (int64_t)sizeof(cab)) {
+        fprintf(stderr, "Error: Cabecera de teselas inválida en %s\n", ruta);
+        close(img->fd);
+        return 0;
+    }
+    img->tamMapa = (size_t)cab.desplazamientoDatos +
+                   (size_t)img->teselasX * img->teselasY * img->bytesTesela;
+    if ((size_t)st.st_size < img->tamMapa) {
+        fprintf(stderr, "Error: Archivo de teselas truncado: %s\n", ruta);
+        close(img->fd);
+        return 0;
+    }
+
+    int proteccion = escritura ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    img->mapa = mmap(NULL, img->tamMapa, proteccion, MAP_SHARED, img->fd, 0);
+    if (img->mapa == MAP_FAILED) {
+        fprintf(stderr, "Error al proyectar archivo de teselas: %s\n", ruta);
+        close(img->fd);
+        img->mapa = NULL;
+        return 0;
+    }
+    img->datos = (unsigned char*)img->mapa + cab.desplazamientoDatos;
+    return 1;
+}
+
+// QUÉ: Cierra una imagen mapeada.
+// CÓMO: munmap de la proyección y close del descriptor (los cambios ya están
+// en la caché de páginas del sistema y se escriben al disco).
+// POR QUÉ: Libera los recursos del sistema operativo.
+static void cerrarImagenMapeada(ImagenMapeada* img) {
+    if (img->mapa) munmap(img->mapa, img->tamMapa);
+    if (img->fd >= 0) close(img->fd);
+    img->mapa = NULL;
+    img->datos = NULL;
+    img->fd = -1;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Devuelve al sistema las páginas de una tesela ya procesada.
+// CÓMO: madvise(MADV_DONTNEED) sobre las páginas completas de la tesela. En
+// una proyección compartida de archivo no se pierde nada: si se vuelve a
+// acceder, el contenido se relee desde el archivo.
+// POR QUÉ: Mantiene acotado el conjunto de trabajo aunque se recorran GB.
+static void soltarTeselaMapeada(const ImagenMapeada* img, int tx, int ty) {
+    long pagina = sysconf(_SC_PAGESIZE);
+    unsigned char* inicio = img->datos + ((size_t)ty * img->teselasX + tx) * img->bytesTesela;
+    uintptr_t a = ((uintptr_t)inicio + pagina - 1) & ~(uintptr_t)(pagina - 1);
+    uintptr_t b = ((uintptr_t)inicio + img->bytesTesela) & ~(uintptr_t)(pagina - 1);
+    if (b > a) madvise((void*)a, b - a, MADV_DONTNEED);
+}
+
+// QUÉ: Copia un rectángulo de una imagen mapeada a una matriz 3D en memoria.
+// CÓMO: Para cada píxel destino (i, j) lee el origen (x0 + i, y0 + j) con las
+// coordenadas recortadas al borde (replicación). Si convertirGris es 1 y el
+// origen es RGB, guarda la luminancia en 1 canal (misma fórmula que Sobel).
+// POR QUÉ: Las operaciones copian su tesela + halo a una ventana pequeña y
+// reutilizan los kernels de memoria sin cambios.
+static void copiarVentanaMapeada(const ImagenMapeada* img, int x0, int y0, int ancho, int alto,
+                                 int convertirGris, unsigned char*** ventana) {
+    for (int j = 0; j < alto; j++) {
+        int y = y0 + j;
+        if (y < 0) y = 0;
+        if (y >= img->alto) y = img->alto - 1;
+        for (int i = 0; i < ancho; i++) {
+            int x = x0 + i;
+            if (x < 0) x = 0;
+            if (x >= img->ancho) x = img->ancho - 1;
+            unsigned char* px = pixelMapeado(img, x, y);
+            if (convertirGris && img->canales == 3) {
+                ventana[j][i][0] = (unsigned char)(0.299f * px[0] + 0.587f * px[1] + 0.114f * px[2]);
+            } else {
+                for (int c = 0; c < img->canales; c++) ventana[j][i][c] = px[c];
+            }
+        }
+    }
+}
+
+// QUÉ: Escribe una región de una matriz 3D en una tesela de la imagen mapeada.
+// CÓMO: Copia fila a fila (dentro de una tesela cada fila es contigua) la
+// región [ox, ox + ancho) x [oy, oy + alto) de 'region' en (x0, y0).
+// POR QUÉ: Complemento de copiarVentanaMapeada() para guardar resultados.
+static void escribirTeselaMapeada(ImagenMapeada* img, int x0, int y0, int ancho, int alto,
+                                  unsigned char*** region, int ox, int oy) {
+    for (int j = 0; j < alto; j++) {
+        memcpy(pixelMapeado(img, x0, y0 + j), region[oy + j][ox], (size_t)ancho * img->canales);
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Tipos de operación fuera de memoria.
+// CÓMO: Cada valor corresponde a una operación en memoria equivalente.
+// POR QUÉ: Una sola función de tesela atiende las cuatro operaciones.
+typedef enum {
+    MAPEADA_DESENFOQUE,
+    MAPEADA_ESCALAR,
+    MAPEADA_ROTAR,
+    MAPEADA_SOBEL
+} OperacionMapeada;
+
+// QUÉ: Datos compartidos por las teselas de una operación fuera de memoria.
+// CÓMO: Origen y destino mapeados más los parámetros de la operación.
+// POR QUÉ: Se pasa como 'datos' al motor de teselas (solo lectura salvo destino).
+typedef struct {
+    OperacionMapeada operacion;
+    const ImagenMapeada* origen;
+    ImagenMapeada* destino;
+    float** kernel;                // Desenfoque
+    int tamKernel;                 // Desenfoque
+    float anguloRad;               // Rotación
+    int teselasFallidas;           // Teselas sin memoria para su ventana (atómico)
+} MapeadaArgs;
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Interpolación bilineal leyendo directamente de la imagen mapeada.
+// CÓMO: Las mismas cuentas y el mismo clamp al borde que
+// interpolacionBilineal(), con pixelMapeado() en lugar de img[y][x].
+// POR QUÉ: Al reducir mucho, la caja de origen de una tesela destino crece
+// con el factor de escala; muestrear sin copiarla mantiene acotado el
+// conjunto de trabajo (cada píxel destino toca solo 4 del origen).
+static unsigned char interpolacionBilinealMapeada(const ImagenMapeada* img, float x, float y, int c) {
+    int x0 = (int)floor(x), y0 = (int)floor(y);
+    int x1 = x0 + 1, y1 = y0 + 1;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= img->ancho) x1 = img->ancho - 1;
+    if (y1 >= img->alto) y1 = img->alto - 1;
+    float a = x - x0, b = y - y0;
+    float v00 = pixelMapeado(img, x0, y0)[c];
+    float v10 = pixelMapeado(img, x1, y0)[c];
+    float v01 = pixelMapeado(img, x0, y1)[c];
+    float v11 = pixelMapeado(img, x1, y1)[c];
+    float resultado = (1.0f - a) * (1.0f - b) * v00 + a * (1.0f - b) * v10 + (1.0f - a) * b * v01 + a * b * v11;
+    return (unsigned char)(resultado + 0.5f);
+}
+
+// QUÉ: Procesa una tesela del destino de una operación fuera de memoria.
+// CÓMO: Calcula qué rectángulo del origen necesita la tesela (la tesela más el
+// halo del kernel, o la caja que contiene sus coordenadas de origen en escalado
+// y rotación), lo copia a una ventana en memoria, aplica el mismo kernel que la
+// versión en memoria y escribe el resultado en la tesela del destino. Después
+// suelta las páginas de la tesela escrita. Si la caja de origen supera
+// FACTOR_VENTANA_MAPEADA teselas (reducciones fuertes) no se copia: se
+// muestrea directamente del archivo. Si falta memoria para la ventana, cuenta
+// la tesela en teselasFallidas y la operación completa falla.
+// POR QUÉ: El conjunto de trabajo por hilo es una ventana de pocos cientos de KB.
+static void operacionMapeadaTesela(void* datos, int hilo, int x0, int y0, int x1, int y1) {
+    (void)hilo;
+    MapeadaArgs* m = (MapeadaArgs*)datos;
+    const ImagenMapeada* o = m->origen;
+    ImagenMapeada* d = m->destino;
+    int ancho = x1 - x0, alto = y1 - y0;
+
+    if (m->operacion == MAPEADA_DESENFOQUE || m->operacion == MAPEADA_SOBEL) {
+        int halo = (m->operacion == MAPEADA_DESENFOQUE) ? m->tamKernel / 2 : 1;
+        int canalesVentana = (m->operacion == MAPEADA_SOBEL) ? 1 : o->canales;
+        int anchoV = ancho + 2 * halo, altoV = alto + 2 * halo;
+        unsigned char*** ventana = asignarMatriz3D(altoV, anchoV, canalesVentana);
+        unsigned char*** salida = asignarMatriz3D(altoV, anchoV, canalesVentana);
+        if (!ventana || !salida) {
+            liberarMatriz3D(ventana, altoV, anchoV);
+            liberarMatriz3D(salida, altoV, anchoV);
+            __atomic_fetch_add(&m->teselasFallidas, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        copiarVentanaMapeada(o, x0 - halo, y0 - halo, anchoV, altoV,
+                             m->operacion == MAPEADA_SOBEL, ventana);
+        if (m->operacion == MAPEADA_DESENFOQUE) {
+            ConvolucionArgs c;
+            c.pixelesOrigen = ventana;
+            c.pixelesDestino = salida;
+            c.kernel = m->kernel;
+            c.tamKernel = m->tamKernel;
+            c.inicio = 0;
+            c.fin = altoV;
+            c.ancho = anchoV;
+            c.alto = altoV;
+            c.canales = canalesVentana;
+            convolucionRegion(&c, halo, halo, halo + ancho, halo + alto);
+        } else {
+            SobelArgs s;
+            s.origen = ventana;
+            s.destino = salida;
+            s.inicio = 0;
+            s.fin = altoV;
+            s.ancho = anchoV;
+            s.alto = altoV;
+            sobelRegion(&s, halo, halo, halo + ancho, halo + alto);
+        }
+        escribirTeselaMapeada(d, x0, y0, ancho, alto, salida, halo, halo);
+        liberarMatriz3D(ventana, altoV, anchoV);
+        liberarMatriz3D(salida, altoV, anchoV);
+    } else {
+        // Escalado y rotación: caja del origen que cubre la tesela destino
+        float scaleX = (float)o->ancho / d->ancho, scaleY = (float)o->alto / d->alto;
+        float cxO = o->ancho / 2.0f, cyO = o->alto / 2.0f;
+        float cxN = d->ancho / 2.0f, cyN = d->alto / 2.0f;
+        float cosA = cosf(m->anguloRad), sinA = sinf(m->anguloRad);
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+        for (int esquina = 0; esquina < 4; esquina++) {
+            float x = (esquina & 1) ? (float)(x1 - 1) : (float)x0;
+            float y = (esquina & 2) ? (float)(y1 - 1) : (float)y0;
+            float xO, yO;
+            if (m->operacion == MAPEADA_ESCALAR) {
+                xO = x * scaleX;
+                yO = y * scaleY;
+            } else {
+                xO = (x - cxN) * cosA + (y - cyN) * sinA + cxO;
+                yO = -(x - cxN) * sinA + (y - cyN) * cosA + cyO;
+            }
+            if (xO < minX) minX = xO;
+            if (xO > maxX) maxX = xO;
+            if (yO < minY) minY = yO;
+            if (yO > maxY) maxY = yO;
+        }
+        int bx0 = (int)floorf(minX) - 1, by0 = (int)floorf(minY) - 1;
+        int bx1 = (int)floorf(maxX) + 2, by1 = (int)floorf(maxY) + 2;
+        if (bx0 < 0) bx0 = 0;
+        if (by0 < 0) by0 = 0;
+        if (bx1 > o->ancho) bx1 = o->ancho;
+        if (by1 > o->alto) by1 = o->alto;
+
+        unsigned char*** salida = asignarMatriz3D(alto, ancho, o->canales);
+        if (!salida) {
+            __atomic_fetch_add(&m->teselasFallidas, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        unsigned char*** ventana = NULL;
+        int anchoV = bx1 - bx0, altoV = by1 - by0;
+        int directo = (size_t)anchoV * altoV > (size_t)FACTOR_VENTANA_MAPEADA * d->lado * d->lado;
+        if (anchoV > 0 && altoV > 0 && !directo) {
+            ventana = asignarMatriz3D(altoV, anchoV, o->canales);
+            if (!ventana) {
+                liberarMatriz3D(salida, alto, ancho);
+                __atomic_fetch_add(&m->teselasFallidas, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            copiarVentanaMapeada(o, bx0, by0, anchoV, altoV, 0, ventana);
+        }
+
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                float xO, yO;
+                if (m->operacion == MAPEADA_ESCALAR) {
+                    xO = x * scaleX;
+                    yO = y * scaleY;
+                } else {
+                    xO = (x - cxN) * cosA + (y - cyN) * sinA + cxO;
+                    yO = -(x - cxN) * sinA + (y - cyN) * cosA + cyO;
+                }
+                int dentro = (ventana || directo) && xO >= 0 && xO < o->ancho && yO >= 0 && yO < o->alto;
+                for (int c = 0; c < o->canales; c++) {
+                    // La ventana llega hasta el borde real del origen, así que
+                    // el clamp de interpolacionBilineal() es el mismo que en memoria
+                    if (!dentro) salida[y - y0][x - x0][c] = 0;
+                    else if (directo) salida[y - y0][x - x0][c] = interpolacionBilinealMapeada(o, xO, yO, c);
+                    else salida[y - y0][x - x0][c] = interpolacionBilineal(ventana, xO - bx0, yO - by0, c,
+                                                                           anchoV, altoV);
+                }
+            }
+        }
+        escribirTeselaMapeada(d, x0, y0, ancho, alto, salida, 0, 0);
+        liberarMatriz3D(ventana, altoV, anchoV);
+        liberarMatriz3D(salida, alto, ancho);
+    }
+
+    soltarTeselaMapeada(d, x0 >> d->desplazamientoLado, y0 >> d->desplazamientoLado);
+}
+
+// QUÉ: Aplica una operación a un archivo de teselas y guarda el resultado en otro.
+// CÓMO: Abre el origen, calcula la geometría del destino (igual, escalada,
+// rotada o en grises para Sobel), lo crea con el mismo lado de tesela y
+// recorre sus teselas con el motor de teselas (hilosPorOperacion hilos).
+// POR QUÉ: Desenfoque, escalado, rotación y Sobel funcionan con imágenes más
+// grandes que la RAM: solo se mantienen unas pocas teselas a la vez.
+static int procesarImagenMapeadaConcurrente(const char* rutaOrigen, const char* rutaDestino,
+                                     OperacionMapeada operacion, int tamKernel, float sigma,
+                                     int nuevoAncho, int nuevoAlto, float angulo) {
+    ImagenMapeada origen, destino;
+    if (!abrirImagenMapeada(rutaOrigen, 0, &origen)) return 0;
+
+    // Crear el destino trunca el archivo: si es el mismo que el origen, la
+    // proyección del origen se quedaría sin páginas detrás (SIGBUS)
+    struct stat stOrigen, stDestino;
+    if (fstat(origen.fd, &stOrigen) == 0 && stat(rutaDestino, &stDestino) == 0 &&
+        stOrigen.st_dev == stDestino.st_dev && stOrigen.st_ino == stDestino.st_ino) {
+        fprintf(stderr, "Error: El destino %s es el mismo archivo que el origen\n", rutaDestino);
+        cerrarImagenMapeada(&origen);
+        return 0;
+    }
+
+    MapeadaArgs m;
+    memset(&m, 0, sizeof(m));
+    m.operacion = operacion;
+    m.origen = &origen;
+    m.destino = &destino;
+
+    int ancho = origen.ancho, alto = origen.alto, canales = origen.canales;
+    if (operacion == MAPEADA_DESENFOQUE) {
+        m.kernel = generarKernelGaussiano(tamKernel, sigma);
+        m.tamKernel = tamKernel;
+        if (!m.kernel) {
+            cerrarImagenMapeada(&origen);
+            return 0;
+        }
+    } else if (operacion == MAPEADA_ESCALAR) {
+        ancho = nuevoAncho;
+        alto = nuevoAlto;
+    } else if (operacion == MAPEADA_ROTAR) {
+        m.anguloRad = angulo * (float)M_PI / 180.0f;
+        float cosA = fabsf(cosf(m.anguloRad)), sinA = fabsf(sinf(m.anguloRad));
+        ancho = (int)ceilf(origen.alto * sinA + origen.ancho * cosA);
+        alto = (int)ceilf(origen.alto * cosA + origen.ancho * sinA);
+    } else {
+        canales = 1;
+    }
+
+    int exito = crearImagenMapeada(rutaDestino, ancho, alto, canales, origen.lado, &destino);
+    if (exito) {
+        // Acceso por teselas: desactivar la lectura anticipada secuencial
+        madvise(origen.mapa, origen.tamMapa, MADV_RANDOM);
+        exito = ejecutarPorTeselasConcurrente("mapeada", ancho, alto, origen.lado, operacionMapeadaTesela, &m);
+        cerrarImagenMapeada(&destino);
+        if (exito && m.teselasFallidas > 0) {
+            fprintf(stderr, "Error: Memoria insuficiente en %d teselas; se descarta %s\n", m.teselasFallidas,
+                    rutaDestino);
+            exito = 0;
+        }
+        if (!exito) unlink(rutaDestino);
+    }
+
+    if (m.kernel) {
+        for (int i = 0; i < tamKernel; i++) free(m.kernel[i]);
+        free(m.kernel);
+    }
+    cerrarImagenMapeada(&origen);
+    if (exito) {
+        informar("Resultado guardado en %s: %dx%d, %d canales (teselas de %d)\n",
+               rutaDestino, ancho, alto, canales, destino.lado);
+    }
+    return exito;
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// QUÉ: Guarda la imagen en memoria como archivo de teselas.
+// CÓMO: Crea el archivo proyectado y copia cada píxel a su tesela.
+// POR QUÉ: Punto de entrada al formato en disco desde una imagen cargada.
+static int exportarImagenMapeada(const ImagenInfo* info, const char* ruta) {
+    if (!info->pixeles) {
+        fprintf(stderr, "No hay imagen para exportar.\n");
+        return 0;
+    }
+    ImagenMapeada img;
+    if (!crearImagenMapeada(ruta, info->ancho, info->alto, info->canales, LADO_TESELA_DISCO, &img)) {
+        return 0;
+    }
+    for (int y = 0; y < info->alto; y++) {
+        for (int x = 0; x < info->ancho; x++) {
+            memcpy(pixelMapeado(&img, x, y), info->pixeles[y][x], info->canales);
+        }
+    }
+    cerrarImagenMapeada(&img);
+    informar("Imagen exportada a %s (%dx%d, teselas de %d)\n", ruta, info->ancho, info->alto,
+           LADO_TESELA_DISCO);
+    return 1;
+}
+
+// QUÉ: Carga un archivo de teselas completo como imagen en memoria.
+// CÓMO: Lo proyecta, asigna la matriz 3D y copia cada píxel desde su tesela.
+// POR QUÉ: Para ver o guardar como PNG resultados que sí caben en RAM (p. ej.
+// tras reducir una imagen enorme).
+static int importarImagenMapeada(const char* ruta, ImagenInfo* info) {
+    ImagenMapeada img;
+    if (!abrirImagenMapeada(ruta, 0, &img)) return 0;
+    unsigned char*** pixeles = asignarMatriz3D(img.alto, img.ancho, img.canales);
+    if (!pixeles) {
+        fprintf(stderr, "Error: La imagen %dx%d no cabe en memoria\n", img.ancho, img.alto);
+        cerrarImagenMapeada(&img);
+        return 0;
+    }
+    madvise(img.mapa, img.tamMapa, MADV_SEQUENTIAL);
+    for (int y = 0; y < img.alto; y++) {
+        for (int x = 0; x < img.ancho; x++) {
+            memcpy(pixeles[y][x], pixelMapeado(&img, x, y), img.canales);
+        }
+    }
+    liberarImagen(info);
+    info->pixeles = pixeles;
+    info->ancho = img.ancho;
+    info->alto = img.alto;
+    info->canales = img.canales;
+    cerrarImagenMapeada(&img);
+    informar("Imagen cargada desde teselas: %dx%d, %d canales (%s)\n", info->ancho, info->alto,
+           info->canales, info->canales == 1 ? "grises" : "RGB");
+    return 1;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Lee una ruta desde la entrada estándar mostrando un mensaje.
+// CÓMO: fgets + eliminar el salto de línea, como la opción 1 del menú.
+// POR QUÉ: Los submenús de archivos piden varias rutas.
+static int leerRutaMenu(const char* mensaje, char* ruta, size_t tam) {
+    printf("%s", mensaje);
+    if (fgets(ruta, (int)tam, stdin) == NULL) {
+        printf("Error al leer ruta.\n");
+        return 0;
+    }
+    ruta[strcspn(ruta, "\n")] = 0;
+    return ruta[0] != '\0';
+}
+
+// QUÉ: Submenú de imágenes grandes en disco (archivos de teselas .tsl).
+// CÓMO: Exporta/importa la imagen actual y aplica operaciones de archivo a
+// archivo sin cargar el origen en memoria.
+// POR QUÉ: Permite procesar mapas escaneados de varios GB con memoria acotada.
+static void menuImagenesEnDisco(ImagenInfo* imagen) {
+    while (1) {
+        printf("\n--- Imágenes grandes en disco (teselas .tsl) ---\n");
+        printf("1. Exportar imagen actual a archivo de teselas\n");
+        printf("2. Desenfoque Gaussiano (archivo → archivo)\n");
+        printf("3. Redimensionar (archivo → archivo)\n");
+        printf("4. Rotar (archivo → archivo)\n");
+        printf("5. Detectar bordes Sobel (archivo → archivo)\n");
+        printf("6. Cargar archivo de teselas como imagen actual\n");
+        printf("7. Volver\n");
+
+        int opcion;
+        if (!leerEnteroMenu("Opción: ", &opcion)) continue;
+        if (opcion == 7) return;
+
+        char origen[256], destino[256];
+        switch (opcion) {
+            case 1:
+                if (!imagen->pixeles) {
+                    printf("Primero carga una imagen (opción 1).\n");
+                    break;
+                }
+                if (leerRutaMenu("Archivo de salida (.tsl): ", destino, sizeof(destino))) {
+                    exportarImagenMapeada(imagen, destino);
+                }
+                break;
+            case 2: case 3: case 4: case 5: {
+                if (!leerRutaMenu("Archivo de origen (.tsl): ", origen, sizeof(origen))) break;
+                if (!leerRutaMenu("Archivo de destino (.tsl): ", destino, sizeof(destino))) break;
+                int tamKernel = 0, nuevoAncho = 0, nuevoAlto = 0;
+                float sigma = 0.0f, angulo = 0.0f;
+                OperacionMapeada operacion = MAPEADA_SOBEL;
+                if (opcion == 2) {
+                    operacion = MAPEADA_DESENFOQUE;
+                    if (!leerEnteroMenu("Tamaño del kernel (impar): ", &tamKernel)) break;
+                    if (!leerRealMenu("Sigma: ", &sigma)) break;
+                    if (tamKernel <= 0 || tamKernel % 2 == 0 || sigma <= 0.0f) {
+                        printf("Kernel impar y positivo, sigma positivo.\n");
+                        break;
+                    }
+                } else if (opcion == 3) {
+                    operacion = MAPEADA_ESCALAR;
+                    if (!leerEnteroMenu("Nuevo ancho: ", &nuevoAncho)) break;
+                    if (!leerEnteroMenu("Nuevo alto: ", &nuevoAlto)) break;
+                    if (nuevoAncho <= 0 || nuevoAlto <= 0) {
+                        printf("Las dimensiones deben ser positivas.\n");
+                        break;
+                    }
+                } else if (opcion == 4) {
+                    operacion = MAPEADA_ROTAR;
+                    if (!leerRealMenu("Ángulo (grados): ", &angulo)) break;
+                }
+                procesarImagenMapeadaConcurrente(origen, destino, operacion, tamKernel, sigma,
+                                                 nuevoAncho, nuevoAlto, angulo);
+                break;
+            }
+            case 6:
+                if (leerRutaMenu("Archivo de teselas (.tsl): ", origen, sizeof(origen))) {
+                    importarImagenMapeada(origen, imagen);
+                }
+                break;
+            default:
+                printf("Opción inválida.\n");
+        }
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// CARGA DE PNG EN STREAMING (DECODIFICACIÓN Y PROCESO FILA A FILA)
+// =====================================================================
+
+#define FILAS_COLA_STREAMING 16     // Filas decodificadas en espera como máximo
+
+// QUÉ: Lector de bits del flujo comprimido repartido en los chunks IDAT.
+// CÓMO: Lee bytes del archivo mientras queden en el IDAT actual; al agotarse
+// salta el CRC y continúa con el siguiente chunk si también es IDAT. Los bits
+// se acumulan en un entero de 64 bits empezando por el menos significativo,
+// como exige DEFLATE.
+// POR QUÉ: Permite descomprimir leyendo el archivo de a poco, sin cargar todos
+// los datos comprimidos en memoria.
+typedef struct {
+    FILE* archivo;
+    uint32_t restanteChunk;   // Bytes que quedan en el IDAT actual
+    int sinMasIDAT;           // 1 cuando el siguiente chunk ya no es IDAT
+    uint64_t bits;            // Bits leídos aún no consumidos
+    int numBits;              // Cantidad de bits válidos en 'bits'
+    int error;                // 1 si faltaron datos o el flujo es inválido
+} LectorIDAT;
+
+// QUÉ: Tabla de Huffman canónica para decodificar DEFLATE.
+// CÓMO: 'rapido' resuelve en una consulta los códigos de hasta 9 bits
+// (longitud << 9 | símbolo); los más largos se resuelven con los contadores
+// por longitud y la lista de símbolos ordenada (método canónico).
+// POR QUÉ: La mayoría de los símbolos tienen códigos cortos; la tabla rápida
+// evita leer bit a bit en el caso común.
+typedef struct {
+    uint16_t rapido[512];
+    uint16_t contador[16];
+    uint16_t simbolos[288];
+} TablaHuffman;
+
+// QUÉ: Estado del decodificador PNG en streaming.
+// CÓMO: Contiene el lector, la ventana de 32 KB de DEFLATE, dos filas crudas
+// (actual y anterior, para deshacer los filtros) y la geometría del PNG.
+// POR QUÉ: Con esto basta para producir filas: la memoria no depende del alto.
+typedef struct {
+    LectorIDAT lector;
+    unsigned char ventana[32768];   // Últimos 32 KB descomprimidos
+    uint64_t posVentana;            // Bytes descomprimidos en total (64 bits: no da la vuelta a los 4 GB)
+    unsigned char* filaActual;      // Byte de filtro + datos de la fila en curso
+    unsigned char* filaAnterior;    // Fila previa ya sin filtro (para Up/Avg/Paeth)
+    size_t bytesFila;               // 1 + ancho * bytesPorPixel
+    size_t llenos;                  // Bytes ya recibidos de la fila en curso
+    int bytesPorPixel;              // Bytes por píxel en el PNG (1..4)
+    int filasEntregadas;            // Filas completas producidas
+    int ancho, alto;                // Dimensiones del PNG
+    int tipoColor;                  // 0 gris, 2 RGB, 3 paleta, 4 gris+alfa, 6 RGBA
+    int canales;                    // Canales de salida (1 o 3)
+    unsigned char paleta[256][3];   // PLTE (solo tipo 3)
+    struct ColaFilas* cola;         // Cola donde se entregan las filas
+} DecodificadorPNG;
+
+// QUÉ: Cola acotada de filas entre el hilo decodificador y el que procesa.
+// CÓMO: Búfer circular de FILAS_COLA_STREAMING filas (una pequeña matriz 3D)
+// con mutex y variables de condición. El productor escribe la ranura libre y
+// el consumidor lee la más antigua fuera del mutex: cada ranura tiene un único
+// dueño en cada momento, el mutex solo protege los contadores.
+// POR QUÉ: Es el único punto donde dos hilos se comunican mientras trabajan
+// (a diferencia del reparto por filas con join del resto del programa), por
+// eso aquí sí hace falta sincronización. Acota la memoria a unas pocas filas.
+typedef struct ColaFilas {
+    unsigned char*** filas;         // [capacidad][ancho][canales]
+    int capacidad;
+    int cabeza;                     // Próxima fila a consumir
+    int cantidad;                   // Filas listas
+    int terminado;                  // El productor ya no entregará más filas
+    int error;                      // El productor terminó con error
+    pthread_mutex_t mutex;
+    pthread_cond_t hayFilas;
+    pthread_cond_t hayEspacio;
+} ColaFilas;
+
+// QUÉ: Lee el siguiente byte comprimido (cruzando chunks IDAT si hace falta).
+// CÓMO: Si el IDAT actual se agotó, salta su CRC y lee la cabecera del
+// siguiente chunk; si no es IDAT, el flujo terminó.
+// POR QUÉ: DEFLATE no sabe de chunks: el flujo continúa entre IDAT consecutivos.
+static int siguienteByteIDAT(LectorIDAT* l) {
+    while (l->restanteChunk == 0) {
+        if (l->sinMasIDAT) return -1;
+        unsigned char cab[12];
+        if (fread(cab, 1, 12, l->archivo) != 12) {   // CRC anterior + longitud + tipo
+            l->sinMasIDAT = 1;
+            return -1;
+        }
+        if (memcmp(cab + 8, "IDAT", 4) != 0) {
+            l->sinMasIDAT = 1;
+            return -1;
+        }
+        l->restanteChunk = ((uint32_t)cab[4] << 24) | ((uint32_t)cab[5] << 16) |
+                           ((uint32_t)cab[6] << 8) | cab[7];
+    }
+    l->restanteChunk--;
+    return getc(l->archivo);
+}
+
+// QUÉ: Garantiza al menos n bits en el acumulador (si quedan datos).
+// CÓMO: Agrega bytes por la parte alta del acumulador.
+// POR QUÉ: La tabla rápida de Huffman necesita mirar 9 bits por adelantado.
+static void recargarBits(LectorIDAT* l, int n) {
+    while (l->numBits < n) {
+        int b = siguienteByteIDAT(l);
+        if (b < 0) return;
+        l->bits |= (uint64_t)b << l->numBits;
+        l->numBits += 8;
+    }
+}
+
+// QUÉ: Lee n bits (0..16) del flujo DEFLATE.
+// CÓMO: Recarga, toma los n bits bajos y los descarta del acumulador.
+// POR QUÉ: Campos de cabecera, bits extra de longitudes y distancias.
+static uint32_t leerBitsIDAT(LectorIDAT* l, int n) {
+    recargarBits(l, n);
+    if (l->numBits < n) {
+        l->error = 1;
+        return 0;
+    }
+    uint32_t valor = (uint32_t)(l->bits & ((1u << n) - 1));
+    l->bits >>= n;
+    l->numBits -= n;
+    return valor;
+}
+
+// QUÉ: Construye una tabla de Huffman canónica a partir de las longitudes.
+// CÓMO: Cuenta códigos por longitud, ordena los símbolos y llena la tabla
+// rápida invirtiendo los bits de cada código (DEFLATE los guarda al revés).
+// Rechaza longitudes mayores que 15 y códigos sobre-suscritos.
+// POR QUÉ: Los bloques fijos y dinámicos describen sus códigos solo con
+// longitudes; vienen del archivo, así que una longitud inválida no debe
+// indexar fuera de los contadores.
+static int construirHuffman(TablaHuffman* t, const unsigned char* longitudes, int num) {
+    uint16_t desplazamiento[16];
+    memset(t->contador, 0, sizeof(t->contador));
+    memset(t->rapido, 0, sizeof(t->rapido));
+    for (int i = 0; i < num; i++) {
+        if (longitudes[i] > 15) return 0;
+        t->contador[longitudes[i]]++;
+    }
+    t->contador[0] = 0;
+
+    int disponibles = 1;
+    for (int len = 1; len < 16; len++) {
+        disponibles <<= 1;
+        disponibles -= t->contador[len];
+        if (disponibles < 0) return 0;   // Códigos sobre-suscritos
+    }
+    desplazamiento[1] = 0;
+    for (int len = 1; len < 15; len++) desplazamiento[len + 1] = desplazamiento[len] + t->contador[len];
+    for (int i = 0; i < num; i++) {
+        if (longitudes[i]) t->simbolos[desplazamiento[longitudes[i]]++] = (uint16_t)i;
+    }
+
+    // Tabla rápida: recorrer los códigos canónicos de hasta 9 bits
+    int codigo = 0, indice = 0;
+    for (int len = 1; len <= 9; len++) {
+        for (int k = 0; k < t->contador[len]; k++, codigo++, indice++) {
+            int invertido = 0;
+            for (int b = 0; b < len; b++) invertido |= ((codigo >> b) & 1) << (len - 1 - b);
+            for (int r = invertido; r < 512; r += 1 << len) {
+                t->rapido[r] = (uint16_t)((len << 9) | t->simbolos[indice]);
+            }
+        }
+        codigo <<= 1;
+    }
+    return 1;
+}
+
+// QUÉ: Decodifica un símbolo con la tabla de Huffman.
+// CÓMO: Intenta la tabla rápida con 9 bits; si el código es más largo (o
+// quedan menos bits al final del flujo) decodifica bit a bit canónicamente.
+// POR QUÉ: Es el paso más repetido de la descompresión.
+static int decodificarSimbolo(LectorIDAT* l, const TablaHuffman* t) {
+    recargarBits(l, 16);
+    uint16_t entrada = t->rapido[l->bits & 511];
+    if (entrada && (entrada >> 9) <= l->numBits) {
+        l->bits >>= entrada >> 9;
+        l->numBits -= entrada >> 9;
+        return entrada & 511;
+    }
+    int codigo = 0, primero = 0, indice = 0;
+    for (int len = 1; len < 16; len++) {
+        codigo |= (int)leerBitsIDAT(l, 1);
+        int cuenta = t->contador[len];
+        if (codigo - primero < cuenta) return t->simbolos[indice + codigo - primero];
+        indice += cuenta;
+        primero = (primero + cuenta) << 1;
+        codigo <<= 1;
+        if (l->error) break;
+    }
+    l->error = 1;
+    return -1;
+}
+
+// QUÉ: Predictor de Paeth de PNG.
+// CÓMO: Elige entre izquierda, arriba y diagonal el más cercano a a + b - c.
+// POR QUÉ: Necesario para deshacer el filtro 4.
+static unsigned char predictorPaeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+static void encolarFila(ColaFilas* cola, DecodificadorPNG* d, const unsigned char* cruda);
+
+// QUÉ: Agrega un byte descomprimido a la ventana y a la fila en curso.
+// CÓMO: Cuando la fila se completa, deshace su filtro (None, Sub, Up, Average,
+// Paeth) usando la fila anterior, la entrega a la cola y la convierte en la
+// nueva fila anterior.
+// Tras un error (p. ej. un byte de filtro inválido) no escribe nada más.
+// POR QUÉ: Así cada fila sale en cuanto se descomprime, sin esperar al resto.
+static void emitirBytePNG(DecodificadorPNG* d, unsigned char b) {
+    if (d->lector.error) return;   // La fila en curso ya está llena o es inválida
+    d->ventana[d->posVentana++ & 32767] = b;
+    if (d->filasEntregadas >= d->alto) return;   // Relleno tras la última fila
+    d->filaActual[d->llenos++] = b;
+    if (d->llenos < d->bytesFila) return;
+
+    unsigned char* f = d->filaActual + 1;
+    const unsigned char* ant = d->filaAnterior + 1;
+    size_t n = d->bytesFila - 1;
+    int bpp = d->bytesPorPixel;
+    switch (d->filaActual[0]) {
+        case 0: break;
+        case 1: for (size_t i = bpp; i < n; i++) f[i] += f[i - bpp]; break;
+        case 2: for (size_t i = 0; i < n; i++) f[i] += ant[i]; break;
+        case 3:
+            for (size_t i = 0; i < n; i++) {
+                int izq = i >= (size_t)bpp ? f[i - bpp] : 0;
+                f[i] += (unsigned char)((izq + ant[i]) / 2);
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < n; i++) {
+                int izq = i >= (size_t)bpp ? f[i - bpp] : 0;
+                int diag = i >= (size_t)bpp ? ant[i - bpp] : 0;
+                f[i] += predictorPaeth(izq, ant[i], diag);
+            }
+            break;
+        default:
+            d->lector.error = 1;
+            return;
+    }
+    encolarFila(d->cola, d, f);
+
+    unsigned char* tmp = d->filaAnterior;
+    d->filaAnterior = d->filaActual;
+    d->filaActual = tmp;
+    d->llenos = 0;
+    d->filasEntregadas++;
+}
+
+// QUÉ: Descomprime el flujo zlib/DEFLATE de los IDAT entregando filas.
+// CÓMO: Valida la cabecera zlib y procesa bloques almacenados, de Huffman fijo
+// y de Huffman dinámico (RFC 1951) hasta el bloque final o hasta completar
+// todas las filas. Las copias hacia atrás leen de la ventana de 32 KB.
+// POR QUÉ: stb_image descomprime todo el PNG de una vez; aquí la
+// descompresión avanza al ritmo en que se consumen las filas.
+static int inflarPNG(DecodificadorPNG* d) {
+    static const uint16_t baseLongitud[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,
+                                              35,43,51,59,67,83,99,115,131,163,195,227,258};
+    static const unsigned char extraLongitud[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,
+                                                    3,3,3,3,4,4,4,4,5,5,5,5,0};
+    static const uint16_t baseDistancia[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+                                               257,385,513,769,1025,1537,2049,3073,4097,
+                                               6145,8193,12289,16385,24577};
+    static const unsigned char extraDistancia[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,
+                                                     7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+    static const unsigned char ordenLongitudes[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+    LectorIDAT* l = &d->lector;
+
+    uint32_t cmf = leerBitsIDAT(l, 8), flg = leerBitsIDAT(l, 8);
+    if ((cmf & 15) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 32)) return 0;
+
+    TablaHuffman literales, distancias;
+    int final = 0;
+    while (!final && !l->error && d->filasEntregadas < d->alto) {
+        final = (int)leerBitsIDAT(l, 1);
+        int tipo = (int)leerBitsIDAT(l, 2);
+
+        if (tipo == 0) {
+            // Bloque almacenado: alinear a byte y copiar LEN bytes
+            l->bits >>= l->numBits & 7;
+            l->numBits -= l->numBits & 7;
+            uint32_t len = leerBitsIDAT(l, 16), nlen = leerBitsIDAT(l, 16);
+            if ((len ^ 0xFFFF) != nlen) return 0;
+            for (uint32_t i = 0; i < len && !l->error; i++) emitirBytePNG(d, (unsigned char)leerBitsIDAT(l, 8));
+            continue;
+        }
+
+        unsigned char longitudes[288 + 32];
+        if (tipo == 1) {
+            for (int i = 0; i < 144; i++) longitudes[i] = 8;
+            for (int i = 144; i < 256; i++) longitudes[i] = 9;
+            for (int i = 256; i < 280; i++) longitudes[i] = 7;
+            for (int i = 280; i < 288; i++) longitudes[i] = 8;
+            construirHuffman(&literales, longitudes, 288);
+            for (int i = 0; i < 30; i++) longitudes[i] = 5;
+            construirHuffman(&distancias, longitudes, 30);
+        } else if (tipo == 2) {
+            int hlit = (int)leerBitsIDAT(l, 5) + 257;
+            int hdist = (int)leerBitsIDAT(l, 5) + 1;
+            int hclen = (int)leerBitsIDAT(l, 4) + 4;
+            unsigned char longitudesCodigo[19] = {0};
+            for (int i = 0; i < hclen; i++) longitudesCodigo[ordenLongitudes[i]] = (unsigned char)leerBitsIDAT(l, 3);
+            TablaHuffman tablaCodigos;
+            if (!construirHuffman(&tablaCodigos, longitudesCodigo, 19)) return 0;
+            int n = 0;
+            while (n < hlit + hdist && !l->error) {
+                int sym = decodificarSimbolo(l, &tablaCodigos);
+                if (sym < 0) return 0;
+                if (sym < 16) {
+                    longitudes[n++] = (unsigned char)sym;
+                } else {
+                    int repetir, valor = 0;
+                    if (sym == 16) {
+                        if (n == 0) return 0;
+                        valor = longitudes[n - 1];
+                        repetir = 3 + (int)leerBitsIDAT(l, 2);
+                    } else if (sym == 17) {
+                        repetir = 3 + (int)leerBitsIDAT(l, 3);
+                    } else {
+                        repetir = 11 + (int)leerBitsIDAT(l, 7);
+                    }
+                    if (n + repetir > hlit + hdist) return 0;
+                    while (repetir--) longitudes[n++] = (unsigned char)valor;
+                }
+            }
+            if (l->error) return 0;   // Longitudes incompletas
+            if (!construirHuffman(&literales, longitudes, hlit) ||
+                !construirHuffman(&distancias, longitudes + hlit, hdist)) return 0;
+        } else {
+            return 0;
+        }
+
+        // Símbolos del bloque: literales, longitudes + distancias, fin (256)
+        while (!l->error) {
+            int sym = decodificarSimbolo(l, &literales);
+            if (sym < 0) return 0;
+            if (sym < 256) {
+                emitirBytePNG(d, (unsigned char)sym);
+            } else if (sym == 256) {
+                break;
+            } else {
+                sym -= 257;
+                if (sym >= 29) return 0;
+                int len = baseLongitud[sym] + (int)leerBitsIDAT(l, extraLongitud[sym]);
+                int dsym = decodificarSimbolo(l, &distancias);
+                if (dsym < 0 || dsym >= 30) return 0;
+                uint32_t dist = baseDistancia[dsym] + leerBitsIDAT(l, extraDistancia[dsym]);
+                if (dist > d->posVentana) return 0;
+                for (int i = 0; i < len && !l->error; i++) {
+                    emitirBytePNG(d, d->ventana[(d->posVentana - dist) & 32767]);
+                }
+            }
+            if (d->filasEntregadas >= d->alto) break;
+        }
+    }
+    return !l->error && d->filasEntregadas == d->alto;
+}
+
+// QUÉ: Convierte una fila PNG sin filtro a la fila de salida y la encola.
+// CÓMO: Espera a que haya una ranura libre (mutex + variable de condición),
+// escribe la fila fuera del mutex quitando el alfa o expandiendo la paleta, y
+// la publica incrementando 'cantidad'.
+// POR QUÉ: El decodificador produce filas mientras el otro hilo las procesa;
+// si el consumidor se atrasa, el productor espera en lugar de acumular memoria.
+static void encolarFila(ColaFilas* cola, DecodificadorPNG* d, const unsigned char* cruda) {
+    pthread_mutex_lock(&cola->mutex);
+    while (cola->cantidad == cola->capacidad) pthread_cond_wait(&cola->hayEspacio, &cola->mutex);
+    int ranura = (cola->cabeza + cola->cantidad) % cola->capacidad;
+    pthread_mutex_unlock(&cola->mutex);
+
+    unsigned char** fila = cola->filas[ranura];
+    for (int x = 0; x < d->ancho; x++) {
+        const unsigned char* p = cruda + (size_t)x * d->bytesPorPixel;
+        switch (d->tipoColor) {
+            case 0: case 4: fila[x][0] = p[0]; break;
+            case 2: case 6: fila[x][0] = p[0]; fila[x][1] = p[1]; fila[x][2] = p[2]; break;
+            case 3: memcpy(fila[x], d->paleta[p[0]], 3); break;
+        }
+    }
+
+    pthread_mutex_lock(&cola->mutex);
+    cola->cantidad++;
+    pthread_cond_signal(&cola->hayFilas);
+    pthread_mutex_unlock(&cola->mutex);
+}
+
+// QUÉ: Hilo decodificador: descomprime el PNG y marca el fin en la cola.
+// CÓMO: Llama a inflarPNG() y al terminar (bien o con error) avisa al consumidor.
+// POR QUÉ: La descompresión corre en paralelo con el procesamiento de filas.
+static void* decodificarPNGHilo(void* args) {
+    DecodificadorPNG* d = (DecodificadorPNG*)args;
+    int ok = inflarPNG(d);
+    pthread_mutex_lock(&d->cola->mutex);
+    d->cola->terminado = 1;
+    d->cola->error = !ok;
+    pthread_cond_signal(&d->cola->hayFilas);
+    pthread_mutex_unlock(&d->cola->mutex);
+    return NULL;
+}
+
+// QUÉ: Lee los chunks del PNG hasta el primer IDAT y prepara el decodificador.
+// CÓMO: Valida la firma e IHDR (8 bits por canal, sin entrelazado; tipos 0, 2,
+// 3, 4 y 6), guarda PLTE si existe y deja el archivo al inicio de los datos
+// del primer IDAT.
+// POR QUÉ: Con la cabecera se conocen las dimensiones finales antes de
+// descomprimir, así que el destino se asigna una sola vez.
+static int leerCabeceraPNG(FILE* f, DecodificadorPNG* d) {
+    static const unsigned char firma[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    unsigned char buf[13];
+    if (fread(buf, 1, 8, f) != 8 || memcmp(buf, firma, 8) != 0) return 0;
+
+    int vistoIHDR = 0;
+    while (1) {
+        unsigned char cab[8];
+        if (fread(cab, 1, 8, f) != 8) return 0;
+        uint32_t len = ((uint32_t)cab[0] << 24) | ((uint32_t)cab[1] << 16) |
+                       ((uint32_t)cab[2] << 8) | cab[3];
+        if (memcmp(cab + 4, "IHDR", 4) == 0) {
+            if (len != 13 || fread(buf, 1, 13, f) != 13) return 0;
+            uint32_t ancho = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+            uint32_t alto = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
+            int profundidad = buf[8];
+            d->tipoColor = buf[9];
+            int entrelazado = buf[12];
+            if (ancho == 0 || alto == 0 || ancho > INT_MAX || alto > INT_MAX || profundidad != 8 ||
+                entrelazado != 0) {
+                return 0;
+            }
+            d->ancho = (int)ancho;
+            d->alto = (int)alto;
+            switch (d->tipoColor) {
+                case 0: d->bytesPorPixel = 1; d->canales = 1; break;
+                case 2: d->bytesPorPixel = 3; d->canales = 3; break;
+                case 3: d->bytesPorPixel = 1; d->canales = 3; break;
+                case 4: d->bytesPorPixel = 2; d->canales = 1; break;
+                case 6: d->bytesPorPixel = 4; d->canales = 3; break;
+                default: return 0;
+            }
+            fseek(f, 4, SEEK_CUR);   // CRC
+            vistoIHDR = 1;
+        } else if (memcmp(cab + 4, "PLTE", 4) == 0) {
+            if (len > 768) return 0;
+            unsigned char plte[768];
+            if (fread(plte, 1, len, f) != len) return 0;
+            for (uint32_t i = 0; i < len / 3; i++) memcpy(d->paleta[i], plte + 3 * i, 3);
+            fseek(f, 4, SEEK_CUR);
+        } else if (memcmp(cab + 4, "IDAT", 4) == 0) {
+            if (!vistoIHDR) return 0;
+            d->lector.archivo = f;
+            d->lector.restanteChunk = len;
+            return 1;
+        } else if (memcmp(cab + 4, "IEND", 4) == 0) {
+            return 0;
+        } else {
+            fseek(f, (long)len + 4, SEEK_CUR);   // Chunk auxiliar + CRC
+        }
+    }
+}
+
+// QUÉ: Opciones de procesamiento que se aplican mientras se decodifica.
+// CÓMO: Se aplican en este orden: conversión a gris, escalado bilineal y LUT.
+// rutaTeselas != NULL envía el resultado a un archivo .tsl en lugar de memoria.
+// POR QUÉ: Todas son operaciones que solo necesitan las filas recientes.
+typedef struct {
+    int convertirGris;          // 1 = luminancia (misma fórmula que Sobel)
+    int nuevoAncho;             // 0 = sin escalar
+    int nuevoAlto;              // 0 = sin escalar
+    int aplicarLUT;             // 1 = aplicar 'lut' a cada fila de salida
+    TablaLUT lut;               // Brillo u otra operación puntual compuesta
+    const char* rutaTeselas;    // Destino en disco (NULL = imagen en memoria)
+} OpcionesStreaming;
+
+// QUÉ: Entrega una fila de salida (ya escalada) al destino aplicando la LUT.
+// CÓMO: Aplica la LUT en el lugar y copia la fila a la matriz o al archivo
+// de teselas (por tramos contiguos de cada tesela).
+// POR QUÉ: Último paso común del consumidor.
+static void escribirFilaStreaming(unsigned char** fila, int ancho, int canales, int y,
+                                  const OpcionesStreaming* op, unsigned char*** destino,
+                                  ImagenMapeada* mapeada) {
+    if (op->aplicarLUT) {
+        for (int x = 0; x < ancho; x++) {
+            for (int c = 0; c < canales; c++) fila[x][c] = op->lut.tabla[c][fila[x][c]];
+        }
+    }
+    if (destino) {
+        memcpy(destino[y][0], fila[0], (size_t)ancho * canales);
+    } else {
+        for (int x0 = 0; x0 < ancho; x0 += mapeada->lado) {
+            int n = (x0 + mapeada->lado < ancho) ? mapeada->lado : ancho - x0;
+            memcpy(pixelMapeado(mapeada, x0, y), fila[x0], (size_t)n * canales);
+        }
+    }
+}
+
+// QUÉ: Carga un PNG fila a fila aplicando gris/escalado/LUT durante la decodificación.
+// CÓMO: Un hilo descomprime y deshace filtros; este hilo consume cada fila en
+// cuanto llega: la pasa a gris, la guarda en una ventana de 2 filas para la
+// interpolación bilineal vertical, produce todas las filas de salida que ya
+// puede calcular (misma fórmula que escalarImagenConcurrente) y las escribe
+// con la LUT aplicada. Solo la imagen de salida ocupa memoria completa (o
+// ninguna, si va a un archivo .tsl).
+// POR QUÉ: Con stbi_load la CPU espera a que termine toda la descompresión y
+// el pico de memoria incluye la imagen decodificada entera; aquí ambas etapas
+// se solapan y la memoria intermedia es de unas pocas filas.
+static int cargarPNGStreaming(const char* ruta, ImagenInfo* info, const OpcionesStreaming* op) {
+    FILE* f = fopen(ruta, "rb");
+    if (!f) {
+        fprintf(stderr, "Error al abrir PNG: %s\n", ruta);
+        return 0;
+    }
+    DecodificadorPNG* d = calloc(1, sizeof(DecodificadorPNG));
+    if (!d) {
+        fclose(f);
+        fprintf(stderr, "Error de memoria para el decodificador\n");
+        return 0;
+    }
+    if (!leerCabeceraPNG(f, d)) {
+        fprintf(stderr, "Error: %s no es un PNG de 8 bits sin entrelazar (use la opción 1)\n", ruta);
+        free(d);
+        fclose(f);
+        return 0;
+    }
+
+    int canalesFuente = op->convertirGris ? 1 : d->canales;
+    int anchoSalida = op->nuevoAncho > 0 ? op->nuevoAncho : d->ancho;
+    int altoSalida = op->nuevoAlto > 0 ? op->nuevoAlto : d->alto;
+    int escalar = anchoSalida != d->ancho || altoSalida != d->alto;
+
+    // Todo lo que la carga tendrá reservado a la vez, antes de reservar nada
+    size_t bytesAuxiliares = bytesMatriz3D(FILAS_COLA_STREAMING, d->ancho, d->canales) +
+                             bytesMatriz3D(1, d->ancho, 1) + bytesMatriz3D(2, d->ancho, canalesFuente) +
+                             bytesMatriz3D(1, anchoSalida, canalesFuente) +
+                             2 * (1 + (size_t)d->ancho * d->bytesPorPixel);
+    if (!op->rutaTeselas &&
+        !matrizCabeEnPresupuesto(altoSalida, anchoSalida, canalesFuente, bytesAuxiliares, "La carga en streaming")) {
+        free(d);
+        fclose(f);
+        return 0;
+    }
+
+    ColaFilas cola;
+    memset(&cola, 0, sizeof(cola));
+    cola.capacidad = FILAS_COLA_STREAMING;
+    cola.filas = asignarMatriz3D(cola.capacidad, d->ancho, d->canales);
+    d->cola = &cola;
+    d->bytesFila = 1 + (size_t)d->ancho * d->bytesPorPixel;
+    d->filaActual = calloc(d->bytesFila, 1);
+    d->filaAnterior = calloc(d->bytesFila, 1);   // Fila "-1" en ceros
+
+    unsigned char*** gris = asignarMatriz3D(1, d->ancho, 1);
+    unsigned char*** par = asignarMatriz3D(2, d->ancho, canalesFuente);
+    unsigned char*** filaSalida = asignarMatriz3D(1, anchoSalida, canalesFuente);
+    unsigned char*** destino = NULL;
+    ImagenMapeada mapeada;
+    int destinoListo = 0;
+    if (op->rutaTeselas) {
+        destinoListo = crearImagenMapeada(op->rutaTeselas, anchoSalida, altoSalida, canalesFuente,
+                                          LADO_TESELA_DISCO, &mapeada);
+    } else {
+        destino = asignarMatriz3D(altoSalida, anchoSalida, canalesFuente);
+        destinoListo = destino != NULL;
+    }
+
+    int exito = cola.filas && d->filaActual && d->filaAnterior && gris && par && filaSalida && destinoListo;
+    pthread_t decodificador;
+    if (exito) {
+        pthread_mutex_init(&cola.mutex, NULL);
+        pthread_cond_init(&cola.hayFilas, NULL);
+        pthread_cond_init(&cola.hayEspacio, NULL);
+        if (pthread_create(&decodificador, NULL, decodificarPNGHilo, d) != 0) {
+            fprintf(stderr, "Error al crear hilo decodificador\n");
+            exito = 0;
+        }
+    } else {
+        fprintf(stderr, "Error de memoria para la carga en streaming\n");
+    }
+
+    if (exito) {
+        float scaleX = (float)d->ancho / anchoSalida;
+        float scaleY = (float)d->alto / altoSalida;
+        int ySalida = 0;
+        for (int y = 0; y < d->alto; y++) {
+            // Esperar la siguiente fila decodificada
+            pthread_mutex_lock(&cola.mutex);
+            while (cola.cantidad == 0 && !cola.terminado) pthread_cond_wait(&cola.hayFilas, &cola.mutex);
+            int hay = cola.cantidad > 0;
+            pthread_mutex_unlock(&cola.mutex);
+            if (!hay) break;
+
+            unsigned char** fila = cola.filas[cola.cabeza];
+            if (op->convertirGris && d->canales == 3) {
+                for (int x = 0; x < d->ancho; x++) {
+                    gris[0][x][0] = (unsigned char)(0.299f * fila[x][0] + 0.587f * fila[x][1] +
+                                                    0.114f * fila[x][2]);
+                }
+                fila = gris[0];
+            }
+
+            if (!escalar) {
+                memcpy(filaSalida[0][0], fila[0], (size_t)d->ancho * canalesFuente);
+                escribirFilaStreaming(filaSalida[0], anchoSalida, canalesFuente, y, op, destino, &mapeada);
+            } else {
+                memcpy(par[y % 2][0], fila[0], (size_t)d->ancho * canalesFuente);
+                // Producir las filas de salida cuyas dos filas de origen ya llegaron
+                while (ySalida < altoSalida) {
+                    float yOrig = ySalida * scaleY;
+                    int y0 = (int)floor(yOrig);
+                    int y1 = (y0 + 1 < d->alto) ? y0 + 1 : d->alto - 1;
+                    if (y1 > y) break;
+                    unsigned char** ventana[2] = {par[y0 % 2], par[y1 % 2]};
+                    float yLocal = yOrig - y0;
+                    for (int x = 0; x < anchoSalida; x++) {
+                        for (int c = 0; c < canalesFuente; c++) {
+                            filaSalida[0][x][c] = interpolacionBilineal(ventana, x * scaleX, yLocal, c,
+                                                                        d->ancho, 2);
+                        }
+                    }
+                    escribirFilaStreaming(filaSalida[0], anchoSalida, canalesFuente, ySalida, op,
+                                          destino, &mapeada);
+                    ySalida++;
+                }
+            }
+
+            // Liberar la ranura para el decodificador
+            pthread_mutex_lock(&cola.mutex);
+            cola.cabeza = (cola.cabeza + 1) % cola.capacidad;
+            cola.cantidad--;
+            pthread_cond_signal(&cola.hayEspacio);
+            pthread_mutex_unlock(&cola.mutex);
+        }
+        pthread_join(decodificador, NULL);
+        exito = !cola.error;
+        pthread_mutex_destroy(&cola.mutex);
+        pthread_cond_destroy(&cola.hayFilas);
+        pthread_cond_destroy(&cola.hayEspacio);
+        if (!exito) fprintf(stderr, "Error: Datos PNG corruptos o incompletos en %s\n", ruta);
+    }
+
+    liberarMatriz3D(cola.filas, cola.capacidad, d->ancho);
+    liberarMatriz3D(gris, 1, d->ancho);
+    liberarMatriz3D(par, 2, d->ancho);
+    liberarMatriz3D(filaSalida, 1, anchoSalida);
+    free(d->filaActual);
+    free(d->filaAnterior);
+    free(d);
+    fclose(f);
+    if (op->rutaTeselas && destinoListo) cerrarImagenMapeada(&mapeada);
+
+    if (!exito) {
+        liberarMatriz3D(destino, altoSalida, anchoSalida);
+        return 0;
+    }
+    if (op->rutaTeselas) {
+        informar("PNG convertido en streaming a %s: %dx%d, %d canales\n", op->rutaTeselas,
+               anchoSalida, altoSalida, canalesFuente);
+        return 1;
+    }
+    liberarImagen(info);
+    info->pixeles = destino;
+    info->ancho = anchoSalida;
+    info->alto = altoSalida;
+    info->canales = canalesFuente;
+    informar("Imagen cargada en streaming: %dx%d, %d canales (%s)\n", info->ancho, info->alto,
+           info->canales, info->canales == 1 ? "grises" : "RGB");
+    return 1;
+}
+
+// QUÉ: Carga un PNG sin operaciones, en streaming.
+// CÓMO: cargarPNGStreaming() con todas las opciones en cero.
+// POR QUÉ: cargarImagen() la usa cuando stb no cabe en el presupuesto de
+// memoria (está declarada antes que OpcionesStreaming).
+static int cargarPNGConPocaMemoria(const char* ruta, ImagenInfo* info) {
+    OpcionesStreaming op;
+    memset(&op, 0, sizeof(op));
+    return cargarPNGStreaming(ruta, info, &op);
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Submenú para cargar un PNG en streaming con operaciones por fila.
+// CÓMO: Pide ruta, conversión a gris, nuevo tamaño, brillo y destino
+// (memoria o archivo .tsl).
+// POR QUÉ: Expone la carga en streaming sin recompilar.
+static void menuCargaStreaming(ImagenInfo* imagen) {
+    char ruta[256], rutaTeselas[256];
+    OpcionesStreaming op;
+    memset(&op, 0, sizeof(op));
+
+    if (!leerRutaMenu("Ruta del archivo PNG: ", ruta, sizeof(ruta))) return;
+    if (!leerEnteroMenu("¿Convertir a grises? (1 = sí, 0 = no): ", &op.convertirGris)) return;
+    if (!leerEnteroMenu("Nuevo ancho (0 = sin escalar): ", &op.nuevoAncho)) return;
+    if (op.nuevoAncho > 0 && !leerEnteroMenu("Nuevo alto: ", &op.nuevoAlto)) return;
+    if (op.nuevoAncho < 0 || op.nuevoAlto < 0 || (op.nuevoAncho > 0) != (op.nuevoAlto > 0)) {
+        printf("Las dimensiones deben ser positivas.\n");
+        return;
+    }
+    int delta;
+    if (!leerEnteroMenu("Ajuste de brillo (0 = ninguno): ", &delta)) return;
+    if (delta != 0) {
+        op.aplicarLUT = 1;
+        lutBrillo(&op.lut, -1, delta);
+    }
+    int aDisco;
+    if (!leerEnteroMenu("Destino (0 = imagen actual, 1 = archivo .tsl): ", &aDisco)) return;
+    if (aDisco == 1) {
+        if (!leerRutaMenu("Archivo de teselas de salida (.tsl): ", rutaTeselas, sizeof(rutaTeselas))) return;
+        op.rutaTeselas = rutaTeselas;
+    }
+    cargarPNGStreaming(ruta, imagen, &op);
+}
+
+// QUÉ: Compara carga completa (stb) + operaciones contra la carga en streaming.
+// CÓMO: Carga el PNG con cargarImagen(), escala a la mitad y sube el brillo
+// en memoria; luego hace lo mismo con cargarPNGStreaming() y compara tiempos
+// y resultados.
+// POR QUÉ: Muestra cuánto se gana solapando descompresión y procesamiento.
+static void medirCargaStreaming(void) {
+    char ruta[256];
+    if (!leerRutaMenu("Ruta del archivo PNG: ", ruta, sizeof(ruta))) return;
+
+    ImagenInfo completa = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+    ImagenInfo streaming = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+    double t0 = tiempoActualSegundos();
+    if (!cargarImagen(ruta, &completa)) return;
+    int nuevoAncho = completa.ancho / 2 > 0 ? completa.ancho / 2 : 1;
+    int nuevoAlto = completa.alto / 2 > 0 ? completa.alto / 2 : 1;
+    escalarImagenConcurrente(&completa, nuevoAncho, nuevoAlto);
+    ajustarBrilloVectorialConcurrente(&completa, 30);
+    double tCompleta = tiempoActualSegundos() - t0;
+
+    OpcionesStreaming op;
+    memset(&op, 0, sizeof(op));
+    op.nuevoAncho = nuevoAncho;
+    op.nuevoAlto = nuevoAlto;
+    op.aplicarLUT = 1;
+    lutBrillo(&op.lut, -1, 30);
+    t0 = tiempoActualSegundos();
+    int ok = cargarPNGStreaming(ruta, &streaming, &op);
+    double tStreaming = tiempoActualSegundos() - t0;
+
+    if (ok) {
+        int iguales = completa.ancho == streaming.ancho && completa.alto == streaming.alto &&
+                      completa.canales == streaming.canales &&
+                      memcmp(completa.pixeles[0][0], streaming.pixeles[0][0],
+                             (size_t)completa.alto * completa.ancho * completa.canales) == 0;
+        printf("\nCarga + escalar %dx%d + brillo +30:\n", nuevoAncho, nuevoAlto);
+        printf("  completa (stb): %8.3f ms\n", tCompleta * 1e3);
+        printf("  streaming:      %8.3f ms (%.2fx)\n", tStreaming * 1e3,
+               tStreaming > 0 ? tCompleta / tStreaming : 0.0);
+        printf("  resultados %s\n", iguales ? "idénticos" : "DIFERENTES");
+    }
+    liberarImagen(&completa);
+    liberarImagen(&streaming);
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// GUARDADO PNG PARALELO (DEFLATE POR TRAMOS ENTRE HILOS)
+// =====================================================================
+
+#define VENTANA_DEFLATE 32768       // Distancia máxima de DEFLATE
+#define NIVEL_PNG_POR_DEFECTO 6     // Nivel de compresión del guardado normal
+
+// QUÉ: Estrategia de filtro PNG por fila.
+// CÓMO: Un filtro fijo para todas las filas o el adaptativo (mejor de los 5).
+// POR QUÉ: Los filtros fijos son más rápidos; el adaptativo suele comprimir más.
+typedef enum {
+    FILTRO_PNG_NINGUNO = 0,
+    FILTRO_PNG_SUB = 1,
+    FILTRO_PNG_UP = 2,
+    FILTRO_PNG_PAETH = 4,
+    FILTRO_PNG_ADAPTATIVO = 5
+} FiltroPNG;
+
+// QUÉ: Opciones del guardado PNG.
+// CÓMO: nivel 0 = almacenar sin comprimir, 1 = rápido (sin coincidencia
+// perezosa, una sola entrada de la cadena hash), 2..9 = cadenas cada vez más
+// largas con coincidencia perezosa desde el nivel 4.
+// POR QUÉ: Los archivos intermedios priorizan velocidad; los finales, tamaño.
+typedef struct {
+    int nivel;              // 0..9
+    FiltroPNG filtro;
+} OpcionesPNG;
+
+// Candidatos de la cadena hash revisados por posición en cada nivel
+static const int cadenaPorNivelPNG[10] = {0, 1, 4, 8, 12, 16, 32, 128, 512, 4096};
+
+// QUÉ: Búfer de salida de bits para DEFLATE.
+// CÓMO: Acumula bits desde el menos significativo y vuelca bytes completos
+// a un arreglo que crece con realloc (contado contra el presupuesto).
+// POR QUÉ: Cada hilo escribe su propio tramo comprimido sin compartir nada.
+typedef struct {
+    unsigned char* datos;
+    size_t tam;
+    size_t capacidad;
+    uint64_t bits;
+    int numBits;
+    int error;
+} BufferBits;
+
+// QUÉ: Argumentos del filtrado de filas PNG por hilo.
+// CÓMO: Rango de filas [inicio, fin) y búfer destino compartido (cada fila
+// escribe su propio tramo de 1 + ancho * canales bytes, contando desde la
+// fila 'filaBase' de la banda).
+// POR QUÉ: El filtro de una fila solo lee la fila anterior de la imagen.
+typedef struct {
+    const ImagenInfo* info;
+    unsigned char* filtrado;
+    int filaBase;               // Fila de la imagen que va al inicio de 'filtrado'
+    int inicio;
+    int fin;
+    FiltroPNG filtro;
+} FiltroPNGArgs;
+
+// QUÉ: Argumentos de la compresión DEFLATE de un tramo por hilo.
+// CÓMO: El hilo comprime datos[inicio, fin) usando como diccionario hasta
+// 32 KB anteriores a 'inicio' (ya filtrados por el otro hilo) y devuelve su
+// salida, el Adler-32 de su tramo y el CRC parcial de su chunk IDAT.
+// POR QUÉ: Cebar el diccionario con los datos previos conserva la mayoría de
+// las coincidencias que tendría un compresor secuencial (como pigz).
+typedef struct {
+    const unsigned char* datos;
+    size_t inicio;
+    size_t fin;
+    int esPrimero;              // Escribe la cabecera zlib
+    int esUltimo;               // Marca el bloque final (BFINAL)
+    int nivel;                  // Nivel de compresión 0..9
+    BufferBits salida;
+    uint32_t adler;             // Adler-32 de datos[inicio, fin)
+    uint32_t crc;               // CRC-32 sin complementar de "IDAT" + salida
+    const uint32_t* tablaCRC;
+} DeflateArgs;
+
+// QUÉ: Construye la tabla del CRC-32 de PNG (polinomio 0xEDB88320).
+// CÓMO: Método clásico de tabla de 256 entradas.
+// POR QUÉ: Cada chunk PNG termina con el CRC de su tipo y datos.
+static void generarTablaCRC(uint32_t tabla[256]) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        tabla[n] = c;
+    }
+}
+
+// QUÉ: Continúa un CRC-32 (sin complementar) con más bytes.
+// CÓMO: Un paso de tabla por byte.
+// POR QUÉ: Permite calcular el CRC de un chunk por partes.
+static uint32_t actualizarCRC(uint32_t crc, const unsigned char* datos, size_t n, const uint32_t tabla[256]) {
+    for (size_t i = 0; i < n; i++) crc = tabla[(crc ^ datos[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+// QUÉ: Adler-32 de un tramo de bytes.
+// CÓMO: Sumas s1/s2 reduciendo módulo 65521 cada 5552 bytes (máximo sin desborde).
+// POR QUÉ: El flujo zlib termina con el Adler-32 de los datos sin comprimir.
+static uint32_t calcularAdler32(const unsigned char* datos, size_t n) {
+    uint32_t s1 = 1, s2 = 0;
+    while (n > 0) {
+        size_t bloque = n < 5552 ? n : 5552;
+        n -= bloque;
+        while (bloque--) {
+            s1 += *datos++;
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+    return (s2 << 16) | s1;
+}
+
+// QUÉ: Combina el Adler-32 de dos tramos consecutivos.
+// CÓMO: Fórmula de adler32_combine de zlib usando la longitud del segundo tramo.
+// POR QUÉ: Cada hilo calcula el Adler-32 de su tramo; el total se obtiene sin
+// volver a recorrer los datos.
+static uint32_t combinarAdler32(uint32_t adler1, uint32_t adler2, size_t len2) {
+    const uint32_t base = 65521;
+    uint32_t resto = (uint32_t)(len2 % base);
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (uint32_t)(((uint64_t)resto * sum1) % base);
+    sum1 += (adler2 & 0xFFFF) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - resto;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= base * 2) sum2 -= base * 2;
+    if (sum2 >= base) sum2 -= base;
+    return (sum2 << 16) | sum1;
+}
+
+// QUÉ: Escribe n bits (hasta 32) en el búfer de salida.
+// CÓMO: Los agrega al acumulador y vuelca bytes completos.
+// POR QUÉ: DEFLATE empaqueta sus campos desde el bit menos significativo.
+static void escribirBits(BufferBits* b, uint32_t valor, int n) {
+    b->bits |= (uint64_t)valor << b->numBits;
+    b->numBits += n;
+    while (b->numBits >= 8) {
+        if (b->tam == b->capacidad) {
+            size_t nueva = b->capacidad ? b->capacidad * 2 : 4096;
+            unsigned char* tmp = recontarBufer(b->datos, b->capacidad, nueva);
+            if (!tmp) {
+                b->error = 1;
+                b->tam = 0;   // Seguir descartando para no escribir fuera
+            } else {
+                b->datos = tmp;
+                b->capacidad = nueva;
+            }
+        }
+        if (!b->error) b->datos[b->tam++] = (unsigned char)b->bits;
+        b->bits >>= 8;
+        b->numBits -= 8;
+    }
+}
+
+// QUÉ: Invierte los 'n' bits bajos de un código.
+// CÓMO: Bit a bit.
+// POR QUÉ: Los códigos de Huffman se escriben empezando por el bit más significativo.
+static uint32_t invertirBits(uint32_t codigo, int n) {
+    uint32_t r = 0;
+    for (int i = 0; i < n; i++) r |= ((codigo >> i) & 1) << (n - 1 - i);
+    return r;
+}
+
+// QUÉ: Códigos del Huffman fijo de DEFLATE ya invertidos, y tablas de símbolos.
+// CÓMO: Se calculan al inicio de cada tramo (son unos pocos cientos de entradas).
+// POR QUÉ: Con Huffman fijo no hay que transmitir tablas, y los tramos se
+// pueden comprimir de forma totalmente independiente.
+typedef struct {
+    uint16_t codigoLiteral[288];
+    unsigned char bitsLiteral[288];
+    unsigned char simboloLongitud[259];   // Longitud 3..258 → símbolo 257..285 (menos 257)
+    unsigned char simboloDistancia[512];  // Como d_code de zlib
+} TablasDeflateFijo;
+
+static const uint16_t baseLongitudDeflate[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,
+                                                 35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const unsigned char extraLongitudDeflate[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,
+                                                       3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t baseDistanciaDeflate[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+                                                  257,385,513,769,1025,1537,2049,3073,4097,
+                                                  6145,8193,12289,16385,24577};
+static const unsigned char extraDistanciaDeflate[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,
+                                                        7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+static void prepararTablasDeflate(TablasDeflateFijo* t) {
+    for (int s = 0; s < 288; s++) {
+        uint32_t codigo;
+        int bits;
+        if (s < 144) { codigo = 0x30 + s; bits = 8; }
+        else if (s < 256) { codigo = 0x190 + (s - 144); bits = 9; }
+        else if (s < 280) { codigo = s - 256; bits = 7; }
+        else { codigo = 0xC0 + (s - 280); bits = 8; }
+        t->codigoLiteral[s] = (uint16_t)invertirBits(codigo, bits);
+        t->bitsLiteral[s] = (unsigned char)bits;
+    }
+    for (int s = 0; s < 29; s++) {
+        int ultimo = (s == 28) ? 258 : baseLongitudDeflate[s] + (1 << extraLongitudDeflate[s]) - 1;
+        for (int len = baseLongitudDeflate[s]; len <= ultimo && len <= 258; len++) {
+            t->simboloLongitud[len] = (unsigned char)s;
+        }
+    }
+    for (int s = 0; s < 30; s++) {
+        int ultimo = baseDistanciaDeflate[s] + (1 << extraDistanciaDeflate[s]) - 1;
+        for (int d = baseDistanciaDeflate[s]; d <= ultimo; d++) {
+            int i = d - 1;
+            t->simboloDistancia[i < 256 ? i : 256 + (i >> 7)] = (unsigned char)s;
+        }
+    }
+}
+
+static void escribirLiteral(BufferBits* b, const TablasDeflateFijo* t, int simbolo) {
+    escribirBits(b, t->codigoLiteral[simbolo], t->bitsLiteral[simbolo]);
+}
+
+// QUÉ: Escribe una coincidencia (longitud, distancia) con Huffman fijo.
+// CÓMO: Símbolo de longitud + bits extra, código de distancia de 5 bits + extra.
+// POR QUÉ: Es la salida del LZ77 cuando encuentra una repetición.
+static void escribirCoincidencia(BufferBits* b, const TablasDeflateFijo* t, int longitud, int distancia) {
+    int s = t->simboloLongitud[longitud];
+    escribirLiteral(b, t, 257 + s);
+    if (extraLongitudDeflate[s]) escribirBits(b, longitud - baseLongitudDeflate[s], extraLongitudDeflate[s]);
+    int i = distancia - 1;
+    int sd = t->simboloDistancia[i < 256 ? i : 256 + (i >> 7)];
+    escribirBits(b, invertirBits(sd, 5), 5);
+    if (extraDistanciaDeflate[sd]) escribirBits(b, distancia - baseDistanciaDeflate[sd], extraDistanciaDeflate[sd]);
+}
+
+// QUÉ: Hash de los 3 bytes en una posición.
+// CÓMO: Mezcla con desplazamientos y recorta a 15 bits.
+// POR QUÉ: Las coincidencias de DEFLATE empiezan en al menos 3 bytes iguales.
+static inline uint32_t hashDeflate(const unsigned char* p) {
+    return (((uint32_t)p[0] << 10) ^ ((uint32_t)p[1] << 5) ^ p[2]) & (VENTANA_DEFLATE - 1);
+}
+
+// QUÉ: Busca la coincidencia más larga para 'pos' recorriendo la cadena hash.
+// CÓMO: Revisa hasta 'maxCadena' candidatos dentro de la ventana de 32 KB y
+// sin pasar de 'fin' (el tramo siguiente lo comprime otro hilo).
+// POR QUÉ: Núcleo del LZ77; la longitud de la cadena regula velocidad vs tamaño.
+static int buscarCoincidencia(const unsigned char* datos, size_t pos, size_t fin, const int64_t* cabeza,
+                              const int64_t* previo, int maxCadena, int* distancia) {
+    int maxLong = (fin - pos < 258) ? (int)(fin - pos) : 258;
+    if (maxLong < 3) return 0;
+    int64_t limite = (int64_t)pos - (VENTANA_DEFLATE - 1);
+    int64_t candidato = cabeza[hashDeflate(datos + pos)];
+    int mejor = 0;
+    while (candidato >= 0 && candidato >= limite && maxCadena-- > 0) {
+        const unsigned char* a = datos + candidato;
+        const unsigned char* b = datos + pos;
+        if (a[mejor] == b[mejor] && a[0] == b[0]) {
+            int len = 0;
+            while (len < maxLong && a[len] == b[len]) len++;
+            if (len > mejor) {
+                mejor = len;
+                *distancia = (int)(pos - candidato);
+                if (len == maxLong) break;
+            }
+        }
+        candidato = previo[candidato & (VENTANA_DEFLATE - 1)];
+    }
+    return mejor >= 3 ? mejor : 0;
+}
+
+// QUÉ: Inserta la posición 'pos' en las cadenas hash.
+// CÓMO: 'previo' guarda el candidato anterior con el mismo hash.
+// POR QUÉ: Mantiene el diccionario de las últimas 32 KB.
+static inline void insertarHash(const unsigned char* datos, size_t pos, int64_t* cabeza, int64_t* previo) {
+    uint32_t h = hashDeflate(datos + pos);
+    previo[pos & (VENTANA_DEFLATE - 1)] = cabeza[h];
+    cabeza[h] = (int64_t)pos;
+}
+
+// QUÉ: Copia bytes al búfer de salida cuando está alineado a byte.
+// CÓMO: Asegura capacidad y usa memcpy.
+// POR QUÉ: Los bloques almacenados copian los datos tal cual.
+static void escribirBytesAlineados(BufferBits* b, const unsigned char* datos, size_t n) {
+    if (b->error) return;
+    if (b->tam + n > b->capacidad) {
+        size_t nueva = b->capacidad * 2 > b->tam + n ? b->capacidad * 2 : b->tam + n;
+        unsigned char* tmp = recontarBufer(b->datos, b->capacidad, nueva);
+        if (!tmp) {
+            b->error = 1;
+            return;
+        }
+        b->datos = tmp;
+        b->capacidad = nueva;
+    }
+    memcpy(b->datos + b->tam, datos, n);
+    b->tam += n;
+}
+
+// QUÉ: Escribe el tramo como bloques almacenados (nivel 0).
+// CÓMO: Bloques de hasta 65535 bytes con LEN/NLEN; el último del último
+// tramo lleva BFINAL. Un tramo vacío final emite un bloque vacío.
+// POR QUÉ: Modo "almacenar": el guardado queda limitado por el disco.
+static void comprimirTramoAlmacenado(DeflateArgs* a, BufferBits* b) {
+    size_t pos = a->inicio;
+    do {
+        size_t n = a->fin - pos < 65535 ? a->fin - pos : 65535;
+        int final = a->esUltimo && pos + n == a->fin;
+        escribirBits(b, final ? 1 : 0, 1);
+        escribirBits(b, 0, 2);                         // BTYPE = 00
+        if (b->numBits > 0) escribirBits(b, 0, 8 - b->numBits);
+        escribirBits(b, (uint32_t)n, 16);
+        escribirBits(b, (uint32_t)n ^ 0xFFFF, 16);
+        escribirBytesAlineados(b, a->datos + pos, n);
+        pos += n;
+    } while (pos < a->fin);
+}
+
+// QUÉ: Comprime el tramo con LZ77 + Huffman fijo (niveles 1..9).
+// CÓMO: Ceba las cadenas hash con los 32 KB anteriores al tramo y emite un
+// único bloque de Huffman fijo. Desde el nivel 4 usa coincidencia perezosa de
+// un paso; el nivel 1 solo indexa el inicio de cada coincidencia. Los tramos
+// no finales se cierran con un bloque almacenado vacío (sync flush). Si la
+// salida pasa de lo que ocuparían los bloques almacenados (datos + 5 bytes
+// por cada 65535), la descarta y escribe el tramo almacenado.
+// POR QUÉ: Los tramos alineados a byte se concatenan tal cual en un único
+// flujo zlib válido, así que cada hilo comprime sin esperar al otro. Con
+// Huffman fijo los literales ≥ 144 ocupan 9 bits: sobre ruido el bloque
+// crecería más que los datos.
+static void comprimirTramoFijo(DeflateArgs* a, BufferBits* b, int64_t* cabeza, int64_t* previo) {
+    BufferBits inicial = *b;
+    size_t n = a->fin - a->inicio;
+    size_t limite = b->tam + n + 5 * (n / 65535 + (n % 65535 != 0 || n == 0));
+    TablasDeflateFijo tablas;
+    prepararTablasDeflate(&tablas);
+    int maxCadena = cadenaPorNivelPNG[a->nivel];
+    int perezosa = a->nivel >= 4;
+    int indexarTodo = a->nivel > 1;
+    for (int i = 0; i < VENTANA_DEFLATE; i++) cabeza[i] = -1;
+
+    // Diccionario: los 32 KB anteriores (filtrados por el otro hilo)
+    size_t desde = a->inicio > VENTANA_DEFLATE ? a->inicio - VENTANA_DEFLATE : 0;
+    for (size_t p = desde; p + 2 < a->inicio; p++) insertarHash(a->datos, p, cabeza, previo);
+
+    escribirBits(b, a->esUltimo ? 1 : 0, 1);   // BFINAL
+    escribirBits(b, 1, 2);                     // BTYPE = 01 (Huffman fijo)
+    size_t pos = a->inicio;
+    while (pos < a->fin && b->tam <= limite) {
+        int distancia = 0;
+        int longitud = (pos + 2 < a->fin) ? buscarCoincidencia(a->datos, pos, a->fin, cabeza, previo,
+                                                               maxCadena, &distancia) : 0;
+        if (longitud && perezosa && pos + 3 < a->fin && longitud < 258) {
+            // Coincidencia perezosa: si la siguiente posición da una más larga,
+            // emitir este byte como literal
+            insertarHash(a->datos, pos, cabeza, previo);
+            int distSiguiente = 0;
+            int sig = buscarCoincidencia(a->datos, pos + 1, a->fin, cabeza, previo, maxCadena, &distSiguiente);
+            if (sig > longitud) {
+                escribirLiteral(b, &tablas, a->datos[pos]);
+                pos++;
+                continue;
+            }
+            escribirCoincidencia(b, &tablas, longitud, distancia);
+            for (size_t p = pos + 1; p < pos + longitud && p + 2 < a->fin; p++) {
+                insertarHash(a->datos, p, cabeza, previo);
+            }
+            pos += longitud;
+        } else if (longitud) {
+            escribirCoincidencia(b, &tablas, longitud, distancia);
+            size_t hasta = indexarTodo ? pos + longitud : pos + 1;
+            for (size_t p = pos; p < hasta && p + 2 < a->fin; p++) {
+                insertarHash(a->datos, p, cabeza, previo);
+            }
+            pos += longitud;
+        } else {
+            if (pos + 2 < a->fin) insertarHash(a->datos, pos, cabeza, previo);
+            escribirLiteral(b, &tablas, a->datos[pos]);
+            pos++;
+        }
+    }
+    escribirLiteral(b, &tablas, 256);   // Fin de bloque
+
+    if (!a->esUltimo) {
+        // Sync flush: bloque almacenado vacío (BFINAL=0, BTYPE=00, LEN=0, NLEN=FFFF)
+        escribirBits(b, 0, 3);
+        if (b->numBits > 0) escribirBits(b, 0, 8 - b->numBits);
+        escribirBits(b, 0x0000, 16);
+        escribirBits(b, 0xFFFF, 16);
+    } else if (b->numBits > 0) {
+        escribirBits(b, 0, 8 - b->numBits);
+    }
+
+    if (b->tam > limite) {
+        // Más grande que almacenado: se descarta lo escrito (el búfer conserva su capacidad)
+        inicial.datos = b->datos;
+        inicial.capacidad = b->capacidad;
+        inicial.error = b->error;
+        *b = inicial;
+        comprimirTramoAlmacenado(a, b);
+    }
+}
+
+// QUÉ: Hilo que comprime un tramo del búfer filtrado con DEFLATE.
+// CÓMO: Sobre la salida que reservó quien lo lanza, escribe la cabecera zlib
+// si es el primer tramo, comprime según el nivel (almacenado o Huffman fijo)
+// y calcula el Adler-32 del tramo y el CRC
+// parcial del chunk IDAT que lo contendrá.
+// POR QUÉ: Todo el trabajo por tramo queda dentro del hilo.
+static void* comprimirDeflateHilo(void* args) {
+    DeflateArgs* a = (DeflateArgs*)args;
+    BufferBits* b = &a->salida;
+    int64_t* cabeza = a->nivel > 0 ? malloc(VENTANA_DEFLATE * sizeof(int64_t)) : NULL;
+    int64_t* previo = a->nivel > 0 ? malloc(VENTANA_DEFLATE * sizeof(int64_t)) : NULL;
+    if (!b->datos || (a->nivel > 0 && (!cabeza || !previo))) {
+        b->error = 1;
+        free(cabeza);
+        free(previo);
+        return NULL;
+    }
+
+    if (a->esPrimero) {
+        // FLG: FLEVEL según el nivel (como zlib: 0-1, 2-5, 6, 7-9) y CMF*256+FLG múltiplo de 31
+        static const unsigned char flgPorNivel[10] = {0x01, 0x01, 0x5E, 0x5E, 0x5E, 0x5E, 0x9C, 0xDA, 0xDA, 0xDA};
+        escribirBits(b, 0x78, 8);   // CMF: DEFLATE, ventana de 32 KB
+        escribirBits(b, flgPorNivel[a->nivel], 8);
+    }
+    if (a->nivel == 0) {
+        comprimirTramoAlmacenado(a, b);
+    } else {
+        comprimirTramoFijo(a, b, cabeza, previo);
+    }
+
+    a->adler = calcularAdler32(a->datos + a->inicio, a->fin - a->inicio);
+    a->crc = actualizarCRC(0xFFFFFFFFu, (const unsigned char*)"IDAT", 4, a->tablaCRC);
+    if (!b->error) a->crc = actualizarCRC(a->crc, b->datos, b->tam, a->tablaCRC);
+
+    free(cabeza);
+    free(previo);
+    return NULL;
+}
+
+// QUÉ: Aplica el filtro PNG de una fila (0 None, 1 Sub, 2 Up, 3 Average, 4 Paeth).
+// CÓMO: Resta al byte su predicción; 'anterior' es NULL en la primera fila.
+// POR QUÉ: Los residuos filtrados se comprimen mucho mejor que los píxeles.
+static void filtrarFilaPNG(unsigned char* salida, const unsigned char* fila, const unsigned char* anterior,
+                           size_t n, int bpp, int tipo) {
+    for (size_t i = 0; i < n; i++) {
+        int a = i >= (size_t)bpp ? fila[i - bpp] : 0;
+        int b = anterior ? anterior[i] : 0;
+        int c = (anterior && i >= (size_t)bpp) ? anterior[i - bpp] : 0;
+        int prediccion;
+        switch (tipo) {
+            case 1: prediccion = a; break;
+            case 2: prediccion = b; break;
+            case 3: prediccion = (a + b) / 2; break;
+            case 4: prediccion = predictorPaeth(a, b, c); break;
+            default: prediccion = 0; break;
+        }
+        salida[i] = (unsigned char)(fila[i] - prediccion);
+    }
+}
+
+// QUÉ: Hilo que filtra un rango de filas.
+// CÓMO: Con un filtro fijo lo aplica a cada fila; con el adaptativo prueba
+// los 5 filtros y se queda con el de menor suma de valores absolutos (como
+// byte con signo), heurística habitual de libpng y stb.
+// POR QUÉ: Cada fila solo lee la imagen original, así que las filas se
+// reparten entre hilos sin dependencias.
+static void* filtrarFilasPNGHilo(void* args) {
+    FiltroPNGArgs* a = (FiltroPNGArgs*)args;
+    const ImagenInfo* info = a->info;
+    size_t n = (size_t)info->ancho * info->canales;
+    if (a->filtro != FILTRO_PNG_ADAPTATIVO) {
+        for (int y = a->inicio; y < a->fin; y++) {
+            unsigned char* destino = a->filtrado + (size_t)(y - a->filaBase) * (n + 1);
+            filtrarFilaPNG(destino + 1, info->pixeles[y][0], y > 0 ? info->pixeles[y - 1][0] : NULL,
+                           n, info->canales, a->filtro);
+            destino[0] = (unsigned char)a->filtro;
+        }
+        return NULL;
+    }
+    unsigned char* prueba = malloc(n);
+    if (!prueba) return NULL;   // El llamador detecta el error por el byte de filtro 0xFF
+    for (int y = a->inicio; y < a->fin; y++) {
+        const unsigned char* fila = info->pixeles[y][0];
+        const unsigned char* anterior = y > 0 ? info->pixeles[y - 1][0] : NULL;
+        unsigned char* destino = a->filtrado + (size_t)(y - a->filaBase) * (n + 1);
+        long mejorCosto = -1;
+        for (int tipo = 0; tipo < 5; tipo++) {
+            filtrarFilaPNG(prueba, fila, anterior, n, info->canales, tipo);
+            long costo = 0;
+            for (size_t i = 0; i < n; i++) costo += abs((signed char)prueba[i]);
+            if (mejorCosto < 0 || costo < mejorCosto) {
+                mejorCosto = costo;
+                destino[0] = (unsigned char)tipo;
+                memcpy(destino + 1, prueba, n);
+            }
+        }
+    }
+    free(prueba);
+    return NULL;
+}
+
+// QUÉ: Escribe un entero de 32 bits big-endian.
+// CÓMO: Cuatro bytes del más al menos significativo.
+// POR QUÉ: PNG usa big-endian en longitudes, CRC y cabecera.
+static void escribirBE32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// QUÉ: Filas por banda del guardado PNG según el presupuesto de memoria.
+// CÓMO: Cada fila cuesta su tramo filtrado más la salida de DEFLATE estimada
+// (igual a la entrada en el nivel 0, la mitad en los demás); aparte van el
+// diccionario de 32 KB y, por hilo, las tablas hash y la fila de prueba.
+// Devuelve 'alto' si cabe entera (o no hay límite) y 0 si no cabe ni una fila.
+// POR QUÉ: Sin presupuesto se conserva el guardado de una sola banda (mismo
+// archivo que antes); con presupuesto el búfer filtrado deja de ser del
+// tamaño de la imagen.
+static int calcularFilasBandaPNG(const ImagenInfo* info, int nivel, int numHilos) {
+    size_t bytesFila = 1 + (size_t)info->ancho * info->canales;
+    size_t porFila = bytesFila + (nivel == 0 ? bytesFila : bytesFila / 2);
+    size_t fijo = VENTANA_DEFLATE + (size_t)numHilos * (2 * VENTANA_DEFLATE * sizeof(int64_t) + bytesFila + 4096);
+    size_t disponible = memoriaDisponible();
+    if (disponible == SIZE_MAX || fijo + porFila * info->alto <= disponible) return info->alto;
+    if (disponible < fijo + porFila) return 0;
+    return (int)((disponible - fijo) / porFila);
+}
+
+// QUÉ: Filtra y comprime con hilosPorOperacion hilos las filas [y0, y1) y
+// escribe sus chunks IDAT.
+// CÓMO: (1) cada hilo filtra su rango de filas detrás de los 'prefijo' bytes
+// filtrados de la banda anterior; (2) las filas de la banda se parten en
+// tramos de bytes y cada hilo los comprime con DEFLATE cebando el
+// diccionario con los 32 KB previos. Cada tramo se escribe como un chunk
+// IDAT con su CRC (calculado por el hilo); *adler acumula el Adler-32 de
+// todos y el último tramo de la última banda lo agrega a su chunk.
+// POR QUÉ: Con una sola banda es el guardado de siempre; con varias, el
+// flujo zlib es el mismo porque cada tramo ya termina alineado a byte.
+static int comprimirBandaPNG(const ImagenInfo* info, const OpcionesPNG* op, unsigned char* banda, size_t prefijo,
+                             int y0, int y1, int esPrimera, int esUltima, const uint32_t* tablaCRC,
+                             uint32_t* adler, FILE* f) {
+    const int numHilos = hilosPorOperacion;
+    size_t bytesFila = 1 + (size_t)info->ancho * info->canales;
+    size_t total = prefijo + bytesFila * (y1 - y0);
+    unsigned char* filtrado = banda + prefijo;
+
+    // Fase 1: filtrado por filas
+    pthread_t hilos[numHilos];
+    FiltroPNGArgs filtros[numHilos];
+    TiempoHilo tiempos[numHilos];
+    int filasPorHilo = (int)ceil((double)(y1 - y0) / numHilos);
+    double inicioRegion = iniciarRegion();
+    for (int i = 0; i < numHilos; i++) {
+        filtros[i].info = info;
+        filtros[i].filtrado = filtrado;
+        filtros[i].filaBase = y0;
+        filtros[i].filtro = op->filtro;
+        filtros[i].inicio = y0 + i * filasPorHilo < y1 ? y0 + i * filasPorHilo : y1;
+        filtros[i].fin = y0 + (i + 1) * filasPorHilo < y1 ? y0 + (i + 1) * filasPorHilo : y1;
+        for (int y = filtros[i].inicio; y < filtros[i].fin; y++) filtrado[(size_t)(y - y0) * bytesFila] = 0xFF;
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, filtrarFilasPNGHilo, &filtros[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d\n", i);
+            for (int j = 0; j < i; j++) pthread_join(hilos[j], NULL);
+            return 0;
+        }
+    }
+    for (int i = 0; i < numHilos; i++) pthread_join(hilos[i], NULL);
+    terminarRegion("png_filtro", tiempos, numHilos, inicioRegion);
+    for (int y = y0; y < y1; y++) {
+        if (filtrado[(size_t)(y - y0) * bytesFila] > 4) {
+            fprintf(stderr, "Error de memoria al filtrar imagen\n");
+            return 0;
+        }
+    }
+
+    // Fase 2: compresión por tramos de bytes
+    DeflateArgs tramos[numHilos];
+    size_t bytesPorHilo = (total - prefijo + numHilos - 1) / numHilos;
+    int creados = 0;
+    inicioRegion = iniciarRegion();
+    for (int i = 0; i < numHilos; i++) {
+        memset(&tramos[i], 0, sizeof(DeflateArgs));
+        tramos[i].datos = banda;
+        tramos[i].inicio = prefijo + (size_t)i * bytesPorHilo < total ? prefijo + (size_t)i * bytesPorHilo : total;
+        tramos[i].fin = prefijo + (size_t)(i + 1) * bytesPorHilo < total ? prefijo + (size_t)(i + 1) * bytesPorHilo
+                                                                          : total;
+        tramos[i].esPrimero = esPrimera && i == 0;
+        tramos[i].esUltimo = esUltima && i == numHilos - 1;
+        tramos[i].nivel = op->nivel;
+        tramos[i].tablaCRC = tablaCRC;
+        // La salida se reserva aquí para contarla en la operación que guarda
+        BufferBits* b = &tramos[i].salida;
+        b->capacidad = (op->nivel == 0 ? tramos[i].fin - tramos[i].inicio : (tramos[i].fin - tramos[i].inicio) / 2) +
+                       4096;
+        b->datos = reservarContado(b->capacidad, NULL);
+        if (!b->datos) b->capacidad = 0;
+        if (crearHiloMedido(&hilos[i], &tiempos[i], i, comprimirDeflateHilo, &tramos[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d\n", i);
+            liberarContado(b->datos, b->capacidad);
+            break;
+        }
+        creados++;
+    }
+    for (int i = 0; i < creados; i++) pthread_join(hilos[i], NULL);
+    terminarRegion("png_deflate", tiempos, creados, inicioRegion);
+
+    int exito = creados == numHilos;
+    for (int i = 0; i < creados; i++) {
+        if (tramos[i].salida.error) exito = 0;
+    }
+    if (exito) {
+        for (int i = 0; i < numHilos; i++) {
+            *adler = (esPrimera && i == 0) ? tramos[i].adler
+                   : combinarAdler32(*adler, tramos[i].adler, tramos[i].fin - tramos[i].inicio);
+        }
+        for (int i = 0; i < numHilos; i++) {
+            BufferBits* b = &tramos[i].salida;
+            unsigned char cab[8], cola[8];
+            size_t extra = 0;
+            uint32_t crc = tramos[i].crc;
+            if (tramos[i].esUltimo) {
+                escribirBE32(cola, *adler);
+                crc = actualizarCRC(crc, cola, 4, tablaCRC);
+                extra = 4;
+            }
+            escribirBE32(cab, (uint32_t)(b->tam + extra));
+            memcpy(cab + 4, "IDAT", 4);
+            escribirBE32(cola + extra, ~crc);
+            fwrite(cab, 1, 8, f);
+            fwrite(b->datos, 1, b->tam, f);
+            fwrite(cola, 1, extra + 4, f);
+        }
+    }
+    for (int i = 0; i < creados; i++) liberarContado(tramos[i].salida.datos, tramos[i].salida.capacidad);
+    return exito;
+}
+
+// QUÉ: Guarda la imagen como PNG filtrando y comprimiendo con hilosPorOperacion hilos.
+// CÓMO: Escribe la firma y el IHDR y pasa las filas por comprimirBandaPNG()
+// en bandas tan grandes como permita el presupuesto de memoria (una sola sin
+// --mem-limit); entre bandas conserva los últimos 32 KB filtrados como
+// diccionario de la siguiente. 'opciones' NULL usa el nivel por defecto con
+// filtro adaptativo.
+// POR QUÉ: stbi_write_png filtra y comprime todo en un hilo; en imágenes
+// grandes guardar tardaba más que procesar. Las bandas evitan que el búfer
+// filtrado del tamaño de la imagen supere el presupuesto.
+static int guardarPNGParalelo(const ImagenInfo* info, const char* rutaSalida, const OpcionesPNG* opciones) {
+    if (!info->pixeles) {
+        fprintf(stderr, "No hay imagen para guardar.\n");
+        return 0;
+    }
+    OpcionesPNG op = {NIVEL_PNG_POR_DEFECTO, FILTRO_PNG_ADAPTATIVO};
+    if (opciones) op = *opciones;
+    if (op.nivel < 0 || op.nivel > 9) {
+        fprintf(stderr, "Error: Nivel de compresión %d fuera de rango (0-9)\n", op.nivel);
+        return 0;
+    }
+    size_t bytesFila = 1 + (size_t)info->ancho * info->canales;
+    int filasBanda = calcularFilasBandaPNG(info, op.nivel, hilosPorOperacion);
+    if (filasBanda == 0) {
+        fprintf(stderr, "Error: El presupuesto de memoria no alcanza ni para una fila del PNG (%.1f MB libres)\n",
+                memoriaDisponible() / (1024.0 * 1024.0));
+        return 0;
+    }
+    size_t capacidad = (filasBanda < info->alto ? VENTANA_DEFLATE : 0) + bytesFila * filasBanda;
+    unsigned char* banda = reservarContado(capacidad, "El filtrado PNG");
+    if (!banda) {
+        fprintf(stderr, "Error de memoria al filtrar imagen\n");
+        return 0;
+    }
+    if (filasBanda < info->alto) {
+        informar("Guardado PNG en bandas de %d filas (presupuesto de memoria)\n", filasBanda);
+    }
+    uint32_t tablaCRC[256];
+    generarTablaCRC(tablaCRC);
+
+    FILE* f = fopen(rutaSalida, "wb");
+    int exito = f != NULL;
+    if (f) {
+        static const unsigned char firma[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        unsigned char ihdr[25];
+        escribirBE32(ihdr, 13);
+        memcpy(ihdr + 4, "IHDR", 4);
+        escribirBE32(ihdr + 8, (uint32_t)info->ancho);
+        escribirBE32(ihdr + 12, (uint32_t)info->alto);
+        ihdr[16] = 8;                              // Bits por canal
+        ihdr[17] = info->canales == 1 ? 0 : 2;     // Grises o RGB
+        ihdr[18] = ihdr[19] = ihdr[20] = 0;        // DEFLATE, filtro adaptativo, sin entrelazado
+        escribirBE32(ihdr + 21, ~actualizarCRC(0xFFFFFFFFu, ihdr + 4, 17, tablaCRC));
+        fwrite(firma, 1, 8, f);
+        fwrite(ihdr, 1, 25, f);
+
+        uint32_t adler = 1;
+        size_t prefijo = 0;
+        for (int y0 = 0; y0 < info->alto && exito; y0 += filasBanda) {
+            int y1 = y0 + filasBanda < info->alto ? y0 + filasBanda : info->alto;
+            exito = comprimirBandaPNG(info, &op, banda, prefijo, y0, y1, y0 == 0, y1 == info->alto, tablaCRC,
+                                      &adler, f);
+            // Diccionario de la banda siguiente: los últimos 32 KB filtrados
+            size_t usados = prefijo + bytesFila * (y1 - y0);
+            size_t nuevo = usados < VENTANA_DEFLATE ? usados : VENTANA_DEFLATE;
+            if (y1 < info->alto) memmove(banda, banda + usados - nuevo, nuevo);
+            prefijo = nuevo;
+        }
+        if (exito) {
+            unsigned char iend[12] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+            fwrite(iend, 1, 12, f);
+            exito = !ferror(f);
+        }
+        if (fclose(f) != 0) exito = 0;
+        if (!exito) remove(rutaSalida);
+    }
+
+    liberarContado(banda, capacidad);
+    if (exito) {
+        informar("Imagen guardada en: %s (%s)\n", rutaSalida,
+               info->canales == 1 ? "grises" : "RGB");
+        return 1;
+    }
+    fprintf(stderr, "Error al guardar PNG: %s\n", rutaSalida);
+    return 0;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Submenú para guardar con nivel de compresión y filtro elegidos.
+// CÓMO: Pide ruta, nivel (0 almacenar, 1 rápido, 9 máximo) y filtro.
+// POR QUÉ: Los archivos intermedios se guardan rápido y los finales pequeños.
+static void menuGuardarPNGConOpciones(const ImagenInfo* info) {
+    static const FiltroPNG filtros[] = {FILTRO_PNG_NINGUNO, FILTRO_PNG_SUB, FILTRO_PNG_UP,
+                                        FILTRO_PNG_PAETH, FILTRO_PNG_ADAPTATIVO};
+    if (!info->pixeles) {
+        printf("No hay imagen para guardar.\n");
+        return;
+    }
+    char salida[256];
+    OpcionesPNG op;
+    int filtro;
+    if (!leerRutaMenu("Nombre del archivo PNG de salida: ", salida, sizeof(salida))) return;
+    if (!leerEnteroMenu("Nivel de compresión (0 = almacenar, 1 = rápido ... 9 = máximo): ", &op.nivel)) return;
+    if (!leerEnteroMenu("Filtro (0 = ninguno, 1 = sub, 2 = up, 3 = paeth, 4 = adaptativo): ", &filtro)) return;
+    if (op.nivel < 0 || op.nivel > 9 || filtro < 0 || filtro > 4) {
+        printf("Opciones inválidas.\n");
+        return;
+    }
+    op.filtro = filtros[filtro];
+    guardarPNGParalelo(info, salida, &op);
+}
+
+// QUÉ: Tabla de tiempo de guardado vs tamaño de archivo.
+// CÓMO: Guarda la imagen actual con stb y con el guardado paralelo en varias
+// combinaciones de nivel y filtro, en un archivo temporal, midiendo el tiempo
+// y el tamaño resultante.
+// POR QUÉ: Ayuda a elegir entre velocidad (intermedios) y tamaño (finales).
+static void medirGuardadoPNG(const ImagenInfo* info) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    static const OpcionesPNG combinaciones[] = {
+        {0, FILTRO_PNG_NINGUNO}, {1, FILTRO_PNG_UP}, {1, FILTRO_PNG_ADAPTATIVO},
+        {6, FILTRO_PNG_NINGUNO}, {6, FILTRO_PNG_SUB}, {6, FILTRO_PNG_UP}, {6, FILTRO_PNG_PAETH},
+        {6, FILTRO_PNG_ADAPTATIVO}, {9, FILTRO_PNG_ADAPTATIVO}
+    };
+    const char* nombresFiltro[] = {"ninguno", "sub", "up", "", "paeth", "adaptativo"};
+    const char* rutaTemporal = "bench_guardado.png";
+    int numCombinaciones = (int)(sizeof(combinaciones) / sizeof(combinaciones[0]));
+    size_t bytesCrudos = (size_t)info->ancho * info->alto * info->canales;
+    struct stat st;
+
+    double tiempos[16];
+    long tamanos[16];
+    double t0 = tiempoActualSegundos();
+    int ok = guardarPNG(info, rutaTemporal);
+    tiempos[0] = tiempoActualSegundos() - t0;
+    tamanos[0] = (ok && stat(rutaTemporal, &st) == 0) ? (long)st.st_size : -1;
+    for (int i = 0; i < numCombinaciones; i++) {
+        t0 = tiempoActualSegundos();
+        ok = guardarPNGParalelo(info, rutaTemporal, &combinaciones[i]);
+        tiempos[i + 1] = tiempoActualSegundos() - t0;
+        tamanos[i + 1] = (ok && stat(rutaTemporal, &st) == 0) ? (long)st.st_size : -1;
+    }
+
+    printf("\nGuardado PNG %dx%d (%zu bytes sin comprimir):\n", info->ancho, info->alto, bytesCrudos);
+    printf("  %-10s %5s  %-10s %10s %12s %9s\n", "método", "nivel", "filtro", "ms", "bytes", "tamaño");
+    for (int i = 0; i <= numCombinaciones; i++) {
+        if (tamanos[i] < 0) continue;
+        const char* filtro = i == 0 ? "adaptativo" : nombresFiltro[combinaciones[i - 1].filtro];
+        printf("  %-9s %5d  %-10s %10.3f %12ld %7.2f%%\n", i == 0 ? "stb" : "paralelo",
+               i == 0 ? 8 : combinaciones[i - 1].nivel, filtro, tiempos[i] * 1e3, tamanos[i],
+               100.0 * tamanos[i] / bytesCrudos);
+    }
+    remove(rutaTemporal);
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// FORMATO CRUDO NATIVO (.icr) E IMPORTACIÓN/EXPORTACIÓN PPM/PGM
+// =====================================================================
+
+#define MAGIA_CRUDA "IMGCRU1"       // Identificador del formato (8 bytes con '\0')
+
+// QUÉ: Cabecera del formato crudo nativo (.icr) tal como se guarda en disco.
+// CÓMO: Tamaños fijos (stdint); los píxeles empiezan en un desplazamiento
+// múltiplo de página, en orden [y][x][c] con 'paso' bytes por fila (el mismo
+// orden que el bloque contiguo de la matriz 3D).
+// POR QUÉ: Sin compresión ni filtros, guardar es una sola escritura y cargar
+// es proyectar el archivo: ideal para resultados intermedios entre pasos.
+typedef struct {
+    char magia[8];                 // MAGIA_CRUDA
+    int32_t ancho;                 // Ancho en píxeles
+    int32_t alto;                  // Alto en píxeles
+    int32_t canales;               // 1 o 3
+    int32_t paso;                  // Bytes por fila (ancho * canales)
+    int64_t desplazamientoDatos;   // Inicio de los píxeles (múltiplo de página)
+} CabeceraCruda;
+
+// QUÉ: Guarda la imagen en formato crudo nativo con una sola escritura.
+// CÓMO: Arma la cabecera rellenada hasta el límite de página y la envía junto
+// con el bloque contiguo de píxeles con writev (dos tramos, una llamada; solo
+// se repite si el sistema escribe de forma parcial).
+// POR QUÉ: Evita filtrar y comprimir como PNG cuando el archivo solo se usa
+// para retomar el trabajo más tarde.
+static int guardarCrudo(const ImagenInfo* info, const char* ruta) {
+    if (!info->pixeles) {
+        fprintf(stderr, "No hay imagen para guardar.\n");
+        return 0;
+    }
+    if (!datosContiguos(info, "El formato crudo")) return 0;
+    long pagina = sysconf(_SC_PAGESIZE);
+    size_t desplazamiento = ((sizeof(CabeceraCruda) + TAM_CABECERA_BLOQUE + pagina - 1) / pagina) * pagina;
+    unsigned char* cabecera = calloc(1, desplazamiento);
+    if (!cabecera) {
+        fprintf(stderr, "Error de memoria al preparar cabecera\n");
+        return 0;
+    }
+    CabeceraCruda cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magia, MAGIA_CRUDA, sizeof(cab.magia));
+    cab.ancho = info->ancho;
+    cab.alto = info->alto;
+    cab.canales = info->canales;
+    cab.paso = info->ancho * info->canales;
+    cab.desplazamientoDatos = (int64_t)desplazamiento;
+    memcpy(cabecera, &cab, sizeof(cab));
+
+    int fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error al crear archivo crudo: %s\n", ruta);
+        free(cabecera);
+        return 0;
+    }
+    struct iovec tramos[2];
+    tramos[0].iov_base = cabecera;
+    tramos[0].iov_len = desplazamiento;
+    tramos[1].iov_base = info->pixeles[0][0];
+    tramos[1].iov_len = (size_t)cab.paso * info->alto;
+    int exito = 1;
+    int indice = 0;
+    while (indice < 2) {
+        ssize_t escritos = writev(fd, tramos + indice, 2 - indice);
+        if (escritos < 0) {
+            exito = 0;
+            break;
+        }
+        // Avanzar sobre lo escrito (escritura parcial)
+        while (indice < 2 && (size_t)escritos >= tramos[indice].iov_len) {
+            escritos -= (ssize_t)tramos[indice].iov_len;
+            indice++;
+        }
+        if (indice < 2) {
+            tramos[indice].iov_base = (unsigned char*)tramos[indice].iov_base + escritos;
+            tramos[indice].iov_len -= (size_t)escritos;
+        }
+    }
+    if (close(fd) != 0) exito = 0;
+    free(cabecera);
+    if (!exito) {
+        fprintf(stderr, "Error al escribir archivo crudo: %s\n", ruta);
+        return 0;
+    }
+    informar("Imagen guardada en formato crudo: %s (%dx%d, %d canales)\n", ruta,
+           info->ancho, info->alto, info->canales);
+    return 1;
+}
+
+// QUÉ: Carga un archivo crudo nativo proyectándolo en memoria, sin copiar.
+// CÓMO: Valida la cabecera, proyecta el archivo completo con mmap privado
+// (copia en escritura: modificar la imagen no altera el archivo), escribe la
+// CabeceraBloque en el relleno que precede a los píxeles y arma las tablas
+// de la matriz sobre los datos proyectados. liberarImagen() hace el munmap.
+// POR QUÉ: La carga no lee ni copia los píxeles: el sistema trae cada página
+// la primera vez que se toca.
+static int cargarCrudo(const char* ruta, ImagenInfo* info) {
+    int fd = open(ruta, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error al abrir archivo crudo: %s\n", ruta);
+        return 0;
+    }
+    CabeceraCruda cab;
+    struct stat st;
+    if (read(fd, &cab, sizeof(cab)) != (ssize_t)sizeof(cab) ||
+        memcmp(cab.magia, MAGIA_CRUDA, sizeof(cab.magia)) != 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: %s no es un archivo crudo válido\n", ruta);
+        close(fd);
+        return 0;
+    }
+    long pagina = sysconf(_SC_PAGESIZE);
+    if (cab.ancho <= 0 || cab.alto <= 0 || (cab.canales != 1 && cab.canales != 3) ||
+        cab.paso <= 0 || (size_t)cab.paso != (size_t)cab.ancho * cab.canales ||
+        cab.desplazamientoDatos < (int64_t)(sizeof(cab) + TAM_CABECERA_BLOQUE) ||
+        cab.desplazamientoDatos % pagina != 0) {
+        fprintf(stderr, "Error: Cabecera cruda inválida en %s\n", ruta);
+        close(fd);
+        return 0;
+    }
+    size_t tamMapa = (size_t)cab.desplazamientoDatos + (size_t)cab.paso * cab.alto;
+    if ((size_t)st.st_size < tamMapa) {
+        fprintf(stderr, "Error: Archivo crudo truncado: %s\n", ruta);
+        close(fd);
+        return 0;
+    }
+    void* mapa = mmap(NULL, tamMapa, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);   // La proyección se mantiene sin el descriptor
+    if (mapa == MAP_FAILED) {
+        fprintf(stderr, "Error al proyectar archivo crudo: %s\n", ruta);
+        return 0;
+    }
+
+    unsigned char* datos = (unsigned char*)mapa + cab.desplazamientoDatos;
+    CabeceraBloque* cabecera = cabeceraDeBloque(datos);
+    cabecera->magia = MAGIA_BLOQUE;
+    cabecera->origen = ORIGEN_MMAP;
+    cabecera->base = mapa;
+    cabecera->tamMapa = tamMapa;
+    unsigned char*** pixeles = enlazarMatriz3D(datos, cab.alto, cab.ancho, cab.canales);
+    if (!pixeles) {
+        munmap(mapa, tamMapa);
+        return 0;
+    }
+
+    liberarImagen(info);
+    info->pixeles = pixeles;
+    info->ancho = cab.ancho;
+    info->alto = cab.alto;
+    info->canales = cab.canales;
+    informar("Imagen cruda cargada (mmap): %dx%d, %d canales (%s)\n", info->ancho, info->alto,
+           info->canales, info->canales == 1 ? "grises" : "RGB");
+    return 1;
+}
+
+// QUÉ: Exporta la imagen como PGM (grises, P5) o PPM (RGB, P6) binario.
+// CÓMO: Escribe la cabecera de texto y el bloque contiguo de píxeles con un
+// solo fwrite (el orden [y][x][c] coincide con el de Netpbm).
+// POR QUÉ: Formato sin compresión que leen casi todas las herramientas.
+static int exportarPNM(const ImagenInfo* info, const char* ruta) {
+    if (!info->pixeles) {
+        fprintf(stderr, "No hay imagen para guardar.\n");
+        return 0;
+    }
+    if (!datosContiguos(info, "Exportar PNM")) return 0;
+    FILE* f = fopen(ruta, "wb");
+    if (!f) {
+        fprintf(stderr, "Error al crear archivo: %s\n", ruta);
+        return 0;
+    }
+    size_t bytes = (size_t)info->ancho * info->alto * info->canales;
+    fprintf(f, "P%d\n%d %d\n255\n", info->canales == 1 ? 5 : 6, info->ancho, info->alto);
+    int exito = fwrite(info->pixeles[0][0], 1, bytes, f) == bytes;
+    if (fclose(f) != 0) exito = 0;
+    if (!exito) {
+        fprintf(stderr, "Error al escribir archivo: %s\n", ruta);
+        return 0;
+    }
+    informar("Imagen exportada en: %s (%s)\n", ruta, info->canales == 1 ? "PGM" : "PPM");
+    return 1;
+}
+
+// QUÉ: Lee un número de la cabecera de texto de un archivo Netpbm.
+// CÓMO: Salta espacios y comentarios ('#' hasta fin de línea) y lee dígitos.
+// POR QUÉ: La cabecera PPM/PGM admite comentarios entre sus campos.
+static int leerNumeroPNM(FILE* f, int* valor) {
+    int c = fgetc(f);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) c = fgetc(f);
+        }
+        c = fgetc(f);
+    }
+    if (c < '0' || c > '9') return 0;
+    long n = 0;
+    while (c >= '0' && c <= '9') {
+        n = n * 10 + (c - '0');
+        if (n > 1000000000L) return 0;
+        c = fgetc(f);
+    }
+    *valor = (int)n;
+    return 1;   // 'c' era el único espacio obligatorio tras el número
+}
+
+// QUÉ: Importa un PGM (P5) o PPM (P6) binario de 8 bits.
+// CÓMO: Lee la cabecera, asigna la matriz y lee los píxeles directo al bloque
+// contiguo con un solo fread. Si el máximo de la cabecera es menor que 255,
+// lleva cada muestra a 0..255 con una tabla (las mayores que el máximo
+// quedan en 255).
+// POR QUÉ: Permite traer imágenes de otras herramientas sin pasar por PNG; un
+// PGM con máximo 15 o 100 se vería casi negro si se tomara tal cual.
+static int importarPNM(const char* ruta, ImagenInfo* info) {
+    FILE* f = fopen(ruta, "rb");
+    if (!f) {
+        fprintf(stderr, "Error al abrir archivo: %s\n", ruta);
+        return 0;
+    }
+    int ancho, alto, maximo;
+    char magia[2];
+    if (fread(magia, 1, 2, f) != 2 || magia[0] != 'P' || (magia[1] != '5' && magia[1] != '6') ||
+        !leerNumeroPNM(f, &ancho) || !leerNumeroPNM(f, &alto) || !leerNumeroPNM(f, &maximo) ||
+        ancho <= 0 || alto <= 0 || maximo <= 0 || maximo > 255) {
+        fprintf(stderr, "Error: %s no es un PGM/PPM binario de 8 bits\n", ruta);
+        fclose(f);
+        return 0;
+    }
+    int canales = magia[1] == '5' ? 1 : 3;
+    unsigned char*** pixeles = asignarMatriz3D(alto, ancho, canales);
+    if (!pixeles) {
+        fclose(f);
+        return 0;
+    }
+    size_t bytes = (size_t)ancho * alto * canales;
+    if (fread(pixeles[0][0], 1, bytes, f) != bytes) {
+        fprintf(stderr, "Error: Datos incompletos en %s\n", ruta);
+        liberarMatriz3D(pixeles, alto, ancho);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    if (maximo < 255) {
+        unsigned char tabla[256];
+        for (int v = 0; v < 256; v++) tabla[v] = v >= maximo ? 255 : (unsigned char)((v * 255 + maximo / 2) / maximo);
+        unsigned char* p = pixeles[0][0];
+        for (size_t i = 0; i < bytes; i++) p[i] = tabla[p[i]];
+    }
+
+    liberarImagen(info);
+    info->pixeles = pixeles;
+    info->ancho = ancho;
+    info->alto = alto;
+    info->canales = canales;
+    informar("Imagen importada: %dx%d, %d canales (%s)\n", ancho, alto, canales,
+           canales == 1 ? "grises" : "RGB");
+    return 1;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Submenú de formatos sin compresión.
+// CÓMO: Guardar/cargar formato crudo nativo y exportar/importar PPM/PGM.
+// POR QUÉ: Para guardar resultados intermedios sin el costo de PNG.
+static void menuFormatosCrudos(ImagenInfo* imagen) {
+    while (1) {
+        printf("\n--- Formatos sin compresión ---\n");
+        printf("1. Guardar en formato crudo nativo (.icr)\n");
+        printf("2. Cargar formato crudo nativo (mmap, sin copia)\n");
+        printf("3. Exportar PPM/PGM\n");
+        printf("4. Importar PPM/PGM\n");
+        printf("5. Volver\n");
+        printf("Opción: ");
+
+        int opcion;
+        if (scanf("%d", &opcion) != 1) {
+            while (getchar() != '\n');
+            printf("Entrada inválida.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+
+        char ruta[256];
+        switch (opcion) {
+            case 1:
+                if (leerRutaMenu("Archivo crudo de salida (.icr): ", ruta, sizeof(ruta))) {
+                    guardarCrudo(imagen, ruta);
+                }
+                break;
+            case 2:
+                if (leerRutaMenu("Archivo crudo (.icr): ", ruta, sizeof(ruta))) {
+                    cargarCrudo(ruta, imagen);
+                }
+                break;
+            case 3:
+                if (leerRutaMenu("Archivo PPM/PGM de salida: ", ruta, sizeof(ruta))) {
+                    exportarPNM(imagen, ruta);
+                }
+                break;
+            case 4:
+                if (leerRutaMenu("Archivo PPM/PGM: ", ruta, sizeof(ruta))) {
+                    importarPNM(ruta, imagen);
+                }
+                break;
+            case 5:
+                return;
+            default:
+                printf("Opción inválida.\n");
+        }
+    }
+}
+
+// QUÉ: Compara guardar y recargar un intermedio como PNG vs formato crudo.
+// CÓMO: Mide guardarPNGParalelo + cargarImagen contra guardarCrudo +
+// cargarCrudo (tocando todos los píxeles para incluir los fallos de página)
+// y verifica que la imagen recargada sea idéntica.
+// POR QUÉ: Cuantifica el costo de usar PNG entre pasos de un pipeline.
+static void medirFormatoCrudo(const ImagenInfo* info) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    const char* rutaPNG = "bench_intermedio.png";
+    const char* rutaCruda = "bench_intermedio.icr";
+    size_t bytes = (size_t)info->ancho * info->alto * info->canales;
+    ImagenInfo png = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+    ImagenInfo cruda = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+
+    double t0 = tiempoActualSegundos();
+    int okPNG = guardarPNGParalelo(info, rutaPNG, NULL) && cargarImagen(rutaPNG, &png);
+    double tPNG = tiempoActualSegundos() - t0;
+
+    t0 = tiempoActualSegundos();
+    int okCrudo = guardarCrudo(info, rutaCruda) && cargarCrudo(rutaCruda, &cruda);
+    unsigned long suma = 0;
+    if (okCrudo) {
+        const unsigned char* p = cruda.pixeles[0][0];
+        for (size_t i = 0; i < bytes; i += 64) suma += p[i];   // Un byte por línea de caché
+    }
+    double tCrudo = tiempoActualSegundos() - t0;
+
+    if (okPNG && okCrudo) {
+        int iguales = memcmp(info->pixeles[0][0], cruda.pixeles[0][0], bytes) == 0 &&
+                      memcmp(info->pixeles[0][0], png.pixeles[0][0], bytes) == 0;
+        printf("\nGuardar + recargar intermedio %dx%d (%zu bytes):\n", info->ancho, info->alto, bytes);
+        printf("  PNG:   %8.3f ms\n", tPNG * 1e3);
+        printf("  crudo: %8.3f ms (%.2fx)  [suma de control %lu]\n", tCrudo * 1e3,
+               tCrudo > 0 ? tPNG / tCrudo : 0.0, suma);
+        printf("  resultados %s\n", iguales ? "idénticos" : "DIFERENTES");
+    }
+    liberarImagen(&png);
+    liberarImagen(&cruda);
+    remove(rutaPNG);
+    remove(rutaCruda);
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// IMÁGENES EN MEMORIA COMPARTIDA (shm_open / memfd) SIN COPIAS
+// =====================================================================
+
+#define PREFIJO_SHM "shm:"          // shm:/nombre → segmento POSIX con nombre
+#define PREFIJO_DESCRIPTOR "fd:"    // fd:N → descriptor ya abierto (memfd, shm, archivo)
+
+// QUÉ: Indica si una ruta designa un segmento de memoria compartida.
+// CÓMO: Reconoce los prefijos shm: y fd:.
+// POR QUÉ: Las rutas compartidas pasan por el mismo lugar que los archivos
+// (línea de comandos, lotes y servidor).
+static int esRutaCompartida(const char* ruta) {
+    return strncmp(ruta, PREFIJO_SHM, strlen(PREFIJO_SHM)) == 0 ||
+           strncmp(ruta, PREFIJO_DESCRIPTOR, strlen(PREFIJO_DESCRIPTOR)) == 0;
+}
+
+// QUÉ: Obtiene el descriptor de un segmento a partir de su ruta.
+// CÓMO: shm:/nombre se abre con shm_open (y se crea si 'crear'); fd:N
+// devuelve N tal cual. *propio indica si hay que cerrarlo después.
+// POR QUÉ: Un proceso puede compartir por nombre o heredar/enviar el
+// descriptor (memfd_create, SCM_RIGHTS) sin que el segmento tenga nombre.
+static int abrirSegmentoCompartido(const char* ruta, int crear, int* propio) {
+    *propio = 0;
+    if (strncmp(ruta, PREFIJO_DESCRIPTOR, strlen(PREFIJO_DESCRIPTOR)) == 0) {
+        char* fin;
+        long fd = strtol(ruta + strlen(PREFIJO_DESCRIPTOR), &fin, 10);
+        return (*fin == '\0' && fin != ruta + strlen(PREFIJO_DESCRIPTOR) && fd >= 0) ? (int)fd : -1;
+    }
+    int fd = shm_open(ruta + strlen(PREFIJO_SHM), O_RDWR | (crear ? O_CREAT : 0), 0600);
+    *propio = fd >= 0;
+    return fd;
+}
+
+// QUÉ: Calcula el inicio de los píxeles en un segmento.
+// CÓMO: Cabecera cruda + CabeceraBloque redondeadas a página (como en .icr).
+// POR QUÉ: El segmento tiene la misma disposición que un archivo .icr, así
+// que un segmento puede volcarse a disco o leerse de él sin conversión.
+static size_t desplazamientoSegmento(void) {
+    long pagina = sysconf(_SC_PAGESIZE);
+    return ((sizeof(CabeceraCruda) + TAM_CABECERA_BLOQUE + pagina - 1) / pagina) * pagina;
+}
+
+// QUÉ: Proyecta una imagen de un segmento compartido sin copiar sus píxeles.
+// CÓMO: El segmento empieza con una CabeceraCruda (ancho, alto, canales, paso
+// y desplazamiento de los datos). Con 'enLugar' se proyecta MAP_SHARED: lo
+// que hagan las operaciones en el lugar lo ve el otro proceso; si no,
+// MAP_PRIVATE (copia en escritura, el segmento no cambia). Si el paso es
+// mayor que ancho*canales, las filas se copian a una matriz propia compacta
+// (el resto del programa espera un bloque contiguo) y la proyección se
+// suelta: el segmento del cliente no se toca hasta escribir el resultado,
+// que escribirImagenCompartida() deja con el paso declarado.
+// POR QUÉ: Otro proceso local entrega sus cuadros sin codificar PNG ni pasar
+// por disco, y los píxeles compactos nunca se copian de un proceso al otro;
+// un cuadro con relleno no queda revuelto si el trabajo falla a mitad.
+static int proyectarImagenCompartida(int fd, ImagenInfo* info, int enLugar) {
+    struct stat st;
+    CabeceraCruda cab;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cab) ||
+        pread(fd, &cab, sizeof(cab), 0) != (ssize_t)sizeof(cab) ||
+        memcmp(cab.magia, MAGIA_CRUDA, sizeof(cab.magia)) != 0) {
+        fprintf(stderr, "Error: El segmento no contiene una imagen válida\n");
+        return 0;
+    }
+    long pagina = sysconf(_SC_PAGESIZE);
+    if (cab.ancho <= 0 || cab.alto <= 0 || (cab.canales != 1 && cab.canales != 3) ||
+        cab.paso <= 0 || (size_t)cab.paso < (size_t)cab.ancho * cab.canales ||
+        cab.desplazamientoDatos < (int64_t)(sizeof(cab) + TAM_CABECERA_BLOQUE) ||
+        cab.desplazamientoDatos % pagina != 0 ||
+        (size_t)st.st_size < (size_t)cab.desplazamientoDatos + (size_t)cab.paso * cab.alto) {
+        fprintf(stderr, "Error: Cabecera inválida en el segmento compartido\n");
+        return 0;
+    }
+    size_t tamMapa = (size_t)st.st_size;
+    void* mapa = mmap(NULL, tamMapa, PROT_READ | PROT_WRITE, enLugar ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (mapa == MAP_FAILED) {
+        fprintf(stderr, "Error al proyectar el segmento compartido\n");
+        return 0;
+    }
+
+    unsigned char* datos = (unsigned char*)mapa + cab.desplazamientoDatos;
+    int compacto = cab.ancho * cab.canales;
+    if (cab.paso != compacto) {
+        unsigned char*** copia = asignarMatriz3D(cab.alto, cab.ancho, cab.canales);
+        if (!copia) {
+            munmap(mapa, tamMapa);
+            return 0;
+        }
+        for (int y = 0; y < cab.alto; y++) {
+            memcpy(copia[y][0], datos + (size_t)y * cab.paso, (size_t)compacto);
+        }
+        munmap(mapa, tamMapa);
+        liberarImagen(info);
+        info->pixeles = copia;
+        info->ancho = cab.ancho;
+        info->alto = cab.alto;
+        info->canales = cab.canales;
+        informar("Imagen en memoria compartida: %dx%d, %d canales (copiada: filas con relleno)\n", info->ancho,
+                 info->alto, info->canales);
+        return 1;
+    }
+    CabeceraBloque* cabecera = cabeceraDeBloque(datos);
+    cabecera->magia = MAGIA_BLOQUE;
+    cabecera->origen = enLugar ? ORIGEN_COMPARTIDO : ORIGEN_MMAP;
+    cabecera->base = mapa;
+    cabecera->tamMapa = tamMapa;
+    cabecera->dispositivo = (uint64_t)st.st_dev;
+    cabecera->inodo = (uint64_t)st.st_ino;
+    unsigned char*** pixeles = enlazarMatriz3D(datos, cab.alto, cab.ancho, cab.canales);
+    if (!pixeles) {
+        munmap(mapa, tamMapa);
+        return 0;
+    }
+
+    liberarImagen(info);
+    info->pixeles = pixeles;
+    info->ancho = cab.ancho;
+    info->alto = cab.alto;
+    info->canales = cab.canales;
+    informar("Imagen en memoria compartida: %dx%d, %d canales (%s)\n", info->ancho, info->alto,
+             info->canales, enLugar ? "en el lugar" : "copia en escritura");
+    return 1;
+}
+
+// QUÉ: Deja una imagen en un segmento compartido (el mismo de entrada u otro).
+// CÓMO: Si los píxeles ya viven en ese segmento (operaciones en el lugar con
+// MAP_SHARED, siempre sin relleno) solo se actualiza la cabecera. Si no, se agranda el segmento si hace falta (ftruncate), se
+// proyecta y se escriben cabecera y filas; si el segmento ya describía una
+// imagen del mismo ancho y canales, se respeta su paso.
+// POR QUÉ: El proceso que entregó el cuadro lee el resultado directamente de
+// su propia proyección, sin decodificar nada.
+static int escribirImagenCompartida(int fd, const ImagenInfo* info) {
+    struct stat st;
+    if (!info->pixeles || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: No hay imagen o segmento para escribir\n");
+        return 0;
+    }
+    if (!datosContiguos(info, "Escribir en memoria compartida")) return 0;
+    int compacto = info->ancho * info->canales;
+    unsigned char* datos = info->pixeles[0][0];
+    CabeceraBloque* bloque = cabeceraDeBloque(datos);
+    if (bloque->origen == ORIGEN_COMPARTIDO && bloque->dispositivo == (uint64_t)st.st_dev &&
+        bloque->inodo == (uint64_t)st.st_ino) {
+        // Mismo segmento: los píxeles ya están ahí, solo falta la cabecera
+        CabeceraCruda* cab = (CabeceraCruda*)bloque->base;
+        cab->ancho = info->ancho;
+        cab->alto = info->alto;
+        cab->canales = info->canales;
+        cab->paso = compacto;
+        informar("Resultado escrito en el lugar del segmento compartido\n");
+        return 1;
+    }
+
+    CabeceraCruda previa;
+    size_t desplazamiento = desplazamientoSegmento();
+    int paso = compacto;
+    if ((size_t)st.st_size >= sizeof(previa) && pread(fd, &previa, sizeof(previa), 0) == (ssize_t)sizeof(previa) &&
+        memcmp(previa.magia, MAGIA_CRUDA, sizeof(previa.magia)) == 0 && previa.ancho == info->ancho &&
+        previa.canales == info->canales && previa.paso >= compacto &&
+        previa.desplazamientoDatos >= (int64_t)desplazamiento &&
+        previa.desplazamientoDatos % sysconf(_SC_PAGESIZE) == 0) {
+        paso = previa.paso;
+        desplazamiento = (size_t)previa.desplazamientoDatos;
+    }
+    size_t necesario = desplazamiento + (size_t)paso * info->alto;
+    if ((size_t)st.st_size < necesario && ftruncate(fd, (off_t)necesario) != 0) {
+        fprintf(stderr, "Error: No se pudo agrandar el segmento compartido a %zu bytes\n", necesario);
+        return 0;
+    }
+    unsigned char* mapa = mmap(NULL, necesario, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapa == MAP_FAILED) {
+        fprintf(stderr, "Error al proyectar el segmento compartido de salida\n");
+        return 0;
+    }
+    CabeceraCruda cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magia, MAGIA_CRUDA, sizeof(cab.magia));
+    cab.ancho = info->ancho;
+    cab.alto = info->alto;
+    cab.canales = info->canales;
+    cab.paso = paso;
+    cab.desplazamientoDatos = (int64_t)desplazamiento;
+    memcpy(mapa, &cab, sizeof(cab));
+    if (paso == compacto) {
+        memcpy(mapa + desplazamiento, datos, (size_t)compacto * info->alto);
+    } else {
+        for (int y = 0; y < info->alto; y++) {
+            memcpy(mapa + desplazamiento + (size_t)y * paso, datos + (size_t)y * compacto, (size_t)compacto);
+        }
+    }
+    munmap(mapa, necesario);
+    informar("Resultado escrito en segmento compartido (%dx%d, %d canales)\n", info->ancho, info->alto,
+             info->canales);
+    return 1;
+}
+
+// QUÉ: Carga una imagen desde una ruta shm:/nombre o fd:N.
+// CÓMO: Abre el segmento y lo proyecta con proyectarImagenCompartida().
+// POR QUÉ: Punto de entrada para la línea de comandos y el servidor.
+static int cargarCompartida(const char* ruta, ImagenInfo* info, int enLugar) {
+    int propio;
+    int fd = abrirSegmentoCompartido(ruta, 0, &propio);
+    if (fd < 0) {
+        fprintf(stderr, "Error al abrir segmento compartido: %s\n", ruta);
+        return 0;
+    }
+    int exito = proyectarImagenCompartida(fd, info, enLugar);
+    if (propio) close(fd);   // La proyección se mantiene sin el descriptor
+    return exito;
+}
+
+// QUÉ: Guarda una imagen en una ruta shm:/nombre (se crea si no existe) o fd:N.
+// CÓMO: Abre el segmento y escribe con escribirImagenCompartida().
+// POR QUÉ: Contraparte de cargarCompartida().
+static int guardarCompartida(const ImagenInfo* info, const char* ruta) {
+    int propio;
+    int fd = abrirSegmentoCompartido(ruta, 1, &propio);
+    if (fd < 0) {
+        fprintf(stderr, "Error al abrir segmento compartido: %s\n", ruta);
+        return 0;
+    }
+    int exito = escribirImagenCompartida(fd, info);
+    if (propio) close(fd);
+    return exito;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Crea un segmento compartido anónimo (sin nombre visible).
+// CÓMO: shm_open con un nombre único (proceso, hilo, intento) y shm_unlink
+// inmediato: solo queda el descriptor, que se pasa a otro proceso por
+// herencia o SCM_RIGHTS.
+// POR QUÉ: Equivale a memfd_create usando solo POSIX.
+static int crearSegmentoAnonimo(void) {
+    char nombre[64];
+    for (int intento = 0; intento < 100; intento++) {
+        // Nombre único por proceso e hilo; O_EXCL descarta colisiones
+        snprintf(nombre, sizeof(nombre), "/img_%d_%lx_%d", (int)getpid(), (unsigned long)pthread_self(), intento);
+        int fd = shm_open(nombre, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            shm_unlink(nombre);
+            return fd;
+        }
+    }
+    return -1;
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// BENCHMARK FILAS VS TESELAS (FALLOS DE CACHÉ)
+// =====================================================================
+
+#ifndef PROCESADOR_BIBLIOTECA
+// QUÉ: Imprime una fila de la tabla del benchmark de teselas.
+// CÓMO: Muestra tiempo y fallos de caché (o "n/d" si no hay contador).
+// POR QUÉ: Formato común para las cuatro mediciones.
+static void imprimirFilaTeselas(const char* nombre, double segundos, long long fallos) {
+    if (fallos >= 0) {
+        printf("  %-30s %9.3f ms  %14lld fallos de caché\n", nombre, segundos * 1e3, fallos);
+    } else {
+        printf("  %-30s %9.3f ms  %14s fallos de caché\n", nombre, segundos * 1e3, "n/d");
+    }
+}
+
+// QUÉ: Compara convolución 7x7 y Sobel recorriendo por filas y por teselas.
+// CÓMO: Ejecuta cada kernel sobre la misma imagen con hilosPorOperacion hilos, primero con
+// bandas de filas completas y luego con teselas del tamaño de L2, midiendo
+// tiempo y fallos de caché (perf_event_open). Antes de mostrar los tiempos
+// de cada kernel verifica que ambos recorridos dieran la misma imagen; si no,
+// informa el error en lugar de los tiempos. Sobel usa el canal 0 como imagen
+// en grises.
+// POR QUÉ: En imágenes anchas la ventana k x k de filas completas no cabe en
+// caché; esta medición muestra la diferencia en cada máquina.
+static void medirTeselas(const ImagenInfo* info) {
+    if (!info->pixeles) {
+        printf("No hay imagen cargada.\n");
+        return;
+    }
+    const int tamKernel = 7;
+    float** kernel = generarKernelGaussiano(tamKernel, 2.0f);
+    unsigned char*** filas = asignarMatriz3D(info->alto, info->ancho, info->canales);
+    unsigned char*** teselas = asignarMatriz3D(info->alto, info->ancho, info->canales);
+    if (!kernel || !filas || !teselas) {
+        fprintf(stderr, "Error: Memoria insuficiente para el benchmark\n");
+        if (kernel) {
+            for (int i = 0; i < tamKernel; i++) free(kernel[i]);
+            free(kernel);
+        }
+        liberarMatriz3D(filas, info->alto, info->ancho);
+        liberarMatriz3D(teselas, info->alto, info->ancho);
+        return;
+    }
+
+    int contador = abrirContadorHardware(PERF_COUNT_HW_CACHE_MISSES_SEGURO, 1);
+    size_t bytes = (size_t)info->alto * info->ancho * info->canales;
+    printf("Benchmark filas vs teselas: %dx%d, %d canales, L2 = %ld KB\n",
+           info->ancho, info->alto, info->canales, tamanoCacheL2() / 1024);
+    if (contador < 0) {
+        printf("  (contadores de hardware no disponibles: solo tiempos)\n");
+    }
+
+    // --- Convolución por filas ---
+    int numHilos = hilosPorOperacion;
+    ConvolucionArgs conv[numHilos];
+    pthread_t hilos[numHilos];
+    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
+    for (int i = 0; i < numHilos; i++) {
+        conv[i].pixelesOrigen = info->pixeles;
+        conv[i].pixelesDestino = filas;
+        conv[i].kernel = kernel;
+        conv[i].tamKernel = tamKernel;
+        conv[i].inicio = i * filasPorHilo < info->alto ? i * filasPorHilo : info->alto;
+        conv[i].fin = ((i + 1) * filasPorHilo < info->alto) ? (i + 1) * filasPorHilo : info->alto;
+        conv[i].ancho = info->ancho;
+        conv[i].alto = info->alto;
+        conv[i].canales = info->canales;
+    }
+    iniciarContadorHardware(contador);
+    double t0 = tiempoActualSegundos();
+    int creados = 0;
+    for (int i = 0; i < numHilos; i++) {
+        if (pthread_create(&hilos[i], NULL, aplicarConvolucionHilo, &conv[i]) != 0) break;
+        creados++;
+    }
+    for (int i = 0; i < creados; i++) pthread_join(hilos[i], NULL);
+    double tFilas = tiempoActualSegundos() - t0;
+    long long fallosFilas = detenerContadorHardware(contador);
+    int completo = creados == numHilos;
+
+    // --- Convolución por teselas ---
+    int lado = calcularLadoTesela(info->canales, tamKernel / 2);
+    conv[0].pixelesDestino = teselas;
+    iniciarContadorHardware(contador);
+    t0 = tiempoActualSegundos();
+    completo = ejecutarPorTeselasConcurrente("desenfoque", info->ancho, info->alto, lado, convolucionTesela,
+                                             &conv[0]) && completo;
+    double tTeselas = tiempoActualSegundos() - t0;
+    long long fallosTeselas = detenerContadorHardware(contador);
+
+    // Los tiempos solo se informan si ambos recorridos dieron la misma imagen
+    char nombre[64];
+    if (!completo || memcmp(filas[0][0], teselas[0][0], bytes) != 0) {
+        printf("  Error: la convolución por filas y por teselas no dio el mismo resultado; "
+               "se omiten sus tiempos.\n");
+    } else {
+        imprimirFilaTeselas("convolución 7x7 filas", tFilas, fallosFilas);
+        snprintf(nombre, sizeof(nombre), "convolución 7x7 teselas %d", lado);
+        imprimirFilaTeselas(nombre, tTeselas, fallosTeselas);
+        printf("  resultados idénticos\n");
+    }
+
+    // --- Sobel por filas y por teselas (canal 0 como gris) ---
+    SobelArgs sob[numHilos];
+    for (int i = 0; i < numHilos; i++) {
+        sob[i].origen = info->pixeles;
+        sob[i].destino = filas;
+        sob[i].inicio = conv[i].inicio;
+        sob[i].fin = conv[i].fin;
+        sob[i].ancho = info->ancho;
+        sob[i].alto = info->alto;
+    }
+    iniciarContadorHardware(contador);
+    t0 = tiempoActualSegundos();
+    creados = 0;
+    for (int i = 0; i < numHilos; i++) {
+        if (pthread_create(&hilos[i], NULL, sobelHilo, &sob[i]) != 0) break;
+        creados++;
+    }
+    for (int i = 0; i < creados; i++) pthread_join(hilos[i], NULL);
+    tFilas = tiempoActualSegundos() - t0;
+    fallosFilas = detenerContadorHardware(contador);
+    completo = creados == numHilos;
+
+    lado = calcularLadoTesela(1, 1);
+    sob[0].destino = teselas;
+    iniciarContadorHardware(contador);
+    t0 = tiempoActualSegundos();
+    completo = ejecutarPorTeselasConcurrente("sobel", info->ancho, info->alto, lado, sobelTesela, &sob[0]) &&
+               completo;
+    tTeselas = tiempoActualSegundos() - t0;
+    fallosTeselas = detenerContadorHardware(contador);
+
+    // Sobel escribe solo el canal 0 de cada píxel; los demás siguen con la convolución
+    int iguales = completo;
+    for (int y = 0; iguales && y < info->alto; y++) {
+        for (int x = 0; x < info->ancho; x++) {
+            if (filas[y][x][0] != teselas[y][x][0]) {
+                iguales = 0;
+                break;
+            }
+        }
+    }
+    if (!iguales) {
+        printf("  Error: Sobel por filas y por teselas no dio el mismo resultado; se omiten sus tiempos.\n");
+    } else {
+        imprimirFilaTeselas("Sobel filas", tFilas, fallosFilas);
+        snprintf(nombre, sizeof(nombre), "Sobel teselas %d", lado);
+        imprimirFilaTeselas(nombre, tTeselas, fallosTeselas);
+        printf("  resultados idénticos\n");
+    }
+
+    if (contador >= 0) close(contador);
+    for (int i = 0; i < tamKernel; i++) free(kernel[i]);
+    free(kernel);
+    liberarMatriz3D(filas, info->alto, info->ancho);
+    liberarMatriz3D(teselas, info->alto, info->ancho);
+}
+
+// QUÉ: Submenú de herramientas de rendimiento (benchmarks).
+// CÓMO: Pide la herramienta y sus parámetros, y llama a la función de medición.
+// POR QUÉ: Agrupa las mediciones en un solo lugar para no saturar el menú principal.
+static void menuRendimiento(ImagenInfo* imagen) {
+    while (1) {
+        printf("\n--- Herramientas de rendimiento ---\n");
+        printf("1. Medir brillo clásico vs vectorial (GB/s)\n");
+        printf("2. Comparar pipeline paso a paso vs fusionado\n");
+        printf("3. Comparar convolución y Sobel por filas vs por teselas (fallos de caché)\n");
+        printf("4. Comparar carga PNG completa vs en streaming\n");
+        printf("5. Tabla de guardado PNG: tiempo vs tamaño por nivel y filtro\n");
+        printf("6. Comparar intermedio PNG vs formato crudo (guardar + recargar)\n");
+        printf("7. Medir operaciones puntuales: tabla escalar vs vectorial (GB/s)\n");
+        printf("8. Volver\n");
+        printf("Opción: ");
+
+        int opcion;
+        if (scanf("%d", &opcion) != 1) {
+            while (getchar() != '\n');
+            printf("Entrada inválida.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+
+        switch (opcion) {
+            case 1:
+            case 7: {
+                if (!imagen->pixeles) {
+                    printf("Primero carga una imagen (opción 1).\n");
+                    break;
+                }
+                int repeticiones;
+                printf("Repeticiones (1-1000): ");
+                if (scanf("%d", &repeticiones) != 1 || repeticiones < 1 || repeticiones > 1000) {
+                    while (getchar() != '\n');
+                    printf("Entrada inválida.\n");
+                    break;
+                }
+                while (getchar() != '\n');
+                if (opcion == 1) {
+                    medirRendimientoBrillo(imagen, repeticiones);
+                } else {
+                    medirRendimientoLUT(imagen, repeticiones);
+                }
+                break;
+            }
+            case 2:
+                medirPipelineFusionado(imagen);
+                break;
+            case 3:
+                medirTeselas(imagen);
+                break;
+            case 4:
+                medirCargaStreaming();
+                break;
+            case 5:
+                medirGuardadoPNG(imagen);
+                break;
+            case 6:
+                medirFormatoCrudo(imagen);
+                break;
+            case 8:
+                return;
+            default:
+                printf("Opción inválida.\n");
+        }
+    }
+}
+#endif // PROCESADOR_BIBLIOTECA
+
+// =====================================================================
+// MODO LÍNEA DE COMANDOS (SIN MENÚ)
+// =====================================================================
+
+#define MAX_PASOS_LINEA_COMANDOS 16
+
+// QUÉ: Indica si una ruta termina en la extensión dada (sin distinguir mayúsculas).
+// CÓMO: Compara el final de la cadena carácter por carácter con tolower.
+// POR QUÉ: El formato de entrada y salida se elige por la extensión.
+static int tieneExtension(const char* ruta, const char* extension) {
+    size_t n = strlen(ruta), m = strlen(extension);
+    if (n < m) return 0;
+    for (size_t i = 0; i < m; i++) {
+        if (tolower((unsigned char)ruta[n - m + i]) != tolower((unsigned char)extension[i])) return 0;
+    }
+    return 1;
+}
+
+// QUÉ: Carga una imagen eligiendo el formato por la extensión.
+// CÓMO: shm:/fd: → cargarCompartida (copia en escritura), .icr → cargarCrudo,
+// .ppm/.pgm → importarPNM, .tsl → importarImagenMapeada; cualquier otra →
+// cargarImagen (stb). La carga se mide como operación "cargar".
+// POR QUÉ: Los trabajos por lotes encadenan pasos usando formatos intermedios.
+static int cargarSegunExtension(const char* ruta, ImagenInfo* info) {
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, NULL);
+    int exito;
+    if (esRutaCompartida(ruta)) exito = cargarCompartida(ruta, info, 0);
+    else if (tieneExtension(ruta, ".icr")) exito = cargarCrudo(ruta, info);
+    else if (tieneExtension(ruta, ".ppm") || tieneExtension(ruta, ".pgm")) exito = importarPNM(ruta, info);
+    else if (tieneExtension(ruta, ".tsl")) exito = importarImagenMapeada(ruta, info);
+    else exito = cargarImagen(ruta, info);
+    if (exito) terminarMedicion(&medicion, "cargar", ruta, info);
+    return exito;
+}
+
+// QUÉ: Guarda una imagen eligiendo el formato por la extensión.
+// CÓMO: shm:/fd:, .icr, .ppm/.pgm y .tsl usan sus funciones; cualquier otra
+// se guarda como PNG con guardarPNGParalelo() y las opciones dadas. El
+// guardado se mide como operación "guardar".
+// POR QUÉ: Contraparte de cargarSegunExtension().
+static int guardarSegunExtension(const ImagenInfo* info, const char* ruta, const OpcionesPNG* opciones) {
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, info);
+    int exito;
+    if (esRutaCompartida(ruta)) exito = guardarCompartida(info, ruta);
+    else if (tieneExtension(ruta, ".icr")) exito = guardarCrudo(info, ruta);
+    else if (tieneExtension(ruta, ".ppm") || tieneExtension(ruta, ".pgm")) exito = exportarPNM(info, ruta);
+    else if (tieneExtension(ruta, ".tsl")) exito = exportarImagenMapeada(info, ruta);
+    else exito = guardarPNGParalelo(info, ruta, opciones);
+    if (exito) terminarMedicion(&medicion, "guardar", ruta, info);
+    return exito;
+}
+
+#ifndef PROCESADOR_BIBLIOTECA
+// =====================================================================
+// PROCESAMIENTO POR LOTES (DECODIFICAR → PROCESAR → CODIFICAR)
+// =====================================================================
+
+// QUÉ: Cola acotada de punteros entre dos etapas del lote.
+// CÓMO: Búfer circular con mutex y variables de condición. Cada etapa
+// productora avisa al terminar (terminarProductor); cuando no quedan
+// productores y la cola está vacía, desencolar devuelve NULL. cerrada corta
+// la cola antes de tiempo (cerrarColaTrabajos).
+// POR QUÉ: Las etapas avanzan a su propio ritmo sin acumular imágenes: si
+// una etapa se atrasa, la anterior espera (memoria acotada).
+typedef struct {
+    void** elementos;
+    int capacidad;
+    int cabeza;
+    int cantidad;
+    int productoresActivos;
+    int cerrada;                    // 1 tras cerrarColaTrabajos(): no entra ni sale nada
+    pthread_mutex_t mutex;
+    pthread_cond_t hayElementos;
+    pthread_cond_t hayEspacio;
+} ColaTrabajos;
+
+static int iniciarColaTrabajos(ColaTrabajos* cola, int capacidad, int productores) {
+    memset(cola, 0, sizeof(*cola));
+    cola->elementos = malloc((size_t)capacidad * sizeof(void*));
+    if (!cola->elementos) return 0;
+    cola->capacidad = capacidad;
+    cola->productoresActivos = productores;
+    pthread_mutex_init(&cola->mutex, NULL);
+    pthread_cond_init(&cola->hayElementos, NULL);
+    pthread_cond_init(&cola->hayEspacio, NULL);
+    return 1;
+}
+
+static void destruirColaTrabajos(ColaTrabajos* cola) {
+    pthread_mutex_destroy(&cola->mutex);
+    pthread_cond_destroy(&cola->hayElementos);
+    pthread_cond_destroy(&cola->hayEspacio);
+    free(cola->elementos);
+}
+
+// QUÉ: Agrega un elemento esperando si la cola está llena.
+// CÓMO: Suma a *espera el tiempo bloqueado; con --trace, si tuvo que
+// esperar, lo registra como intervalo. Devuelve 0 si la cola se cerró: el
+// elemento no entró y sigue siendo del llamador.
+// POR QUÉ: El tiempo de espera por espacio indica que la etapa siguiente es
+// el cuello de botella.
+static int encolarTrabajo(ColaTrabajos* cola, void* elemento, double* espera) {
+    double t0 = tiempoActualSegundos();
+    int esperoEspacio = 0;
+    pthread_mutex_lock(&cola->mutex);
+    while (cola->cantidad == cola->capacidad && !cola->cerrada) {
+        esperoEspacio = 1;
+        pthread_cond_wait(&cola->hayEspacio, &cola->mutex);
+    }
+    int encolado = !cola->cerrada;
+    if (encolado) {
+        cola->elementos[(cola->cabeza + cola->cantidad) % cola->capacidad] = elemento;
+        cola->cantidad++;
+        pthread_cond_signal(&cola->hayElementos);
+    }
+    pthread_mutex_unlock(&cola->mutex);
+    double t1 = tiempoActualSegundos();
+    *espera += t1 - t0;
+    if (trazaActiva && esperoEspacio) registrarEventoTraza("esperar espacio", "cola", NULL, t0, t1, idHiloTraza());
+    return encolado;
+}
+
+// QUÉ: Saca un elemento esperando si la cola está vacía.
+// CÓMO: Devuelve NULL cuando no hay elementos ni productores activos, o si la
+// cola se cerró; con --trace registra la espera como encolarTrabajo().
+// POR QUÉ: Así cada hilo consumidor sabe cuándo terminar.
+static void* desencolarTrabajo(ColaTrabajos* cola, double* espera) {
+    double t0 = tiempoActualSegundos();
+    int esperoElemento = 0;
+    pthread_mutex_lock(&cola->mutex);
+    while (cola->cantidad == 0 && cola->productoresActivos > 0 && !cola->cerrada) {
+        esperoElemento = 1;
+        pthread_cond_wait(&cola->hayElementos, &cola->mutex);
+    }
+    void* elemento = NULL;
+    if (cola->cantidad > 0 && !cola->cerrada) {
+        elemento = cola->elementos[cola->cabeza];
+        cola->cabeza = (cola->cabeza + 1) % cola->capacidad;
+        cola->cantidad--;
+        pthread_cond_signal(&cola->hayEspacio);
+    }
+    pthread_mutex_unlock(&cola->mutex);
+    double t1 = tiempoActualSegundos();
+    *espera += t1 - t0;
+    if (trazaActiva && esperoElemento) registrarEventoTraza("esperar trabajo", "cola", NULL, t0, t1, idHiloTraza());
+    return elemento;
+}
+
+// QUÉ: Marca que un hilo productor terminó.
+// CÓMO: Decrementa el contador y despierta a todos los consumidores.
+// POR QUÉ: Los consumidores bloqueados deben ver el fin de la cola.
+static void terminarProductor(ColaTrabajos* cola) {
+    pthread_mutex_lock(&cola->mutex);
+    cola->productoresActivos--;
+    pthread_cond_broadcast(&cola->hayElementos);
+    pthread_mutex_unlock(&cola->mutex);
+}
+
+// QUÉ: Cierra la cola sin esperar a que se vacíe.
+// CÓMO: Marca cerrada y despierta a productores y consumidores: encolar
+// devuelve 0 y desencolar NULL. Lo que quedó adentro lo saca quien la
+// destruye (sacarTrabajoCerrada).
+// POR QUÉ: Si falta un hilo de alguna etapa, los demás quedarían bloqueados
+// para siempre esperando a un productor o consumidor que nunca existió.
+static void cerrarColaTrabajos(ColaTrabajos* cola) {
+    pthread_mutex_lock(&cola->mutex);
+    cola->cerrada = 1;
+    pthread_cond_broadcast(&cola->hayElementos);
+    pthread_cond_broadcast(&cola->hayEspacio);
+    pthread_mutex_unlock(&cola->mutex);
+}
+
+// QUÉ: Saca sin esperar un elemento de una cola cerrada.
+// CÓMO: Devuelve NULL cuando ya no queda ninguno.
+// POR QUÉ: Tras unir los hilos, libera lo que quedó en tránsito.
+static void* sacarTrabajoCerrada(ColaTrabajos* cola) {
+    pthread_mutex_lock(&cola->mutex);
+    void* elemento = NULL;
+    if (cola->cantidad > 0) {
+        elemento = cola->elementos[cola->cabeza];
+        cola->cabeza = (cola->cabeza + 1) % cola->capacidad;
+        cola->cantidad--;
+    }
+    pthread_mutex_unlock(&cola->mutex);
+    return elemento;
+}
+
+// QUÉ: Una imagen en tránsito por el lote.
+// CÓMO: Rutas de entrada/salida y la imagen cargada.
+// POR QUÉ: Es lo que viaja por las colas entre etapas.
+typedef struct {
+    const char* rutaEntrada;
+    char rutaSalida[512];
+    ImagenInfo imagen;
+} TrabajoLote;
+
+// QUÉ: Estado compartido del lote.
+// CÓMO: Lista de entradas, operaciones, opciones de salida, las dos colas y
+// contadores de resultados (solo se escriben con operaciones atómicas).
+// POR QUÉ: Todos los hilos de todas las etapas leen esta configuración.
+typedef struct {
+    char** entradas;
+    int numEntradas;
+    int siguiente;                  // Próxima entrada a decodificar (atómico)
+    const char* dirSalida;
+    const char* formato;            // Extensión de salida sin punto
+    unsigned char* conservarExtension;  // Por entrada: 1 si su salida chocaba con otra
+    const PasoPipeline* pasos;
+    int numPasos;
+    const OpcionesPNG* opcionesPNG;
+    ColaTrabajos decodificadas;     // Decodificar → procesar
+    ColaTrabajos procesadas;        // Procesar → codificar
+    int correctas;                  // Imágenes guardadas (atómico)
+    int fallidas;                   // Imágenes con error (atómico)
+} LoteCompartido;
+
+// QUÉ: Argumentos y estadísticas de un hilo de una etapa del lote.
+// CÓMO: Cada hilo acumula sus propios tiempos y elementos; se suman al final.
+// POR QUÉ: Sin contadores compartidos por hilo no hay contención al medir.
+typedef struct {
+    LoteCompartido* lote;
+    double ocupado;                 // Segundos trabajando
+    double espera;                  // Segundos bloqueado en colas
+    int elementos;                  // Imágenes procesadas por el hilo
+    int grupo;                      // Grupo de afinidad (--numa)
+    RegistroEstadisticas estadisticas;  // Copia del registro del hilo al terminar
+} HiloLoteArgs;
+
+// QUÉ: Arma la ruta de salida: directorio + nombre base + nueva extensión.
+// CÓMO: Toma lo que sigue a la última '/' y reemplaza la extensión; con
+// conservarExtension la agrega después de la de origen (foto.pgm.png).
+// POR QUÉ: Cada archivo de entrada produce uno de salida con el mismo nombre.
+static void construirRutaSalida(const char* entrada, const char* dir, const char* formato,
+                                int conservarExtension, char* salida, size_t tam) {
+    const char* base = strrchr(entrada, '/');
+    base = base ? base + 1 : entrada;
+    const char* punto = conservarExtension ? NULL : strrchr(base, '.');
+    int largoBase = punto ? (int)(punto - base) : (int)strlen(base);
+    snprintf(salida, tam, "%s/%.*s.%s", dir, largoBase, base, formato);
+}
+
+// QUÉ: Hilo de la etapa de decodificación.
+// CÓMO: Toma índices de entrada con un contador atómico, carga cada imagen
+// según su extensión y la pasa a la cola de procesamiento.
+// POR QUÉ: Varios decodificadores mantienen alimentada la etapa siguiente.
+static void* decodificarLoteHilo(void* args) {
+    HiloLoteArgs* a = (HiloLoteArgs*)args;
+    grupoAfinidadHilo = a->grupo;
+    LoteCompartido* lote = a->lote;
+    while (1) {
+        int i = __atomic_fetch_add(&lote->siguiente, 1, __ATOMIC_RELAXED);
+        if (i >= lote->numEntradas) break;
+        double t0 = tiempoActualSegundos();
+        TrabajoLote* t = calloc(1, sizeof(TrabajoLote));
+        int ok = t && cargarSegunExtension(lote->entradas[i], &t->imagen);
+        a->ocupado += tiempoActualSegundos() - t0;
+        if (!ok) {
+            fprintf(stderr, "Error: No se pudo decodificar %s\n", lote->entradas[i]);
+            __atomic_fetch_add(&lote->fallidas, 1, __ATOMIC_RELAXED);
+            free(t);
+            continue;
+        }
+        t->rutaEntrada = lote->entradas[i];
+        construirRutaSalida(t->rutaEntrada, lote->dirSalida, lote->formato, lote->conservarExtension[i],
+                            t->rutaSalida, sizeof(t->rutaSalida));
+        a->elementos++;
+        if (!encolarTrabajo(&lote->decodificadas, t, &a->espera)) {
+            liberarImagen(&t->imagen);
+            free(t);
+            break;
+        }
+    }
+    a->estadisticas = estadisticasHilo;
+    terminarProductor(&lote->decodificadas);
+    return NULL;
+}
+
+// QUÉ: Hilo de la etapa de procesamiento.
+// CÓMO: Saca imágenes decodificadas, ejecuta el pipeline fusionado (que a su
+// vez usa hilosPorOperacion hilos) y las pasa a la cola de codificación.
+// POR QUÉ: Separa el cómputo de la E/S y la (de)compresión.
+static void* procesarLoteHilo(void* args) {
+    HiloLoteArgs* a = (HiloLoteArgs*)args;
+    grupoAfinidadHilo = a->grupo;
+    LoteCompartido* lote = a->lote;
+    TrabajoLote* t;
+    while ((t = desencolarTrabajo(&lote->decodificadas, &a->espera)) != NULL) {
+        double t0 = tiempoActualSegundos();
+        int ok = lote->numPasos == 0 ||
+                 ejecutarPipelineFusionadoConcurrente(&t->imagen, lote->pasos, lote->numPasos);
+        a->ocupado += tiempoActualSegundos() - t0;
+        if (!ok) {
+            fprintf(stderr, "Error: No se pudo procesar %s\n", t->rutaEntrada);
+            __atomic_fetch_add(&lote->fallidas, 1, __ATOMIC_RELAXED);
+            liberarImagen(&t->imagen);
+            free(t);
+            continue;
+        }
+        a->elementos++;
+        if (!encolarTrabajo(&lote->procesadas, t, &a->espera)) {
+            liberarImagen(&t->imagen);
+            free(t);
+            break;
         }
     }
-    
-    // Normalizar el kernel para que la suma sea 1.0
-    // Esto garantiza que el brillo promedio de la imagen no cambie
-    if (suma > 0.0f) {
-        for (int i = 0; i < tamKernel; i++) {
-            for (int j = 0; j < tamKernel; j++) {
-                kernel[i][j] /= suma;
-            }
+    a->estadisticas = estadisticasHilo;
+    terminarProductor(&lote->procesadas);
+    return NULL;
+}
+
+// QUÉ: Hilo de la etapa de codificación.
+// CÓMO: Saca imágenes procesadas, las guarda según el formato de salida y
+// libera su memoria.
+// POR QUÉ: La compresión PNG suele ser la etapa más cara; puede tener más hilos.
+static void* codificarLoteHilo(void* args) {
+    HiloLoteArgs* a = (HiloLoteArgs*)args;
+    grupoAfinidadHilo = a->grupo;
+    LoteCompartido* lote = a->lote;
+    TrabajoLote* t;
+    while ((t = desencolarTrabajo(&lote->procesadas, &a->espera)) != NULL) {
+        double t0 = tiempoActualSegundos();
+        int ok = guardarSegunExtension(&t->imagen, t->rutaSalida, lote->opcionesPNG);
+        liberarImagen(&t->imagen);
+        a->ocupado += tiempoActualSegundos() - t0;
+        if (ok) {
+            a->elementos++;
+            __atomic_fetch_add(&lote->correctas, 1, __ATOMIC_RELAXED);
+        } else {
+            fprintf(stderr, "Error: No se pudo guardar %s\n", t->rutaSalida);
+            __atomic_fetch_add(&lote->fallidas, 1, __ATOMIC_RELAXED);
         }
+        free(t);
     }
-    
-    return kernel;
+    a->estadisticas = estadisticasHilo;
+    return NULL;
 }
 
-// QUÉ: Estructura para pasar datos al hilo de convolución.
-// CÓMO: Contiene matrices origen y destino, kernel, rango de filas y dimensiones.
-// POR QUÉ: Los hilos necesitan datos específicos para procesar convolución en paralelo,
-// incluyendo acceso al kernel y matrices separadas para lectura y escritura.
-typedef struct {
-    unsigned char*** pixelesOrigen;   // Matriz de lectura (imagen original)
-    unsigned char*** pixelesDestino;  // Matriz de escritura (resultado)
-    float** kernel;                   // Kernel de convolución
-    int tamKernel;                    // Tamaño del kernel (debe ser impar)
-    int inicio;                       // Fila inicial (inclusiva)
-    int fin;                          // Fila final (exclusiva)
-    int ancho;                        // Ancho de la imagen
-    int alto;                         // Alto de la imagen
-    int canales;                      // Número de canales (1 o 3)
-} ConvolucionArgs;
+// QUÉ: Compara dos cadenas para qsort.
+// CÓMO: strcmp sobre punteros a cadenas.
+// POR QUÉ: El listado de un directorio se ordena para que el lote sea repetible.
+static int compararRutas(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
 
-// QUÉ: Estructura para pasar datos al hilo de escalado.
-// CÓMO: Contiene matrices origen y destino, dimensiones originales y destino,
-// y el rango de filas a procesar en la imagen destino.
-// POR QUÉ: Los hilos necesitan los factores de escala implícitos en las dimensiones
-// para mapear cada píxel destino a su posición en la imagen origen.
-typedef struct {
-    unsigned char*** pixelesOrigen;   // Matriz de lectura (imagen original)
-    unsigned char*** pixelesDestino;  // Matriz de escritura (imagen escalada)
-    int anchoOrigen;                  // Ancho de la imagen original
-    int altoOrigen;                   // Alto de la imagen original
-    int anchoDestino;                 // Ancho de la imagen escalada
-    int altoDestino;                  // Alto de la imagen escalada
-    int canales;                      // Número de canales (1 o 3)
-    int inicio;                       // Fila inicial en imagen destino (inclusiva)
-    int fin;                          // Fila final en imagen destino (exclusiva)
-} EscaladoArgs;
+// QUÉ: Arma la lista de entradas desde un directorio o un archivo de lista.
+// CÓMO: Si la ruta es un directorio, toma sus archivos .png/.icr/.ppm/.pgm
+// (ordenados); si es un archivo, lee una ruta por línea.
+// POR QUÉ: Los lotes vienen como carpetas o como listas generadas por scripts.
+static char** listarEntradasLote(const char* ruta, int* numEntradas) {
+    int capacidad = 64, n = 0;
+    char** lista = malloc((size_t)capacidad * sizeof(char*));
+    if (!lista) return NULL;
+    struct stat st;
+    if (stat(ruta, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(ruta);
+        struct dirent* e;
+        while (dir && (e = readdir(dir)) != NULL) {
+            if (!tieneExtension(e->d_name, ".png") && !tieneExtension(e->d_name, ".icr") &&
+                !tieneExtension(e->d_name, ".ppm") && !tieneExtension(e->d_name, ".pgm")) continue;
+            if (n == capacidad) {
+                capacidad *= 2;
+                char** tmp = realloc(lista, (size_t)capacidad * sizeof(char*));
+                if (!tmp) break;
+                lista = tmp;
+            }
+            size_t tam = strlen(ruta) + strlen(e->d_name) + 2;
+            lista[n] = malloc(tam);
+            if (!lista[n]) break;
+            snprintf(lista[n], tam, "%s/%s", ruta, e->d_name);
+            n++;
+        }
+        if (dir) closedir(dir);
+        qsort(lista, (size_t)n, sizeof(char*), compararRutas);
+    } else {
+        FILE* f = fopen(ruta, "r");
+        if (!f) {
+            fprintf(stderr, "Error: No se pudo abrir la lista de entradas: %s\n", ruta);
+            free(lista);
+            return NULL;
+        }
+        char linea[512];
+        while (fgets(linea, sizeof(linea), f)) {
+            linea[strcspn(linea, "\r\n")] = 0;
+            if (linea[0] == '\0' || linea[0] == '#') continue;
+            if (n == capacidad) {
+                capacidad *= 2;
+                char** tmp = realloc(lista, (size_t)capacidad * sizeof(char*));
+                if (!tmp) break;
+                lista = tmp;
+            }
+            lista[n] = strdup(linea);
+            if (!lista[n]) break;
+            n++;
+        }
+        fclose(f);
+    }
+    *numEntradas = n;
+    return lista;
+}
 
-// QUÉ: Aplica convolución en un rango de filas (para hilos).
-// CÓMO: Para cada píxel en el rango, aplica el kernel mediante suma ponderada
-// de los píxeles vecinos. Usa clamping de coordenadas para replicar bordes.
-// Clamp el resultado final a [0, 255]. Procesa cada canal independientemente.
-// POR QUÉ: Permite procesar la imagen en paralelo dividiendo filas entre hilos,
-// mejorando el rendimiento en sistemas multi-core.
-void* aplicarConvolucionHilo(void* args) {
-    ConvolucionArgs* cArgs = (ConvolucionArgs*)args;
-    
-    // Calcular el offset desde el centro del kernel
-    int offset = cArgs->tamKernel / 2;
-    
-    // Procesar cada fila asignada a este hilo
-    for (int y = cArgs->inicio; y < cArgs->fin; y++) {
-        for (int x = 0; x < cArgs->ancho; x++) {
-            // Procesar cada canal del píxel independientemente
-            for (int c = 0; c < cArgs->canales; c++) {
-                float suma = 0.0f;
-                
-                // Aplicar convolución: sumar píxeles vecinos ponderados por kernel
-                for (int ky = -offset; ky <= offset; ky++) {
-                    for (int kx = -offset; kx <= offset; kx++) {
-                        // Calcular coordenadas del píxel vecino
-                        int ny = y + ky;
-                        int nx = x + kx;
-                        
-                        // Manejo de bordes: replicar píxeles de borde (clamping)
-                        // Esto evita artefactos negros en los bordes
-                        if (ny < 0) ny = 0;
-                        if (ny >= cArgs->alto) ny = cArgs->alto - 1;
-                        if (nx < 0) nx = 0;
-                        if (nx >= cArgs->ancho) nx = cArgs->ancho - 1;
-                        
-                        // Acumular: valor_pixel * peso_kernel
-                        suma += cArgs->pixelesOrigen[ny][nx][c] * 
-                                cArgs->kernel[ky + offset][kx + offset];
-                    }
-                }
-                
-                // Redondear y clamp resultado a rango válido [0, 255]
-                int resultado = (int)(suma + 0.5f);  // Redondeo
-                if (resultado < 0) resultado = 0;
-                if (resultado > 255) resultado = 255;
-                
-                // Asignar resultado a matriz destino
-                cArgs->pixelesDestino[y][x][c] = (unsigned char)resultado;
+// QUÉ: Busca entradas del lote que producirían el mismo archivo de salida.
+// CÓMO: Arma la salida de cada entrada, ordena los punteros con
+// compararRutas() y compara vecinos (el índice sale de la posición en el
+// búfer). Las que chocan (foto.png y foto.pgm → foto.png) se marcan en
+// conservarExtension; si aun así chocan (mismo nombre en distintos
+// directorios), informa el par y devuelve 0.
+// POR QUÉ: Sin esto un codificador sobrescribe en silencio la salida de otro.
+static int resolverColisionesSalida(LoteCompartido* lote) {
+    const size_t tamRuta = sizeof(((TrabajoLote*)0)->rutaSalida);
+    int n = lote->numEntradas;
+    char* rutas = malloc((size_t)n * tamRuta);
+    char** orden = malloc((size_t)n * sizeof(char*));
+    lote->conservarExtension = calloc((size_t)n, 1);
+    if (!rutas || !orden || !lote->conservarExtension) {
+        fprintf(stderr, "Error de memoria para el lote\n");
+        free(rutas);
+        free(orden);
+        return 0;
+    }
+    int exito = 1;
+    for (int pasada = 0; pasada < 2 && exito; pasada++) {
+        for (int i = 0; i < n; i++) {
+            orden[i] = rutas + (size_t)i * tamRuta;
+            construirRutaSalida(lote->entradas[i], lote->dirSalida, lote->formato,
+                                lote->conservarExtension[i], orden[i], tamRuta);
+        }
+        qsort(orden, (size_t)n, sizeof(char*), compararRutas);
+        for (int k = 1; k < n; k++) {
+            if (strcmp(orden[k - 1], orden[k]) != 0) continue;
+            int a = (int)((orden[k - 1] - rutas) / tamRuta), b = (int)((orden[k] - rutas) / tamRuta);
+            if (pasada == 0) {
+                lote->conservarExtension[a] = lote->conservarExtension[b] = 1;
+            } else {
+                fprintf(stderr, "Error: %s y %s producirían el mismo archivo de salida %s\n",
+                        lote->entradas[a], lote->entradas[b], orden[k]);
+                exito = 0;
+                break;
             }
         }
     }
-    
-    return NULL;
+    free(rutas);
+    free(orden);
+    return exito;
 }
 
-// QUÉ: Aplica desenfoque Gaussiano mediante convolución concurrente.
-// CÓMO: Genera kernel Gaussiano, crea matriz temporal para resultados, divide
-// trabajo entre 2 hilos por filas, espera sincronización, reemplaza matriz original.
-// POR QUÉ: Suaviza la imagen para reducir ruido. Usa concurrencia para acelerar
-// el procesamiento en imágenes grandes.
-void aplicarConvolucionConcurrente(ImagenInfo* info, int tamKernel, float sigma) {
-    // Validar que hay imagen cargada
-    if (!info || !info->pixeles) {
-        fprintf(stderr, "Error: No hay imagen cargada para aplicar convolución\n");
-        return;
+// QUÉ: Imprime una fila de la tabla de utilización por etapa.
+// CÓMO: Suma las estadísticas de los hilos de la etapa y las relaciona con
+// el tiempo total: utilización = ocupado / (hilos * tiempo total).
+// POR QUÉ: La etapa con utilización cercana al 100% es el cuello de botella.
+static void imprimirEtapaLote(const char* nombre, const HiloLoteArgs* hilos, int numHilos, double total) {
+    double ocupado = 0, espera = 0;
+    int elementos = 0;
+    for (int i = 0; i < numHilos; i++) {
+        ocupado += hilos[i].ocupado;
+        espera += hilos[i].espera;
+        elementos += hilos[i].elementos;
     }
-    
-    // Validar tamaño del kernel (debe ser impar y positivo)
-    if (tamKernel <= 0 || tamKernel % 2 == 0) {
-        fprintf(stderr, "Error: El tamaño del kernel debe ser impar y positivo (recibido: %d)\n", 
-                tamKernel);
-        return;
+    printf("  %-12s %5d %9d %11.3f %10.3f %9.3f %11.1f%%\n", nombre, numHilos, elementos, ocupado,
+           espera, elementos > 0 ? ocupado * 1e3 / elementos : 0.0,
+           total > 0 ? 100.0 * ocupado / (numHilos * total) : 0.0);
+}
+
+// QUÉ: Procesa un lote de imágenes con tres etapas concurrentes.
+// CÓMO: 'decodificadores' hilos cargan imágenes, 'procesadores' hilos aplican
+// los pasos y 'codificadores' hilos guardan; las etapas se conectan con colas
+// acotadas (2 lugares por hilo consumidor). Al final muestra por etapa hilos,
+// imágenes, tiempo ocupado, tiempo de espera en colas y utilización.
+// POR QUÉ: Ejecutar el programa una vez por archivo serializa decodificar,
+// procesar y codificar; con las etapas solapadas todos los núcleos trabajan.
+static int procesarLoteConcurrente(const char* rutaEntradas, const char* dirSalida, const char* formato,
+                            const PasoPipeline* pasos, int numPasos, const OpcionesPNG* opcionesPNG,
+                            int decodificadores, int procesadores, int codificadores) {
+    LoteCompartido lote;
+    memset(&lote, 0, sizeof(lote));
+    lote.entradas = listarEntradasLote(rutaEntradas, &lote.numEntradas);
+    if (!lote.entradas) return 0;
+    if (lote.numEntradas == 0) {
+        fprintf(stderr, "Error: No hay imágenes en %s\n", rutaEntradas);
+        free(lote.entradas);
+        return 0;
     }
-    
-    // Validar sigma (debe ser positivo)
-    if (sigma <= 0.0f) {
-        fprintf(stderr, "Error: Sigma debe ser positivo (recibido: %.2f)\n", sigma);
-        return;
+    if (mkdir(dirSalida, 0755) != 0) {
+        struct stat st;
+        if (stat(dirSalida, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Error: No se pudo crear el directorio de salida %s\n", dirSalida);
+            for (int i = 0; i < lote.numEntradas; i++) free(lote.entradas[i]);
+            free(lote.entradas);
+            return 0;
+        }
     }
-    
-    printf("Generando kernel Gaussiano %dx%d con sigma=%.2f...\n", 
-           tamKernel, tamKernel, sigma);
-    
-    // Generar kernel Gaussiano
-    float** kernel = generarKernelGaussiano(tamKernel, sigma);
-    if (!kernel) {
-        fprintf(stderr, "Error: No se pudo generar el kernel Gaussiano\n");
-        return;
+    lote.dirSalida = dirSalida;
+    lote.formato = formato;
+    if (!resolverColisionesSalida(&lote)) {
+        for (int i = 0; i < lote.numEntradas; i++) free(lote.entradas[i]);
+        free(lote.entradas);
+        free(lote.conservarExtension);
+        return 0;
     }
-    
-    printf("Aplicando convolución a imagen %dx%d, %d canales...\n", 
-           info->ancho, info->alto, info->canales);
-    
-    // Crear matriz temporal para almacenar resultados
-    unsigned char*** matrizTemporal = asignarMatriz3D(info->alto, info->ancho, info->canales);
-    if (!matrizTemporal) {
-        fprintf(stderr, "Error: No se pudo asignar memoria para matriz temporal\n");
-        // Liberar kernel antes de retornar
-        for (int i = 0; i < tamKernel; i++) {
-            free(kernel[i]);
+    lote.pasos = pasos;
+    lote.numPasos = numPasos;
+    lote.opcionesPNG = opcionesPNG;
+
+    int totalHilos = decodificadores + procesadores + codificadores;
+    pthread_t* hilos = malloc((size_t)totalHilos * sizeof(pthread_t));
+    HiloLoteArgs* args = calloc((size_t)totalHilos, sizeof(HiloLoteArgs));
+    int colaDecodificadas = iniciarColaTrabajos(&lote.decodificadas, 2 * procesadores, decodificadores);
+    int colaProcesadas = iniciarColaTrabajos(&lote.procesadas, 2 * codificadores, procesadores);
+    if (!hilos || !args || !colaDecodificadas || !colaProcesadas) {
+        fprintf(stderr, "Error de memoria para el lote\n");
+        if (colaDecodificadas) destruirColaTrabajos(&lote.decodificadas);
+        if (colaProcesadas) destruirColaTrabajos(&lote.procesadas);
+        for (int i = 0; i < lote.numEntradas; i++) free(lote.entradas[i]);
+        free(lote.entradas);
+        free(lote.conservarExtension);
+        free(hilos);
+        free(args);
+        return 0;
+    }
+
+    double t0 = tiempoActualSegundos();
+    int creados = 0;
+    repartirAfinidadEnGrupos(totalHilos);
+    for (int i = 0; i < totalHilos; i++) {
+        void* (*funcion)(void*) = i < decodificadores ? decodificarLoteHilo
+                                : i < decodificadores + procesadores ? procesarLoteHilo
+                                : codificarLoteHilo;
+        args[i].lote = &lote;
+        args[i].grupo = i;
+        if (pthread_create(&hilos[i], NULL, funcion, &args[i]) != 0) {
+            fprintf(stderr, "Error al crear hilo %d del lote\n", i);
+            break;
         }
-        free(kernel);
-        return;
+        creados++;
     }
-    
-    // Configurar hilos para procesamiento paralelo
-    const int numHilos = 2;  // Número fijo de hilos para simplicidad
-    pthread_t hilos[numHilos];
-    ConvolucionArgs args[numHilos];
-    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
-    
-    // Configurar y lanzar hilos
-    for (int i = 0; i < numHilos; i++) {
-        args[i].pixelesOrigen = info->pixeles;
-        args[i].pixelesDestino = matrizTemporal;
-        args[i].kernel = kernel;
-        args[i].tamKernel = tamKernel;
-        args[i].inicio = i * filasPorHilo;
-        args[i].fin = ((i + 1) * filasPorHilo < info->alto) 
-                      ? (i + 1) * filasPorHilo 
-                      : info->alto;
-        args[i].ancho = info->ancho;
-        args[i].alto = info->alto;
-        args[i].canales = info->canales;
-        
-        if (pthread_create(&hilos[i], NULL, aplicarConvolucionHilo, &args[i]) != 0) {
-            fprintf(stderr, "Error al crear hilo %d para convolución\n", i);
-            // Liberar recursos
-            liberarMatriz3D(matrizTemporal, info->alto, info->ancho);
-            for (int j = 0; j < tamKernel; j++) {
-                free(kernel[j]);
+    if (creados < totalHilos) {
+        // Sin todos los hilos las colas nunca se vaciarían: cortar el lote,
+        // esperar a los hilos creados y liberar lo que quedó en tránsito
+        __atomic_store_n(&lote.siguiente, lote.numEntradas, __ATOMIC_RELAXED);
+        cerrarColaTrabajos(&lote.decodificadas);
+        cerrarColaTrabajos(&lote.procesadas);
+        for (int i = 0; i < creados; i++) pthread_join(hilos[i], NULL);
+        ColaTrabajos* colas[] = {&lote.decodificadas, &lote.procesadas};
+        for (int c = 0; c < 2; c++) {
+            TrabajoLote* t;
+            while ((t = sacarTrabajoCerrada(colas[c])) != NULL) {
+                liberarImagen(&t->imagen);
+                free(t);
             }
-            free(kernel);
-            return;
+            destruirColaTrabajos(colas[c]);
         }
+        for (int i = 0; i < lote.numEntradas; i++) free(lote.entradas[i]);
+        free(lote.entradas);
+        free(lote.conservarExtension);
+        free(hilos);
+        free(args);
+        return 0;
     }
-    
-    // Esperar a que todos los hilos terminen
-    for (int i = 0; i < numHilos; i++) {
-        pthread_join(hilos[i], NULL);
+    for (int i = 0; i < creados; i++) pthread_join(hilos[i], NULL);
+    double total = tiempoActualSegundos() - t0;
+    for (int i = 0; i < creados; i++) combinarEstadisticas(&estadisticasHilo, &args[i].estadisticas);
+
+    printf("Lote: %d imágenes (%d guardadas, %d con error) en %.3f s → %.1f imágenes/s\n",
+           lote.numEntradas, lote.correctas, lote.fallidas, total,
+           total > 0 ? lote.correctas / total : 0.0);
+    printf("  %-12s %5s %10s %11s %10s %9s %13s\n", "etapa", "hilos", "imágenes", "ocupado(s)",
+           "espera(s)", "ms/imagen", "utilización");
+    imprimirEtapaLote("decodificar", args, decodificadores, total);
+    imprimirEtapaLote("procesar", args + decodificadores, procesadores, total);
+    imprimirEtapaLote("codificar", args + decodificadores + procesadores, codificadores, total);
+
+    destruirColaTrabajos(&lote.decodificadas);
+    destruirColaTrabajos(&lote.procesadas);
+    for (int i = 0; i < lote.numEntradas; i++) free(lote.entradas[i]);
+    free(lote.entradas);
+    free(lote.conservarExtension);
+    free(hilos);
+    free(args);
+    return lote.fallidas == 0;
+}
+
+// =====================================================================
+// SUITE DE BENCHMARKS (--bench)
+// =====================================================================
+
+#define MAX_TAMANOS_BENCH 8                 // Tamaños en --bench-sizes
+#define TAMANOS_BENCH_POR_DEFECTO "0.1,1,12,50"
+#define REPETICIONES_BENCH 5                // --repeat por defecto
+#define TOLERANCIA_BENCH 10.0               // --tolerance por defecto (%)
+#define MAX_ENTRADAS_BASE_BENCH 4096        // Líneas leídas de --baseline
+
+// QUÉ: Compara dos double para qsort.
+// CÓMO: Orden ascendente sin restar (evita problemas de signo).
+// POR QUÉ: Medianas y percentiles (benchmarks y latencias del servidor) se
+// calculan sobre muestras ordenadas.
+static int compararDobles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// QUÉ: Kernels que mide la suite.
+// CÓMO: Cada uno llama a la misma función que usan el menú y la línea de
+// comandos; 'parametro' es el kernel Gaussiano, el factor de escala o el ángulo.
+// POR QUÉ: Medir las funciones reales evita que la suite y el programa diverjan.
+typedef enum {
+    KERNEL_BENCH_BRILLO,
+    KERNEL_BENCH_GAUSS,
+    KERNEL_BENCH_ESCALAR,
+    KERNEL_BENCH_ROTAR,
+    KERNEL_BENCH_SOBEL,
+    KERNEL_BENCH_PNG_CODIFICAR,
+    KERNEL_BENCH_PNG_DECODIFICAR
+} TipoKernelBench;
+
+typedef struct {
+    const char* nombre;     // Clave en la tabla y en el archivo de base
+    TipoKernelBench tipo;
+    float parametro;
+    int paralelo;           // 0: se mide solo con 1 hilo (stbi_load no usa hilos)
+} KernelBench;
+
+static const KernelBench kernelsBench[] = {
+    {"brillo", KERNEL_BENCH_BRILLO, 40, 1},
+    {"gauss3", KERNEL_BENCH_GAUSS, 3, 1},
+    {"gauss7", KERNEL_BENCH_GAUSS, 7, 1},
+    {"gauss15", KERNEL_BENCH_GAUSS, 15, 1},
+    {"gauss31", KERNEL_BENCH_GAUSS, 31, 1},
+    {"escalar_x1.5", KERNEL_BENCH_ESCALAR, 1.5f, 1},
+    {"escalar_x0.5", KERNEL_BENCH_ESCALAR, 0.5f, 1},
+    {"rotar15", KERNEL_BENCH_ROTAR, 15, 1},
+    {"rotar90", KERNEL_BENCH_ROTAR, 90, 1},
+    {"sobel", KERNEL_BENCH_SOBEL, 0, 1},
+    {"png_codificar", KERNEL_BENCH_PNG_CODIFICAR, 0, 1},
+    {"png_decodificar", KERNEL_BENCH_PNG_DECODIFICAR, 0, 0},   // Lee lo que escribió png_codificar
+};
+
+// QUÉ: Una medición guardada en el archivo de base.
+// CÓMO: Una línea de texto "kernel MP canales hilos mediana_ms".
+// POR QUÉ: El formato de texto se puede revisar y versionar a mano.
+typedef struct {
+    char kernel[32];
+    double megapixeles;
+    int canales;
+    int hilos;
+    double medianaMs;
+} EntradaBaseBench;
+
+// QUÉ: Genera una imagen sintética de unos 'megapixeles' MP con 4:3 de aspecto.
+// CÓMO: Degradado horizontal + vertical por canal más ruido xorshift de
+// semilla fija, para que cada ejecución mida exactamente los mismos píxeles.
+// POR QUÉ: La suite no depende de archivos de prueba, y el ruido evita que el
+// PNG comprima de forma irreal una imagen lisa.
+static int generarImagenSintetica(double megapixeles, int canales, ImagenInfo* info) {
+    double total = megapixeles * 1e6;
+    int alto = (int)lround(sqrt(total * 3.0 / 4.0));
+    if (alto < 1) alto = 1;
+    int ancho = (int)lround(total / alto);
+    if (ancho < 1) ancho = 1;
+    info->pixeles = asignarMatriz3D(alto, ancho, canales);
+    if (!info->pixeles) {
+        fprintf(stderr, "Error de memoria para la imagen sintética de %g MP\n", megapixeles);
+        return 0;
     }
-    
-    // Liberar el kernel (ya no se necesita)
-    for (int i = 0; i < tamKernel; i++) {
-        free(kernel[i]);
+    info->ancho = ancho;
+    info->alto = alto;
+    info->canales = canales;
+    uint32_t estado = 2463534242u;
+    for (int y = 0; y < alto; y++) {
+        for (int x = 0; x < ancho; x++) {
+            for (int c = 0; c < canales; c++) {
+                estado ^= estado << 13;
+                estado ^= estado >> 17;
+                estado ^= estado << 5;
+                int valor = (x * 255 / ancho + y * 255 / alto) / 2 + c * 40 + (int)(estado & 31) - 16;
+                info->pixeles[y][x][c] = (unsigned char)(valor < 0 ? 0 : valor > 255 ? 255 : valor);
+            }
+        }
     }
-    free(kernel);
-    
-    // Liberar matriz original y reemplazar con la nueva
-    liberarMatriz3D(info->pixeles, info->alto, info->ancho);
-    info->pixeles = matrizTemporal;
-    
-    printf("Convolución aplicada con kernel %dx%d, sigma=%.2f (%s)\n", 
-           tamKernel, tamKernel, sigma,
-           info->canales == 1 ? "grises" : "RGB");
+    return 1;
 }
 
-// QUÉ: Escala (redimensiona) una imagen en un rango de filas (para hilos).
-// CÓMO: Para cada píxel en la imagen destino, calcula su posición correspondiente
-// en la imagen origen usando factores de escala (scaleX, scaleY). Como las
-// coordenadas resultantes son fraccionarias, usa interpolación bilineal para
-// obtener valores suaves. Procesa cada canal independientemente.
-// POR QUÉ: La interpolación bilineal evita aliasing (efecto pixelado o escalera)
-// que ocurre con nearest-neighbor, produciendo imágenes escaladas de mayor calidad.
-// El procesamiento por hilos acelera operaciones en imágenes grandes.
-void* escalarImagenHilo(void* args) {
-    EscaladoArgs* eArgs = (EscaladoArgs*)args;
-    
-    // Calcular factores de escala (mapeo destino → origen)
-    // Si anchoDestino < anchoOrigen: upscale (ampliar)
-    // Si anchoDestino > anchoOrigen: downscale (reducir)
-    float scaleX = (float)eArgs->anchoOrigen / eArgs->anchoDestino;
-    float scaleY = (float)eArgs->altoOrigen / eArgs->altoDestino;
-    
-    // Procesar cada fila asignada a este hilo en la imagen DESTINO
-    for (int y = eArgs->inicio; y < eArgs->fin; y++) {
-        for (int x = 0; x < eArgs->anchoDestino; x++) {
-            // Calcular coordenadas correspondientes en imagen ORIGEN
-            // Estas coordenadas son fraccionarias (float), no enteras
-            float xOrig = x * scaleX;
-            float yOrig = y * scaleY;
-            
-            // Procesar cada canal del píxel
-            for (int c = 0; c < eArgs->canales; c++) {
-                // Usar interpolación bilineal para obtener valor suave
-                // Esto considera los 4 píxeles vecinos más cercanos en la imagen origen
-                unsigned char valorInterpolado = interpolacionBilineal(
-                    eArgs->pixelesOrigen,
-                    xOrig,
-                    yOrig,
-                    c,
-                    eArgs->anchoOrigen,
-                    eArgs->altoOrigen
-                );
-                
-                // Asignar valor interpolado al píxel destino
-                eArgs->pixelesDestino[y][x][c] = valorInterpolado;
-            }
+// QUÉ: Ejecuta una vez un kernel sobre 'imagen' y devuelve los segundos.
+// CÓMO: Clona la imagen fuera de la región medida (los kernels la modifican)
+// y mide solo la llamada; la codificación escribe en 'rutaPNG' y la
+// decodificación lo lee. Devuelve -1 si falla.
+// POR QUÉ: Clonar dentro de la medición sumaría una copia de memoria a todos
+// los kernels y ocultaría las diferencias entre ellos.
+static double medirKernelBench(const KernelBench* kernel, const ImagenInfo* imagen, const char* rutaPNG) {
+    ImagenInfo copia = *imagen;
+    memset(&copia.repuesto, 0, sizeof(copia.repuesto));
+    int necesitaCopia = kernel->tipo != KERNEL_BENCH_PNG_CODIFICAR && kernel->tipo != KERNEL_BENCH_PNG_DECODIFICAR;
+    if (necesitaCopia) {
+        copia.pixeles = clonarMatriz3D(imagen->pixeles, imagen->alto, imagen->ancho, imagen->canales);
+        if (!copia.pixeles) {
+            fprintf(stderr, "Error de memoria al clonar la imagen de prueba\n");
+            return -1;
+        }
+    }
+    OpcionesPNG opciones = {NIVEL_PNG_POR_DEFECTO, FILTRO_PNG_ADAPTATIVO};
+    ImagenInfo leida = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+    int exito = 1;
+
+    double t0 = tiempoActualSegundos();
+    switch (kernel->tipo) {
+        case KERNEL_BENCH_BRILLO:
+            ajustarBrilloVectorialConcurrente(&copia, (int)kernel->parametro);
+            break;
+        case KERNEL_BENCH_GAUSS:
+            aplicarConvolucionConcurrente(&copia, (int)kernel->parametro, kernel->parametro / 6.0f);
+            break;
+        case KERNEL_BENCH_ESCALAR: {
+            int nuevoAncho = (int)lround(copia.ancho * kernel->parametro);
+            int nuevoAlto = (int)lround(copia.alto * kernel->parametro);
+            escalarImagenConcurrente(&copia, nuevoAncho > 0 ? nuevoAncho : 1, nuevoAlto > 0 ? nuevoAlto : 1);
+            break;
+        }
+        case KERNEL_BENCH_ROTAR:
+            exito = rotarImagenConcurrente(&copia, kernel->parametro);
+            break;
+        case KERNEL_BENCH_SOBEL:
+            detectarBordesConcurrente(&copia);
+            break;
+        case KERNEL_BENCH_PNG_CODIFICAR:
+            exito = guardarPNGParalelo(imagen, rutaPNG, &opciones);
+            break;
+        case KERNEL_BENCH_PNG_DECODIFICAR:
+            exito = cargarImagen(rutaPNG, &leida);
+            break;
+    }
+    double segundos = tiempoActualSegundos() - t0;
+
+    if (necesitaCopia) liberarImagen(&copia);
+    liberarImagen(&leida);
+    return exito ? segundos : -1;
+}
+
+// QUÉ: Lee un archivo de base de la suite.
+// CÓMO: Una entrada por línea "kernel MP canales hilos mediana_ms"; ignora
+// líneas vacías y las que empiezan con '#'. Devuelve el número de entradas
+// o -1 si no se puede abrir.
+// POR QUÉ: La base guardada con --save-baseline se compara en ejecuciones
+// posteriores para detectar regresiones.
+static int leerBaseBench(const char* ruta, EntradaBaseBench* entradas, int maximo) {
+    FILE* archivo = fopen(ruta, "r");
+    if (!archivo) {
+        fprintf(stderr, "Error: No se pudo abrir la base %s\n", ruta);
+        return -1;
+    }
+    char linea[256];
+    int n = 0;
+    while (n < maximo && fgets(linea, sizeof(linea), archivo)) {
+        EntradaBaseBench* e = &entradas[n];
+        if (linea[0] == '#') continue;
+        if (sscanf(linea, "%31s %lf %d %d %lf", e->kernel, &e->megapixeles, &e->canales, &e->hilos,
+                   &e->medianaMs) == 5) {
+            n++;
+        }
+    }
+    fclose(archivo);
+    return n;
+}
+
+// QUÉ: Busca en la base la mediana de una combinación kernel/tamaño/canales/hilos.
+// CÓMO: Búsqueda lineal; el tamaño se compara con tolerancia relativa porque
+// se escribió con "%g".
+// POR QUÉ: La base tiene a lo sumo unos cientos de entradas.
+static const EntradaBaseBench* buscarBaseBench(const EntradaBaseBench* entradas, int n, const char* kernel,
+                                               double megapixeles, int canales, int hilos) {
+    for (int i = 0; i < n; i++) {
+        if (strcmp(entradas[i].kernel, kernel) == 0 && entradas[i].canales == canales &&
+            entradas[i].hilos == hilos && fabs(entradas[i].megapixeles - megapixeles) <= 1e-6 * megapixeles) {
+            return &entradas[i];
         }
     }
-    
     return NULL;
 }
 
-// QUÉ: Escala (redimensiona) una imagen a nuevas dimensiones usando concurrencia.
-// CÓMO: Crea matriz con nuevas dimensiones, divide filas entre 2 hilos, cada hilo
-// mapea píxeles destino a origen con interpolación bilineal, sincroniza, y reemplaza
-// la imagen original actualizando dimensiones en la estructura.
-// POR QUÉ: Permite cambiar el tamaño de imágenes (ampliar o reducir) manteniendo
-// calidad visual mediante interpolación. La concurrencia acelera el procesamiento.
-void escalarImagenConcurrente(ImagenInfo* info, int nuevoAncho, int nuevoAlto) {
-    // Validar que hay imagen cargada
-    if (!info || !info->pixeles) {
-        fprintf(stderr, "Error: No hay imagen cargada para escalar\n");
-        return;
+// QUÉ: Ejecuta la suite de benchmarks completa.
+// CÓMO: Para cada tamaño de 'tamanos' (MP separados por comas) genera una
+// imagen sintética en grises y otra RGB, y mide cada kernel con 1..maxHilos
+// hilos (cambiando hilosPorOperacion) 'repeticiones' veces; muestra la
+// mediana, el p95, los MP/s de entrada, la aceleración y la eficiencia
+// paralela respecto de 1 hilo (T1 / (h x Th)) y el desbalance de las regiones
+// paralelas medidas (hilo más lento / promedio). Si hay 'rutaBase', marca como
+// regresión toda mediana que supere la de la base en más de 'tolerancia' %;
+// si hay 'rutaGuardar', escribe ahí las medianas como nueva base. Devuelve 0
+// si algo falló o hubo regresiones.
+// POR QUÉ: Da una medida repetible de cada kernel y de su escalabilidad (para
+// elegir cuántos hilos conviene en cada máquina), y permite detectar
+// automáticamente un cambio que lo haga más lento.
+static int ejecutarSuiteBenchmarks(const char* tamanos, int maxHilos, int repeticiones, const char* rutaBase,
+                            const char* rutaGuardar, double tolerancia) {
+    double listaTamanos[MAX_TAMANOS_BENCH];
+    int numTamanos = 0;
+    const char* cursor = tamanos;
+    while (*cursor) {
+        char* fin;
+        double mp = strtod(cursor, &fin);
+        if (fin == cursor || mp <= 0 || mp > 1000 || numTamanos == MAX_TAMANOS_BENCH || (*fin && *fin != ',')) {
+            fprintf(stderr, "Error: Lista de tamaños inválida: %s (hasta %d valores en MP)\n", tamanos,
+                    MAX_TAMANOS_BENCH);
+            return 0;
+        }
+        listaTamanos[numTamanos++] = mp;
+        cursor = *fin ? fin + 1 : fin;
     }
-    
-    // Validar nuevas dimensiones (deben ser positivas)
-    if (nuevoAncho <= 0 || nuevoAlto <= 0) {
-        fprintf(stderr, "Error: Las nuevas dimensiones deben ser positivas (recibido: %dx%d)\n",
-                nuevoAncho, nuevoAlto);
-        return;
+
+    EntradaBaseBench* base = NULL;
+    int numBase = 0;
+    if (rutaBase) {
+        base = malloc(MAX_ENTRADAS_BASE_BENCH * sizeof(EntradaBaseBench));
+        numBase = base ? leerBaseBench(rutaBase, base, MAX_ENTRADAS_BASE_BENCH) : -1;
+        if (numBase < 0) {
+            free(base);
+            return 0;
+        }
     }
-    
-    // Mensaje informativo sobre la operación
-    printf("Escalando imagen de %dx%d a %dx%d...\n", 
-           info->ancho, info->alto, nuevoAncho, nuevoAlto);
-    
-    // Crear nueva matriz con las dimensiones destino
-    unsigned char*** nueva = asignarMatriz3D(nuevoAlto, nuevoAncho, info->canales);
-    if (!nueva) {
-        fprintf(stderr, "Error: No se pudo asignar memoria para imagen escalada\n");
-        return;
+    FILE* guardar = NULL;
+    if (rutaGuardar) {
+        guardar = fopen(rutaGuardar, "w");
+        if (!guardar) {
+            fprintf(stderr, "Error: No se pudo crear la base %s\n", rutaGuardar);
+            free(base);
+            return 0;
+        }
+        fprintf(guardar, "# kernel MP canales hilos mediana_ms\n");
     }
-    
-    // Configurar hilos para procesamiento paralelo
-    const int numHilos = 2;  // Número fijo de hilos para simplicidad
-    pthread_t hilos[numHilos];
-    EscaladoArgs args[numHilos];
-    int filasPorHilo = (int)ceil((double)nuevoAlto / numHilos);
-    
-    // Configurar y lanzar hilos
-    for (int i = 0; i < numHilos; i++) {
-        args[i].pixelesOrigen = info->pixeles;
-        args[i].pixelesDestino = nueva;
-        args[i].anchoOrigen = info->ancho;
-        args[i].altoOrigen = info->alto;
-        args[i].anchoDestino = nuevoAncho;
-        args[i].altoDestino = nuevoAlto;
-        args[i].canales = info->canales;
-        args[i].inicio = i * filasPorHilo;
-        args[i].fin = ((i + 1) * filasPorHilo < nuevoAlto) 
-                      ? (i + 1) * filasPorHilo 
-                      : nuevoAlto;
-        
-        if (pthread_create(&hilos[i], NULL, escalarImagenHilo, &args[i]) != 0) {
-            fprintf(stderr, "Error al crear hilo %d para escalado\n", i);
-            // Liberar recursos
-            liberarMatriz3D(nueva, nuevoAlto, nuevoAncho);
-            return;
+    double* muestras = malloc((size_t)repeticiones * sizeof(double));
+    if (!muestras) {
+        fprintf(stderr, "Error de memoria para el benchmark\n");
+        if (guardar) fclose(guardar);
+        free(base);
+        return 0;
+    }
+
+    char rutaPNG[64];
+    snprintf(rutaPNG, sizeof(rutaPNG), "/tmp/img_bench_%d.png", (int)getpid());
+    const int hilosOriginales = hilosPorOperacion;
+    const int estadisticasOriginales = estadisticasActivas;
+    estadisticasActivas = 1;    // Para medir las regiones paralelas de cada kernel
+    const int numKernels = (int)(sizeof(kernelsBench) / sizeof(kernelsBench[0]));
+    int exito = 1, regresiones = 0, comparadas = 0, medidas = 0;
+
+    printf("Suite de benchmarks: %d repeticiones, 1..%d hilos%s\n", repeticiones, maxHilos,
+           rutaBase ? "" : " (sin base de comparación)");
+    printf("  %-16s %6s %3s %5s %11s %11s %9s %6s %6s %7s %9s\n", "kernel", "MP", "can", "hilos",
+           "mediana ms", "p95 ms", "MP/s", "acel.", "efic.", "desbal.", "vs base");
+    for (int t = 0; exito && t < numTamanos; t++) {
+        for (int canales = 1; exito && canales <= 3; canales += 2) {
+            ImagenInfo imagen = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+            if (!generarImagenSintetica(listaTamanos[t], canales, &imagen)) {
+                exito = 0;
+                break;
+            }
+            double mpReales = (double)imagen.ancho * imagen.alto / 1e6;
+            for (int k = 0; exito && k < numKernels; k++) {
+                const KernelBench* kernel = &kernelsBench[k];
+                int ultimoHilo = kernel->paralelo ? maxHilos : 1;
+                double medianaUnHilo = 0;
+                for (int h = 1; exito && h <= ultimoHilo; h++) {
+                    // Registro propio para ver solo las regiones de esta medición
+                    RegistroEstadisticas registroPrevio = estadisticasHilo;
+                    memset(&estadisticasHilo, 0, sizeof(estadisticasHilo));
+                    hilosPorOperacion = h;
+                    for (int r = 0; exito && r < repeticiones; r++) {
+                        muestras[r] = medirKernelBench(kernel, &imagen, rutaPNG);
+                        exito = muestras[r] >= 0;
+                    }
+                    double trabajoMaximo = 0, trabajoPromedio = 0;
+                    for (int g = 0; g < estadisticasHilo.numRegiones; g++) {
+                        trabajoMaximo += estadisticasHilo.regiones[g].trabajoMaximo;
+                        trabajoPromedio += estadisticasHilo.regiones[g].trabajoPromedio;
+                    }
+                    combinarEstadisticas(&registroPrevio, &estadisticasHilo);
+                    estadisticasHilo = registroPrevio;
+                    if (!exito) {
+                        fprintf(stderr, "Error: Falló %s con %g MP\n", kernel->nombre, listaTamanos[t]);
+                        break;
+                    }
+                    qsort(muestras, (size_t)repeticiones, sizeof(double), compararDobles);
+                    double medianaMs = muestras[(repeticiones - 1) / 2] * 1e3;
+                    double p95Ms = muestras[(int)ceil(0.95 * repeticiones) - 1] * 1e3;
+                    if (h == 1) medianaUnHilo = medianaMs;
+                    double aceleracion = medianaMs > 0 ? medianaUnHilo / medianaMs : 0.0;
+                    char desbalance[16] = "-";
+                    if (trabajoPromedio > 0) {
+                        snprintf(desbalance, sizeof(desbalance), "%.2f", trabajoMaximo / trabajoPromedio);
+                    }
+                    char comparacion[24] = "-";
+                    medidas++;
+                    const EntradaBaseBench* anterior =
+                        buscarBaseBench(base, numBase, kernel->nombre, listaTamanos[t], canales, h);
+                    if (anterior && anterior->medianaMs > 0) {
+                        double cambio = (medianaMs / anterior->medianaMs - 1.0) * 100.0;
+                        int regresion = cambio > tolerancia;
+                        snprintf(comparacion, sizeof(comparacion), "%+.1f%%%s", cambio, regresion ? " !" : "");
+                        regresiones += regresion;
+                        comparadas++;
+                    }
+                    printf("  %-16s %6g %3d %5d %11.3f %11.3f %9.1f %6.2f %5.0f%% %7s %9s\n", kernel->nombre,
+                           listaTamanos[t], canales, h, medianaMs, p95Ms,
+                           medianaMs > 0 ? mpReales / (medianaMs / 1e3) : 0.0, aceleracion,
+                           100.0 * aceleracion / h, desbalance, comparacion);
+                    if (guardar) {
+                        fprintf(guardar, "%s %g %d %d %.4f\n", kernel->nombre, listaTamanos[t], canales, h,
+                                medianaMs);
+                    }
+                }
+            }
+            liberarImagen(&imagen);
         }
     }
-    
-    // Esperar a que todos los hilos terminen
-    for (int i = 0; i < numHilos; i++) {
-        pthread_join(hilos[i], NULL);
+    hilosPorOperacion = hilosOriginales;
+    estadisticasActivas = estadisticasOriginales;
+    unlink(rutaPNG);
+
+    if (rutaBase) {
+        printf("Comparadas %d mediciones con %s: %d regresiones (tolerancia %.1f%%)\n", comparadas, rutaBase,
+               regresiones, tolerancia);
+        // Una base que no cubre nada no puede aprobar la corrida
+        if (comparadas == 0 && medidas > 0) {
+            fprintf(stderr, "Error: Ninguna medición tiene referencia en %s (¿otros tamaños, hilos o kernels?)\n",
+                    rutaBase);
+            exito = 0;
+        } else if (comparadas < medidas) {
+            fprintf(stderr, "Aviso: %d de %d mediciones no tienen referencia en %s\n", medidas - comparadas,
+                    medidas, rutaBase);
+        }
     }
-    
-    // Liberar matriz original y reemplazar con la nueva
-    liberarMatriz3D(info->pixeles, info->alto, info->ancho);
-    info->pixeles = nueva;
-    
-    // Actualizar dimensiones en la estructura
-    info->ancho = nuevoAncho;
-    info->alto = nuevoAlto;
-    // info->canales se mantiene sin cambios
-    
-    printf("Escalado completado. Nuevas dimensiones: %dx%d (%s)\n",
-           nuevoAncho, nuevoAlto,
-           info->canales == 1 ? "grises" : "RGB");
+    if (guardar) {
+        if (fclose(guardar) != 0) {
+            fprintf(stderr, "Error al escribir la base %s\n", rutaGuardar);
+            exito = 0;
+        } else if (exito) {
+            printf("Base guardada en %s\n", rutaGuardar);
+        }
+    }
+    free(muestras);
+    free(base);
+    return exito && regresiones == 0;
 }
 
-// QUÉ: Liberar memoria asignada para la imagen.
-// CÓMO: Libera cada fila y canal de la matriz 3D, luego el arreglo de filas y
-// reinicia la estructura.
-// POR QUÉ: Evita fugas de memoria, esencial en C para manejar recursos manualmente.
-void liberarImagen(ImagenInfo* info) {
-    if (info->pixeles) {
-        for (int y = 0; y < info->alto; y++) {
-            for (int x = 0; x < info->ancho; x++) {
-                free(info->pixeles[y][x]); // Liberar canales por píxel
+// QUÉ: Muestra la ayuda del modo línea de comandos.
+// CÓMO: Lista las opciones en el orden en que se documentan en el README.
+// POR QUÉ: --help y los errores de sintaxis remiten a esta ayuda.
+static void mostrarUsoLineaComandos(FILE* salida, const char* programa) {
+    fprintf(salida,
+            "Uso: %s entrada [operaciones...] -o salida [opciones]\n"
+            "Operaciones (se aplican en el orden dado, fusionadas en una pasada):\n"
+            "  --resize AxH         Redimensionar a A x H píxeles\n"
+            "  --blur K,S           Desenfoque Gaussiano con kernel K (impar) y sigma S\n"
+            "  --brightness D       Ajustar brillo en D (-255..255)\n"
+            "  --rotate G           Rotar G grados\n"
+            "  --sobel              Detectar bordes (resultado en grises)\n"
+            "  --crop X,Y,AxH       Recortar al rectángulo (vista sin copia)\n"
+            "  --roi X,Y,AxH        Las operaciones siguientes solo cambian ese rectángulo\n"
+            "                       (escalar y rotar actúan sobre él recortado); --roi full la quita,\n"
+            "                       y también --resize, --rotate y --crop, que cambian la geometría\n"
+            "Opciones:\n"
+            "  -o RUTA              Archivo de salida (.png, .icr, .ppm/.pgm, .tsl)\n"
+            "Lotes (en lugar de entrada y -o):\n"
+            "  --batch RUTA         Directorio de imágenes o archivo con una ruta por línea\n"
+            "  --out-dir DIR        Directorio de salida (se crea si no existe)\n"
+            "  --format EXT         Formato de salida: png (por defecto), icr, ppm, pgm\n"
+            "  --decoders N         Hilos decodificadores\n"
+            "  --workers N          Hilos de procesamiento (cada uno usa --threads hilos)\n"
+            "  --encoders N         Hilos codificadores\n"
+            "Servidor (socket Unix):\n"
+            "  --serve SOCKET       Quedar residente atendiendo solicitudes (--workers hilos)\n"
+            "  --client SOCKET ...  Enviar al servidor una solicitud con esta misma sintaxis\n"
+            "  --bench-serve RUTA   Comparar latencia servidor vs un proceso por solicitud\n"
+            "  --requests N         Solicitudes del benchmark (por defecto 200)\n"
+            "  --level N            Nivel de compresión PNG 0..9 (por defecto %d)\n"
+            "  --filter NOMBRE      Filtro PNG: none, sub, up, paeth, adaptive\n"
+            "  --threads N          Hilos por operación (por defecto %d; máximo %d)\n"
+            "  --mem-limit MB       Presupuesto de memoria: carga en streaming y guarda por bandas si\n"
+            "                       no alcanza; si ni así cabe, la operación falla sin reservar\n"
+            "  --no-pool            No reutilizar los búferes grandes entre pasos y trabajos\n"
+            "  --numa               Fijar cada hilo a una CPU y que toque primero su banda de filas\n"
+            "Suite de benchmarks (en lugar de entrada y -o):\n"
+            "  --bench              Medir cada kernel con 1..N hilos (N = --threads o núcleos)\n"
+            "  --bench-sizes LISTA  Tamaños en MP separados por comas (por defecto %s)\n"
+            "  --repeat R           Repeticiones por medición (por defecto %d)\n"
+            "  --baseline RUTA      Comparar con una base y fallar si hay regresiones\n"
+            "  --save-baseline RUTA Guardar las medianas como nueva base\n"
+            "  --tolerance PCT      Regresión tolerada en %% (por defecto %g)\n"
+            "  --stats              Resumen por operación (tiempo, CPU, MP/s, memoria) en stderr\n"
+            "  --stats-json RUTA    Agregar una línea JSON por operación a RUTA (- = stderr)\n"
+            "  --trace RUTA         Guardar al terminar una traza JSON (chrome://tracing, Perfetto)\n"
+            "  --counters           Como --stats, con ciclos, IPC, fallos de LLC y de salto por operación\n"
+            "  -v, --verbose        Mostrar mensajes de progreso\n"
+            "  -h, --help           Mostrar esta ayuda\n"
+            "Sin argumentos (o solo con la entrada) se abre el menú interactivo.\n",
+            programa, NIVEL_PNG_POR_DEFECTO, HILOS_POR_DEFECTO, MAX_HILOS_OPERACION,
+            TAMANOS_BENCH_POR_DEFECTO, REPETICIONES_BENCH, TOLERANCIA_BENCH);
+}
+
+// QUÉ: Opciones leídas de la línea de comandos (o de una solicitud al servidor).
+// CÓMO: Entrada/salida, pasos del pipeline, opciones de PNG y de los modos
+// lote, servidor, benchmark del servidor y suite de benchmarks.
+// POR QUÉ: El mismo análisis sirve para el modo directo, los lotes y cada
+// solicitud que recibe el servidor.
+typedef struct {
+    const char* entrada;
+    const char* salida;
+    const char* lote;               // --batch
+    const char* dirSalida;          // --out-dir
+    const char* formato;            // --format
+    const char* servidor;           // --serve: ruta del socket
+    const char* benchServidor;      // --bench-serve: imagen de prueba
+    int solicitudes;                // --requests
+    int decodificadores;
+    int procesadores;               // También hilos de atención del servidor
+    int codificadores;
+    PasoPipeline pasos[MAX_PASOS_LINEA_COMANDOS];
+    int numPasos;
+    PasoPipeline region;            // --roi: región de las operaciones siguientes
+    int verboso;
+    int estadisticas;               // --stats: resumen por operación al terminar
+    int contadores;                 // --counters: contadores de hardware por operación
+    int hilos;                      // --threads (0 = por defecto); en el servidor se ignora por solicitud
+    double limiteMemoriaMB;         // --mem-limit (0 = sin límite)
+    int sinPool;                    // --no-pool: cada búfer grande se reserva y libera aparte
+    int numa;                       // --numa: hilos fijos y primer toque por bandas
+    int bench;                      // --bench: suite de benchmarks
+    const char* tamanosBench;       // --bench-sizes
+    int repeticionesBench;          // --repeat
+    const char* baseBench;          // --baseline
+    const char* guardarBaseBench;   // --save-baseline
+    double toleranciaBench;         // --tolerance (%)
+    const char* estadisticasJSON;   // --stats-json: una línea JSON por operación
+    const char* traza;              // --trace: archivo de traza al terminar
+    OpcionesPNG opcionesPNG;
+} OpcionesLineaComandos;
+
+// QUÉ: Analiza argumentos con la sintaxis del modo línea de comandos.
+// CÓMO: Recorre argv desde 1; cada operación agrega un PasoPipeline en orden.
+// Devuelve 1 si son válidos, 0 si hay un error (informado por stderr) y 2 si
+// se pidió la ayuda (se muestra en 'ayuda', si no es NULL).
+// POR QUÉ: Separar el análisis de la ejecución permite reutilizarlo en el
+// servidor, donde cada solicitud trae sus propios argumentos.
+static int analizarLineaComandos(int argc, char* argv[], OpcionesLineaComandos* op, FILE* ayuda) {
+    long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+    memset(op, 0, sizeof(*op));
+    op->formato = "png";
+    op->solicitudes = 200;
+    op->tamanosBench = TAMANOS_BENCH_POR_DEFECTO;
+    op->repeticionesBench = REPETICIONES_BENCH;
+    op->toleranciaBench = TOLERANCIA_BENCH;
+    op->decodificadores = nucleos >= 4 ? (int)(nucleos / 4) : 1;
+    op->procesadores = op->decodificadores;
+    op->codificadores = nucleos >= 4 ? (int)(nucleos / 2) : 1;
+    op->opcionesPNG.nivel = NIVEL_PNG_POR_DEFECTO;
+    op->opcionesPNG.filtro = FILTRO_PNG_ADAPTATIVO;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* valor = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int esOperacion = strcmp(arg, "--resize") == 0 || strcmp(arg, "--blur") == 0 ||
+                          strcmp(arg, "--brightness") == 0 || strcmp(arg, "--rotate") == 0 ||
+                          strcmp(arg, "--sobel") == 0 || strcmp(arg, "--crop") == 0;
+        if (esOperacion && op->numPasos == MAX_PASOS_LINEA_COMANDOS) {
+            fprintf(stderr, "Error: Máximo %d operaciones\n", MAX_PASOS_LINEA_COMANDOS);
+            return 0;
+        }
+        PasoPipeline* paso = &op->pasos[op->numPasos];
+        int ok = 1;
+        int usaValor = 1;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            if (!ayuda) return 0;
+            mostrarUsoLineaComandos(ayuda, argv[0]);
+            return 2;
+        } else if (strcmp(arg, "-v") == 0 || strcmp(arg, "--verbose") == 0) {
+            op->verboso = 1;
+            usaValor = 0;
+        } else if (strcmp(arg, "--stats") == 0) {
+            op->estadisticas = 1;
+            usaValor = 0;
+        } else if (strcmp(arg, "--counters") == 0) {
+            op->contadores = 1;
+            op->estadisticas = 1;
+            usaValor = 0;
+        } else if (strcmp(arg, "--stats-json") == 0) {
+            op->estadisticasJSON = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--trace") == 0) {
+            op->traza = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "-o") == 0) {
+            op->salida = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--resize") == 0) {
+            paso->tipo = PASO_ESCALAR;
+            ok = valor && sscanf(valor, "%dx%d", &paso->nuevoAncho, &paso->nuevoAlto) == 2;
+        } else if (strcmp(arg, "--blur") == 0) {
+            paso->tipo = PASO_DESENFOQUE;
+            ok = valor && sscanf(valor, "%d,%f", &paso->tamKernel, &paso->sigma) == 2 && isfinite(paso->sigma);
+        } else if (strcmp(arg, "--brightness") == 0) {
+            paso->tipo = PASO_BRILLO;
+            ok = valor && sscanf(valor, "%d", &paso->delta) == 1 && paso->delta >= -255 && paso->delta <= 255;
+        } else if (strcmp(arg, "--rotate") == 0) {
+            paso->tipo = PASO_ROTAR;
+            ok = valor && sscanf(valor, "%f", &paso->angulo) == 1 && isfinite(paso->angulo);
+        } else if (strcmp(arg, "--sobel") == 0) {
+            paso->tipo = PASO_SOBEL;
+            usaValor = 0;
+        } else if (strcmp(arg, "--crop") == 0) {
+            paso->tipo = PASO_RECORTAR;
+            ok = valor && sscanf(valor, "%d,%d,%dx%d", &paso->regionX, &paso->regionY, &paso->regionAncho,
+                                 &paso->regionAlto) == 4 && paso->regionAncho > 0 && paso->regionAlto > 0;
+        } else if (strcmp(arg, "--roi") == 0) {
+            PasoPipeline* r = &op->region;
+            if (valor && strcmp(valor, "full") == 0) {
+                memset(r, 0, sizeof(*r));
+            } else {
+                ok = valor && sscanf(valor, "%d,%d,%dx%d", &r->regionX, &r->regionY, &r->regionAncho,
+                                     &r->regionAlto) == 4 && r->regionAncho > 0 && r->regionAlto > 0;
+            }
+        } else if (strcmp(arg, "--batch") == 0) {
+            op->lote = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--out-dir") == 0) {
+            op->dirSalida = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--format") == 0) {
+            op->formato = valor;
+            ok = valor && (strcmp(valor, "png") == 0 || strcmp(valor, "icr") == 0 ||
+                           strcmp(valor, "ppm") == 0 || strcmp(valor, "pgm") == 0);
+        } else if (strcmp(arg, "--decoders") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->decodificadores) == 1 && op->decodificadores > 0;
+        } else if (strcmp(arg, "--workers") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->procesadores) == 1 && op->procesadores > 0;
+        } else if (strcmp(arg, "--encoders") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->codificadores) == 1 && op->codificadores > 0;
+        } else if (strcmp(arg, "--serve") == 0) {
+            op->servidor = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--bench-serve") == 0) {
+            op->benchServidor = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--requests") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->solicitudes) == 1 && op->solicitudes > 0;
+        } else if (strcmp(arg, "--threads") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->hilos) == 1 && op->hilos > 0 &&
+                 op->hilos <= MAX_HILOS_OPERACION;
+        } else if (strcmp(arg, "--mem-limit") == 0) {
+            ok = valor && sscanf(valor, "%lf", &op->limiteMemoriaMB) == 1 && op->limiteMemoriaMB > 0;
+        } else if (strcmp(arg, "--no-pool") == 0) {
+            op->sinPool = 1;
+            usaValor = 0;
+        } else if (strcmp(arg, "--numa") == 0) {
+            op->numa = 1;
+            usaValor = 0;
+        } else if (strcmp(arg, "--bench") == 0) {
+            op->bench = 1;
+            usaValor = 0;
+        } else if (strcmp(arg, "--bench-sizes") == 0) {
+            op->tamanosBench = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--repeat") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->repeticionesBench) == 1 && op->repeticionesBench > 0;
+        } else if (strcmp(arg, "--baseline") == 0) {
+            op->baseBench = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--save-baseline") == 0) {
+            op->guardarBaseBench = valor;
+            ok = valor != NULL;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            ok = valor && sscanf(valor, "%lf", &op->toleranciaBench) == 1 && op->toleranciaBench >= 0;
+        } else if (strcmp(arg, "--level") == 0) {
+            ok = valor && sscanf(valor, "%d", &op->opcionesPNG.nivel) == 1 &&
+                 op->opcionesPNG.nivel >= 0 && op->opcionesPNG.nivel <= 9;
+        } else if (strcmp(arg, "--filter") == 0) {
+            if (!valor) ok = 0;
+            else if (strcmp(valor, "none") == 0) op->opcionesPNG.filtro = FILTRO_PNG_NINGUNO;
+            else if (strcmp(valor, "sub") == 0) op->opcionesPNG.filtro = FILTRO_PNG_SUB;
+            else if (strcmp(valor, "up") == 0) op->opcionesPNG.filtro = FILTRO_PNG_UP;
+            else if (strcmp(valor, "paeth") == 0) op->opcionesPNG.filtro = FILTRO_PNG_PAETH;
+            else if (strcmp(valor, "adaptive") == 0) op->opcionesPNG.filtro = FILTRO_PNG_ADAPTATIVO;
+            else ok = 0;
+        } else if (arg[0] == '-' && arg[1] != '\0') {
+            fprintf(stderr, "Error: Opción desconocida: %s\n", arg);
+            if (ayuda) mostrarUsoLineaComandos(stderr, argv[0]);
+            return 0;
+        } else if (!op->entrada) {
+            op->entrada = arg;
+            usaValor = 0;
+        } else {
+            fprintf(stderr, "Error: Argumento sobrante: %s\n", arg);
+            return 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: Valor inválido o ausente para %s\n", arg);
+            return 0;
+        }
+        if (esOperacion) {
+            if (paso->tipo != PASO_RECORTAR) {
+                paso->regionX = op->region.regionX;
+                paso->regionY = op->region.regionY;
+                paso->regionAncho = op->region.regionAncho;
+                paso->regionAlto = op->region.regionAlto;
             }
-            free(info->pixeles[y]); // Liberar fila
+            // Escalar, rotar y recortar cambian la geometría: las coordenadas
+            // de --roi ya no corresponden a la imagen resultante y se descartan
+            if (paso->tipo == PASO_ESCALAR || paso->tipo == PASO_ROTAR || paso->tipo == PASO_RECORTAR) {
+                memset(&op->region, 0, sizeof(op->region));
+            }
+            op->numPasos++;
         }
-        free(info->pixeles); // Liberar arreglo de filas
-        info->pixeles = NULL;
+        if (usaValor) i++;
     }
-    info->ancho = 0;
-    info->alto = 0;
-    info->canales = 0;
+    return 1;
 }
 
-// QUÉ: Cargar una imagen PNG desde un archivo.
-// CÓMO: Usa stbi_load para leer el archivo, detecta canales (1 o 3), y convierte
-// los datos a una matriz 3D (alto x ancho x canales).
-// POR QUÉ: La matriz 3D es intuitiva para principiantes y permite procesar
-// píxeles y canales individualmente.
-int cargarImagen(const char* ruta, ImagenInfo* info) {
-    int canales;
-    // QUÉ: Cargar imagen con formato original (0 canales = usar formato nativo).
-    // CÓMO: stbi_load lee el archivo y llena ancho, alto y canales.
-    // POR QUÉ: Respetar el formato original asegura que grises o RGB se mantengan.
-    unsigned char* datos = stbi_load(ruta, &info->ancho, &info->alto, &canales, 0);
-    if (!datos) {
+// =====================================================================
+// MODO SERVIDOR (SOCKET UNIX) CON CACHÉ DE IMÁGENES DECODIFICADAS
+// =====================================================================
+
+#define ENTRADAS_CACHE_SERVIDOR 16              // Imágenes decodificadas en caché
+#define BYTES_CACHE_SERVIDOR ((size_t)256 << 20) // Memoria máxima de la caché
+#define MAX_ARGUMENTOS_SOLICITUD 64
+
+// QUÉ: Imagen de la caché con contador de referencias.
+// CÓMO: La entrada que la contiene tiene una referencia y cada solicitud que
+// la está clonando otra; quien suelta la última la libera.
+// POR QUÉ: El clon se hace fuera del mutex; si mientras tanto otra solicitud
+// desaloja la entrada, la imagen sigue viva hasta que el clon termina.
+typedef struct {
+    ImagenInfo imagen;              // Solo lectura: las solicitudes trabajan sobre un clon
+    int referencias;                // Protegido por el mutex de la caché
+} ImagenCache;
+
+// QUÉ: Una imagen decodificada guardada en la caché del servidor.
+// CÓMO: Se identifica por ruta, fecha de modificación y tamaño del archivo.
+// POR QUÉ: Si el archivo cambia, la entrada deja de coincidir y se recarga.
+typedef struct {
+    char ruta[512];
+    time_t modificado;
+    off_t tamArchivo;
+    ImagenCache* imagen;            // NULL si la entrada está libre
+    unsigned long ultimoUso;        // Reloj lógico para reemplazo LRU
+} EntradaCache;
+
+// QUÉ: Caché LRU de imágenes decodificadas compartida por los hilos del servidor.
+// CÓMO: Arreglo fijo de entradas protegido por un mutex; al insertar se
+// desalojan las menos usadas hasta entrar en BYTES_CACHE_SERVIDOR.
+// POR QUÉ: Las miniaturas bajo demanda suelen pedir las mismas imágenes; sin
+// caché cada solicitud vuelve a decodificar el PNG.
+typedef struct {
+    EntradaCache entradas[ENTRADAS_CACHE_SERVIDOR];
+    size_t bytes;
+    unsigned long reloj;
+    long aciertos;
+    long fallos;
+    long solicitudes;
+    pthread_mutex_t mutex;
+} CacheImagenes;
+
+// QUÉ: Suelta una referencia a una imagen de la caché (con el mutex tomado).
+// CÓMO: Al soltar la última libera la imagen.
+// POR QUÉ: Ni la entrada ni un clon en curso saben quién termina último.
+static void soltarImagenCache(ImagenCache* c) {
+    if (--c->referencias > 0) return;
+    liberarImagen(&c->imagen);
+    free(c);
+}
+
+// QUÉ: Libera la entrada i de la caché (con el mutex tomado).
+// CÓMO: Descuenta sus bytes y suelta la referencia de la entrada; si una
+// solicitud la está clonando, la imagen se libera cuando esa termina.
+// POR QUÉ: Usado al desalojar y al cerrar el servidor.
+static void liberarEntradaCache(CacheImagenes* cache, int i) {
+    EntradaCache* e = &cache->entradas[i];
+    if (!e->imagen) return;
+    cache->bytes -= (size_t)e->imagen->imagen.ancho * e->imagen->imagen.alto * e->imagen->imagen.canales;
+    soltarImagenCache(e->imagen);
+    e->imagen = NULL;
+    e->ruta[0] = '\0';
+}
+
+// QUÉ: Carga una imagen usando la caché del servidor.
+// CÓMO: Con stat() identifica la versión del archivo; si está en caché toma
+// una referencia con el mutex y devuelve un clon (un memcpy del bloque
+// contiguo) hecho sin él; si no, la decodifica fuera del mutex y guarda un
+// clon desalojando las entradas menos usadas.
+// POR QUÉ: El resultado se modifica en el lugar, así que nunca se entrega la
+// copia de la caché.
+static int cargarConCache(CacheImagenes* cache, const char* ruta, ImagenInfo* info) {
+    struct stat st;
+    if (stat(ruta, &st) != 0) {
         fprintf(stderr, "Error al cargar imagen: %s\n", ruta);
         return 0;
     }
-    info->canales = (canales == 1 || canales == 3) ? canales : 1; // Forzar 1 o 3
+    pthread_mutex_lock(&cache->mutex);
+    ImagenCache* encontrada = NULL;
+    for (int i = 0; i < ENTRADAS_CACHE_SERVIDOR; i++) {
+        EntradaCache* e = &cache->entradas[i];
+        if (e->imagen && strcmp(e->ruta, ruta) == 0 && e->modificado == st.st_mtime &&
+            e->tamArchivo == st.st_size) {
+            encontrada = e->imagen;
+            encontrada->referencias++;
+            e->ultimoUso = ++cache->reloj;
+            cache->aciertos++;
+            break;
+        }
+    }
+    if (!encontrada) cache->fallos++;
+    pthread_mutex_unlock(&cache->mutex);
+    if (encontrada) {
+        // Hasta 256 MB de memcpy: sin el mutex, los demás hilos siguen usando la caché
+        const ImagenInfo* original = &encontrada->imagen;
+        info->pixeles = clonarMatriz3D(original->pixeles, original->alto, original->ancho, original->canales);
+        info->ancho = original->ancho;
+        info->alto = original->alto;
+        info->canales = original->canales;
+        pthread_mutex_lock(&cache->mutex);
+        soltarImagenCache(encontrada);
+        pthread_mutex_unlock(&cache->mutex);
+        return info->pixeles != NULL;
+    }
 
-    // QUÉ: Asignar memoria para matriz 3D.
-    // CÓMO: Asignar alto filas, luego ancho columnas por fila, luego canales por píxel.
-    // POR QUÉ: Estructura clara y flexible para grises (1 canal) o RGB (3 canales).
-    info->pixeles = (unsigned char***)malloc(info->alto * sizeof(unsigned char**));
-    if (!info->pixeles) {
-        fprintf(stderr, "Error de memoria al asignar filas\n");
-        stbi_image_free(datos);
-        return 0;
+    if (!cargarSegunExtension(ruta, info)) return 0;
+    size_t bytes = (size_t)info->ancho * info->alto * info->canales;
+    if (bytes > BYTES_CACHE_SERVIDOR || strlen(ruta) >= sizeof(cache->entradas[0].ruta)) return 1;
+    ImagenCache* nueva = malloc(sizeof(ImagenCache));
+    unsigned char*** copia = nueva ? clonarMatriz3D(info->pixeles, info->alto, info->ancho, info->canales) : NULL;
+    if (!copia) {
+        free(nueva);
+        return 1;
     }
-    for (int y = 0; y < info->alto; y++) {
-        info->pixeles[y] = (unsigned char**)malloc(info->ancho * sizeof(unsigned char*));
-        if (!info->pixeles[y]) {
-            fprintf(stderr, "Error de memoria al asignar columnas\n");
-            liberarImagen(info);
-            stbi_image_free(datos);
-            return 0;
+
+    pthread_mutex_lock(&cache->mutex);
+    int libre = -1;
+    for (int i = 0; i < ENTRADAS_CACHE_SERVIDOR; i++) {
+        // Otra solicitud pudo cargar la misma versión mientras tanto
+        if (cache->entradas[i].imagen && strcmp(cache->entradas[i].ruta, ruta) == 0) {
+            liberarEntradaCache(cache, i);
         }
-        for (int x = 0; x < info->ancho; x++) {
-            info->pixeles[y][x] = (unsigned char*)malloc(info->canales * sizeof(unsigned char));
-            if (!info->pixeles[y][x]) {
-                fprintf(stderr, "Error de memoria al asignar canales\n");
-                liberarImagen(info);
-                stbi_image_free(datos);
-                return 0;
-            }
-            // Copiar píxeles a matriz 3D
-            for (int c = 0; c < info->canales; c++) {
-                info->pixeles[y][x][c] = datos[(y * info->ancho + x) * info->canales + c];
+    }
+    while (1) {
+        int menosUsada = -1;
+        libre = -1;
+        for (int i = 0; i < ENTRADAS_CACHE_SERVIDOR; i++) {
+            EntradaCache* e = &cache->entradas[i];
+            if (!e->imagen) {
+                if (libre < 0) libre = i;
+            } else if (menosUsada < 0 || e->ultimoUso < cache->entradas[menosUsada].ultimoUso) {
+                menosUsada = i;
             }
         }
+        if (libre >= 0 && cache->bytes + bytes <= BYTES_CACHE_SERVIDOR) break;
+        liberarEntradaCache(cache, menosUsada);
     }
-
-    stbi_image_free(datos); // Liberar buffer de stb
-    printf("Imagen cargada: %dx%d, %d canales (%s)\n", info->ancho, info->alto,
-           info->canales, info->canales == 1 ? "grises" : "RGB");
+    EntradaCache* e = &cache->entradas[libre];
+    snprintf(e->ruta, sizeof(e->ruta), "%s", ruta);
+    e->modificado = st.st_mtime;
+    e->tamArchivo = st.st_size;
+    nueva->imagen = *info;
+    nueva->imagen.pixeles = copia;
+    memset(&nueva->imagen.repuesto, 0, sizeof(nueva->imagen.repuesto));
+    nueva->referencias = 1;
+    e->imagen = nueva;
+    e->ultimoUso = ++cache->reloj;
+    cache->bytes += bytes;
+    pthread_mutex_unlock(&cache->mutex);
     return 1;
 }
 
-// QUÉ: Mostrar la matriz de píxeles (primeras 10 filas).
-// CÓMO: Imprime los valores de los píxeles, agrupando canales por píxel (grises o RGB).
-// POR QUÉ: Ayuda a visualizar la matriz para entender la estructura de datos.
-void mostrarMatriz(const ImagenInfo* info) {
-    if (!info->pixeles) {
-        printf("No hay imagen cargada.\n");
-        return;
+// QUÉ: Carga escalando en streaming cuando la imagen original no cabe en el
+// presupuesto y el pipeline empieza por redimensionar.
+// CÓMO: Solo con --mem-limit, entrada PNG y primer paso PASO_ESCALAR (sin
+// región de interés): si la
+// carga completa con stb no cabe en memoriaDisponible(), decodifica con
+// cargarPNGStreaming() produciendo ya las filas escaladas (misma fórmula
+// que el paso) y devuelve 1 (pasos consumidos) con *cargada; si no aplica
+// devuelve 0 y no toca nada.
+// POR QUÉ: Reducir una foto enorme solo necesita la imagen de salida; así el
+// trabajo cabe en un contenedor pequeño en lugar de fallar.
+static int cargarEscaladaConPocaMemoria(const char* ruta, const PasoPipeline* pasos, int numPasos,
+                                        ImagenInfo* info, int* cargada) {
+    int ancho, alto, canales;
+    if (!limiteMemoriaBytes || numPasos == 0 || pasos[0].tipo != PASO_ESCALAR || pasoConRegion(&pasos[0]) ||
+        esRutaCompartida(ruta) ||
+        tieneExtension(ruta, ".icr") || tieneExtension(ruta, ".ppm") || tieneExtension(ruta, ".pgm") ||
+        tieneExtension(ruta, ".tsl")) {
+        return 0;
     }
-    printf("Matriz de la imagen (primeras 10 filas):\n");
-    for (int y = 0; y < info->alto && y < 10; y++) {
-        for (int x = 0; x < info->ancho; x++) {
-            if (info->canales == 1) {
-                printf("%3u ", info->pixeles[y][x][0]); // Escala de grises
-            } else {
-                printf("(%3u,%3u,%3u) ", info->pixeles[y][x][0], info->pixeles[y][x][1],
-                       info->pixeles[y][x][2]); // RGB
-            }
-        }
-        printf("\n");
+    size_t bytesCompleta = bytesDecodificacionStb(ruta, &ancho, &alto, &canales);
+    if (bytesCompleta == 0 || bytesCompleta + bytesMatriz3D(alto, ancho, canales) <= memoriaDisponible()) return 0;
+
+    OpcionesStreaming op;
+    memset(&op, 0, sizeof(op));
+    op.nuevoAncho = pasos[0].nuevoAncho;
+    op.nuevoAlto = pasos[0].nuevoAlto;
+    informar("La imagen completa no cabe en el presupuesto de memoria: se carga escalando en streaming\n");
+    MedicionOperacion medicion;
+    iniciarMedicion(&medicion, NULL);
+    *cargada = cargarPNGStreaming(ruta, info, &op);
+    if (*cargada) terminarMedicion(&medicion, "cargar", ruta, info);
+    return 1;
+}
+
+// QUÉ: Ejecuta un trabajo carga → pipeline → guardado.
+// CÓMO: Si hay caché la usa para cargar (salvo segmentos compartidos, que se
+// proyectan; en el lugar si la salida es el mismo segmento, y salvo que el
+// primer paso se haga durante la carga por falta de memoria); devuelve las
+// dimensiones finales en *resultado (sin píxeles).
+// POR QUÉ: Lo comparten el modo directo y el servidor.
+static int ejecutarTrabajoImagen(const OpcionesLineaComandos* op, CacheImagenes* cache, ImagenInfo* resultado) {
+    ImagenInfo imagen = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+    int cargada = 0;
+    int consumidos = cargarEscaladaConPocaMemoria(op->entrada, op->pasos, op->numPasos, &imagen, &cargada);
+    if (consumidos > 0) {
+        // Ya cargada y escalada
+    } else if (esRutaCompartida(op->entrada)) {
+        // Misma ruta de entrada y salida: se trabaja en el lugar sobre el segmento
+        MedicionOperacion medicion;
+        iniciarMedicion(&medicion, NULL);
+        cargada = cargarCompartida(op->entrada, &imagen, strcmp(op->entrada, op->salida) == 0);
+        if (cargada) terminarMedicion(&medicion, "cargar", op->entrada, &imagen);
+    } else {
+        cargada = cache ? cargarConCache(cache, op->entrada, &imagen) : cargarSegunExtension(op->entrada, &imagen);
     }
-    if (info->alto > 10) {
-        printf("... (más filas)\n");
+    int exito = cargada &&
+                (op->numPasos == consumidos ||
+                 ejecutarPipelineFusionadoConcurrente(&imagen, op->pasos + consumidos, op->numPasos - consumidos)) &&
+                guardarSegunExtension(&imagen, op->salida, &op->opcionesPNG);
+    if (resultado) {
+        *resultado = imagen;
+        resultado->pixeles = NULL;
+        memset(&resultado->repuesto, 0, sizeof(resultado->repuesto));
     }
+    liberarImagen(&imagen);
+    return exito;
 }
 
-// QUÉ: Guardar la matriz como PNG (grises o RGB).
-// CÓMO: Aplana la matriz 3D a 1D y usa stbi_write_png con el número de canales correcto.
-// POR QUÉ: Respeta el formato original (grises o RGB) para consistencia.
-int guardarPNG(const ImagenInfo* info, const char* rutaSalida) {
-    if (!info->pixeles) {
-        fprintf(stderr, "No hay imagen para guardar.\n");
-        return 0;
-    }
+#define MAX_DESCRIPTORES_SOLICITUD 4   // Segmentos adjuntos a una solicitud (SCM_RIGHTS)
 
-    // QUÉ: Aplanar matriz 3D a 1D para stb.
-    // CÓMO: Copia píxeles en orden [y][x][c] a un arreglo plano.
-    // POR QUÉ: stb_write_png requiere datos contiguos.
-    unsigned char* datos1D = (unsigned char*)malloc(info->ancho * info->alto * info->canales);
-    if (!datos1D) {
-        fprintf(stderr, "Error de memoria al aplanar imagen\n");
-        return 0;
+// QUÉ: Lector de líneas con búfer sobre un socket.
+// CÓMO: Llena el búfer con recvmsg() y entrega hasta cada '\n'; los
+// descriptores que lleguen adjuntos (SCM_RIGHTS) se acumulan en fds.
+// POR QUÉ: Un cliente puede enviar varias solicitudes por la misma conexión
+// y adjuntar segmentos de memoria compartida sin nombre.
+typedef struct {
+    int fd;
+    char buf[4096];
+    size_t inicio;
+    size_t fin;
+    int fds[MAX_DESCRIPTORES_SOLICITUD];
+    int numFds;
+} LectorSocket;
+
+// QUÉ: Lee bytes de un socket guardando los descriptores adjuntos.
+// CÓMO: recvmsg con espacio de control para MAX_DESCRIPTORES_SOLICITUD; los
+// que no quepan se cierran.
+// POR QUÉ: Los descriptores solo se pueden recibir junto con datos.
+static ssize_t recibirSocket(LectorSocket* l) {
+    union {
+        struct cmsghdr alineado;
+        char datos[CMSG_SPACE(sizeof(int) * MAX_DESCRIPTORES_SOLICITUD)];
+    } control;
+    struct iovec tramo = {l->buf, sizeof(l->buf)};
+    struct msghdr mensaje;
+    memset(&mensaje, 0, sizeof(mensaje));
+    mensaje.msg_iov = &tramo;
+    mensaje.msg_iovlen = 1;
+    mensaje.msg_control = control.datos;
+    mensaje.msg_controllen = sizeof(control.datos);
+    ssize_t r = recvmsg(l->fd, &mensaje, 0);
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&mensaje); r > 0 && c; c = CMSG_NXTHDR(&mensaje, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int n = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int* recibidos = (int*)CMSG_DATA(c);
+        for (int i = 0; i < n; i++) {
+            if (l->numFds < MAX_DESCRIPTORES_SOLICITUD) l->fds[l->numFds++] = recibidos[i];
+            else close(recibidos[i]);
+        }
     }
-    for (int y = 0; y < info->alto; y++) {
-        for (int x = 0; x < info->ancho; x++) {
-            for (int c = 0; c < info->canales; c++) {
-                datos1D[(y * info->ancho + x) * info->canales + c] = info->pixeles[y][x][c];
-            }
+    return r;
+}
+
+// QUÉ: Lee una línea (sin el '\n') del socket.
+// CÓMO: Toma bytes del búfer del lector, recibiendo más cuando se vacía.
+// Devuelve 0 al terminar la conexión, 1 con una línea completa y 2 si la
+// línea no cabía en 'tam' (se descarta el resto hasta el '\n').
+// POR QUÉ: Una solicitud cortada podría ejecutarse con otros argumentos (por
+// ejemplo, una ruta de salida truncada); quien llama la rechaza.
+static int leerLineaSocket(LectorSocket* l, char* linea, size_t tam) {
+    size_t n = 0;
+    int larga = 0;
+    while (1) {
+        if (l->inicio == l->fin) {
+            ssize_t r = recibirSocket(l);
+            if (r <= 0) return n > 0;   // Fin de la conexión
+            l->inicio = 0;
+            l->fin = (size_t)r;
         }
+        char c = l->buf[l->inicio++];
+        if (c == '\n') break;
+        if (n + 1 < tam) linea[n++] = c;
+        else larga = 1;
     }
+    if (n > 0 && linea[n - 1] == '\r') n--;
+    linea[n] = '\0';
+    return larga ? 2 : 1;
+}
 
-    // QUÉ: Guardar como PNG.
-    // CÓMO: Usa stbi_write_png con los canales de la imagen original.
-    // POR QUÉ: Mantiene el formato (grises o RGB) de la entrada.
-    int resultado = stbi_write_png(rutaSalida, info->ancho, info->alto, info->canales,
-                                   datos1D, info->ancho * info->canales);
-    free(datos1D);
-    if (resultado) {
-        printf("Imagen guardada en: %s (%s)\n", rutaSalida,
-               info->canales == 1 ? "grises" : "RGB");
-        return 1;
-    } else {
-        fprintf(stderr, "Error al guardar PNG: %s\n", rutaSalida);
-        return 0;
+// QUÉ: Cierra los descriptores recibidos con la última solicitud.
+// CÓMO: close() de cada uno y numFds a cero.
+// POR QUÉ: Cada solicitud trae sus propios segmentos.
+static void cerrarDescriptoresRecibidos(LectorSocket* l) {
+    for (int i = 0; i < l->numFds; i++) close(l->fds[i]);
+    l->numFds = 0;
+}
+
+// QUÉ: Escribe una cadena completa en un socket.
+// CÓMO: Repite write() hasta enviar todo.
+// POR QUÉ: write() puede escribir parcialmente.
+static int escribirSocket(int fd, const char* texto) {
+    size_t n = strlen(texto);
+    while (n > 0) {
+        ssize_t w = write(fd, texto, n);
+        if (w <= 0) return 0;
+        texto += w;
+        n -= (size_t)w;
     }
+    return 1;
 }
 
-// QUÉ: Estructura para pasar datos al hilo de ajuste de brillo.
-// CÓMO: Contiene matriz, rango de filas, ancho, canales y delta de brillo.
-// POR QUÉ: Los hilos necesitan datos específicos para procesar en paralelo.
+// QUÉ: Estado compartido del servidor.
+// CÓMO: Cola de conexiones aceptadas y caché de imágenes.
+// POR QUÉ: Los hilos de atención toman conexiones de la cola.
 typedef struct {
-    unsigned char*** pixeles;
-    int inicio;
-    int fin;
-    int ancho;
-    int canales;
-    int delta;
-} BrilloArgs;
+    ColaTrabajos conexiones;
+    CacheImagenes cache;
+    int siguienteGrupo;             // Grupo de afinidad del próximo hilo de atención (atómico)
+    pthread_mutex_t mutexEstadisticas;
+    RegistroEstadisticas estadisticas;  // --stats: lo que ya entregaron los hilos de atención
+} ServidorImagenes;
 
-// QUÉ: Ajustar brillo en un rango de filas (para hilos).
-// CÓMO: Suma delta a cada canal de cada píxel, con clamp entre 0-255.
-// POR QUÉ: Procesa píxeles en paralelo para demostrar concurrencia.
-void* ajustarBrilloHilo(void* args) {
-    BrilloArgs* bArgs = (BrilloArgs*)args;
-    for (int y = bArgs->inicio; y < bArgs->fin; y++) {
-        for (int x = 0; x < bArgs->ancho; x++) {
-            for (int c = 0; c < bArgs->canales; c++) {
-                int nuevoValor = bArgs->pixeles[y][x][c] + bArgs->delta;
-                bArgs->pixeles[y][x][c] = (unsigned char)(nuevoValor < 0 ? 0 :
-                                                          (nuevoValor > 255 ? 255 : nuevoValor));
+// QUÉ: Pedido de detener el servidor.
+// CÓMO: El manejador de SIGINT/SIGTERM solo levanta la bandera; el bucle de
+// aceptar la revisa.
+// POR QUÉ: Terminar por el camino normal permite mostrar --stats y escribir
+// --trace al salir.
+static volatile sig_atomic_t detenerServidor = 0;
+
+static void pedirDetenerServidor(int senal) {
+    (void)senal;
+    detenerServidor = 1;
+}
+
+// QUÉ: Atiende las solicitudes de una conexión hasta que el cliente cierra.
+// CÓMO: Cada línea tiene la sintaxis de la línea de comandos sin el nombre
+// del programa ("entrada [operaciones] -o salida [opciones]"), o "STATS".
+// Entrada y salida pueden ser segmentos compartidos (shm:/nombre o fd:K con
+// el descriptor adjunto a la línea). Responde "OK ancho alto canales ms" o
+// "ERROR motivo".
+// POR QUÉ: Reutiliza el análisis de argumentos; los clientes no necesitan un
+// protocolo aparte.
+static void atenderConexion(ServidorImagenes* servidor, int fd) {
+    LectorSocket lector = {fd, {0}, 0, 0, {0}, 0};
+    char linea[2048], respuesta[256];
+    int leida;
+    while ((leida = leerLineaSocket(&lector, linea, sizeof(linea))) != 0) {
+        if (leida == 2) {
+            snprintf(respuesta, sizeof(respuesta), "ERROR solicitud demasiado larga (máximo %zu bytes)\n",
+                     sizeof(linea) - 1);
+            cerrarDescriptoresRecibidos(&lector);
+            if (!escribirSocket(fd, respuesta)) break;
+            continue;
+        }
+        if (strcmp(linea, "STATS") == 0) {
+            pthread_mutex_lock(&servidor->cache.mutex);
+            snprintf(respuesta, sizeof(respuesta), "OK solicitudes=%ld aciertos=%ld fallos=%ld bytes=%zu\n",
+                     servidor->cache.solicitudes, servidor->cache.aciertos, servidor->cache.fallos,
+                     servidor->cache.bytes);
+            pthread_mutex_unlock(&servidor->cache.mutex);
+            if (!escribirSocket(fd, respuesta)) break;
+            continue;
+        }
+        // Separar la línea en argumentos (sin comillas: rutas sin espacios).
+        // fd:K se refiere al K-ésimo descriptor adjunto y se traduce al
+        // número local; un fd: que no corresponda a un adjunto se rechaza.
+        char* argv[MAX_ARGUMENTOS_SOLICITUD];
+        char traducidos[MAX_ARGUMENTOS_SOLICITUD][24];
+        int argc = 0, solicitudValida = 1;
+        char* contexto = NULL;
+        argv[argc++] = "img";
+        for (char* tok = strtok_r(linea, " \t", &contexto); tok && argc < MAX_ARGUMENTOS_SOLICITUD;
+             tok = strtok_r(NULL, " \t", &contexto)) {
+            if (strncmp(tok, PREFIJO_DESCRIPTOR, strlen(PREFIJO_DESCRIPTOR)) == 0) {
+                int k = atoi(tok + strlen(PREFIJO_DESCRIPTOR));
+                if (k < 0 || k >= lector.numFds) solicitudValida = 0;
+                else snprintf(traducidos[argc], sizeof(traducidos[argc]), "%s%d", PREFIJO_DESCRIPTOR, lector.fds[k]);
+                tok = traducidos[argc];
             }
+            argv[argc++] = tok;
+        }
+        // Argumentos de más: rechazar en lugar de ignorar el resto
+        if (argc == MAX_ARGUMENTOS_SOLICITUD && strtok_r(NULL, " \t", &contexto)) solicitudValida = 0;
+        OpcionesLineaComandos op;
+        double t0 = tiempoActualSegundos();
+        ImagenInfo resultado = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+        if (!solicitudValida || analizarLineaComandos(argc, argv, &op, NULL) != 1 || !op.entrada ||
+            !op.salida || op.lote || op.servidor || op.benchServidor) {
+            snprintf(respuesta, sizeof(respuesta), "ERROR solicitud inválida\n");
+        } else if (!ejecutarTrabajoImagen(&op, &servidor->cache, &resultado)) {
+            snprintf(respuesta, sizeof(respuesta), "ERROR no se pudo procesar %s\n", op.entrada);
+        } else {
+            snprintf(respuesta, sizeof(respuesta), "OK %d %d %d %.3f\n", resultado.ancho, resultado.alto,
+                     resultado.canales, (tiempoActualSegundos() - t0) * 1e3);
+        }
+        cerrarDescriptoresRecibidos(&lector);
+        pthread_mutex_lock(&servidor->cache.mutex);
+        servidor->cache.solicitudes++;
+        pthread_mutex_unlock(&servidor->cache.mutex);
+        if (!escribirSocket(fd, respuesta)) break;
+    }
+    cerrarDescriptoresRecibidos(&lector);
+    close(fd);
+}
+
+// QUÉ: Hilo de atención del servidor.
+// CÓMO: Toma descriptores de la cola (guardados como fd + 1 para no
+// confundir el 0 con el fin de la cola) y atiende cada conexión.
+// POR QUÉ: Varios clientes se atienden a la vez con hilos ya creados.
+static void* atenderServidorHilo(void* args) {
+    ServidorImagenes* servidor = (ServidorImagenes*)args;
+    grupoAfinidadHilo = __atomic_fetch_add(&servidor->siguienteGrupo, 1, __ATOMIC_RELAXED);
+    double espera = 0;
+    void* elemento;
+    while ((elemento = desencolarTrabajo(&servidor->conexiones, &espera)) != NULL) {
+        atenderConexion(servidor, (int)((intptr_t)elemento - 1));
+        // El hilo nunca termina: entrega su registro después de cada conexión
+        if (estadisticasActivas) {
+            pthread_mutex_lock(&servidor->mutexEstadisticas);
+            combinarEstadisticas(&servidor->estadisticas, &estadisticasHilo);
+            pthread_mutex_unlock(&servidor->mutexEstadisticas);
+            memset(&estadisticasHilo, 0, sizeof(estadisticasHilo));
         }
     }
     return NULL;
 }
 
-// QUÉ: Ajustar brillo de la imagen usando múltiples hilos.
-// CÓMO: Divide las filas entre 2 hilos, pasa argumentos y espera con join.
-// POR QUÉ: Usa concurrencia para acelerar el procesamiento y enseñar hilos.
-void ajustarBrilloConcurrente(ImagenInfo* info, int delta) {
-    if (!info->pixeles) {
-        printf("No hay imagen cargada.\n");
-        return;
+// QUÉ: Ejecuta el servidor en un socket Unix hasta que el proceso termina.
+// CÓMO: Crea el socket (reemplazando uno viejo en la misma ruta), lanza
+// 'trabajadores' hilos de atención y acepta conexiones encolándolas hasta
+// recibir SIGINT/SIGTERM (bloqueadas en los hilos de atención, así llegan al
+// que acepta). Al detenerse borra el socket y pasa al hilo principal las
+// estadísticas que entregaron los hilos de atención.
+// POR QUÉ: Un proceso residente evita el arranque, y su caché evita volver a
+// decodificar, en cada solicitud de miniaturas bajo demanda.
+static int ejecutarServidor(const char* rutaSocket, int trabajadores) {
+    struct sockaddr_un direccion;
+    if (strlen(rutaSocket) >= sizeof(direccion.sun_path)) {
+        fprintf(stderr, "Error: Ruta de socket demasiado larga: %s\n", rutaSocket);
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN);   // Un cliente que se va no debe terminar el servidor
+    int fdServidor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fdServidor < 0) {
+        fprintf(stderr, "Error al crear socket\n");
+        return 0;
+    }
+    memset(&direccion, 0, sizeof(direccion));
+    direccion.sun_family = AF_UNIX;
+    strcpy(direccion.sun_path, rutaSocket);
+    unlink(rutaSocket);
+    if (bind(fdServidor, (struct sockaddr*)&direccion, sizeof(direccion)) != 0 ||
+        listen(fdServidor, 64) != 0) {
+        fprintf(stderr, "Error al escuchar en %s\n", rutaSocket);
+        close(fdServidor);
+        return 0;
     }
 
-    const int numHilos = 2; // QUÉ: Número fijo de hilos para simplicidad.
-    pthread_t hilos[numHilos];
-    BrilloArgs args[numHilos];
-    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
-
-    // QUÉ: Configurar y lanzar hilos.
-    // CÓMO: Asigna rangos de filas a cada hilo y pasa datos.
-    // POR QUÉ: Divide el trabajo para procesar en paralelo.
-    for (int i = 0; i < numHilos; i++) {
-        args[i].pixeles = info->pixeles;
-        args[i].inicio = i * filasPorHilo;
-        args[i].fin = (i + 1) * filasPorHilo < info->alto ? (i + 1) * filasPorHilo : info->alto;
-        args[i].ancho = info->ancho;
-        args[i].canales = info->canales;
-        args[i].delta = delta;
-        if (pthread_create(&hilos[i], NULL, ajustarBrilloHilo, &args[i]) != 0) {
-            fprintf(stderr, "Error al crear hilo %d\n", i);
-            return;
+    ServidorImagenes* servidor = calloc(1, sizeof(ServidorImagenes));
+    pthread_t* hilos = malloc((size_t)trabajadores * sizeof(pthread_t));
+    if (!servidor || !hilos || !iniciarColaTrabajos(&servidor->conexiones, 64, 1)) {
+        fprintf(stderr, "Error de memoria para el servidor\n");
+        free(servidor);
+        free(hilos);
+        close(fdServidor);
+        return 0;
+    }
+    pthread_mutex_init(&servidor->cache.mutex, NULL);
+    pthread_mutex_init(&servidor->mutexEstadisticas, NULL);
+    sigset_t senales, previas;
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGINT);
+    sigaddset(&senales, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &senales, &previas);
+    repartirAfinidadEnGrupos(trabajadores);
+    int creados = 0;
+    for (; creados < trabajadores; creados++) {
+        if (pthread_create(&hilos[creados], NULL, atenderServidorHilo, servidor) != 0) {
+            fprintf(stderr, "Error al crear hilo %d del servidor\n", creados);
+            break;
         }
     }
+    if (creados < trabajadores) {
+        // Todavía no se aceptó ninguna conexión: la cola y la caché están
+        // vacías, alcanza con cerrar la cola y esperar a los hilos creados
+        cerrarColaTrabajos(&servidor->conexiones);
+        for (int i = 0; i < creados; i++) pthread_join(hilos[i], NULL);
+        pthread_sigmask(SIG_SETMASK, &previas, NULL);
+        destruirColaTrabajos(&servidor->conexiones);
+        pthread_mutex_destroy(&servidor->cache.mutex);
+        pthread_mutex_destroy(&servidor->mutexEstadisticas);
+        free(servidor);
+        free(hilos);
+        close(fdServidor);
+        unlink(rutaSocket);
+        return 0;
+    }
+    struct sigaction accion;
+    memset(&accion, 0, sizeof(accion));
+    accion.sa_handler = pedirDetenerServidor;
+    sigaction(SIGINT, &accion, NULL);
+    sigaction(SIGTERM, &accion, NULL);
+    pthread_sigmask(SIG_SETMASK, &previas, NULL);
+    informar("Servidor escuchando en %s con %d hilos de atención\n", rutaSocket, trabajadores);
 
-    // QUÉ: Esperar a que los hilos terminen.
-    // CÓMO: Usa pthread_join para sincronizar.
-    // POR QUÉ: Garantiza que todos los píxeles se procesen antes de continuar.
-    for (int i = 0; i < numHilos; i++) {
-        pthread_join(hilos[i], NULL);
+    double espera = 0;
+    struct pollfd escucha = {fdServidor, POLLIN, 0};
+    while (!detenerServidor) {
+        // Espera acotada: una señal que llega justo antes de poll() se ve en la vuelta siguiente
+        if (poll(&escucha, 1, 200) <= 0) continue;
+        int fd = accept(fdServidor, NULL, NULL);
+        if (fd < 0) continue;
+        encolarTrabajo(&servidor->conexiones, (void*)(intptr_t)(fd + 1), &espera);
     }
-    printf("Brillo ajustado concurrentemente con %d hilos (%s).\n", numHilos,
-           info->canales == 1 ? "grises" : "RGB");
+    close(fdServidor);
+    unlink(rutaSocket);
+    // Los hilos de atención pueden seguir con una conexión: no se esperan ni
+    // se libera el estado compartido, el proceso termina a continuación
+    pthread_mutex_lock(&servidor->mutexEstadisticas);
+    combinarEstadisticas(&estadisticasHilo, &servidor->estadisticas);
+    pthread_mutex_unlock(&servidor->mutexEstadisticas);
+    informar("Servidor detenido\n");
+    return 1;
 }
 
-// QUÉ: Mostrar el menú interactivo.
-// CÓMO: Imprime opciones y espera entrada del usuario.
-// POR QUÉ: Proporciona una interfaz simple para interactuar con el programa.
-void mostrarMenu() {
-    printf("\n--- Plataforma de Edición de Imágenes ---\n");
-    printf("1. Cargar imagen PNG\n");
-    printf("2. Mostrar matriz de píxeles\n");
-    printf("3. Guardar como PNG\n");
-    printf("4. Ajustar brillo (+/- valor) concurrentemente\n");
-    printf("5. Aplicar desenfoque Gaussiano (convolución)\n");
-    printf("6. Redimensionar imagen (escalar)\n");
-    printf("7. Rotar imagen\n");
-    printf("8. Detectar bordes (Sobel)\n");
-    printf("9. Salir\n");
-    printf("Opción: ");
+// QUÉ: Conecta al servidor, envía una solicitud y lee la respuesta.
+// CÓMO: Una conexión por solicitud; la línea se envía con sendmsg llevando
+// adjuntos (SCM_RIGHTS) los 'numFds' descriptores dados, que la solicitud
+// nombra como fd:0, fd:1... La respuesta es una línea.
+// POR QUÉ: Lo usan --client y el benchmark de latencia.
+static int enviarSolicitudServidor(const char* rutaSocket, const char* solicitud, const int* fds, int numFds,
+                            char* respuesta, size_t tam) {
+    struct sockaddr_un direccion;
+    if (strlen(rutaSocket) >= sizeof(direccion.sun_path)) return 0;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+    memset(&direccion, 0, sizeof(direccion));
+    direccion.sun_family = AF_UNIX;
+    strcpy(direccion.sun_path, rutaSocket);
+    if (connect(fd, (struct sockaddr*)&direccion, sizeof(direccion)) != 0) {
+        close(fd);
+        return 0;
+    }
+    char linea[2048];
+    int largo = snprintf(linea, sizeof(linea), "%s\n", solicitud);
+    if (largo < 0 || (size_t)largo >= sizeof(linea) || numFds > MAX_DESCRIPTORES_SOLICITUD) {
+        close(fd);
+        return 0;
+    }
+    union {
+        struct cmsghdr alineado;
+        char datos[CMSG_SPACE(sizeof(int) * MAX_DESCRIPTORES_SOLICITUD)];
+    } control;
+    struct iovec tramo = {linea, (size_t)largo};
+    struct msghdr mensaje;
+    memset(&mensaje, 0, sizeof(mensaje));
+    memset(&control, 0, sizeof(control));
+    mensaje.msg_iov = &tramo;
+    mensaje.msg_iovlen = 1;
+    if (numFds > 0) {
+        mensaje.msg_control = control.datos;
+        mensaje.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&mensaje);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * numFds);
+    }
+    ssize_t enviados = sendmsg(fd, &mensaje, 0);
+    // Los descriptores viajan con el primer byte; el resto (si hubo envío parcial) va solo
+    int ok = enviados > 0 && escribirSocket(fd, linea + enviados);
+    LectorSocket lector = {fd, {0}, 0, 0, {0}, 0};
+    ok = ok && leerLineaSocket(&lector, respuesta, tam);
+    close(fd);
+    return ok;
 }
 
-// QUÉ: Función principal que controla el flujo del programa.
-// CÓMO: Maneja entrada CLI, ejecuta el menú en bucle y llama funciones según opción.
-// POR QUÉ: Centraliza la lógica y asegura limpieza al salir.
+// QUÉ: Compara la latencia del servidor contra un proceso por solicitud.
+// CÓMO: Arranca un servidor hijo en un socket temporal y envía 'solicitudes'
+// miniaturas (128x128) por el socket con la imagen como archivo y luego como
+// segmento compartido anónimo (entrada y salida adjuntas con SCM_RIGHTS);
+// por último lanza el mismo número de procesos "img entrada --resize 128x128
+// -o ..." con posix_spawn. De cada modo muestra p50, p99 y media.
+// POR QUÉ: Cuantifica lo que cuesta arrancar el proceso y decodificar en
+// cada solicitud, y lo que se ahorra al no pasar por PNG.
+static int medirServidorVsProcesos(const char* programa, const char* entrada, int solicitudes) {
+    char rutaSocket[64], salidaServidor[64], salidaProceso[64];
+    snprintf(rutaSocket, sizeof(rutaSocket), "/tmp/img_bench_%d.sock", (int)getpid());
+    snprintf(salidaServidor, sizeof(salidaServidor), "/tmp/img_bench_%d_s.png", (int)getpid());
+    snprintf(salidaProceso, sizeof(salidaProceso), "/tmp/img_bench_%d_p.png", (int)getpid());
+    double* latencias[3];
+    const char* nombres[3] = {"servidor", "servidor shm", "un proceso"};
+    for (int s = 0; s < 3; s++) latencias[s] = malloc((size_t)solicitudes * sizeof(double));
+    if (!latencias[0] || !latencias[1] || !latencias[2]) {
+        fprintf(stderr, "Error de memoria para el benchmark\n");
+        for (int s = 0; s < 3; s++) free(latencias[s]);
+        return 0;
+    }
 
+    // Segmentos compartidos de entrada (con la imagen) y de salida
+    ImagenInfo imagen = {0, 0, 0, NULL, {NULL, 0, 0, 0}};
+    int segmentos[2] = {crearSegmentoAnonimo(), crearSegmentoAnonimo()};
+    int exito = segmentos[0] >= 0 && segmentos[1] >= 0 && cargarSegunExtension(entrada, &imagen) &&
+                escribirImagenCompartida(segmentos[0], &imagen);
+    liberarImagen(&imagen);
 
-// ============================================================================
-// FUNCIONES NUEVAS: Rotación concurrente y Detección de Bordes (Sobel)
-// QUÉ: Se agregan según reglas del parcial sin modificar código base existente.
-// CÓMO: Se usan pthreads (2 hilos), matrices 3D, interpolación bilineal y Sobel.
-// POR QUÉ: Extienden la plataforma con transformaciones y análisis de bordes.
-// ============================================================================
+    pid_t hijo;
+    char* argsServidor[] = {(char*)programa, "--serve", rutaSocket, NULL};
+    if (!exito || posix_spawn(&hijo, programa, NULL, NULL, argsServidor, environ) != 0) {
+        fprintf(stderr, "Error al preparar segmentos o lanzar el servidor\n");
+        for (int s = 0; s < 2; s++) if (segmentos[s] >= 0) close(segmentos[s]);
+        for (int s = 0; s < 3; s++) free(latencias[s]);
+        return 0;
+    }
 
-typedef struct {
-    unsigned char*** origen;
-    unsigned char*** destino;
-    int anchoOrig, altoOrig;
-    int anchoDest, altoDest;
-    int canales;
-    float anguloRad;
-    int inicio, fin;
-} RotacionArgs;
+    char solicitud[1024], respuesta[256];
+    const char* solicitudShm = "fd:0 --resize 128x128 -o fd:1";
+    snprintf(solicitud, sizeof(solicitud), "%s --resize 128x128 -o %s", entrada, salidaServidor);
+    int listo = 0;
+    for (int intento = 0; intento < 500 && !listo; intento++) {   // Esperar hasta 5 s
+        listo = enviarSolicitudServidor(rutaSocket, solicitud, NULL, 0, respuesta, sizeof(respuesta));
+        if (!listo) usleep(10000);
+    }
+    exito = listo && strncmp(respuesta, "OK", 2) == 0;
+    for (int i = 0; exito && i < solicitudes; i++) {
+        double t0 = tiempoActualSegundos();
+        exito = enviarSolicitudServidor(rutaSocket, solicitud, NULL, 0, respuesta, sizeof(respuesta)) &&
+                strncmp(respuesta, "OK", 2) == 0;
+        latencias[0][i] = tiempoActualSegundos() - t0;
+    }
+    for (int i = 0; exito && i < solicitudes; i++) {
+        double t0 = tiempoActualSegundos();
+        exito = enviarSolicitudServidor(rutaSocket, solicitudShm, segmentos, 2, respuesta, sizeof(respuesta)) &&
+                strncmp(respuesta, "OK", 2) == 0;
+        latencias[1][i] = tiempoActualSegundos() - t0;
+    }
+    kill(hijo, SIGTERM);
+    waitpid(hijo, NULL, 0);
+    unlink(rutaSocket);
+    close(segmentos[0]);
+    close(segmentos[1]);
 
-static void* rotarHilo(void* arg) {
-    RotacionArgs* r = (RotacionArgs*)arg;
-    float cxO = r->anchoOrig / 2.0f, cyO = r->altoOrig / 2.0f;
-    float cxN = r->anchoDest / 2.0f, cyN = r->altoDest / 2.0f;
-    float cosA = cosf(r->anguloRad), sinA = sinf(r->anguloRad);
+    char* argsProceso[] = {(char*)programa, (char*)entrada, "--resize", "128x128", "-o", salidaProceso, NULL};
+    for (int i = 0; exito && i < solicitudes; i++) {
+        double t0 = tiempoActualSegundos();
+        pid_t pid;
+        int estado = 1;
+        exito = posix_spawn(&pid, programa, NULL, NULL, argsProceso, environ) == 0 &&
+                waitpid(pid, &estado, 0) == pid && WIFEXITED(estado) && WEXITSTATUS(estado) == 0;
+        latencias[2][i] = tiempoActualSegundos() - t0;
+    }
 
-    for (int y = r->inicio; y < r->fin; y++) {
-        for (int x = 0; x < r->anchoDest; x++) {
-            float xO = (x - cxN) * cosA + (y - cyN) * sinA + cxO;
-            float yO = -(x - cxN) * sinA + (y - cyN) * cosA + cyO;
-            for (int c = 0; c < r->canales; c++) {
-                if (xO >= 0 && xO < r->anchoOrig && yO >= 0 && yO < r->altoOrig) {
-                    r->destino[y][x][c] = interpolacionBilineal(
-                        r->origen, xO, yO, c, r->anchoOrig, r->altoOrig
-                    );
-                } else {
-                    r->destino[y][x][c] = 0;
-                }
-            }
+    if (exito) {
+        printf("Latencia de miniatura 128x128 de %s (%d solicitudes):\n", entrada, solicitudes);
+        printf("  %-12s %10s %10s %10s\n", "modo", "p50 ms", "p99 ms", "media ms");
+        for (int s = 0; s < 3; s++) {
+            double suma = 0;
+            for (int i = 0; i < solicitudes; i++) suma += latencias[s][i];
+            qsort(latencias[s], (size_t)solicitudes, sizeof(double), compararDobles);
+            int i99 = (int)ceil(0.99 * solicitudes) - 1;
+            printf("  %-12s %10.3f %10.3f %10.3f\n", nombres[s], latencias[s][(solicitudes - 1) / 2] * 1e3,
+                   latencias[s][i99] * 1e3, suma / solicitudes * 1e3);
         }
+    } else {
+        fprintf(stderr, "Error: El benchmark del servidor falló (%s)\n", listo ? respuesta : "sin conexión");
     }
-    return NULL;
+    unlink(salidaServidor);
+    unlink(salidaProceso);
+    for (int s = 0; s < 3; s++) free(latencias[s]);
+    return exito;
 }
 
-// QUÉ: Rotar imagen por un ángulo en grados, creando nueva matriz.
-// CÓMO: Calcula dimensiones destino, divide por filas entre 2 hilos y usa
-//       interpolación bilineal para mapear destino→origen.
-// POR QUÉ: Mantiene calidad visual y cumple concurrencia mínima del parcial.
-void rotarImagenConcurrente(ImagenInfo* info, float angulo) {
-    if (!info || !info->pixeles) {
-        fprintf(stderr, "Error: No hay imagen cargada\n");
-        return;
+// QUÉ: Ejecuta carga → operaciones → guardado según los argumentos, sin menú.
+// CÓMO: analizarLineaComandos() traduce cada operación a un PasoPipeline
+// (mismo orden que en la línea de comandos) y ejecutarTrabajoImagen() las
+// ejecuta juntas; --batch, --serve, --bench-serve, --bench y --client
+// eligen los otros modos. Con --trace, la traza se escribe al final (cuando
+// ya terminaron todos los hilos). Los mensajes informativos se silencian
+// salvo con -v; los errores van a stderr y el código de salida indica éxito
+// o fallo.
+// POR QUÉ: Los trabajos por lotes dejan de simular teclas en el menú y de
+// esperar la E/S de la terminal entre pasos.
+static int ejecutarLineaComandos(int argc, char* argv[]) {
+    if (strcmp(argv[1], "--client") == 0) {
+        // El resto de los argumentos forman la solicitud; cada fd:N (descriptor
+        // de este proceso) se adjunta y se renombra fd:K según su posición
+        char solicitud[2048] = "", respuesta[256], renombrado[24];
+        int fds[MAX_DESCRIPTORES_SOLICITUD], numFds = 0;
+        if (argc < 4) {
+            fprintf(stderr, "Error: --client requiere SOCKET y la solicitud\n");
+            return EXIT_FAILURE;
+        }
+        for (int i = 3; i < argc; i++) {
+            const char* arg = argv[i];
+            if (strncmp(arg, PREFIJO_DESCRIPTOR, strlen(PREFIJO_DESCRIPTOR)) == 0) {
+                int propio, local = abrirSegmentoCompartido(arg, 0, &propio);
+                int k = 0;
+                while (k < numFds && fds[k] != local) k++;
+                if (local < 0 || fcntl(local, F_GETFD) < 0 || (k == numFds && numFds == MAX_DESCRIPTORES_SOLICITUD)) {
+                    fprintf(stderr, "Error: Descriptor inválido o demasiados descriptores: %s\n", arg);
+                    return EXIT_FAILURE;
+                }
+                if (k == numFds) fds[numFds++] = local;
+                snprintf(renombrado, sizeof(renombrado), "%s%d", PREFIJO_DESCRIPTOR, k);
+                arg = renombrado;
+            }
+            if (strlen(solicitud) + strlen(arg) + 2 > sizeof(solicitud)) {
+                fprintf(stderr, "Error: Solicitud demasiado larga\n");
+                return EXIT_FAILURE;
+            }
+            if (i > 3) strcat(solicitud, " ");
+            strcat(solicitud, arg);
+        }
+        if (!enviarSolicitudServidor(argv[2], solicitud, fds, numFds, respuesta, sizeof(respuesta))) {
+            fprintf(stderr, "Error: No se pudo contactar al servidor en %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        printf("%s\n", respuesta);
+        return strncmp(respuesta, "OK", 2) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    float rad = angulo * (float)M_PI / 180.0f;
-    float cosA = fabsf(cosf(rad)), sinA = fabsf(sinf(rad));
-    int nuevoAncho = (int)ceilf(info->alto * sinA + info->ancho * cosA);
-    int nuevoAlto  = (int)ceilf(info->alto * cosA + info->ancho * sinA);
 
-    unsigned char*** nueva = asignarMatriz3D(nuevoAlto, nuevoAncho, info->canales);
-    if (!nueva) {
-        fprintf(stderr, "Error: Memoria insuficiente para rotación\n");
-        return;
+    OpcionesLineaComandos op;
+    int analisis = analizarLineaComandos(argc, argv, &op, stdout);
+    if (analisis != 1) return analisis == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if ((op.servidor || op.benchServidor) &&
+        (op.entrada || op.salida || op.lote || (op.servidor && op.benchServidor))) {
+        fprintf(stderr, "Error: --serve y --bench-serve no admiten entrada, -o ni --batch\n");
+        return EXIT_FAILURE;
+    }
+    if (op.traza && op.servidor) {
+        // El servidor termina con una señal: no llegaría a escribir la traza
+        fprintf(stderr, "Error: --trace no se admite con --serve\n");
+        return EXIT_FAILURE;
+    }
+    if (op.bench && (op.entrada || op.salida || op.lote || op.servidor || op.benchServidor)) {
+        fprintf(stderr, "Error: --bench no admite entrada, -o, --batch ni modos de servidor\n");
+        return EXIT_FAILURE;
+    }
+    if (op.lote && (!op.dirSalida || op.entrada || op.salida)) {
+        fprintf(stderr, "Error: --batch requiere --out-dir y no admite entrada ni -o\n");
+        return EXIT_FAILURE;
+    }
+    if (!op.bench && !op.servidor && !op.benchServidor && !op.lote && (!op.entrada || !op.salida)) {
+        fprintf(stderr, "Error: Se requieren la imagen de entrada y -o salida\n");
+        mostrarUsoLineaComandos(stderr, argv[0]);
+        return EXIT_FAILURE;
     }
 
-    const int numHilos = 2;
-    pthread_t hilos[numHilos];
-    RotacionArgs args[numHilos];
-    int filasPorHilo = (int)ceil((double)nuevoAlto / numHilos);
-
-    for (int i = 0; i < numHilos; i++) {
-        args[i].origen = info->pixeles;
-        args[i].destino = nueva;
-        args[i].anchoOrig = info->ancho;
-        args[i].altoOrig = info->alto;
-        args[i].anchoDest = nuevoAncho;
-        args[i].altoDest = nuevoAlto;
-        args[i].canales = info->canales;
-        args[i].anguloRad = rad;
-        args[i].inicio = i * filasPorHilo;
-        args[i].fin = ((i + 1) * filasPorHilo < nuevoAlto) ? (i + 1) * filasPorHilo : nuevoAlto;
-
-        if (pthread_create(&hilos[i], NULL, rotarHilo, &args[i]) != 0) {
-            fprintf(stderr, "Error al crear hilo %d en rotación\n", i);
-            // No se liberan hilos ya lanzados por simplicidad educativa; se gestiona memoria:
-            liberarMatriz3D(nueva, nuevoAlto, nuevoAncho);
-            return;
+    // Configuración global de solo lectura: se fija antes de crear cualquier hilo
+    mensajesActivos = op.verboso;
+    if (op.hilos > 0 && !op.bench) hilosPorOperacion = op.hilos;
+    if (op.limiteMemoriaMB > 0) limiteMemoriaBytes = (size_t)(op.limiteMemoriaMB * 1024 * 1024);
+    poolActivo = !op.sinPool;
+    if (op.numa && !activarAfinidad(1)) {
+        fprintf(stderr, "Aviso: --numa no disponible en este sistema; los hilos no se fijan\n");
+    }
+    if (op.estadisticasJSON) {
+        salidaEstadisticasJSON = strcmp(op.estadisticasJSON, "-") == 0 ? stderr : fopen(op.estadisticasJSON, "a");
+        if (!salidaEstadisticasJSON) {
+            fprintf(stderr, "Error: No se pudo abrir %s\n", op.estadisticasJSON);
+            return EXIT_FAILURE;
         }
     }
+    estadisticasActivas = op.estadisticas || salidaEstadisticasJSON != NULL;
+    trazaActiva = op.traza != NULL;
+    if (op.contadores) {
+        contadoresActivos = contadoresHardwareDisponibles();
+        if (!contadoresActivos)
+            fprintf(stderr, "Aviso: contadores de hardware no disponibles (perf_event_open); "
+                            "se muestran solo tiempos\n");
+    }
 
-    for (int i = 0; i < numHilos; i++) pthread_join(hilos[i], NULL);
+    int exito;
+    if (op.bench) {
+        long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+        int maxHilos = op.hilos > 0 ? op.hilos
+                     : nucleos > MAX_HILOS_OPERACION ? MAX_HILOS_OPERACION
+                     : nucleos > HILOS_POR_DEFECTO ? (int)nucleos : HILOS_POR_DEFECTO;
+        exito = ejecutarSuiteBenchmarks(op.tamanosBench, maxHilos, op.repeticionesBench, op.baseBench,
+                                        op.guardarBaseBench, op.toleranciaBench);
+    } else if (op.servidor) {
+        exito = ejecutarServidor(op.servidor, op.procesadores);
+    } else if (op.benchServidor) {
+#ifdef __linux__
+        const char* programa = "/proc/self/exe";
+#else
+        const char* programa = argv[0];
+#endif
+        exito = medirServidorVsProcesos(programa, op.benchServidor, op.solicitudes);
+    } else if (op.lote) {
+        exito = procesarLoteConcurrente(op.lote, op.dirSalida, op.formato, op.pasos, op.numPasos,
+                                        &op.opcionesPNG, op.decodificadores, op.procesadores,
+                                        op.codificadores);
+    } else {
+        exito = ejecutarTrabajoImagen(&op, NULL, NULL);
+    }
 
-    liberarMatriz3D(info->pixeles, info->alto, info->ancho);
-    info->pixeles = nueva;
-    info->ancho = nuevoAncho;
-    info->alto = nuevoAlto;
-    printf("Rotación completada. Nuevas dimensiones: %dx%d\n", nuevoAncho, nuevoAlto);
+    if (op.estadisticas) mostrarResumenEstadisticas(stderr, &estadisticasHilo);
+    if (salidaEstadisticasJSON && salidaEstadisticasJSON != stderr) fclose(salidaEstadisticasJSON);
+    if (op.traza && !escribirTraza(op.traza)) exito = 0;
+    liberarTraza();
+    return exito ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+#endif // PROCESADOR_BIBLIOTECA
 
-// ========================== SOBEL ==========================
-typedef struct {
-    unsigned char*** origen;
-    unsigned char*** destino;
-    int inicio, fin;
-    int ancho, alto;
-} SobelArgs;
+// =====================================================================
+// API DE BIBLIOTECA (procesador.h)
+// =====================================================================
 
-static void* sobelHilo(void* arg) {
-    SobelArgs* s = (SobelArgs*)arg;
-    // Kernels Sobel
-    int Gx[3][3] = { {-1,0,1}, {-2,0,2}, {-1,0,1} };
-    int Gy[3][3] = { {-1,-2,-1}, {0,0,0}, {1,2,1} };
+// QUÉ: Contenido del manejador opaco de la API.
+// CÓMO: Envuelve la ImagenInfo que usa el resto del programa.
+// POR QUÉ: Quien enlaza no depende de la matriz 3D ni de sus tablas.
+struct ImagenProcesador {
+    ImagenInfo info;
+};
 
-    for (int y = s->inicio; y < s->fin; y++) {
-        for (int x = 0; x < s->ancho; x++) {
-            int sx = 0, sy = 0;
-            for (int ky = -1; ky <= 1; ky++) {
-                for (int kx = -1; kx <= 1; kx++) {
-                    int ny = y + ky, nx = x + kx;
-                    if (ny < 0) ny = 0;
-                    if (nx < 0) nx = 0;
-                    if (ny >= s->alto) ny = s->alto - 1;
-                    if (nx >= s->ancho) nx = s->ancho - 1;
-                    int v = s->origen[ny][nx][0]; // siempre gris en esta fase
-                    sx += v * Gx[ky+1][kx+1];
-                    sy += v * Gy[ky+1][kx+1];
-                }
-            }
-            int mag = (int)(sqrtf((float)(sx*sx + sy*sy)) + 0.5f);
-            if (mag > 255) mag = 255;
-            if (mag < 0) mag = 0;
-            s->destino[y][x][0] = (unsigned char)mag;
-        }
+// QUÉ: Crea una imagen nueva, opcionalmente con píxeles iniciales.
+// CÓMO: Reserva el manejador y la matriz con asignarMatriz3D(); copia 'datos'
+// (ancho*canales bytes por fila, orden [y][x][c]) o la deja en negro.
+// POR QUÉ: Permite procesar cuadros que el programa ya tiene en memoria sin
+// pasar por un archivo.
+PROCESADOR_API CodigoProcesador procesadorCrear(int ancho, int alto, int canales,
+                                                const unsigned char* datos, ImagenProcesador** imagen) {
+    if (!imagen || ancho <= 0 || alto <= 0 || (canales != 1 && canales != 3)) return PROCESADOR_ERROR_ARGUMENTO;
+    *imagen = NULL;
+    ImagenProcesador* nueva = calloc(1, sizeof(ImagenProcesador));
+    if (!nueva) return PROCESADOR_ERROR_MEMORIA;
+    nueva->info.pixeles = asignarMatriz3D(alto, ancho, canales);
+    if (!nueva->info.pixeles) {
+        free(nueva);
+        return PROCESADOR_ERROR_MEMORIA;
     }
-    return NULL;
+    nueva->info.ancho = ancho;
+    nueva->info.alto = alto;
+    nueva->info.canales = canales;
+    size_t bytes = (size_t)ancho * alto * canales;
+    if (datos) memcpy(nueva->info.pixeles[0][0], datos, bytes);
+    else memset(nueva->info.pixeles[0][0], 0, bytes);
+    *imagen = nueva;
+    return PROCESADOR_OK;
 }
 
-// QUÉ: Detectar bordes con Sobel. Resultado en escala de grises (1 canal).
-// CÓMO: Si la imagen es RGB, se convierte a gris; luego se aplica Gx/Gy en 2 hilos.
-// POR QUÉ: Extrae bordes fuertes para análisis posterior.
-void detectarBordesConcurrente(ImagenInfo* info) {
-    if (!info || !info->pixeles) {
-        fprintf(stderr, "Error: No hay imagen cargada\n");
-        return;
+// QUÉ: Carga una imagen de un archivo o segmento compartido.
+// CÓMO: Usa cargarSegunExtension() (PNG/JPG, .icr, .ppm/.pgm, .tsl, shm:, fd:).
+// POR QUÉ: Mismos formatos que el programa, sin mensajes en stdout.
+PROCESADOR_API CodigoProcesador procesadorCargar(const char* ruta, ImagenProcesador** imagen) {
+    if (!ruta || !imagen) return PROCESADOR_ERROR_ARGUMENTO;
+    *imagen = NULL;
+    ImagenProcesador* nueva = calloc(1, sizeof(ImagenProcesador));
+    if (!nueva) return PROCESADOR_ERROR_MEMORIA;
+    if (!cargarSegunExtension(ruta, &nueva->info)) {
+        free(nueva);
+        return PROCESADOR_ERROR_ARCHIVO;
     }
+    *imagen = nueva;
+    return PROCESADOR_OK;
+}
 
-    // Asegurar imagen en escala de grises
-    if (info->canales == 3) {
-        unsigned char*** gris = asignarMatriz3D(info->alto, info->ancho, 1);
-        if (!gris) { fprintf(stderr, "Error: Memoria insuficiente\n"); return; }
-        for (int y = 0; y < info->alto; y++) {
-            for (int x = 0; x < info->ancho; x++) {
-                gris[y][x][0] = (unsigned char)(
-                    0.299f * info->pixeles[y][x][0] +
-                    0.587f * info->pixeles[y][x][1] +
-                    0.114f * info->pixeles[y][x][2]
-                );
-            }
+// QUÉ: Guarda la imagen eligiendo el formato por la extensión de la ruta.
+// CÓMO: guardarSegunExtension() con filtro adaptativo y el nivel dado
+// (-1 = NIVEL_PNG_POR_DEFECTO); el nivel solo se usa para PNG.
+// POR QUÉ: Contraparte de procesadorCargar().
+PROCESADOR_API CodigoProcesador procesadorGuardar(const ImagenProcesador* imagen, const char* ruta, int nivelPNG) {
+    if (!imagen || !ruta || nivelPNG < -1 || nivelPNG > 9) return PROCESADOR_ERROR_ARGUMENTO;
+    OpcionesPNG opciones = {nivelPNG < 0 ? NIVEL_PNG_POR_DEFECTO : nivelPNG, FILTRO_PNG_ADAPTATIVO};
+    return guardarSegunExtension(&imagen->info, ruta, &opciones) ? PROCESADOR_OK : PROCESADOR_ERROR_ARCHIVO;
+}
+
+// QUÉ: Libera una imagen de la API.
+// CÓMO: liberarImagen() y luego el manejador; acepta NULL.
+// POR QUÉ: Un único punto de liberación, sea cual sea el origen del bloque.
+PROCESADOR_API void procesadorDestruir(ImagenProcesador* imagen) {
+    if (!imagen) return;
+    liberarImagen(&imagen->info);
+    free(imagen);
+}
+
+// QUÉ: Devuelve las dimensiones actuales de la imagen.
+// CÓMO: Cualquiera de los punteros de salida puede ser NULL.
+// POR QUÉ: Las operaciones pueden cambiar ancho, alto y canales.
+PROCESADOR_API CodigoProcesador procesadorDimensiones(const ImagenProcesador* imagen, int* ancho, int* alto,
+                                                      int* canales) {
+    if (!imagen || !imagen->info.pixeles) return PROCESADOR_ERROR_ARGUMENTO;
+    if (ancho) *ancho = imagen->info.ancho;
+    if (alto) *alto = imagen->info.alto;
+    if (canales) *canales = imagen->info.canales;
+    return PROCESADOR_OK;
+}
+
+// QUÉ: Devuelve el bloque contiguo de píxeles (NULL si no hay imagen).
+// CÓMO: Es pixeles[0][0]: ancho*canales bytes por fila, sin relleno.
+// POR QUÉ: Leer o escribir los píxeles sin copiarlos; el puntero deja de ser
+// válido después de una operación que cambie las dimensiones.
+PROCESADOR_API unsigned char* procesadorPixeles(ImagenProcesador* imagen) {
+    if (!imagen || !imagen->info.pixeles || !compactarVista(&imagen->info)) return NULL;
+    return imagen->info.pixeles[0][0];
+}
+
+// QUÉ: Aplica una cadena de pasos fusionados a la imagen.
+// CÓMO: Valida los parámetros (para devolver PROCESADOR_ERROR_ARGUMENTO) y
+// ejecuta ejecutarPipelineFusionadoConcurrente().
+// POR QUÉ: Todas las operaciones sueltas de la API pasan por aquí, así la
+// biblioteca produce los mismos píxeles que el modo línea de comandos.
+PROCESADOR_API CodigoProcesador procesadorAplicarPasos(ImagenProcesador* imagen, const PasoPipeline* pasos,
+                                                       int numPasos) {
+    if (!imagen || !imagen->info.pixeles || !pasos || numPasos <= 0) return PROCESADOR_ERROR_ARGUMENTO;
+    for (int i = 0; i < numPasos; i++) {
+        const PasoPipeline* paso = &pasos[i];
+        if ((paso->tipo == PASO_DESENFOQUE && (paso->tamKernel <= 0 || paso->tamKernel % 2 == 0 ||
+                                               !(paso->sigma > 0.0f) || !isfinite(paso->sigma))) ||
+            (paso->tipo == PASO_ROTAR && !isfinite(paso->angulo)) ||
+            (paso->tipo == PASO_ESCALAR && (paso->nuevoAncho <= 0 || paso->nuevoAlto <= 0)) ||
+            paso->tipo < PASO_BRILLO || paso->tipo > PASO_RECORTAR) {
+            return PROCESADOR_ERROR_ARGUMENTO;
         }
-        liberarMatriz3D(info->pixeles, info->alto, info->ancho);
-        info->pixeles = gris;
-        info->canales = 1;
     }
+    if (!validarPasosPipeline(&imagen->info, pasos, numPasos)) return PROCESADOR_ERROR_ARGUMENTO;
+    return ejecutarPipelineFusionadoConcurrente(&imagen->info, pasos, numPasos) ? PROCESADOR_OK
+                                                                                 : PROCESADOR_ERROR_OPERACION;
+}
 
-    unsigned char*** salida = asignarMatriz3D(info->alto, info->ancho, 1);
-    if (!salida) { fprintf(stderr, "Error: Memoria insuficiente\n"); return; }
+// QUÉ: Operaciones sueltas de la API.
+// CÓMO: Cada una arma un PasoPipeline y llama a procesadorAplicarPasos().
+// POR QUÉ: Una sola validación y un solo camino de ejecución.
+PROCESADOR_API CodigoProcesador procesadorBrillo(ImagenProcesador* imagen, int delta) {
+    PasoPipeline paso = {.tipo = PASO_BRILLO, .delta = delta};
+    return procesadorAplicarPasos(imagen, &paso, 1);
+}
 
-    const int numHilos = 2;
-    pthread_t hilos[numHilos];
-    SobelArgs args[numHilos];
-    int filasPorHilo = (int)ceil((double)info->alto / numHilos);
+PROCESADOR_API CodigoProcesador procesadorDesenfoque(ImagenProcesador* imagen, int tamKernel, float sigma) {
+    PasoPipeline paso = {.tipo = PASO_DESENFOQUE, .tamKernel = tamKernel, .sigma = sigma};
+    return procesadorAplicarPasos(imagen, &paso, 1);
+}
 
-    for (int i = 0; i < numHilos; i++) {
-        args[i].origen = info->pixeles;
-        args[i].destino = salida;
-        args[i].inicio = i * filasPorHilo;
-        args[i].fin = ((i + 1) * filasPorHilo < info->alto) ? (i + 1) * filasPorHilo : info->alto;
-        args[i].ancho = info->ancho;
-        args[i].alto = info->alto;
+PROCESADOR_API CodigoProcesador procesadorRedimensionar(ImagenProcesador* imagen, int nuevoAncho, int nuevoAlto) {
+    PasoPipeline paso = {.tipo = PASO_ESCALAR, .nuevoAncho = nuevoAncho, .nuevoAlto = nuevoAlto};
+    return procesadorAplicarPasos(imagen, &paso, 1);
+}
 
-        if (pthread_create(&hilos[i], NULL, sobelHilo, &args[i]) != 0) {
-            fprintf(stderr, "Error al crear hilo %d en Sobel\n", i);
-            liberarMatriz3D(salida, info->alto, info->ancho);
-            return;
-        }
+PROCESADOR_API CodigoProcesador procesadorRotar(ImagenProcesador* imagen, float angulo) {
+    PasoPipeline paso = {.tipo = PASO_ROTAR, .angulo = angulo};
+    return procesadorAplicarPasos(imagen, &paso, 1);
+}
+
+PROCESADOR_API CodigoProcesador procesadorSobel(ImagenProcesador* imagen) {
+    PasoPipeline paso = {.tipo = PASO_SOBEL};
+    return procesadorAplicarPasos(imagen, &paso, 1);
+}
+
+// QUÉ: Texto breve para un código de error.
+// CÓMO: Tabla fija por código.
+// POR QUÉ: Para los registros del programa que enlaza.
+PROCESADOR_API const char* procesadorDescribirError(CodigoProcesador codigo) {
+    switch (codigo) {
+        case PROCESADOR_OK: return "sin error";
+        case PROCESADOR_ERROR_ARGUMENTO: return "argumento inválido";
+        case PROCESADOR_ERROR_MEMORIA: return "memoria insuficiente";
+        case PROCESADOR_ERROR_ARCHIVO: return "error al leer o escribir el archivo";
+        case PROCESADOR_ERROR_OPERACION: return "la operación falló";
     }
-    for (int i = 0; i < numHilos; i++) pthread_join(hilos[i], NULL);
+    return "código desconocido";
+}
+
+// QUÉ: Activa o desactiva los mensajes informativos (stdout).
+// CÓMO: Cambia mensajesActivos; debe llamarse antes de lanzar operaciones
+// desde varios hilos.
+// POR QUÉ: La biblioteca es silenciosa por defecto; útil para depurar.
+PROCESADOR_API void procesadorActivarMensajes(int activos) {
+    mensajesActivos = activos != 0;
+}
+
+// QUÉ: Activa o desactiva las estadísticas por operación de la biblioteca.
+// CÓMO: Fija salidaEstadisticasJSON y estadisticasActivas; igual que los
+// mensajes, debe llamarse antes de lanzar operaciones desde varios hilos.
+// POR QUÉ: El servicio que enlaza registra tiempos y MP/s en sus propios logs.
+PROCESADOR_API void procesadorActivarEstadisticas(FILE* json) {
+    salidaEstadisticasJSON = json;
+    estadisticasActivas = json != NULL;
+}
+
+// QUÉ: Activa o desactiva el registro de la traza de ejecución.
+// CÓMO: Fija trazaActiva con las mismas condiciones que los mensajes.
+// POR QUÉ: Quien enlaza decide qué tramo de su programa quiere ver.
+PROCESADOR_API void procesadorActivarTraza(int activa) {
+    trazaActiva = activa != 0;
+}
+
+// QUÉ: Fija el presupuesto de memoria de la biblioteca (0 = sin límite).
+// CÓMO: Cambia limiteMemoriaBytes con las mismas condiciones que los mensajes.
+// POR QUÉ: En un contenedor, lo que no cabe devuelve un error sin reservar
+// (la carga y el guardado PNG antes intentan hacerlo por partes) en lugar de
+// que el sistema mate al proceso.
+PROCESADOR_API void procesadorLimitarMemoria(size_t bytes) {
+    limiteMemoriaBytes = bytes;
+}
+
+// QUÉ: Bytes contados en uso y pico desde que empezó el proceso.
+// CÓMO: Lee los contadores atómicos; cualquiera de los punteros puede ser NULL.
+// Incluye los bloques ociosos del pool (ver procesadorVaciarPool()).
+// POR QUÉ: Para ajustar el presupuesto con datos reales.
+PROCESADOR_API void procesadorMemoriaEnUso(size_t* vivos, size_t* pico) {
+    if (vivos) *vivos = __atomic_load_n(&bytesVivosProceso, __ATOMIC_RELAXED);
+    if (pico) *pico = __atomic_load_n(&picoBytesProceso, __ATOMIC_RELAXED);
+}
 
-    liberarMatriz3D(info->pixeles, info->alto, info->ancho);
-    info->pixeles = salida;
-    info->canales = 1;
-    printf("Detección de bordes aplicada (Sobel). Imagen ahora en grises.\n");
+// QUÉ: Activa o desactiva el modo --numa en la biblioteca.
+// CÓMO: activarAfinidad(); devuelve PROCESADOR_ERROR_OPERACION si se pidió y
+// el sistema no permite leer la afinidad. Se llama sin operaciones en curso.
+// POR QUÉ: En un servidor de dos zócalos quien enlaza decide si fija los
+// hilos de las operaciones (compiten con los suyos por esas CPUs).
+PROCESADOR_API CodigoProcesador procesadorActivarNUMA(int activa) {
+    return activarAfinidad(activa) || !activa ? PROCESADOR_OK : PROCESADOR_ERROR_OPERACION;
 }
 
+// QUÉ: Devuelve al sistema los búferes ociosos del pool.
+// CÓMO: soltarBloqueOcioso() hasta vaciarlo; el pool sigue activo.
+// POR QUÉ: Entre lotes la biblioteca conserva hasta MAX_BLOQUES_POOL bloques
+// del tamaño de una imagen; quien enlaza puede soltarlos al quedar inactivo.
+PROCESADOR_API void procesadorVaciarPool(void) {
+    while (soltarBloqueOcioso()) {
+    }
+}
 
+// QUÉ: Escribe la traza registrada hasta ahora (formato Chrome) y la vacía.
+// CÓMO: escribirTraza() y, si se pudo escribir, liberarTraza(); los eventos
+// siguientes empiezan una traza nueva. Si falla, los eventos se conservan
+// para reintentar. Se llama sin operaciones en curso.
+// POR QUÉ: La biblioteca no sabe cuándo termina el programa que la usa, y un
+// proceso largo que escribe la traza por tramos no debe acumular los bloques.
+PROCESADOR_API CodigoProcesador procesadorEscribirTraza(const char* ruta) {
+    if (!ruta) return PROCESADOR_ERROR_ARGUMENTO;
+    if (!escribirTraza(ruta)) return PROCESADOR_ERROR_ARCHIVO;
+    liberarTraza();
+    return PROCESADOR_OK;
+}
 
+#ifndef PROCESADOR_BIBLIOTECA
 int main(int argc, char* argv[]) {
-    ImagenInfo imagen = {0, 0, 0, NULL}; // Inicializar estructura
+    ImagenInfo imagen = {0, 0, 0, NULL, {NULL, 0, 0, 0}}; // Inicializar estructura
     char ruta[256] = {0}; // Buffer para ruta de archivo
 
+    // QUÉ: Modo línea de comandos si hay operaciones u opciones.
+    // CÓMO: Más de un argumento (o una opción como --help) evita el menú.
+    // POR QUÉ: ./img imagen.png sigue abriendo el menú con la imagen cargada.
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-' && argv[1][1] != '\0')) {
+        return ejecutarLineaComandos(argc, argv);
+    }
+
     // QUÉ: Cargar imagen desde CLI si se pasa.
     // CÓMO: Copia argv[1] y llama cargarImagen.
     // POR QUÉ: Permite ejecución directa con ./img imagen.png.
@@ -1052,6 +9926,19 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // Historial de deshacer/rehacer: el primer estado es la imagen inicial
+    HistorialImagen historial;
+    memset(&historial, 0, sizeof(historial));
+    historial.actual = -1;
+    registrarEnHistorial(&historial, &imagen, "cargar");
+
+    // Nombre de lo que hizo cada opción, para el historial; "" marca las que
+    // no modifican la imagen (mostrar, guardar, benchmarks) y no se registran,
+    // así no pagan la comparación de la imagen entera
+    const char* nombresOpciones[] = {"", "cargar", "", "", "brillo", "desenfoque", "redimensionar", "rotar",
+                                     "sobel", "operaciones puntuales", "pipeline", "imagen en disco",
+                                     "carga en streaming", "", "formatos crudos", ""};
+
     int opcion;
     while (1) {
         mostrarMenu();
@@ -1090,7 +9977,10 @@ int main(int argc, char* argv[]) {
                     continue;
                 }
                 salida[strcspn(salida, "\n")] = 0;
-                guardarPNG(&imagen, salida);
+                // Guardado paralelo; stb queda como respaldo
+                if (!guardarPNGParalelo(&imagen, salida, NULL) && imagen.pixeles) {
+                    guardarPNG(&imagen, salida);
+                }
                 break;
             }
             case 4: { // Ajustar brillo
@@ -1102,7 +9992,7 @@ int main(int argc, char* argv[]) {
                     continue;
                 }
                 while (getchar() != '\n');
-                ajustarBrilloConcurrente(&imagen, delta);
+                ajustarBrilloVectorialConcurrente(&imagen, delta);
                 break;
             }
             case 5: { // Aplicar convolución
@@ -1134,8 +10024,8 @@ int main(int argc, char* argv[]) {
                 }
                 while (getchar() != '\n');
                 
-                if (sigma <= 0.0f) {
-                    printf("Sigma debe ser positivo.\n");
+                if (!(sigma > 0.0f) || !isfinite(sigma)) {
+                    printf("Sigma debe ser positivo y finito.\n");
                     break;
                 }
                 
@@ -1182,7 +10072,7 @@ int main(int argc, char* argv[]) {
                 if (!imagen.pixeles) { printf("Primero carga una imagen (opción 1).\n"); break; }
                 float angulo;
                 printf("Ángulo de rotación (grados): ");
-                if (scanf("%f", &angulo) != 1) {
+                if (scanf("%f", &angulo) != 1 || !isfinite(angulo)) {
                     while (getchar() != '\n');
                     printf("Entrada inválida.\n");
                     break;
@@ -1195,7 +10085,35 @@ int main(int argc, char* argv[]) {
                 detectarBordesConcurrente(&imagen);
                 break;
             }
-            case 9: // Salir
+            case 9: // Operaciones puntuales encadenadas con LUT
+                menuOperacionesPuntuales(&imagen);
+                break;
+            case 10: // Pipeline fusionado
+                menuPipelineFusionado(&imagen);
+                break;
+            case 11: // Imágenes fuera de memoria
+                menuImagenesEnDisco(&imagen);
+                break;
+            case 12: // Carga en streaming
+                menuCargaStreaming(&imagen);
+                break;
+            case 13: // Guardar con opciones de compresión
+                menuGuardarPNGConOpciones(&imagen);
+                break;
+            case 14: // Formato crudo y PPM/PGM
+                menuFormatosCrudos(&imagen);
+                break;
+            case 15: // Benchmarks
+                menuRendimiento(&imagen);
+                break;
+            case 16: // Deshacer
+                moverEnHistorial(&historial, &imagen, -1);
+                continue;
+            case 17: // Rehacer
+                moverEnHistorial(&historial, &imagen, +1);
+                continue;
+            case 18: // Salir
+                liberarHistorial(&historial);
                 liberarImagen(&imagen);
                 printf("¡Adiós!\n");
                 return EXIT_SUCCESS;
@@ -1203,7 +10121,13 @@ int main(int argc, char* argv[]) {
                 printf("Opción inválida.\n");
 
 }
+        // Si la opción modificó la imagen, queda como un paso que se puede deshacer
+        if (opcion >= 1 && opcion <= 15 && nombresOpciones[opcion][0]) {
+            registrarEnHistorial(&historial, &imagen, nombresOpciones[opcion]);
+        }
     }
+    liberarHistorial(&historial);
     liberarImagen(&imagen);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif // PROCESADOR_BIBLIOTECA
@@ -0,0 +1,128 @@
+// Interfaz de biblioteca del procesador de imágenes.
+// QUÉ: Funciones para crear, cargar, guardar y destruir imágenes y aplicarles
+// las operaciones del programa (brillo, desenfoque, redimensionar, rotar,
+// Sobel y pipelines fusionados) desde otro programa, sin menú.
+// CÓMO: Las imágenes se manejan con un puntero opaco (ImagenProcesador*);
+// cada función devuelve un CodigoProcesador y no escribe nada en stdout
+// (los diagnósticos de error siguen yendo a stderr).
+// POR QUÉ: Permite llamar a los kernels dentro del mismo proceso en lugar de
+// lanzar ./img y pagar fork/exec y la codificación PNG en cada trabajo.
+//
+// Compilar la biblioteca (ver README):
+//   gcc -c -O2 -fPIC -fvisibility=hidden -DPROCESADOR_BIBLIOTECA base.c -o procesador.o
+//   ar rcs libprocesador.a procesador.o
+//   gcc -shared -o libprocesador.so procesador.o -pthread -lm
+
+#ifndef PROCESADOR_H
+#define PROCESADOR_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// QUÉ: Marca las funciones exportadas por la biblioteca compartida.
+// CÓMO: Visibilidad "default" en GCC/Clang; con -fvisibility=hidden el resto
+// de las funciones de base.c quedan internas.
+// POR QUÉ: base.c tiene muchas funciones globales que no son parte de la API.
+#if defined(__GNUC__)
+#define PROCESADOR_API __attribute__((visibility("default")))
+#else
+#define PROCESADOR_API
+#endif
+
+// QUÉ: Resultado de cada función de la API.
+// CÓMO: 0 es éxito; los errores son negativos.
+// POR QUÉ: El programa que enlaza decide qué hacer sin leer mensajes.
+typedef enum {
+    PROCESADOR_OK = 0,
+    PROCESADOR_ERROR_ARGUMENTO = -1,    // Puntero nulo o parámetro fuera de rango
+    PROCESADOR_ERROR_MEMORIA = -2,      // No se pudo reservar la imagen
+    PROCESADOR_ERROR_ARCHIVO = -3,      // No se pudo leer o escribir el archivo
+    PROCESADOR_ERROR_OPERACION = -4     // La operación falló (p. ej. sin memoria para hilos)
+} CodigoProcesador;
+
+// QUÉ: Imagen manejada por la biblioteca (contenido opaco).
+// CÓMO: Se obtiene con procesadorCrear() o procesadorCargar() y se libera con
+// procesadorDestruir().
+// POR QUÉ: La representación interna (matriz 3D sobre un bloque contiguo)
+// puede cambiar sin romper a quien enlaza.
+typedef struct ImagenProcesador ImagenProcesador;
+
+// QUÉ: Tipos de paso que acepta el pipeline.
+// CÓMO: Cada valor corresponde a una operación ya existente del programa.
+// POR QUÉ: Permite describir una cadena completa (p. ej. escalar → desenfoque
+// → brillo) como datos y ejecutarla sin pasar por el menú en cada paso.
+typedef enum {
+    PASO_BRILLO,        // delta
+    PASO_DESENFOQUE,    // tamKernel, sigma
+    PASO_ESCALAR,       // nuevoAncho, nuevoAlto
+    PASO_ROTAR,         // angulo (no se fusiona: actúa como barrera)
+    PASO_SOBEL,         // sin parámetros (resultado en grises)
+    PASO_RECORTAR       // región (vista sin copia de la imagen)
+} TipoPaso;
+
+// QUÉ: Un paso del pipeline con sus parámetros.
+// CÓMO: Solo se usan los campos del tipo indicado. La región de interés
+// (regionAncho y regionAlto en 0 = imagen completa) limita brillo, desenfoque
+// y Sobel a ese rectángulo (el resto de la imagen no cambia; los vecindarios
+// leen el halo de fuera); escalar y rotar actúan sobre el rectángulo recortado.
+// POR QUÉ: Estructura simple que se llena desde el menú (o desde un programa).
+typedef struct {
+    TipoPaso tipo;
+    int delta;          // PASO_BRILLO
+    int tamKernel;      // PASO_DESENFOQUE
+    float sigma;        // PASO_DESENFOQUE
+    int nuevoAncho;     // PASO_ESCALAR
+    int nuevoAlto;      // PASO_ESCALAR
+    float angulo;       // PASO_ROTAR
+    int regionX;        // Región de interés (obligatoria en PASO_RECORTAR)
+    int regionY;
+    int regionAncho;
+    int regionAlto;
+} PasoPipeline;
+
+// Creación, carga, guardado y destrucción
+PROCESADOR_API CodigoProcesador procesadorCrear(int ancho, int alto, int canales,
+                                                const unsigned char* datos, ImagenProcesador** imagen);
+PROCESADOR_API CodigoProcesador procesadorCargar(const char* ruta, ImagenProcesador** imagen);
+PROCESADOR_API CodigoProcesador procesadorGuardar(const ImagenProcesador* imagen, const char* ruta, int nivelPNG);
+PROCESADOR_API void procesadorDestruir(ImagenProcesador* imagen);
+
+// Acceso a los datos: píxeles contiguos en orden [y][x][c], ancho*canales bytes por fila
+PROCESADOR_API CodigoProcesador procesadorDimensiones(const ImagenProcesador* imagen, int* ancho, int* alto,
+                                                      int* canales);
+PROCESADOR_API unsigned char* procesadorPixeles(ImagenProcesador* imagen);
+
+// Operaciones (modifican la imagen; las dimensiones pueden cambiar)
+PROCESADOR_API CodigoProcesador procesadorBrillo(ImagenProcesador* imagen, int delta);
+PROCESADOR_API CodigoProcesador procesadorDesenfoque(ImagenProcesador* imagen, int tamKernel, float sigma);
+PROCESADOR_API CodigoProcesador procesadorRedimensionar(ImagenProcesador* imagen, int nuevoAncho, int nuevoAlto);
+PROCESADOR_API CodigoProcesador procesadorRotar(ImagenProcesador* imagen, float angulo);
+PROCESADOR_API CodigoProcesador procesadorSobel(ImagenProcesador* imagen);
+PROCESADOR_API CodigoProcesador procesadorAplicarPasos(ImagenProcesador* imagen, const PasoPipeline* pasos,
+                                                       int numPasos);
+
+// Utilidades
+PROCESADOR_API const char* procesadorDescribirError(CodigoProcesador codigo);
+PROCESADOR_API void procesadorActivarMensajes(int activos);
+// Una línea JSON por operación (cargar, guardar, brillo, ...) en 'json'; NULL las desactiva
+PROCESADOR_API void procesadorActivarEstadisticas(FILE* json);
+// Traza de ejecución en formato Chrome (chrome://tracing, Perfetto); escribirla
+// libera los eventos registrados y los siguientes forman una traza nueva
+PROCESADOR_API void procesadorActivarTraza(int activa);
+PROCESADOR_API CodigoProcesador procesadorEscribirTraza(const char* ruta);
+// Presupuesto de memoria en bytes (0 = sin límite): lo que no cabe falla antes de reservar
+PROCESADOR_API void procesadorLimitarMemoria(size_t bytes);
+PROCESADOR_API void procesadorMemoriaEnUso(size_t* vivos, size_t* pico);
+// Los búferes grandes liberados quedan ociosos para reutilizarse; esto los devuelve al sistema
+PROCESADOR_API void procesadorVaciarPool(void);
+// Fija cada hilo de una operación a una CPU y ubica cada banda de filas en su nodo NUMA
+PROCESADOR_API CodigoProcesador procesadorActivarNUMA(int activa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROCESADOR_H